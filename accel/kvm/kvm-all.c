@@ -36,6 +36,7 @@
 #include "exec/ram_addr.h"
 #include "exec/address-spaces.h"
 #include "qemu/event_notifier.h"
+#include "qemu/histogram.h"
 #include "trace.h"
 #include "hw/irq.h"
 
@@ -1845,10 +1846,40 @@ static void kvm_eat_signals(CPUState *cpu)
     } while (sigismember(&chkset, SIG_IPI));
 }
 
+/* Histograms of the time spent handling exits, indexed by exit reason */
+#define KVM_EXIT_HISTOGRAMS 64
+static QHistogram *kvm_exit_histograms[KVM_EXIT_HISTOGRAMS + 1];
+
+static QHistogram *kvm_exit_histogram(uint32_t reason)
+{
+    static const char *const names[] = {
+        [KVM_EXIT_UNKNOWN] = "unknown",
+        [KVM_EXIT_IO] = "io",
+        [KVM_EXIT_DEBUG] = "debug",
+        [KVM_EXIT_HLT] = "hlt",
+        [KVM_EXIT_MMIO] = "mmio",
+        [KVM_EXIT_IRQ_WINDOW_OPEN] = "irq-window-open",
+        [KVM_EXIT_SHUTDOWN] = "shutdown",
+        [KVM_EXIT_INTERNAL_ERROR] = "internal-error",
+        [KVM_EXIT_SYSTEM_EVENT] = "system-event",
+    };
+    unsigned idx = MIN(reason, KVM_EXIT_HISTOGRAMS);
+    QHistogram **cache = &kvm_exit_histograms[idx];
+
+    if (idx < ARRAY_SIZE(names) && names[idx]) {
+        return qemu_histogram_get_cached(cache, "kvm-exit:%s", names[idx]);
+    } else if (idx < KVM_EXIT_HISTOGRAMS) {
+        return qemu_histogram_get_cached(cache, "kvm-exit:%u", idx);
+    } else {
+        return qemu_histogram_get_cached(cache, "kvm-exit:other");
+    }
+}
+
 int kvm_cpu_exec(CPUState *cpu)
 {
     struct kvm_run *run = cpu->kvm_run;
     int ret, run_ret;
+    int64_t exit_start;
 
     DPRINTF("kvm_cpu_exec()\n");
 
@@ -1920,6 +1951,7 @@ int kvm_cpu_exec(CPUState *cpu)
         }
 
         trace_kvm_run_exit(cpu->cpu_index, run->exit_reason);
+        exit_start = qemu_histogram_start();
         switch (run->exit_reason) {
         case KVM_EXIT_IO:
             DPRINTF("handle_io\n");
@@ -1986,6 +2018,11 @@ int kvm_cpu_exec(CPUState *cpu)
             ret = kvm_arch_handle_exit(cpu, run);
             break;
         }
+
+        if (exit_start) {
+            qemu_histogram_record(kvm_exit_histogram(run->exit_reason),
+                                  exit_start);
+        }
     } while (ret == 0);
 
     cpu_exec_end(cpu);
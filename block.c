@@ -323,6 +323,7 @@ BlockDriverState *bdrv_new(void)
     notifier_with_return_list_init(&bs->before_write_notifiers);
     qemu_co_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    qemu_spin_init(&bs->block_status_cache.lock);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -3144,6 +3145,7 @@ void bdrv_reopen_commit(BDRVReopenState *reopen_state)
     if (drv->bdrv_reopen_commit) {
         drv->bdrv_reopen_commit(reopen_state);
     }
+    bdrv_bsc_invalidate_all(bs);
 
     /* set BDS specific flags now */
     QDECREF(bs->explicit_options);
@@ -3211,6 +3213,7 @@ static void bdrv_close(BlockDriverState *bs)
         bs->drv->bdrv_close(bs);
         bs->drv = NULL;
     }
+    bdrv_bsc_invalidate_all(bs);
 
     bdrv_set_backing_hd(bs, NULL, &error_abort);
 
@@ -3615,6 +3618,7 @@ int bdrv_truncate(BdrvChild *child, int64_t offset, PreallocMode prealloc,
         offset = bs->total_sectors * BDRV_SECTOR_SIZE;
     }
     bdrv_dirty_bitmap_truncate(bs, offset);
+    bdrv_bsc_invalidate_all(bs);
     bdrv_parent_cb_resize(bs);
     atomic_inc(&bs->write_gen);
     return ret;
@@ -4018,6 +4022,25 @@ ImageInfoSpecific *bdrv_get_specific_info(BlockDriverState *bs)
     return NULL;
 }
 
+/*
+ * Return a host file descriptor from which the data of @bs can be read
+ * directly, with guest offset 0 at *@host_offset in the file.  Only
+ * drivers that map the image linearly onto a single host file support
+ * this; everything else returns -ENOTSUP.
+ */
+int bdrv_get_host_fd(BlockDriverState *bs, int64_t *host_offset)
+{
+    BlockDriver *drv = bs->drv;
+
+    if (!drv) {
+        return -ENOMEDIUM;
+    }
+    if (!drv->bdrv_get_host_fd) {
+        return -ENOTSUP;
+    }
+    return drv->bdrv_get_host_fd(bs, host_offset);
+}
+
 void bdrv_debug_event(BlockDriverState *bs, BlkdebugEvent event)
 {
     if (!bs || !bs->drv || !bs->drv->bdrv_debug_event) {
@@ -4216,6 +4239,9 @@ void bdrv_invalidate_cache(BlockDriverState *bs, Error **errp)
     }
     bdrv_set_perm(bs, perm, shared_perm);
 
+    /* The image may have been written by the migration source */
+    bdrv_bsc_invalidate_all(bs);
+
     if (bs->drv->bdrv_invalidate_cache) {
         bs->drv->bdrv_invalidate_cache(bs, &local_err);
         if (local_err) {
@@ -42,6 +42,9 @@ typedef struct BackupBlockJob {
     uint64_t bytes_read;
     int64_t cluster_size;
     bool compress;
+    /* Cleared on the first failed copy offload, after which clusters are
+     * copied through the bounce buffer. */
+    bool use_copy_range;
     NotifierWithReturn before_write;
     QLIST_HEAD(, CowRequest) inflight_reqs;
 
@@ -120,6 +123,19 @@ static int coroutine_fn backup_do_cow(BackupBlockJob *job,
 
         n = MIN(job->cluster_size, job->common.len - start);
 
+        if (job->use_copy_range) {
+            ret = blk_co_copy_range(blk, start, job->target, start, n,
+                                    is_write_notifier ?
+                                    BDRV_REQ_NO_SERIALISING : 0);
+            if (ret >= 0) {
+                job->bytes_read += n;
+                job->common.offset += n;
+                continue;
+            }
+            trace_backup_do_cow_copy_range_fail(job, start, ret);
+            job->use_copy_range = false;
+        }
+
         if (!bounce_buffer) {
             bounce_buffer = blk_blockalign(blk, job->cluster_size);
         }
@@ -645,6 +661,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     job->sync_bitmap = sync_mode == MIRROR_SYNC_MODE_INCREMENTAL ?
                        sync_bitmap : NULL;
     job->compress = compress;
+    job->use_copy_range = !compress;
 
     /* If there is no backing file on the target, we cannot rely on COW if our
      * backup cluster size is smaller than the target cluster size. Even for
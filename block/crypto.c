@@ -21,6 +21,7 @@
 #include "qemu/osdep.h"
 
 #include "block/block_int.h"
+#include "block/thread-pool.h"
 #include "sysemu/block-backend.h"
 #include "crypto/block.h"
 #include "qapi/opts-visitor.h"
@@ -258,6 +259,155 @@ block_crypto_create_opts_init(QCryptoBlockFormat format,
 }
 
 
+/*
+ * Payload encryption is offloaded to the thread pool of the node's
+ * AioContext so that it neither stalls other requests served by the
+ * same thread nor limits an encrypted volume to the throughput of a
+ * single core.  Large buffers are split into sector aligned chunks
+ * of at least BLOCK_CRYPTO_MIN_CHUNK bytes which are processed in
+ * parallel, each one by a cipher instance of its own.
+ */
+#define BLOCK_CRYPTO_MAX_THREADS 16
+#define BLOCK_CRYPTO_MIN_CHUNK (64 * 1024)
+
+size_t block_crypto_n_threads(void)
+{
+    static size_t n_threads;
+
+    if (!n_threads) {
+        long n = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+        n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        n_threads = MAX(MIN(n, BLOCK_CRYPTO_MAX_THREADS), 1);
+    }
+
+    return n_threads;
+}
+
+typedef struct BlockCryptoCo {
+    Coroutine *co;
+    int in_flight;
+    int ret;
+    Error *err;
+} BlockCryptoCo;
+
+typedef struct BlockCryptoTask {
+    BlockCryptoCo *state;
+    QCryptoBlock *block;
+    uint64_t offset;
+    uint8_t *buf;
+    size_t len;
+    bool encrypt;
+    Error *err;
+} BlockCryptoTask;
+
+static int block_crypto_task_worker(void *opaque)
+{
+    BlockCryptoTask *task = opaque;
+
+    if (task->encrypt) {
+        return qcrypto_block_encrypt(task->block, task->offset,
+                                     task->buf, task->len, &task->err);
+    } else {
+        return qcrypto_block_decrypt(task->block, task->offset,
+                                     task->buf, task->len, &task->err);
+    }
+}
+
+static void block_crypto_task_cb(void *opaque, int ret)
+{
+    BlockCryptoTask *task = opaque;
+    BlockCryptoCo *state = task->state;
+
+    if (ret < 0) {
+        state->ret = -EIO;
+        if (!state->err) {
+            state->err = task->err;
+            task->err = NULL;
+        }
+    }
+    error_free(task->err);
+
+    if (--state->in_flight == 0) {
+        aio_co_wake(state->co);
+    }
+}
+
+static int coroutine_fn
+block_crypto_co_encdec(BlockDriverState *bs, QCryptoBlock *block,
+                       uint64_t offset, uint8_t *buf, size_t len,
+                       bool encrypt, Error **errp)
+{
+    ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    BlockCryptoTask tasks[BLOCK_CRYPTO_MAX_THREADS];
+    BlockCryptoCo state = { 0 };
+    uint64_t sector_size = qcrypto_block_get_sector_size(block);
+    size_t n_chunks, chunk;
+    int i;
+
+    if (!qemu_in_coroutine()) {
+        return encrypt ?
+            qcrypto_block_encrypt(block, offset, buf, len, errp) :
+            qcrypto_block_decrypt(block, offset, buf, len, errp);
+    }
+
+    state.co = qemu_coroutine_self();
+    n_chunks = MIN(block_crypto_n_threads(),
+                   DIV_ROUND_UP(len, BLOCK_CRYPTO_MIN_CHUNK));
+    chunk = QEMU_ALIGN_UP(DIV_ROUND_UP(len, MAX(n_chunks, 1)), sector_size);
+
+    for (i = 0; len > 0; i++) {
+        BlockCryptoTask *task = &tasks[i];
+        size_t cur_len = MIN(len, chunk);
+
+        assert(i < BLOCK_CRYPTO_MAX_THREADS);
+        *task = (BlockCryptoTask) {
+            .state = &state,
+            .block = block,
+            .offset = offset,
+            .buf = buf,
+            .len = cur_len,
+            .encrypt = encrypt,
+        };
+
+        state.in_flight++;
+        thread_pool_submit_aio(pool, block_crypto_task_worker, task,
+                               block_crypto_task_cb, task);
+
+        offset += cur_len;
+        buf += cur_len;
+        len -= cur_len;
+    }
+
+    /* Completion callbacks run in our AioContext, i.e. after we yield */
+    while (state.in_flight > 0) {
+        qemu_coroutine_yield();
+    }
+
+    if (state.err) {
+        error_propagate(errp, state.err);
+    }
+    return state.ret < 0 ? -1 : 0;
+}
+
+int coroutine_fn
+block_crypto_co_encrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len,
+                        Error **errp)
+{
+    return block_crypto_co_encdec(bs, block, offset, buf, len, true, errp);
+}
+
+int coroutine_fn
+block_crypto_co_decrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len,
+                        Error **errp)
+{
+    return block_crypto_co_encdec(bs, block, offset, buf, len, false, errp);
+}
+
+
 static int block_crypto_open_generic(QCryptoBlockFormat format,
                                      QemuOptsList *opts_spec,
                                      BlockDriverState *bs,
@@ -303,6 +453,7 @@ static int block_crypto_open_generic(QCryptoBlockFormat format,
                                        block_crypto_read_func,
                                        bs,
                                        cflags,
+                                       block_crypto_n_threads(),
                                        errp);
 
     if (!crypto->block) {
@@ -432,8 +583,8 @@ block_crypto_co_preadv(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
             goto cleanup;
         }
 
-        if (qcrypto_block_decrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
+        if (block_crypto_co_decrypt(bs, crypto->block, offset + bytes_done,
+                                    cipher_data, cur_bytes, NULL) < 0) {
             ret = -EIO;
             goto cleanup;
         }
@@ -488,8 +639,8 @@ block_crypto_co_pwritev(BlockDriverState *bs, uint64_t offset, uint64_t bytes,
 
         qemu_iovec_to_buf(qiov, bytes_done, cipher_data, cur_bytes);
 
-        if (qcrypto_block_encrypt(crypto->block, offset + bytes_done,
-                                  cipher_data, cur_bytes, NULL) < 0) {
+        if (block_crypto_co_encrypt(bs, crypto->block, offset + bytes_done,
+                                    cipher_data, cur_bytes, NULL) < 0) {
             ret = -EIO;
             goto cleanup;
         }
@@ -98,4 +98,16 @@ block_crypto_open_opts_init(QCryptoBlockFormat format,
                             QDict *opts,
                             Error **errp);
 
+size_t block_crypto_n_threads(void);
+
+int coroutine_fn
+block_crypto_co_encrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len,
+                        Error **errp);
+
+int coroutine_fn
+block_crypto_co_decrypt(BlockDriverState *bs, QCryptoBlock *block,
+                        uint64_t offset, uint8_t *buf, size_t len,
+                        Error **errp);
+
 #endif /* BLOCK_CRYPTO_H__ */
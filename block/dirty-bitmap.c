@@ -55,6 +55,8 @@ struct BdrvDirtyBitmap {
     bool autoload;              /* For persistent bitmaps: bitmap must be
                                    autoloaded on image opening */
     bool persistent;            /* bitmap must be saved to owner disk image */
+    bool qmp_locked;            /* Bitmap is in use by an export and must not
+                                   be removed or cleared through QMP */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -394,6 +396,26 @@ void bdrv_remove_persistent_dirty_bitmap(BlockDriverState *bs,
     }
 }
 
+/**
+ * Load persistent dirty bitmap @name from the storage for reading only.
+ * The bitmap is attached to @bs disabled and read-only, and is not persistent
+ * itself, so releasing it (or closing @bs) leaves the stored version alone.
+ * Bitmaps that are already loaded should be looked up with
+ * bdrv_find_dirty_bitmap() instead.
+ */
+BdrvDirtyBitmap *bdrv_load_persistent_dirty_bitmap(BlockDriverState *bs,
+                                                   const char *name,
+                                                   Error **errp)
+{
+    if (!bs->drv || !bs->drv->bdrv_load_persistent_dirty_bitmap) {
+        error_setg(errp, "Node '%s' does not support persistent bitmaps",
+                   bdrv_get_device_or_node_name(bs));
+        return NULL;
+    }
+
+    return bs->drv->bdrv_load_persistent_dirty_bitmap(bs, name, errp);
+}
+
 /* Called with BQL taken.  */
 void bdrv_disable_dirty_bitmap(BdrvDirtyBitmap *bitmap)
 {
@@ -654,6 +676,19 @@ void bdrv_dirty_bitmap_set_readonly(BdrvDirtyBitmap *bitmap, bool value)
     qemu_mutex_unlock(bitmap->mutex);
 }
 
+/* Called with BQL taken. */
+void bdrv_dirty_bitmap_set_qmp_locked(BdrvDirtyBitmap *bitmap, bool qmp_locked)
+{
+    qemu_mutex_lock(bitmap->mutex);
+    bitmap->qmp_locked = qmp_locked;
+    qemu_mutex_unlock(bitmap->mutex);
+}
+
+bool bdrv_dirty_bitmap_qmp_locked(BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->qmp_locked;
+}
+
 bool bdrv_has_readonly_bitmaps(BlockDriverState *bs)
 {
     BdrvDirtyBitmap *bm;
@@ -1060,6 +1060,7 @@ static int coroutine_fn bdrv_co_do_copy_on_readv(BdrvChild *child,
                 ret = bdrv_driver_pwritev(bs, cluster_offset, pnum,
                                           &local_qiov, 0);
             }
+            bdrv_bsc_invalidate_range(bs, cluster_offset, pnum);
 
             if (ret < 0) {
                 /* It might be okay to ignore write errors for guest
@@ -1492,6 +1493,7 @@ static int coroutine_fn bdrv_aligned_pwritev(BdrvChild *child,
 
     atomic_inc(&bs->write_gen);
     bdrv_set_dirty(bs, offset, bytes);
+    bdrv_bsc_invalidate_range(bs, offset, bytes);
 
     stat64_max(&bs->wr_highest_offset, offset + bytes);
 
@@ -1824,6 +1826,118 @@ int64_t coroutine_fn bdrv_co_get_block_status_from_backing(BlockDriverState *bs,
            (sector_num << BDRV_SECTOR_BITS);
 }
 
+/*
+ * Block status cache
+ *
+ * Drivers that set bdrv_cache_block_status get their most recent
+ * bdrv_co_get_block_status results remembered per node, so that jobs
+ * querying the same regions over and over (mirror, backup, stream, convert)
+ * don't go back to the driver, e.g. to lseek(SEEK_DATA) in file-posix.
+ * Every write, discard or truncate that goes through this file invalidates
+ * the entries it overlaps.
+ */
+
+static bool bdrv_bsc_enabled(BlockDriverState *bs)
+{
+    /* With force-share, someone else may be writing to the image */
+    return bs->drv->bdrv_cache_block_status && !bs->force_share;
+}
+
+/* Looks up @offset (aligned to request_alignment) in the cache of @bs.  On a
+ * hit, returns true and the driver's status, length, host offset and file
+ * for the extent that starts at @offset. */
+static bool bdrv_bsc_lookup(BlockDriverState *bs, int64_t offset,
+                            int *status, int64_t *pnum, int64_t *map,
+                            BlockDriverState **file)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    bool hit = false;
+    int i;
+
+    qemu_spin_lock(&bsc->lock);
+    for (i = 0; i < BDRV_BLOCK_STATUS_CACHE_SIZE; i++) {
+        BdrvBlockStatusCacheEntry *e = &bsc->entries[i];
+
+        if (offset < e->offset || offset >= e->offset + e->bytes) {
+            continue;
+        }
+        /* The node may have been given a different child since */
+        if (e->file && e->file != bs &&
+            (!bs->file || e->file != bs->file->bs)) {
+            continue;
+        }
+
+        *status = e->status;
+        *pnum = e->offset + e->bytes - offset;
+        *map = e->status & BDRV_BLOCK_OFFSET_VALID
+               ? e->map + (offset - e->offset) : 0;
+        *file = e->file;
+        hit = true;
+        break;
+    }
+    qemu_spin_unlock(&bsc->lock);
+
+    return hit;
+}
+
+static uint64_t bdrv_bsc_gen(BlockDriverState *bs)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    uint64_t gen;
+
+    qemu_spin_lock(&bsc->lock);
+    gen = bsc->gen;
+    qemu_spin_unlock(&bsc->lock);
+
+    return gen;
+}
+
+/* Stores a driver result that was computed while the cache was at
+ * generation @gen; it is dropped if an invalidation happened meanwhile. */
+static void bdrv_bsc_insert(BlockDriverState *bs, uint64_t gen,
+                            int64_t offset, int64_t bytes, int status,
+                            int64_t map, BlockDriverState *file)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+
+    qemu_spin_lock(&bsc->lock);
+    if (bsc->gen == gen) {
+        bsc->entries[bsc->next] = (BdrvBlockStatusCacheEntry) {
+            .offset = offset,
+            .bytes  = bytes,
+            .status = status,
+            .map    = map,
+            .file   = file,
+        };
+        bsc->next = (bsc->next + 1) % BDRV_BLOCK_STATUS_CACHE_SIZE;
+    }
+    qemu_spin_unlock(&bsc->lock);
+}
+
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes)
+{
+    BdrvBlockStatusCache *bsc = &bs->block_status_cache;
+    int i;
+
+    qemu_spin_lock(&bsc->lock);
+    bsc->gen++;
+    for (i = 0; i < BDRV_BLOCK_STATUS_CACHE_SIZE; i++) {
+        BdrvBlockStatusCacheEntry *e = &bsc->entries[i];
+
+        if (e->bytes && offset < e->offset + e->bytes &&
+            e->offset < offset + bytes) {
+            e->bytes = 0;
+        }
+    }
+    qemu_spin_unlock(&bsc->lock);
+}
+
+void bdrv_bsc_invalidate_all(BlockDriverState *bs)
+{
+    bdrv_bsc_invalidate_range(bs, 0, INT64_MAX);
+}
+
 /*
  * Returns the allocation status of the specified sectors.
  * Drivers not implementing the functionality are assumed to not support
@@ -1912,9 +2026,14 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
     aligned_offset = QEMU_ALIGN_DOWN(offset, align);
     aligned_bytes = ROUND_UP(offset + bytes, align) - aligned_offset;
 
-    {
+    if (bdrv_bsc_enabled(bs) &&
+        bdrv_bsc_lookup(bs, aligned_offset, &ret, pnum, &local_map,
+                        &local_file)) {
+        *pnum = MIN(*pnum, aligned_bytes);
+    } else {
         int count; /* sectors */
         int64_t longret;
+        uint64_t gen = bdrv_bsc_gen(bs);
 
         assert(QEMU_IS_ALIGNED(aligned_offset | aligned_bytes,
                                BDRV_SECTOR_SIZE));
@@ -1937,6 +2056,11 @@ static int coroutine_fn bdrv_co_block_status(BlockDriverState *bs,
         }
         ret = longret & ~BDRV_BLOCK_OFFSET_MASK;
         *pnum = count * BDRV_SECTOR_SIZE;
+
+        if (bdrv_bsc_enabled(bs) && *pnum) {
+            bdrv_bsc_insert(bs, gen, aligned_offset, *pnum, ret, local_map,
+                            local_file);
+        }
     }
 
     /*
@@ -2607,6 +2731,7 @@ int coroutine_fn bdrv_co_pdiscard(BlockDriverState *bs, int64_t offset,
 out:
     atomic_inc(&bs->write_gen);
     bdrv_set_dirty(bs, req.offset, req.bytes);
+    bdrv_bsc_invalidate_range(bs, req.offset, req.bytes);
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
     return ret;
@@ -2755,3 +2880,127 @@ void bdrv_io_unplug(BlockDriverState *bs)
         bdrv_io_unplug(child->bs);
     }
 }
+
+static int coroutine_fn bdrv_co_copy_range_internal(BdrvChild *src,
+                                                    uint64_t src_offset,
+                                                    BdrvChild *dst,
+                                                    uint64_t dst_offset,
+                                                    uint64_t bytes,
+                                                    BdrvRequestFlags flags,
+                                                    bool recurse_src)
+{
+    BdrvTrackedRequest req;
+    BlockDriverState *bs;
+    int ret;
+
+    if (!dst || !dst->bs || !dst->bs->drv) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_byte_request(dst->bs, dst_offset, bytes);
+    if (ret) {
+        return ret;
+    }
+    if (flags & BDRV_REQ_ZERO_WRITE) {
+        return bdrv_co_pwrite_zeroes(dst, dst_offset, bytes, flags);
+    }
+
+    if (!src || !src->bs || !src->bs->drv) {
+        return -ENOMEDIUM;
+    }
+    ret = bdrv_check_byte_request(src->bs, src_offset, bytes);
+    if (ret) {
+        return ret;
+    }
+
+    if (!src->bs->drv->bdrv_co_copy_range_from
+        || !dst->bs->drv->bdrv_co_copy_range_to
+        || src->bs->encrypted || dst->bs->encrypted) {
+        return -ENOTSUP;
+    }
+
+    if (recurse_src) {
+        bs = src->bs;
+        bdrv_inc_in_flight(bs);
+        tracked_request_begin(&req, bs, src_offset, bytes,
+                              BDRV_TRACKED_READ);
+        if (!(flags & BDRV_REQ_NO_SERIALISING)) {
+            wait_serialising_requests(&req);
+        }
+
+        ret = bs->drv->bdrv_co_copy_range_from(bs, src, src_offset,
+                                               dst, dst_offset,
+                                               bytes, flags);
+
+        tracked_request_end(&req);
+        bdrv_dec_in_flight(bs);
+        return ret;
+    }
+
+    bs = dst->bs;
+    if (bs->read_only) {
+        return -EPERM;
+    }
+    if (bdrv_has_readonly_bitmaps(bs)) {
+        return -EPERM;
+    }
+    assert(!(bs->open_flags & BDRV_O_INACTIVE));
+    assert(dst->perm & BLK_PERM_WRITE);
+
+    bdrv_inc_in_flight(bs);
+    tracked_request_begin(&req, bs, dst_offset, bytes, BDRV_TRACKED_WRITE);
+    wait_serialising_requests(&req);
+
+    ret = notifier_with_return_list_notify(&bs->before_write_notifiers, &req);
+    if (ret == 0) {
+        ret = bs->drv->bdrv_co_copy_range_to(bs, src, src_offset,
+                                             dst, dst_offset,
+                                             bytes, flags);
+    }
+
+    atomic_inc(&bs->write_gen);
+    bdrv_set_dirty(bs, dst_offset, bytes);
+    bdrv_bsc_invalidate_range(bs, dst_offset, bytes);
+    stat64_max(&bs->wr_highest_offset, dst_offset + bytes);
+    if (ret >= 0) {
+        bs->total_sectors = MAX(bs->total_sectors,
+                                DIV_ROUND_UP(dst_offset + bytes,
+                                             BDRV_SECTOR_SIZE));
+    }
+
+    tracked_request_end(&req);
+    bdrv_dec_in_flight(bs);
+    return ret;
+}
+
+/* Copy range from @src to @dst.
+ *
+ * See the comment of bdrv_co_copy_range for the parameter and return value
+ * semantics. */
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, uint64_t src_offset,
+                                         BdrvChild *dst, uint64_t dst_offset,
+                                         uint64_t bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, true);
+}
+
+/* Copy range from @src to @dst.
+ *
+ * See the comment of bdrv_co_copy_range for the parameter and return value
+ * semantics. */
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, uint64_t src_offset,
+                                       BdrvChild *dst, uint64_t dst_offset,
+                                       uint64_t bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_internal(src, src_offset, dst, dst_offset,
+                                       bytes, flags, false);
+}
+
+int coroutine_fn bdrv_co_copy_range(BdrvChild *src, uint64_t src_offset,
+                                    BdrvChild *dst, uint64_t dst_offset,
+                                    uint64_t bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_from(src, src_offset,
+                                   dst, dst_offset,
+                                   bytes, flags);
+}
@@ -33,6 +33,7 @@
 #include "qemu/error-report.h"
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
+#include "qemu/bswap.h"
 #include "block/block_int.h"
 #include "scsi/constants.h"
 #include "qemu/iov.h"
@@ -92,6 +93,9 @@ typedef struct IscsiLun {
     bool dpofua;
     bool has_write_same;
     bool request_timed_out;
+    /* LU designator from the Device Identification VPD page, used to name
+     * this LU as a target of EXTENDED COPY commands. */
+    struct scsi_inquiry_device_designator *dd;
 } IscsiLun;
 
 typedef struct IscsiTask {
@@ -1707,6 +1711,31 @@ static QemuOptsList runtime_opts = {
     },
 };
 
+static void iscsi_save_designator(IscsiLun *lun,
+                                  struct scsi_inquiry_device_identification *inq_di)
+{
+    struct scsi_inquiry_device_designator *desig, *copy = NULL;
+
+    for (desig = inq_di->designators; desig; desig = desig->next) {
+        if (desig->association ||
+            desig->designator_type > SCSI_DESIGNATOR_TYPE_NAA ||
+            desig->designator_length > 20) {
+            continue;
+        }
+        /* NAA works better than T10 vendor ID based designator. */
+        if (!copy || copy->designator_type < desig->designator_type) {
+            copy = desig;
+        }
+    }
+    if (copy) {
+        lun->dd = g_new(struct scsi_inquiry_device_designator, 1);
+        *lun->dd = *copy;
+        lun->dd->next = NULL;
+        lun->dd->designator = g_malloc(copy->designator_length);
+        memcpy(lun->dd->designator, copy->designator, copy->designator_length);
+    }
+}
+
 static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
                       Error **errp)
 {
@@ -1890,6 +1919,7 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
         struct scsi_task *inq_task;
         struct scsi_inquiry_logical_block_provisioning *inq_lbp;
         struct scsi_inquiry_block_limits *inq_bl;
+        struct scsi_inquiry_device_identification *inq_di;
         switch (inq_vpd->pages[i]) {
         case SCSI_INQUIRY_PAGECODE_LOGICAL_BLOCK_PROVISIONING:
             inq_task = iscsi_do_inquiry(iscsilun->iscsi, iscsilun->lun, 1,
@@ -1915,6 +1945,17 @@ static int iscsi_open(BlockDriverState *bs, QDict *options, int flags,
                    sizeof(struct scsi_inquiry_block_limits));
             scsi_free_scsi_task(inq_task);
             break;
+        case SCSI_INQUIRY_PAGECODE_DEVICE_IDENTIFICATION:
+            inq_task = iscsi_do_inquiry(iscsilun->iscsi, iscsilun->lun, 1,
+                                    SCSI_INQUIRY_PAGECODE_DEVICE_IDENTIFICATION,
+                                    (void **) &inq_di, errp);
+            if (inq_task == NULL) {
+                ret = -EINVAL;
+                goto out;
+            }
+            iscsi_save_designator(iscsilun, inq_di);
+            scsi_free_scsi_task(inq_task);
+            break;
         default:
             break;
         }
@@ -1951,12 +1992,230 @@ out:
             }
             iscsi_destroy_context(iscsi);
         }
+        if (iscsilun->dd) {
+            g_free(iscsilun->dd->designator);
+            g_free(iscsilun->dd);
+        }
         memset(iscsilun, 0, sizeof(IscsiLun));
     }
 exit:
     return ret;
 }
 
+static int coroutine_fn iscsi_co_copy_range_from(BlockDriverState *bs,
+                                                 BdrvChild *src,
+                                                 uint64_t src_offset,
+                                                 BdrvChild *dst,
+                                                 uint64_t dst_offset,
+                                                 uint64_t bytes,
+                                                 BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_to(src, src_offset, dst, dst_offset, bytes, flags);
+}
+
+/* EXTENDED COPY (LID1) parameter list layout, see SPC-4 6.3. */
+#define XCOPY_HEADER_LEN            16
+#define XCOPY_DESC_OFFSET           XCOPY_HEADER_LEN
+#define IDENT_DESCR_TGT_DESCR_SIZE  32
+#define XCOPY_BLK2BLK_SEG_DESC_SIZE 28
+#define XCOPY_PARAM_LEN             (XCOPY_HEADER_LEN + \
+                                     2 * IDENT_DESCR_TGT_DESCR_SIZE + \
+                                     XCOPY_BLK2BLK_SEG_DESC_SIZE)
+#define XCOPY_MAX_BLOCKS            0xffff
+
+static void iscsi_xcopy_populate_header(unsigned char *buf, int list_id,
+                                        int str, int list_id_usage, int prio,
+                                        int tgt_desc_len, int seg_desc_len,
+                                        int inline_data_len)
+{
+    buf[0] = list_id;
+    buf[1] = ((str & 1) << 5) | ((list_id_usage & 3) << 3) | (prio & 7);
+    stw_be_p(&buf[2], tgt_desc_len);
+    stl_be_p(&buf[8], seg_desc_len);
+    stl_be_p(&buf[12], inline_data_len);
+}
+
+static int iscsi_xcopy_populate_desc(unsigned char *desc, int dc,
+                                     int cat, int src_index, int dst_index,
+                                     int num_blks, uint64_t src_lba,
+                                     uint64_t dst_lba)
+{
+    desc[0] = 0x02; /* BLK_TO_BLK_SEG_DESCR */
+    desc[1] = ((dc << 1) | cat) & 0xff;
+    stw_be_p(&desc[2], XCOPY_BLK2BLK_SEG_DESC_SIZE - 4);
+    stw_be_p(&desc[4], src_index);
+    stw_be_p(&desc[6], dst_index);
+    stw_be_p(&desc[10], num_blks);
+    stq_be_p(&desc[12], src_lba);
+    stq_be_p(&desc[20], dst_lba);
+
+    return XCOPY_BLK2BLK_SEG_DESC_SIZE;
+}
+
+static int iscsi_xcopy_populate_tgt_desc(unsigned char *desc, IscsiLun *lun)
+{
+    struct scsi_inquiry_device_designator *dd = lun->dd;
+
+    memset(desc, 0, IDENT_DESCR_TGT_DESCR_SIZE);
+    desc[0] = 0xE4; /* IDENT_DESCR_TGT_DESCR */
+    desc[1] = lun->type & 0x1f; /* LU ID 0, NUL 0 */
+    desc[4] = dd->code_set;
+    desc[5] = (dd->designator_type & 0xF)
+        | ((dd->association & 3) << 4)
+        | ((dd->piv & 1) << 7);
+    desc[7] = dd->designator_length;
+    memcpy(desc + 8, dd->designator, dd->designator_length);
+
+    /* Block device type specific parameters: disk block length. */
+    desc[28] = 0;
+    desc[29] = (lun->block_size >> 16) & 0xFF;
+    desc[30] = (lun->block_size >> 8) & 0xFF;
+    desc[31] = lun->block_size & 0xFF;
+
+    return IDENT_DESCR_TGT_DESCR_SIZE;
+}
+
+static void iscsi_xcopy_data(struct iscsi_data *data,
+                             IscsiLun *src, int64_t src_lba,
+                             IscsiLun *dst, int64_t dst_lba,
+                             uint16_t num_blocks)
+{
+    uint8_t *buf;
+    const int src_offset = XCOPY_DESC_OFFSET;
+    const int dst_offset = XCOPY_DESC_OFFSET + IDENT_DESCR_TGT_DESCR_SIZE;
+    const int seg_offset = dst_offset + IDENT_DESCR_TGT_DESCR_SIZE;
+
+    data->size = XCOPY_PARAM_LEN;
+    data->data = g_malloc0(data->size);
+    buf = data->data;
+
+    /* Initialise the parameter list header */
+    iscsi_xcopy_populate_header(buf, 1, 0, 2 /* LIST_ID_USAGE_DISCARD */,
+                                0, 2 * IDENT_DESCR_TGT_DESCR_SIZE,
+                                XCOPY_BLK2BLK_SEG_DESC_SIZE,
+                                0);
+
+    /* Initialise CSCD list with one src + one dst descriptor */
+    iscsi_xcopy_populate_tgt_desc(&buf[src_offset], src);
+    iscsi_xcopy_populate_tgt_desc(&buf[dst_offset], dst);
+
+    /* Initialise one segment descriptor */
+    iscsi_xcopy_populate_desc(&buf[seg_offset], 0, 0, 0, 1, num_blocks,
+                              src_lba, dst_lba);
+}
+
+static struct scsi_task *iscsi_xcopy_task(int param_len)
+{
+    struct scsi_task *task;
+
+    task = g_new0(struct scsi_task, 1);
+
+    task->cdb[0]     = EXTENDED_COPY;
+    task->cdb[10]    = (param_len >> 24) & 0xFF;
+    task->cdb[11]    = (param_len >> 16) & 0xFF;
+    task->cdb[12]    = (param_len >> 8) & 0xFF;
+    task->cdb[13]    = param_len & 0xFF;
+    task->cdb_size   = 16;
+    task->xfer_dir   = SCSI_XFER_WRITE;
+    task->expxferlen = param_len;
+
+    return task;
+}
+
+static int coroutine_fn iscsi_co_copy_range_to(BlockDriverState *bs,
+                                               BdrvChild *src,
+                                               uint64_t src_offset,
+                                               BdrvChild *dst,
+                                               uint64_t dst_offset,
+                                               uint64_t bytes,
+                                               BdrvRequestFlags flags)
+{
+    IscsiLun *dst_lun = dst->bs->opaque;
+    IscsiLun *src_lun;
+    struct IscsiTask iscsi_task = { .task = NULL };
+    struct iscsi_data data = { .data = NULL };
+    int r = 0;
+    int block_size;
+
+    if (src->bs->drv->bdrv_co_copy_range_to != iscsi_co_copy_range_to) {
+        return -ENOTSUP;
+    }
+    src_lun = src->bs->opaque;
+
+    if (!src_lun->dd || !dst_lun->dd) {
+        return -ENOTSUP;
+    }
+    if (!is_byte_request_lun_aligned(dst_offset, bytes, dst_lun)) {
+        return -ENOTSUP;
+    }
+    if (!is_byte_request_lun_aligned(src_offset, bytes, src_lun)) {
+        return -ENOTSUP;
+    }
+    if (dst_lun->block_size != src_lun->block_size ||
+        !dst_lun->block_size) {
+        return -ENOTSUP;
+    }
+
+    block_size = dst_lun->block_size;
+    qemu_mutex_lock(&dst_lun->mutex);
+
+    while (bytes) {
+        uint64_t num_blocks = MIN(bytes / block_size, XCOPY_MAX_BLOCKS);
+        uint64_t cur_bytes = num_blocks * block_size;
+
+        iscsi_co_init_iscsitask(dst_lun, &iscsi_task);
+        iscsi_task.task = iscsi_xcopy_task(XCOPY_PARAM_LEN);
+        iscsi_xcopy_data(&data,
+                         src_lun, src_offset / block_size,
+                         dst_lun, dst_offset / block_size,
+                         num_blocks);
+
+retry:
+        if (iscsi_scsi_command_async(dst_lun->iscsi, dst_lun->lun,
+                                     iscsi_task.task, iscsi_co_generic_cb,
+                                     &data,
+                                     &iscsi_task) != 0) {
+            r = -EIO;
+            goto out_unlock;
+        }
+
+        while (!iscsi_task.complete) {
+            iscsi_set_events(dst_lun);
+            qemu_mutex_unlock(&dst_lun->mutex);
+            qemu_coroutine_yield();
+            qemu_mutex_lock(&dst_lun->mutex);
+        }
+
+        if (iscsi_task.do_retry) {
+            iscsi_task.complete = 0;
+            goto retry;
+        }
+
+        if (iscsi_task.status != SCSI_STATUS_GOOD) {
+            r = iscsi_task.err_code;
+            goto out_unlock;
+        }
+
+        iscsi_allocmap_set_allocated(dst_lun, dst_offset >> BDRV_SECTOR_BITS,
+                                     cur_bytes >> BDRV_SECTOR_BITS);
+
+        g_free(iscsi_task.task);
+        iscsi_task.task = NULL;
+        g_free(data.data);
+        data.data = NULL;
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+
+out_unlock:
+    g_free(iscsi_task.task);
+    g_free(data.data);
+    qemu_mutex_unlock(&dst_lun->mutex);
+    return r;
+}
+
 static void iscsi_close(BlockDriverState *bs)
 {
     IscsiLun *iscsilun = bs->opaque;
@@ -1969,6 +2228,10 @@ static void iscsi_close(BlockDriverState *bs)
     iscsi_destroy_context(iscsi);
     g_free(iscsilun->zeroblock);
     iscsi_allocmap_free(iscsilun);
+    if (iscsilun->dd) {
+        g_free(iscsilun->dd->designator);
+        g_free(iscsilun->dd);
+    }
     qemu_mutex_destroy(&iscsilun->mutex);
     memset(iscsilun, 0, sizeof(IscsiLun));
 }
@@ -2183,6 +2446,8 @@ static BlockDriver bdrv_iscsi = {
     .bdrv_co_get_block_status = iscsi_co_get_block_status,
     .bdrv_co_pdiscard      = iscsi_co_pdiscard,
     .bdrv_co_pwrite_zeroes = iscsi_co_pwrite_zeroes,
+    .bdrv_co_copy_range_from = iscsi_co_copy_range_from,
+    .bdrv_co_copy_range_to  = iscsi_co_copy_range_to,
     .bdrv_co_readv         = iscsi_co_readv,
     .bdrv_co_writev_flags  = iscsi_co_writev_flags,
     .bdrv_co_flush_to_disk = iscsi_co_flush,
@@ -2218,6 +2483,8 @@ static BlockDriver bdrv_iser = {
     .bdrv_co_get_block_status = iscsi_co_get_block_status,
     .bdrv_co_pdiscard      = iscsi_co_pdiscard,
     .bdrv_co_pwrite_zeroes = iscsi_co_pwrite_zeroes,
+    .bdrv_co_copy_range_from = iscsi_co_copy_range_from,
+    .bdrv_co_copy_range_to  = iscsi_co_copy_range_to,
     .bdrv_co_readv         = iscsi_co_readv,
     .bdrv_co_writev_flags  = iscsi_co_writev_flags,
     .bdrv_co_flush_to_disk = iscsi_co_flush,
@@ -26,6 +26,10 @@
 #define MAX_IN_FLIGHT 16
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
+#define MIN_IN_FLIGHT 1
+#define MAX_IN_FLIGHT_LIMIT (4 * MAX_IN_FLIGHT)
+/* Target write latency per MiB above which fewer, larger requests are used */
+#define TARGET_LATENCY_NS 10000000LL /* ns */
 
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
@@ -73,15 +77,43 @@ typedef struct MirrorBlockJob {
     int target_cluster_size;
     int max_iov;
     bool initial_zeroing_ongoing;
+    /* Cleared on the first failed copy offload */
+    bool use_copy_range;
+
+    MirrorCopyMode copy_mode;
+    /* Set while guest writes are copied to the target synchronously */
+    bool actively_mirroring;
+    int in_active_write;
+    /* Active writes waiting for chunks in s->in_flight_bitmap */
+    CoQueue active_write_queue;
+
+    /* Current request pipeline, resized by mirror_adapt() */
+    int max_in_flight;
+    int64_t max_io_bytes;
+    bool in_flight_saturated;
+    int64_t latency_ns; /* smoothed target latency per MiB */
+    int latency_samples;
+    int64_t last_adapt_ns;
 } MirrorBlockJob;
 
+typedef struct MirrorBDSOpaque {
+    MirrorBlockJob *job;
+} MirrorBDSOpaque;
+
 typedef struct MirrorOp {
     MirrorBlockJob *s;
     QEMUIOVector qiov;
     int64_t offset;
     uint64_t bytes;
+    int64_t start_ns;
 } MirrorOp;
 
+typedef enum MirrorMethod {
+    MIRROR_METHOD_COPY,
+    MIRROR_METHOD_ZERO,
+    MIRROR_METHOD_DISCARD,
+} MirrorMethod;
+
 static BlockErrorAction mirror_error_action(MirrorBlockJob *s, bool read,
                                             int error)
 {
@@ -116,6 +148,7 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     chunk_num = op->offset / s->granularity;
     nb_chunks = DIV_ROUND_UP(op->bytes, s->granularity);
     bitmap_clear(s->in_flight_bitmap, chunk_num, nb_chunks);
+    qemu_co_queue_restart_all(&s->active_write_queue);
     if (ret >= 0) {
         if (s->cow_bitmap) {
             bitmap_set(s->cow_bitmap, chunk_num, nb_chunks);
@@ -132,6 +165,23 @@ static void mirror_iteration_done(MirrorOp *op, int ret)
     }
 }
 
+/* Fold the target latency of a completed copy into the running average.  It
+ * is scaled to a MiB so that mirror_adapt() changing the chunk size does not
+ * show up as a change in latency.
+ */
+static void mirror_account_latency(MirrorBlockJob *s, MirrorOp *op)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t sample = muldiv64(now - op->start_ns, 1 << 20, op->bytes);
+
+    if (s->latency_ns == 0) {
+        s->latency_ns = sample;
+    } else {
+        s->latency_ns += (sample - s->latency_ns) / 8;
+    }
+    s->latency_samples++;
+}
+
 static void mirror_write_complete(void *opaque, int ret)
 {
     MirrorOp *op = opaque;
@@ -146,6 +196,9 @@ static void mirror_write_complete(void *opaque, int ret)
         if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
             s->ret = ret;
         }
+    } else if (op->qiov.size) {
+        /* Zero and discard requests say little about the target's speed */
+        mirror_account_latency(s, op);
     }
     mirror_iteration_done(op, ret);
     aio_context_release(blk_get_aio_context(s->common.blk));
@@ -168,12 +221,34 @@ static void mirror_read_complete(void *opaque, int ret)
 
         mirror_iteration_done(op, ret);
     } else {
+        op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
         blk_aio_pwritev(s->target, op->offset, &op->qiov,
                         0, mirror_write_complete, op);
     }
     aio_context_release(blk_get_aio_context(s->common.blk));
 }
 
+static void coroutine_fn mirror_co_copy_range(void *opaque)
+{
+    MirrorOp *op = opaque;
+    MirrorBlockJob *s = op->s;
+    int ret;
+
+    op->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    ret = blk_co_copy_range(s->common.blk, op->offset, s->target, op->offset,
+                            op->bytes, 0);
+    if (ret < 0) {
+        /* Fall back to bounce buffer I/O for this and all later requests;
+         * the chunks for op->qiov have already been reserved. */
+        trace_mirror_copy_range_fail(s, op->offset, op->bytes, ret);
+        s->use_copy_range = false;
+        blk_aio_preadv(s->common.blk, op->offset, &op->qiov, 0,
+                       mirror_read_complete, op);
+        return;
+    }
+    mirror_write_complete(op, ret);
+}
+
 /* Clip bytes relative to offset to not exceed end-of-file */
 static inline int64_t mirror_clip_bytes(MirrorBlockJob *s,
                                         int64_t offset,
@@ -291,7 +366,12 @@ static uint64_t mirror_do_read(MirrorBlockJob *s, int64_t offset,
     s->bytes_in_flight += bytes;
     trace_mirror_one_iteration(s, offset, bytes);
 
-    blk_aio_preadv(source, offset, &op->qiov, 0, mirror_read_complete, op);
+    if (s->use_copy_range) {
+        Coroutine *co = qemu_coroutine_create(mirror_co_copy_range, op);
+        qemu_coroutine_enter(co);
+    } else {
+        blk_aio_preadv(source, offset, &op->qiov, 0, mirror_read_complete, op);
+    }
     return ret;
 }
 
@@ -321,6 +401,35 @@ static void mirror_do_zero_or_discard(MirrorBlockJob *s,
     }
 }
 
+/* Resize the request pipeline from the target latency seen during the last
+ * slice: halve the number of requests in flight when the target falls behind,
+ * and add one while it keeps up with a full pipeline.  All requests share
+ * s->buf, so fewer of them in flight also means larger chunks.
+ */
+static void mirror_adapt(MirrorBlockJob *s)
+{
+    int max_in_flight = s->max_in_flight;
+
+    if (s->latency_samples == 0) {
+        return;
+    }
+
+    if (s->latency_ns > 2 * TARGET_LATENCY_NS) {
+        max_in_flight = MAX(max_in_flight / 2, MIN_IN_FLIGHT);
+    } else if (s->latency_ns < TARGET_LATENCY_NS && s->in_flight_saturated) {
+        max_in_flight = MIN(max_in_flight + 1, MAX_IN_FLIGHT_LIMIT);
+    }
+    s->latency_samples = 0;
+    s->in_flight_saturated = false;
+
+    if (max_in_flight != s->max_in_flight) {
+        s->max_in_flight = max_in_flight;
+        s->max_io_bytes = MAX(s->buf_size / max_in_flight, MAX_IO_BYTES);
+        trace_mirror_adapt(s, s->latency_ns, s->max_in_flight,
+                           s->max_io_bytes);
+    }
+}
+
 static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source = s->source;
@@ -329,7 +438,14 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int64_t max_io_bytes;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (now - s->last_adapt_ns > SLICE_TIME) {
+        s->last_adapt_ns = now;
+        mirror_adapt(s);
+    }
+    max_io_bytes = s->max_io_bytes;
 
     bdrv_dirty_bitmap_lock(s->dirty_bitmap);
     offset = bdrv_dirty_iter_next(s->dbi);
@@ -387,11 +503,7 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
         int ret;
         int64_t io_bytes;
         int64_t io_bytes_acct;
-        enum MirrorMethod {
-            MIRROR_METHOD_COPY,
-            MIRROR_METHOD_ZERO,
-            MIRROR_METHOD_DISCARD
-        } mirror_method = MIRROR_METHOD_COPY;
+        MirrorMethod mirror_method = MIRROR_METHOD_COPY;
 
         assert(!(offset % s->granularity));
         ret = bdrv_block_status_above(source, NULL, offset,
@@ -419,7 +531,8 @@ static uint64_t coroutine_fn mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= s->max_in_flight) {
+            s->in_flight_saturated = true;
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_io(s);
         }
@@ -496,8 +609,11 @@ static void mirror_exit(BlockJob *job, void *opaque)
     BlockDriverState *src = s->source;
     BlockDriverState *target_bs = blk_bs(s->target);
     BlockDriverState *mirror_top_bs = s->mirror_top_bs;
+    MirrorBDSOpaque *bs_opaque = mirror_top_bs->opaque;
     Error *local_err = NULL;
 
+    /* The source is drained, so no guest write is looking at the job */
+    bs_opaque->job = NULL;
     bdrv_release_dirty_bitmap(src, s->dirty_bitmap);
 
     /* Make sure that the source BDS doesn't go away before we called
@@ -631,7 +747,7 @@ static int coroutine_fn mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= s->max_in_flight) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_io(s);
@@ -769,7 +885,11 @@ static void coroutine_fn mirror_run(void *opaque)
 
     mirror_free_init(s);
 
+    s->max_in_flight = MAX_IN_FLIGHT;
+    s->max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+
     s->last_pause_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    s->last_adapt_ns = s->last_pause_ns;
     if (!s->is_none_mode) {
         ret = mirror_dirty_init(s);
         if (ret < 0 || block_job_is_cancelled(&s->common)) {
@@ -777,6 +897,10 @@ static void coroutine_fn mirror_run(void *opaque)
         }
     }
 
+    /* Only start copying guest writes once the initial zeroing of the target
+     * is over, or it could overwrite them. */
+    s->actively_mirroring = s->copy_mode == MIRROR_COPY_MODE_WRITE_BLOCKING;
+
     assert(!s->dbi);
     s->dbi = bdrv_dirty_iter_new(s->dirty_bitmap);
     for (;;) {
@@ -806,7 +930,10 @@ static void coroutine_fn mirror_run(void *opaque)
         delta = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - s->last_pause_ns;
         if (delta < SLICE_TIME &&
             s->common.iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= s->max_in_flight) {
+                s->in_flight_saturated = true;
+            }
+            if (s->in_flight >= s->max_in_flight || s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_io(s);
@@ -892,6 +1019,11 @@ immediate_exit:
         mirror_wait_for_all_io(s);
     }
 
+    s->actively_mirroring = false;
+    while (s->in_active_write > 0) {
+        mirror_wait_for_io(s);
+    }
+
     assert(s->in_flight == 0);
     qemu_vfree(s->buf);
     g_free(s->cow_bitmap);
@@ -1027,10 +1159,228 @@ static int coroutine_fn bdrv_mirror_top_preadv(BlockDriverState *bs,
     return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
 }
 
+/* Active writes keep whole chunks in sync; when the target needs
+ * copy-on-write, those are widened to whole target clusters */
+static int64_t mirror_active_write_align(MirrorBlockJob *s)
+{
+    if (s->cow_bitmap) {
+        return MAX(s->granularity, s->target_cluster_size);
+    }
+    return s->granularity;
+}
+
+/* Wait until no chunk touched by a guest write is being copied, then claim
+ * the chunks so that neither the background copy nor other guest writes
+ * touch them before mirror_active_write_settle().
+ */
+static void coroutine_fn mirror_active_write_prepare(MirrorBlockJob *s,
+                                                     uint64_t offset,
+                                                     uint64_t bytes)
+{
+    int64_t align = mirror_active_write_align(s);
+    int64_t start_chunk = QEMU_ALIGN_DOWN(offset, align) / s->granularity;
+    int64_t end_chunk = DIV_ROUND_UP(MIN(QEMU_ALIGN_UP(offset + bytes, align),
+                                         s->bdev_length),
+                                     s->granularity);
+
+    s->in_active_write++;
+    while (find_next_bit(s->in_flight_bitmap, end_chunk, start_chunk) <
+           end_chunk) {
+        trace_mirror_yield_in_flight(s, offset, s->in_flight);
+        qemu_co_queue_wait(&s->active_write_queue, NULL);
+    }
+    bitmap_set(s->in_flight_bitmap, start_chunk, end_chunk - start_chunk);
+}
+
+static void coroutine_fn mirror_active_write_settle(MirrorBlockJob *s,
+                                                    uint64_t offset,
+                                                    uint64_t bytes)
+{
+    int64_t align = mirror_active_write_align(s);
+    int64_t start_chunk = QEMU_ALIGN_DOWN(offset, align) / s->granularity;
+    int64_t end_chunk = DIV_ROUND_UP(MIN(QEMU_ALIGN_UP(offset + bytes, align),
+                                         s->bdev_length),
+                                     s->granularity);
+
+    bitmap_clear(s->in_flight_bitmap, start_chunk, end_chunk - start_chunk);
+    s->in_active_write--;
+    qemu_co_queue_restart_all(&s->active_write_queue);
+
+    if (s->waiting_for_io) {
+        /* Clear the flag now so that mirror_iteration_done() does not enter
+         * the job a second time before the wakeup has run. */
+        s->waiting_for_io = false;
+        aio_co_wake(s->common.co);
+    }
+}
+
+/* Copy [offset, offset + bytes) from the source to the target.  The guest
+ * write has already reached the source and the chunks are claimed, so what
+ * is read here is up to date.
+ */
+static int coroutine_fn mirror_sync_copy_chunks(MirrorBlockJob *s,
+                                                uint64_t offset,
+                                                uint64_t bytes, int flags)
+{
+    BdrvChild *source = s->mirror_top_bs->backing;
+    QEMUIOVector qiov;
+    struct iovec iov;
+    int ret;
+
+    if (!bytes) {
+        return 0;
+    }
+
+    iov.iov_base = qemu_try_blockalign(source->bs, bytes);
+    if (iov.iov_base == NULL) {
+        return -ENOMEM;
+    }
+    iov.iov_len = bytes;
+    qemu_iovec_init_external(&qiov, &iov, 1);
+
+    ret = bdrv_co_preadv(source, offset, bytes, &qiov, 0);
+    if (ret >= 0) {
+        ret = blk_co_pwritev(s->target, offset, bytes, &qiov,
+                             flags & BDRV_REQ_FUA);
+    }
+
+    qemu_vfree(iov.iov_base);
+    return ret;
+}
+
+/* Bring all chunks touched by a guest write up to date in the target and mark
+ * them clean.  The chunks completely covered by the write are written from
+ * the guest request; a partially written head or tail chunk is copied from
+ * the source as a whole.
+ */
+static void coroutine_fn mirror_sync_target_write(MirrorBlockJob *s,
+                                                  MirrorMethod method,
+                                                  uint64_t offset,
+                                                  uint64_t bytes,
+                                                  QEMUIOVector *qiov,
+                                                  int flags)
+{
+    int64_t align = mirror_active_write_align(s);
+    uint64_t chunk_start, chunk_end, start, end;
+    QEMUIOVector target_qiov;
+    int ret;
+
+    chunk_start = QEMU_ALIGN_DOWN(offset, align);
+    chunk_end = MIN(QEMU_ALIGN_UP(offset + bytes, align), s->bdev_length);
+    if (chunk_start >= chunk_end) {
+        return;
+    }
+
+    /* The part of the request that covers whole chunks */
+    start = QEMU_ALIGN_UP(offset, align);
+    end = offset + bytes;
+    if (end != s->bdev_length) {
+        end = QEMU_ALIGN_DOWN(end, align);
+    }
+
+    bdrv_reset_dirty_bitmap(s->dirty_bitmap, chunk_start,
+                            chunk_end - chunk_start);
+
+    if (start >= end) {
+        /* The request is within a single chunk */
+        ret = mirror_sync_copy_chunks(s, chunk_start, chunk_end - chunk_start,
+                                      flags);
+        goto out;
+    }
+
+    ret = mirror_sync_copy_chunks(s, chunk_start, start - chunk_start, flags);
+    if (ret < 0) {
+        goto out;
+    }
+
+    switch (method) {
+    case MIRROR_METHOD_COPY:
+        qemu_iovec_init(&target_qiov, qiov->niov);
+        qemu_iovec_concat(&target_qiov, qiov, start - offset, end - start);
+        ret = blk_co_pwritev(s->target, start, end - start, &target_qiov,
+                             flags);
+        qemu_iovec_destroy(&target_qiov);
+        break;
+    case MIRROR_METHOD_ZERO:
+        ret = blk_co_pwrite_zeroes(s->target, start, end - start, flags);
+        break;
+    case MIRROR_METHOD_DISCARD:
+        ret = blk_co_pdiscard(s->target, start, end - start);
+        break;
+    default:
+        abort();
+    }
+    if (ret < 0) {
+        goto out;
+    }
+
+    ret = mirror_sync_copy_chunks(s, end, chunk_end - end, flags);
+
+out:
+    trace_mirror_sync_target_write(s, chunk_start, chunk_end - chunk_start,
+                                   ret);
+
+    if (ret < 0) {
+        BlockErrorAction action;
+
+        bdrv_set_dirty_bitmap(s->dirty_bitmap, chunk_start,
+                              chunk_end - chunk_start);
+        action = mirror_error_action(s, false, -ret);
+        if (action == BLOCK_ERROR_ACTION_REPORT && s->ret >= 0) {
+            s->ret = ret;
+        }
+        return;
+    }
+
+    if (s->cow_bitmap) {
+        bitmap_set(s->cow_bitmap, chunk_start / s->granularity,
+                   DIV_ROUND_UP(chunk_end - chunk_start, s->granularity));
+    }
+    s->common.offset += chunk_end - chunk_start;
+}
+
+static int coroutine_fn bdrv_mirror_top_do_write(BlockDriverState *bs,
+    MirrorMethod method, uint64_t offset, uint64_t bytes, QEMUIOVector *qiov,
+    int flags)
+{
+    MirrorBDSOpaque *bs_opaque = bs->opaque;
+    MirrorBlockJob *s = bs_opaque->job;
+    bool copy_to_target;
+    int ret;
+
+    copy_to_target = s && s->actively_mirroring && s->ret >= 0;
+    if (copy_to_target) {
+        mirror_active_write_prepare(s, offset, bytes);
+    }
+
+    switch (method) {
+    case MIRROR_METHOD_COPY:
+        ret = bdrv_co_pwritev(bs->backing, offset, bytes, qiov, flags);
+        break;
+    case MIRROR_METHOD_ZERO:
+        ret = bdrv_co_pwrite_zeroes(bs->backing, offset, bytes, flags);
+        break;
+    case MIRROR_METHOD_DISCARD:
+        ret = bdrv_co_pdiscard(bs->backing->bs, offset, bytes);
+        break;
+    default:
+        abort();
+    }
+
+    if (copy_to_target) {
+        if (ret >= 0 && s->ret >= 0) {
+            mirror_sync_target_write(s, method, offset, bytes, qiov, flags);
+        }
+        mirror_active_write_settle(s, offset, bytes);
+    }
+    return ret;
+}
+
 static int coroutine_fn bdrv_mirror_top_pwritev(BlockDriverState *bs,
     uint64_t offset, uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    return bdrv_co_pwritev(bs->backing, offset, bytes, qiov, flags);
+    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_COPY, offset, bytes,
+                                    qiov, flags);
 }
 
 static int coroutine_fn bdrv_mirror_top_flush(BlockDriverState *bs)
@@ -1045,13 +1395,23 @@ static int coroutine_fn bdrv_mirror_top_flush(BlockDriverState *bs)
 static int coroutine_fn bdrv_mirror_top_pwrite_zeroes(BlockDriverState *bs,
     int64_t offset, int bytes, BdrvRequestFlags flags)
 {
-    return bdrv_co_pwrite_zeroes(bs->backing, offset, bytes, flags);
+    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_ZERO, offset, bytes,
+                                    NULL, flags);
 }
 
 static int coroutine_fn bdrv_mirror_top_pdiscard(BlockDriverState *bs,
     int64_t offset, int bytes)
 {
-    return bdrv_co_pdiscard(bs->backing->bs, offset, bytes);
+    return bdrv_mirror_top_do_write(bs, MIRROR_METHOD_DISCARD, offset, bytes,
+                                    NULL, 0);
+}
+
+static int coroutine_fn bdrv_mirror_top_copy_range_from(BlockDriverState *bs,
+    BdrvChild *src, uint64_t src_offset, BdrvChild *dst, uint64_t dst_offset,
+    uint64_t bytes, BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_from(bs->backing, src_offset, dst, dst_offset,
+                                   bytes, flags);
 }
 
 static void bdrv_mirror_top_refresh_filename(BlockDriverState *bs, QDict *opts)
@@ -1089,10 +1449,12 @@ static void bdrv_mirror_top_child_perm(BlockDriverState *bs, BdrvChild *c,
  * from its backing file and that allows writes on the backing file chain. */
 static BlockDriver bdrv_mirror_top = {
     .format_name                = "mirror_top",
+    .instance_size              = sizeof(MirrorBDSOpaque),
     .bdrv_co_preadv             = bdrv_mirror_top_preadv,
     .bdrv_co_pwritev            = bdrv_mirror_top_pwritev,
     .bdrv_co_pwrite_zeroes      = bdrv_mirror_top_pwrite_zeroes,
     .bdrv_co_pdiscard           = bdrv_mirror_top_pdiscard,
+    .bdrv_co_copy_range_from    = bdrv_mirror_top_copy_range_from,
     .bdrv_co_flush              = bdrv_mirror_top_flush,
     .bdrv_co_get_block_status   = bdrv_co_get_block_status_from_backing,
     .bdrv_refresh_filename      = bdrv_mirror_top_refresh_filename,
@@ -1113,11 +1475,12 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
                              const BlockJobDriver *driver,
                              bool is_none_mode, BlockDriverState *base,
                              bool auto_complete, const char *filter_node_name,
-                             bool is_mirror,
+                             bool is_mirror, MirrorCopyMode copy_mode,
                              Error **errp)
 {
     MirrorBlockJob *s;
     BlockDriverState *mirror_top_bs;
+    MirrorBDSOpaque *bs_opaque;
     bool target_graph_mod;
     bool target_is_backing;
     Error *local_err = NULL;
@@ -1219,6 +1582,9 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
     s->granularity = granularity;
     s->buf_size = ROUND_UP(buf_size, granularity);
     s->unmap = unmap;
+    s->use_copy_range = true;
+    s->copy_mode = copy_mode;
+    qemu_co_queue_init(&s->active_write_queue);
     if (auto_complete) {
         s->should_complete = true;
     }
@@ -1250,6 +1616,9 @@ static void mirror_start_job(const char *job_id, BlockDriverState *bs,
         }
     }
 
+    bs_opaque = mirror_top_bs->opaque;
+    bs_opaque->job = s;
+
     trace_mirror_start(bs, s, opaque);
     block_job_start(&s->common);
     return;
@@ -1278,7 +1647,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name, Error **errp)
+                  bool unmap, const char *filter_node_name,
+                  MirrorCopyMode copy_mode, Error **errp)
 {
     bool is_none_mode;
     BlockDriverState *base;
@@ -1293,7 +1663,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                      speed, granularity, buf_size, backing_mode,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
-                     filter_node_name, true, errp);
+                     filter_node_name, true, copy_mode, errp);
 }
 
 void commit_active_start(const char *job_id, BlockDriverState *bs,
@@ -1316,7 +1686,8 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
                      MIRROR_LEAVE_BACKING_CHAIN,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
-                     filter_node_name, false, &local_err);
+                     filter_node_name, false, MIRROR_COPY_MODE_BACKGROUND,
+                     &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         goto error_restore_flags;
@@ -47,10 +47,9 @@ static void nbd_recv_coroutines_wake_all(NBDClientSession *s)
     }
 }
 
-static void nbd_teardown_connection(BlockDriverState *bs)
+static void nbd_teardown_connection(BlockDriverState *bs,
+                                    NBDClientSession *client)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
-
     if (!client->ioc) { /* Already closed */
         return;
     }
@@ -61,7 +60,7 @@ static void nbd_teardown_connection(BlockDriverState *bs)
                          NULL);
     BDRV_POLL_WHILE(bs, client->read_reply_co);
 
-    nbd_client_detach_aio_context(bs);
+    qio_channel_detach_aio_context(QIO_CHANNEL(client->ioc));
     object_unref(OBJECT(client->sioc));
     client->sioc = NULL;
     object_unref(OBJECT(client->ioc));
@@ -118,11 +117,26 @@ static coroutine_fn void nbd_read_reply_entry(void *opaque)
     s->read_reply_co = NULL;
 }
 
-static int nbd_co_send_request(BlockDriverState *bs,
+/* Choose the connection with the fewest requests in flight.  Connections
+ * that died are only used if no other one is left, so that the request
+ * fails the usual way. */
+static NBDClientSession *nbd_pick_client_session(BlockDriverState *bs)
+{
+    NBDClientSession *best = nbd_get_client_session(bs);
+    NBDClientSession *s;
+
+    for (s = best->next; s; s = s->next) {
+        if (!s->quit && (best->quit || s->in_flight < best->in_flight)) {
+            best = s;
+        }
+    }
+    return best;
+}
+
+static int nbd_co_send_request(NBDClientSession *s,
                                NBDRequest *request,
                                QEMUIOVector *qiov)
 {
-    NBDClientSession *s = nbd_get_client_session(bs);
     int rc, i;
 
     qemu_co_mutex_lock(&s->send_mutex);
@@ -228,6 +242,52 @@ static int nbd_parse_offset_hole_payload(NBDStructuredReplyChunk *chunk,
     return 0;
 }
 
+/* nbd_parse_blockstatus_payload
+ * support only one extent in reply and only for
+ * base:allocation context
+ */
+static int nbd_parse_blockstatus_payload(NBDClientSession *client,
+                                         NBDStructuredReplyChunk *chunk,
+                                         uint8_t *payload, uint64_t orig_length,
+                                         NBDExtent *extent, Error **errp)
+{
+    uint32_t context_id;
+
+    if (chunk->length != sizeof(context_id) + sizeof(*extent)) {
+        error_setg(errp, "Protocol error: invalid payload for "
+                         "NBD_REPLY_TYPE_BLOCK_STATUS");
+        return -EINVAL;
+    }
+
+    context_id = payload_advance32(&payload);
+    if (client->info.meta_base_allocation_id != context_id) {
+        error_setg(errp, "Protocol error: unexpected context id %" PRIu32
+                         " for NBD_REPLY_TYPE_BLOCK_STATUS, when negotiated "
+                         "context id is %" PRIu32, context_id,
+                         client->info.meta_base_allocation_id);
+        return -EINVAL;
+    }
+
+    extent->length = payload_advance32(&payload);
+    extent->flags = payload_advance32(&payload);
+
+    if (extent->length == 0 ||
+        (client->info.min_block && !QEMU_IS_ALIGNED(extent->length,
+                                                    client->info.min_block))) {
+        error_setg(errp, "Protocol error: server sent status chunk with "
+                   "invalid length");
+        return -EINVAL;
+    }
+
+    /* The server is allowed to send an extent longer than requested;
+     * only the part we asked about is of interest */
+    if (extent->length > orig_length) {
+        extent->length = orig_length;
+    }
+
+    return 0;
+}
+
 /* nbd_parse_error_payload
  * on success @errp contains message describing nbd error reply
  */
@@ -640,12 +700,74 @@ static int nbd_co_receive_cmdread_reply(NBDClientSession *s, uint64_t handle,
     return iter.ret;
 }
 
-static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
+static int nbd_co_receive_blockstatus_reply(NBDClientSession *s,
+                                            uint64_t handle, uint64_t length,
+                                            NBDExtent *extent, Error **errp)
+{
+    NBDReplyChunkIter iter;
+    NBDReply reply;
+    void *payload = NULL;
+    Error *local_err = NULL;
+    bool received = false;
+
+    assert(!extent->length);
+    NBD_FOREACH_REPLY_CHUNK(s, iter, handle, s->info.structured_reply,
+                            NULL, &reply, &payload)
+    {
+        int ret;
+        NBDStructuredReplyChunk *chunk = &reply.structured;
+
+        assert(nbd_reply_is_structured(&reply));
+
+        switch (chunk->type) {
+        case NBD_REPLY_TYPE_BLOCK_STATUS:
+            if (received) {
+                s->quit = true;
+                error_setg(&local_err, "Several BLOCK_STATUS chunks in reply");
+                nbd_iter_error(&iter, true, -EINVAL, &local_err);
+            }
+            received = true;
+
+            ret = nbd_parse_blockstatus_payload(s, &reply.structured,
+                                                payload, length, extent,
+                                                &local_err);
+            if (ret < 0) {
+                s->quit = true;
+                nbd_iter_error(&iter, true, ret, &local_err);
+            }
+            break;
+        default:
+            if (!nbd_reply_type_is_error(chunk->type)) {
+                /* not allowed reply type */
+                s->quit = true;
+                error_setg(&local_err,
+                           "Unexpected reply type: %d (%s) "
+                           "for CMD_BLOCK_STATUS",
+                           chunk->type, nbd_reply_type_lookup(chunk->type));
+                nbd_iter_error(&iter, true, -EINVAL, &local_err);
+            }
+        }
+
+        g_free(payload);
+        payload = NULL;
+    }
+
+    if (!extent->length && !iter.err) {
+        error_setg(&iter.err,
+                   "Server did not reply with any status extents");
+        if (!iter.ret) {
+            iter.ret = -EIO;
+        }
+    }
+    error_propagate(errp, iter.err);
+    return iter.ret;
+}
+
+static int nbd_co_request(NBDClientSession *client, NBDRequest *request,
                           QEMUIOVector *write_qiov)
 {
     int ret;
     Error *local_err = NULL;
-    NBDClientSession *client = nbd_get_client_session(bs);
 
     assert(request->type != NBD_CMD_READ);
     if (write_qiov) {
@@ -654,7 +776,7 @@ static int nbd_co_request(BlockDriverState *bs, NBDRequest *request,
     } else {
         assert(request->type != NBD_CMD_WRITE);
     }
-    ret = nbd_co_send_request(bs, request, write_qiov);
+    ret = nbd_co_send_request(client, request, write_qiov);
     if (ret < 0) {
         return ret;
     }
@@ -671,7 +793,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 {
     int ret;
     Error *local_err = NULL;
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_pick_client_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_READ,
         .from = offset,
@@ -684,7 +806,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    ret = nbd_co_send_request(bs, &request, NULL);
+    ret = nbd_co_send_request(client, &request, NULL);
     if (ret < 0) {
         return ret;
     }
@@ -700,7 +822,7 @@ int nbd_client_co_preadv(BlockDriverState *bs, uint64_t offset,
 int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
                           uint64_t bytes, QEMUIOVector *qiov, int flags)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_pick_client_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE,
         .from = offset,
@@ -718,13 +840,13 @@ int nbd_client_co_pwritev(BlockDriverState *bs, uint64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, qiov);
+    return nbd_co_request(client, &request, qiov);
 }
 
 int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
                                 int bytes, BdrvRequestFlags flags)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_pick_client_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_WRITE_ZEROES,
         .from = offset,
@@ -747,12 +869,12 @@ int nbd_client_co_pwrite_zeroes(BlockDriverState *bs, int64_t offset,
     if (!bytes) {
         return 0;
     }
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(client, &request, NULL);
 }
 
 int nbd_client_co_flush(BlockDriverState *bs)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_pick_client_session(bs);
     NBDRequest request = { .type = NBD_CMD_FLUSH };
 
     if (!(client->info.flags & NBD_FLAG_SEND_FLUSH)) {
@@ -762,12 +884,12 @@ int nbd_client_co_flush(BlockDriverState *bs)
     request.from = 0;
     request.len = 0;
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(client, &request, NULL);
 }
 
 int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *client = nbd_pick_client_session(bs);
     NBDRequest request = {
         .type = NBD_CMD_TRIM,
         .from = offset,
@@ -779,26 +901,93 @@ int nbd_client_co_pdiscard(BlockDriverState *bs, int64_t offset, int bytes)
         return 0;
     }
 
-    return nbd_co_request(bs, &request, NULL);
+    return nbd_co_request(client, &request, NULL);
+}
+
+int64_t coroutine_fn nbd_client_co_get_block_status(BlockDriverState *bs,
+                                                    int64_t sector_num,
+                                                    int nb_sectors, int *pnum,
+                                                    BlockDriverState **file)
+{
+    int64_t ret;
+    NBDExtent extent = { 0 };
+    NBDClientSession *client = nbd_pick_client_session(bs);
+    Error *local_err = NULL;
+    int64_t offset = sector_num << BDRV_SECTOR_BITS;
+    NBDRequest request = {
+        .type = NBD_CMD_BLOCK_STATUS,
+        .from = offset,
+        .len = MIN(MIN_NON_ZERO(QEMU_ALIGN_DOWN(INT_MAX,
+                                                bs->bl.request_alignment),
+                                client->info.max_block),
+                   (int64_t)nb_sectors << BDRV_SECTOR_BITS),
+        .flags = NBD_CMD_FLAG_REQ_ONE,
+    };
+
+    if (!client->info.base_allocation) {
+        *pnum = nb_sectors;
+        *file = bs;
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID | offset;
+    }
+
+    ret = nbd_co_send_request(client, &request, NULL);
+    if (ret < 0) {
+        return ret;
+    }
+
+    ret = nbd_co_receive_blockstatus_reply(client, request.handle,
+                                           request.len, &extent, &local_err);
+    if (local_err) {
+        error_report_err(local_err);
+    }
+    if (ret < 0) {
+        return ret;
+    }
+
+    /* The block layer works in sectors here; an extent shorter than a
+     * sector (only possible if the server allows byte granularity) is
+     * conservatively reported as data */
+    *file = bs;
+    if (extent.length < BDRV_SECTOR_SIZE) {
+        *pnum = 1;
+        return BDRV_BLOCK_DATA | BDRV_BLOCK_OFFSET_VALID | offset;
+    }
+
+    *pnum = extent.length >> BDRV_SECTOR_BITS;
+    return (extent.flags & NBD_STATE_HOLE ? 0 : BDRV_BLOCK_DATA) |
+           (extent.flags & NBD_STATE_ZERO ? BDRV_BLOCK_ZERO : 0) |
+           BDRV_BLOCK_OFFSET_VALID | offset;
 }
 
 void nbd_client_detach_aio_context(BlockDriverState *bs)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
-    qio_channel_detach_aio_context(QIO_CHANNEL(client->ioc));
+    NBDClientSession *client;
+
+    for (client = nbd_get_client_session(bs); client; client = client->next) {
+        qio_channel_detach_aio_context(QIO_CHANNEL(client->ioc));
+    }
 }
 
-void nbd_client_attach_aio_context(BlockDriverState *bs,
-                                   AioContext *new_context)
+static void nbd_client_attach_session(NBDClientSession *client,
+                                      AioContext *new_context)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
     qio_channel_attach_aio_context(QIO_CHANNEL(client->ioc), new_context);
     aio_co_schedule(new_context, client->read_reply_co);
 }
 
-void nbd_client_close(BlockDriverState *bs)
+void nbd_client_attach_aio_context(BlockDriverState *bs,
+                                   AioContext *new_context)
+{
+    NBDClientSession *client;
+
+    for (client = nbd_get_client_session(bs); client; client = client->next) {
+        nbd_client_attach_session(client, new_context);
+    }
+}
+
+static void nbd_client_close_session(BlockDriverState *bs,
+                                     NBDClientSession *client)
 {
-    NBDClientSession *client = nbd_get_client_session(bs);
     NBDRequest request = { .type = NBD_CMD_DISC };
 
     if (client->ioc == NULL) {
@@ -807,17 +996,35 @@ void nbd_client_close(BlockDriverState *bs)
 
     nbd_send_request(client->ioc, &request);
 
-    nbd_teardown_connection(bs);
+    nbd_teardown_connection(bs, client);
 }
 
-int nbd_client_init(BlockDriverState *bs,
-                    QIOChannelSocket *sioc,
-                    const char *export,
-                    QCryptoTLSCreds *tlscreds,
-                    const char *hostname,
-                    Error **errp)
+void nbd_client_close(BlockDriverState *bs)
 {
     NBDClientSession *client = nbd_get_client_session(bs);
+    NBDClientSession *next;
+
+    nbd_client_close_session(bs, client);
+
+    for (next = client->next, client->next = NULL; next; ) {
+        client = next;
+        next = client->next;
+        nbd_client_close_session(bs, client);
+        g_free(client);
+    }
+}
+
+/* Negotiate with the server on @sioc and start the reply coroutine of
+ * @client.  The export details end up in @client->info. */
+static int nbd_client_connect(BlockDriverState *bs,
+                              NBDClientSession *client,
+                              QIOChannelSocket *sioc,
+                              const char *export,
+                              QCryptoTLSCreds *tlscreds,
+                              const char *hostname,
+                              const char *x_dirty_bitmap,
+                              Error **errp)
+{
     int ret;
 
     /* NBD handshake */
@@ -826,17 +1033,65 @@ int nbd_client_init(BlockDriverState *bs,
 
     client->info.request_sizes = true;
     client->info.structured_reply = true;
+    client->info.base_allocation = true;
+    client->info.x_dirty_bitmap = g_strdup(x_dirty_bitmap);
     ret = nbd_receive_negotiate(QIO_CHANNEL(sioc), export,
                                 tlscreds, hostname,
                                 &client->ioc, &client->info, errp);
+    g_free((char *)client->info.x_dirty_bitmap);
+    client->info.x_dirty_bitmap = NULL;
     if (ret < 0) {
         logout("Failed to negotiate with the NBD server\n");
         return ret;
     }
+    if (x_dirty_bitmap && !client->info.base_allocation) {
+        error_setg(errp, "requested x-dirty-bitmap %s not found",
+                   x_dirty_bitmap);
+        return -EINVAL;
+    }
+
+    qemu_co_mutex_init(&client->send_mutex);
+    qemu_co_queue_init(&client->free_sema);
+    client->sioc = sioc;
+    object_ref(OBJECT(client->sioc));
+
+    if (!client->ioc) {
+        client->ioc = QIO_CHANNEL(sioc);
+        object_ref(OBJECT(client->ioc));
+    }
+
+    /* Now that we're connected, set the socket to be non-blocking and
+     * kick the reply mechanism.  */
+    qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
+    client->read_reply_co = qemu_coroutine_create(nbd_read_reply_entry, client);
+    nbd_client_attach_session(client, bdrv_get_aio_context(bs));
+
+    logout("Established connection with NBD server\n");
+    return 0;
+}
+
+int nbd_client_init(BlockDriverState *bs,
+                    QIOChannelSocket *sioc,
+                    const char *export,
+                    QCryptoTLSCreds *tlscreds,
+                    const char *hostname,
+                    const char *x_dirty_bitmap,
+                    Error **errp)
+{
+    NBDClientSession *client = nbd_get_client_session(bs);
+    int ret;
+
+    ret = nbd_client_connect(bs, client, sioc, export, tlscreds, hostname,
+                             x_dirty_bitmap, errp);
+    if (ret < 0) {
+        return ret;
+    }
+
     if (client->info.flags & NBD_FLAG_READ_ONLY &&
         !bdrv_is_read_only(bs)) {
         error_setg(errp,
                    "request for write access conflicts with read-only export");
+        nbd_client_close(bs);
         return -EACCES;
     }
     if (client->info.flags & NBD_FLAG_SEND_FUA) {
@@ -850,22 +1105,59 @@ int nbd_client_init(BlockDriverState *bs,
         bs->bl.request_alignment = client->info.min_block;
     }
 
-    qemu_co_mutex_init(&client->send_mutex);
-    qemu_co_queue_init(&client->free_sema);
-    client->sioc = sioc;
-    object_ref(OBJECT(client->sioc));
+    return 0;
+}
 
-    if (!client->ioc) {
-        client->ioc = QIO_CHANNEL(sioc);
-        object_ref(OBJECT(client->ioc));
+/* Open one more connection to the export already opened by
+ * nbd_client_init().  Requests are then spread over all connections.
+ * Only valid if the server advertised NBD_FLAG_CAN_MULTI_CONN, which
+ * guarantees that a flush on any connection covers writes completed
+ * on all of them. */
+int nbd_client_add_connection(BlockDriverState *bs,
+                              QIOChannelSocket *sioc,
+                              const char *export,
+                              QCryptoTLSCreds *tlscreds,
+                              const char *hostname,
+                              const char *x_dirty_bitmap,
+                              Error **errp)
+{
+    NBDClientSession *first = nbd_get_client_session(bs);
+    NBDClientSession *client, *last;
+    int ret;
+
+    assert(first->info.flags & NBD_FLAG_CAN_MULTI_CONN);
+
+    client = g_new0(NBDClientSession, 1);
+    ret = nbd_client_connect(bs, client, sioc, export, tlscreds, hostname,
+                             x_dirty_bitmap, errp);
+    if (ret < 0) {
+        if (client->ioc) {
+            object_unref(OBJECT(client->ioc));
+        }
+        g_free(client);
+        return ret;
     }
 
-    /* Now that we're connected, set the socket to be non-blocking and
-     * kick the reply mechanism.  */
-    qio_channel_set_blocking(QIO_CHANNEL(sioc), false, NULL);
-    client->read_reply_co = qemu_coroutine_create(nbd_read_reply_entry, client);
-    nbd_client_attach_aio_context(bs, bdrv_get_aio_context(bs));
+    /* All connections must see the same export, or requests would
+     * behave differently depending on which one they are sent to */
+    if (client->info.size != first->info.size ||
+        client->info.flags != first->info.flags ||
+        client->info.min_block != first->info.min_block ||
+        client->info.max_block != first->info.max_block ||
+        client->info.structured_reply != first->info.structured_reply ||
+        client->info.base_allocation != first->info.base_allocation ||
+        client->info.meta_base_allocation_id !=
+            first->info.meta_base_allocation_id) {
+        error_setg(errp, "Server negotiated different export parameters "
+                   "on a second connection");
+        nbd_client_close_session(bs, client);
+        g_free(client);
+        return -EINVAL;
+    }
 
-    logout("Established connection with NBD server\n");
+    for (last = first; last->next; last = last->next) {
+        /* find the tail */
+    }
+    last->next = client;
     return 0;
 }
@@ -39,6 +39,7 @@
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qstring.h"
 #include "qemu/cutils.h"
+#include "qemu/error-report.h"
 
 #define EN_OPTSTR ":exportname="
 
@@ -388,9 +389,56 @@ static QemuOptsList nbd_runtime_opts = {
             .type = QEMU_OPT_STRING,
             .help = "ID of the TLS credentials to use",
         },
+        {
+            .name = "x-dirty-bitmap",
+            .type = QEMU_OPT_STRING,
+            .help = "experimental: expose named dirty bitmap in place of "
+                    "block status",
+        },
+        {
+            .name = "multi-conn",
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of connections to open if the server supports "
+                    "multi-conn (default 1)",
+        },
     },
 };
 
+/* Best effort: if the server does not allow more connections, or they
+ * cannot be established, keep going with the ones we have. */
+static void nbd_open_more_connections(BlockDriverState *bs,
+                                      unsigned int multi_conn,
+                                      QCryptoTLSCreds *tlscreds,
+                                      const char *hostname,
+                                      const char *x_dirty_bitmap)
+{
+    BDRVNBDState *s = bs->opaque;
+    Error *local_err = NULL;
+    unsigned int i;
+
+    if (!(s->client.info.flags & NBD_FLAG_CAN_MULTI_CONN)) {
+        warn_report("NBD server does not support multi-conn, "
+                    "using a single connection");
+        return;
+    }
+
+    for (i = 1; i < multi_conn; i++) {
+        QIOChannelSocket *sioc = nbd_establish_connection(s->saddr,
+                                                          &local_err);
+        if (sioc) {
+            nbd_client_add_connection(bs, sioc, s->export, tlscreds, hostname,
+                                      x_dirty_bitmap, &local_err);
+            object_unref(OBJECT(sioc));
+        }
+        if (local_err) {
+            warn_report("Using %u of %u NBD connections: %s", i, multi_conn,
+                        error_get_pretty(local_err));
+            error_free(local_err);
+            return;
+        }
+    }
+}
+
 static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
                     Error **errp)
 {
@@ -400,6 +448,8 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     QIOChannelSocket *sioc = NULL;
     QCryptoTLSCreds *tlscreds = NULL;
     const char *hostname = NULL;
+    const char *x_dirty_bitmap;
+    uint64_t multi_conn;
     int ret = -EINVAL;
 
     opts = qemu_opts_create(&nbd_runtime_opts, NULL, 0, &error_abort);
@@ -421,6 +471,14 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     s->export = g_strdup(qemu_opt_get(opts, "export"));
+    x_dirty_bitmap = qemu_opt_get(opts, "x-dirty-bitmap");
+
+    multi_conn = qemu_opt_get_number(opts, "multi-conn", 1);
+    if (multi_conn < 1 || multi_conn > NBD_MAX_CONNECTIONS) {
+        error_setg(errp, "multi-conn must be between 1 and %d",
+                   NBD_MAX_CONNECTIONS);
+        goto error;
+    }
 
     s->tlscredsid = g_strdup(qemu_opt_get(opts, "tls-creds"));
     if (s->tlscredsid) {
@@ -448,7 +506,11 @@ static int nbd_open(BlockDriverState *bs, QDict *options, int flags,
 
     /* NBD handshake */
     ret = nbd_client_init(bs, sioc, s->export,
-                          tlscreds, hostname, errp);
+                          tlscreds, hostname, x_dirty_bitmap, errp);
+    if (ret == 0 && multi_conn > 1) {
+        nbd_open_more_connections(bs, multi_conn, tlscreds, hostname,
+                                  x_dirty_bitmap);
+    }
  error:
     if (sioc) {
         object_unref(OBJECT(sioc));
@@ -577,6 +639,7 @@ static BlockDriver bdrv_nbd = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -596,6 +659,7 @@ static BlockDriver bdrv_nbd_tcp = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
@@ -615,6 +679,7 @@ static BlockDriver bdrv_nbd_unix = {
     .bdrv_close                 = nbd_close,
     .bdrv_co_flush_to_os        = nbd_co_flush,
     .bdrv_co_pdiscard           = nbd_client_co_pdiscard,
+    .bdrv_co_get_block_status   = nbd_client_co_get_block_status,
     .bdrv_refresh_limits        = nbd_refresh_limits,
     .bdrv_getlength             = nbd_getlength,
     .bdrv_detach_aio_context    = nbd_detach_aio_context,
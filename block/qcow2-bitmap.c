@@ -1288,6 +1288,47 @@ fail:
     bitmap_list_free(bm_list);
 }
 
+BdrvDirtyBitmap *qcow2_load_persistent_dirty_bitmap(BlockDriverState *bs,
+                                                    const char *name,
+                                                    Error **errp)
+{
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2Bitmap *bm;
+    Qcow2BitmapList *bm_list;
+    BdrvDirtyBitmap *bitmap = NULL;
+
+    if (s->nb_bitmaps == 0) {
+        error_setg(errp, "Bitmap '%s' not found", name);
+        return NULL;
+    }
+
+    bm_list = bitmap_list_load(bs, s->bitmap_directory_offset,
+                               s->bitmap_directory_size, errp);
+    if (bm_list == NULL) {
+        return NULL;
+    }
+
+    bm = find_bitmap_by_name(bm_list, name);
+    if (bm == NULL) {
+        error_setg(errp, "Bitmap '%s' not found", name);
+        goto out;
+    }
+
+    /* load_bitmap() refuses bitmaps with the in_use flag: their data can't be
+     * trusted after an unclean shutdown */
+    bitmap = load_bitmap(bs, bm, errp);
+    if (bitmap == NULL) {
+        goto out;
+    }
+
+    bdrv_disable_dirty_bitmap(bitmap);
+    bdrv_dirty_bitmap_set_readonly(bitmap, true);
+
+out:
+    bitmap_list_free(bm_list);
+    return bitmap;
+}
+
 void qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs, Error **errp)
 {
     BdrvDirtyBitmap *bitmap;
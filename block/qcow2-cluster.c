@@ -29,6 +29,7 @@
 #include "qemu-common.h"
 #include "block/block_int.h"
 #include "block/qcow2.h"
+#include "block/crypto.h"
 #include "qemu/bswap.h"
 #include "trace.h"
 
@@ -460,7 +461,8 @@ static bool coroutine_fn do_perform_cow_encrypt(BlockDriverState *bs,
         assert((offset_in_cluster & ~BDRV_SECTOR_MASK) == 0);
         assert((bytes & ~BDRV_SECTOR_MASK) == 0);
         assert(s->crypto);
-        if (qcrypto_block_encrypt(s->crypto, offset, buffer, bytes, NULL) < 0) {
+        if (block_crypto_co_encrypt(bs, s->crypto, offset, buffer, bytes,
+                                    NULL) < 0) {
             return false;
         }
     }
@@ -288,7 +288,8 @@ static int qcow2_read_extensions(BlockDriverState *bs, uint64_t start_offset,
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
                                            qcow2_crypto_hdr_read_func,
-                                           bs, cflags, errp);
+                                           bs, cflags,
+                                           block_crypto_n_threads(), errp);
             if (!s->crypto) {
                 return -EINVAL;
             }
@@ -1400,7 +1401,8 @@ static int qcow2_do_open(BlockDriverState *bs, QDict *options, int flags,
                 cflags |= QCRYPTO_BLOCK_OPEN_NO_IO;
             }
             s->crypto = qcrypto_block_open(s->crypto_opts, "encrypt.",
-                                           NULL, NULL, cflags, errp);
+                                           NULL, NULL, cflags,
+                                           block_crypto_n_threads(), errp);
             if (!s->crypto) {
                 ret = -EINVAL;
                 goto fail;
@@ -1812,24 +1814,28 @@ static coroutine_fn int qcow2_co_preadv(BlockDriverState *bs, uint64_t offset,
             ret = bdrv_co_preadv(bs->file,
                                  cluster_offset + offset_in_cluster,
                                  cur_bytes, &hd_qiov, 0);
-            qemu_co_mutex_lock(&s->lock);
-            if (ret < 0) {
-                goto fail;
-            }
-            if (bs->encrypted) {
+            if (ret >= 0 && bs->encrypted) {
+                /* cluster_data is private to this request, decrypt it
+                 * without holding the lock */
                 assert(s->crypto);
                 assert((offset & (BDRV_SECTOR_SIZE - 1)) == 0);
                 assert((cur_bytes & (BDRV_SECTOR_SIZE - 1)) == 0);
-                if (qcrypto_block_decrypt(s->crypto,
-                                          (s->crypt_physical_offset ?
-                                           cluster_offset + offset_in_cluster :
-                                           offset),
-                                          cluster_data,
-                                          cur_bytes,
-                                          NULL) < 0) {
+                if (block_crypto_co_decrypt(bs, s->crypto,
+                                            (s->crypt_physical_offset ?
+                                             cluster_offset +
+                                             offset_in_cluster :
+                                             offset),
+                                            cluster_data,
+                                            cur_bytes,
+                                            NULL) < 0) {
                     ret = -EIO;
-                    goto fail;
                 }
+            }
+            qemu_co_mutex_lock(&s->lock);
+            if (ret < 0) {
+                goto fail;
+            }
+            if (bs->encrypted) {
                 qemu_iovec_from_buf(qiov, bytes_done, cluster_data, cur_bytes);
             }
             break;
@@ -1893,6 +1899,42 @@ static bool merge_cow(uint64_t offset, unsigned bytes,
     return false;
 }
 
+/* Link the clusters of *l2meta into the L2 tables if @link_l2 is true, take
+ * the requests off the list of running requests and wake up any dependent
+ * requests.  On success *l2meta is freed and set to NULL; on failure the
+ * remaining entries are left in place for a call with @link_l2 false. */
+static int qcow2_handle_l2meta(BlockDriverState *bs, QCowL2Meta **l2meta,
+                               bool link_l2)
+{
+    int ret = 0;
+    QCowL2Meta *l = *l2meta;
+
+    while (l != NULL) {
+        QCowL2Meta *next;
+
+        if (link_l2) {
+            ret = qcow2_alloc_cluster_link_l2(bs, l);
+            if (ret) {
+                goto out;
+            }
+        }
+
+        /* Take the request off the list of running requests */
+        if (l->nb_clusters != 0) {
+            QLIST_REMOVE(l, next_in_flight);
+        }
+
+        qemu_co_queue_restart_all(&l->dependent_requests);
+
+        next = l->next;
+        g_free(l);
+        l = next;
+    }
+out:
+    *l2meta = l;
+    return ret;
+}
+
 static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                                          uint64_t bytes, QEMUIOVector *qiov,
                                          int flags)
@@ -1955,12 +1997,18 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
                    QCOW_MAX_CRYPT_CLUSTERS * s->cluster_size);
             qemu_iovec_to_buf(&hd_qiov, 0, cluster_data, hd_qiov.size);
 
-            if (qcrypto_block_encrypt(s->crypto,
-                                      (s->crypt_physical_offset ?
-                                       cluster_offset + offset_in_cluster :
-                                       offset),
-                                      cluster_data,
-                                      cur_bytes, NULL) < 0) {
+            /* The allocation in l2meta keeps overlapping requests away
+             * from these clusters, so the lock can be dropped while
+             * the data is encrypted */
+            qemu_co_mutex_unlock(&s->lock);
+            ret = block_crypto_co_encrypt(bs, s->crypto,
+                                          (s->crypt_physical_offset ?
+                                           cluster_offset + offset_in_cluster :
+                                           offset),
+                                          cluster_data,
+                                          cur_bytes, NULL);
+            qemu_co_mutex_lock(&s->lock);
+            if (ret < 0) {
                 ret = -EIO;
                 goto fail;
             }
@@ -1993,24 +2041,9 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
             }
         }
 
-        while (l2meta != NULL) {
-            QCowL2Meta *next;
-
-            ret = qcow2_alloc_cluster_link_l2(bs, l2meta);
-            if (ret < 0) {
-                goto fail;
-            }
-
-            /* Take the request off the list of running requests */
-            if (l2meta->nb_clusters != 0) {
-                QLIST_REMOVE(l2meta, next_in_flight);
-            }
-
-            qemu_co_queue_restart_all(&l2meta->dependent_requests);
-
-            next = l2meta->next;
-            g_free(l2meta);
-            l2meta = next;
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret) {
+            goto fail;
         }
 
         bytes -= cur_bytes;
@@ -2021,24 +2054,171 @@ static coroutine_fn int qcow2_co_pwritev(BlockDriverState *bs, uint64_t offset,
     ret = 0;
 
 fail:
-    while (l2meta != NULL) {
-        QCowL2Meta *next;
+    qcow2_handle_l2meta(bs, &l2meta, false);
+
+    qemu_co_mutex_unlock(&s->lock);
+
+    qemu_iovec_destroy(&hd_qiov);
+    qemu_vfree(cluster_data);
+    trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
 
-        if (l2meta->nb_clusters != 0) {
-            QLIST_REMOVE(l2meta, next_in_flight);
+    return ret;
+}
+
+static int coroutine_fn
+qcow2_co_copy_range_from(BlockDriverState *bs,
+                         BdrvChild *src, uint64_t src_offset,
+                         BdrvChild *dst, uint64_t dst_offset,
+                         uint64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    BdrvChild *child;
+    BdrvRequestFlags cur_flags;
+
+    assert(!bs->encrypted);
+    qemu_co_mutex_lock(&s->lock);
+
+    while (bytes != 0) {
+        uint64_t copy_offset = 0;
+        /* prepare next request */
+        cur_bytes = MIN(bytes, INT_MAX);
+        cur_flags = flags;
+        child = NULL;
+
+        ret = qcow2_get_cluster_offset(bs, src_offset, &cur_bytes,
+                                       &copy_offset);
+        if (ret < 0) {
+            goto out;
         }
-        qemu_co_queue_restart_all(&l2meta->dependent_requests);
 
-        next = l2meta->next;
-        g_free(l2meta);
-        l2meta = next;
+        switch (ret) {
+        case QCOW2_CLUSTER_UNALLOCATED:
+            if (bs->backing && bs->backing->bs) {
+                int64_t backing_length = bdrv_getlength(bs->backing->bs);
+                if (backing_length < 0) {
+                    ret = backing_length;
+                    goto out;
+                }
+                if (src_offset >= backing_length) {
+                    cur_flags |= BDRV_REQ_ZERO_WRITE;
+                } else {
+                    child = bs->backing;
+                    cur_bytes = MIN(cur_bytes, backing_length - src_offset);
+                    copy_offset = src_offset;
+                }
+            } else {
+                cur_flags |= BDRV_REQ_ZERO_WRITE;
+            }
+            break;
+
+        case QCOW2_CLUSTER_ZERO_PLAIN:
+        case QCOW2_CLUSTER_ZERO_ALLOC:
+            cur_flags |= BDRV_REQ_ZERO_WRITE;
+            break;
+
+        case QCOW2_CLUSTER_COMPRESSED:
+            ret = -ENOTSUP;
+            goto out;
+
+        case QCOW2_CLUSTER_NORMAL:
+            child = bs->file;
+            copy_offset += offset_into_cluster(s, src_offset);
+            if ((copy_offset & 511) != 0) {
+                ret = -EIO;
+                goto out;
+            }
+            break;
+
+        default:
+            abort();
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_from(child,
+                                      copy_offset,
+                                      dst, dst_offset,
+                                      cur_bytes, cur_flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto out;
+        }
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
     }
+    ret = 0;
 
+out:
     qemu_co_mutex_unlock(&s->lock);
+    return ret;
+}
 
-    qemu_iovec_destroy(&hd_qiov);
-    qemu_vfree(cluster_data);
-    trace_qcow2_writev_done_req(qemu_coroutine_self(), ret);
+static int coroutine_fn
+qcow2_co_copy_range_to(BlockDriverState *bs,
+                       BdrvChild *src, uint64_t src_offset,
+                       BdrvChild *dst, uint64_t dst_offset,
+                       uint64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVQcow2State *s = bs->opaque;
+    int offset_in_cluster;
+    int ret;
+    unsigned int cur_bytes; /* number of bytes in current iteration */
+    uint64_t cluster_offset;
+    QCowL2Meta *l2meta = NULL;
+
+    assert(!bs->encrypted);
+    s->cluster_cache_offset = -1; /* disable compressed cache */
+
+    qemu_co_mutex_lock(&s->lock);
+
+    while (bytes != 0) {
+
+        l2meta = NULL;
+
+        offset_in_cluster = offset_into_cluster(s, dst_offset);
+        cur_bytes = MIN(bytes, INT_MAX);
+
+        ret = qcow2_alloc_cluster_offset(bs, dst_offset, &cur_bytes,
+                                         &cluster_offset, &l2meta);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        assert((cluster_offset & 511) == 0);
+
+        ret = qcow2_pre_write_overlap_check(bs, 0,
+                cluster_offset + offset_in_cluster, cur_bytes);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        qemu_co_mutex_unlock(&s->lock);
+        ret = bdrv_co_copy_range_to(src, src_offset,
+                                    bs->file,
+                                    cluster_offset + offset_in_cluster,
+                                    cur_bytes, flags);
+        qemu_co_mutex_lock(&s->lock);
+        if (ret < 0) {
+            goto fail;
+        }
+
+        ret = qcow2_handle_l2meta(bs, &l2meta, true);
+        if (ret) {
+            goto fail;
+        }
+
+        bytes -= cur_bytes;
+        src_offset += cur_bytes;
+        dst_offset += cur_bytes;
+    }
+    ret = 0;
+
+fail:
+    qcow2_handle_l2meta(bs, &l2meta, false);
+
+    qemu_co_mutex_unlock(&s->lock);
 
     return ret;
 }
@@ -3665,6 +3845,87 @@ static coroutine_fn int qcow2_co_flush_to_os(BlockDriverState *bs)
     return 0;
 }
 
+/* Block status is queried in segments of this size (a multiple of any
+ * cluster size), each one handed to the next free coroutine */
+#define QCOW2_MEASURE_SEGMENT_SIZE (1 << 30)
+#define QCOW2_MEASURE_COROUTINES 8
+
+typedef struct Qcow2MeasureState {
+    BlockDriverState *in_bs;
+    int64_t ssize;
+    size_t cluster_size;
+    int64_t next_offset;
+    uint64_t required;
+    int running;
+    int ret;
+} Qcow2MeasureState;
+
+static void coroutine_fn qcow2_measure_co_entry(void *opaque)
+{
+    Qcow2MeasureState *m = opaque;
+    size_t cluster_size = m->cluster_size;
+
+    while (!m->ret && m->next_offset < m->ssize) {
+        int64_t offset = m->next_offset;
+        int64_t end = MIN(offset + QCOW2_MEASURE_SEGMENT_SIZE, m->ssize);
+        int64_t pnum = 0;
+
+        m->next_offset = end;
+        for (; offset < end; offset += pnum) {
+            int ret;
+
+            ret = bdrv_block_status_above(m->in_bs, NULL, offset,
+                                          end - offset, &pnum, NULL, NULL);
+            if (ret < 0) {
+                m->ret = ret;
+                break;
+            }
+
+            if (ret & BDRV_BLOCK_ZERO) {
+                /* Skip zero regions (safe with no backing file) */
+            } else if ((ret & (BDRV_BLOCK_DATA | BDRV_BLOCK_ALLOCATED)) ==
+                       (BDRV_BLOCK_DATA | BDRV_BLOCK_ALLOCATED)) {
+                /* Extend pnum to end of cluster for next iteration */
+                pnum = ROUND_UP(offset + pnum, cluster_size) - offset;
+
+                /* Count clusters we've seen */
+                m->required += offset % cluster_size + pnum;
+            }
+        }
+    }
+
+    m->running--;
+}
+
+/* Sums up the size of the clusters of @in_bs that hold data.  Segments never
+ * share a cluster, so they can be counted concurrently, which saves a lot of
+ * time on deep backing chains and remote images. */
+static int qcow2_measure_allocated(BlockDriverState *in_bs, int64_t ssize,
+                                   size_t cluster_size, uint64_t *required)
+{
+    Qcow2MeasureState m = {
+        .in_bs          = in_bs,
+        .ssize          = ssize,
+        .cluster_size   = cluster_size,
+    };
+    int i;
+
+    if (qemu_in_coroutine()) {
+        m.running = 1;
+        qcow2_measure_co_entry(&m);
+    } else {
+        for (i = 0; i < QCOW2_MEASURE_COROUTINES; i++) {
+            Coroutine *co = qemu_coroutine_create(qcow2_measure_co_entry, &m);
+            m.running++;
+            bdrv_coroutine_enter(in_bs, co);
+        }
+        BDRV_POLL_WHILE(in_bs, m.running > 0);
+    }
+
+    *required += m.required;
+    return m.ret;
+}
+
 static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
                                        Error **errp)
 {
@@ -3739,31 +4000,12 @@ static BlockMeasureInfo *qcow2_measure(QemuOpts *opts, BlockDriverState *in_bs,
              */
             required = virtual_size;
         } else {
-            int64_t offset;
-            int64_t pnum = 0;
-
-            for (offset = 0; offset < ssize; offset += pnum) {
-                int ret;
-
-                ret = bdrv_block_status_above(in_bs, NULL, offset,
-                                              ssize - offset, &pnum, NULL,
-                                              NULL);
-                if (ret < 0) {
-                    error_setg_errno(&local_err, -ret,
-                                     "Unable to get block status");
-                    goto err;
-                }
-
-                if (ret & BDRV_BLOCK_ZERO) {
-                    /* Skip zero regions (safe with no backing file) */
-                } else if ((ret & (BDRV_BLOCK_DATA | BDRV_BLOCK_ALLOCATED)) ==
-                           (BDRV_BLOCK_DATA | BDRV_BLOCK_ALLOCATED)) {
-                    /* Extend pnum to end of cluster for next iteration */
-                    pnum = ROUND_UP(offset + pnum, cluster_size) - offset;
-
-                    /* Count clusters we've seen */
-                    required += offset % cluster_size + pnum;
-                }
+            int ret = qcow2_measure_allocated(in_bs, ssize, cluster_size,
+                                              &required);
+            if (ret < 0) {
+                error_setg_errno(&local_err, -ret,
+                                 "Unable to get block status");
+                goto err;
             }
         }
     }
@@ -4363,6 +4605,8 @@ BlockDriver bdrv_qcow2 = {
 
     .bdrv_co_pwrite_zeroes  = qcow2_co_pwrite_zeroes,
     .bdrv_co_pdiscard       = qcow2_co_pdiscard,
+    .bdrv_co_copy_range_from = qcow2_co_copy_range_from,
+    .bdrv_co_copy_range_to  = qcow2_co_copy_range_to,
     .bdrv_truncate          = qcow2_truncate,
     .bdrv_co_pwritev_compressed = qcow2_co_pwritev_compressed,
     .bdrv_make_empty        = qcow2_make_empty,
@@ -4396,6 +4640,7 @@ BlockDriver bdrv_qcow2 = {
     .bdrv_reopen_bitmaps_rw = qcow2_reopen_bitmaps_rw,
     .bdrv_can_store_new_dirty_bitmap = qcow2_can_store_new_dirty_bitmap,
     .bdrv_remove_persistent_dirty_bitmap = qcow2_remove_persistent_dirty_bitmap,
+    .bdrv_load_persistent_dirty_bitmap = qcow2_load_persistent_dirty_bitmap,
 };
 
 static void bdrv_qcow2_init(void)
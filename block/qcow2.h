@@ -677,5 +677,8 @@ bool qcow2_can_store_new_dirty_bitmap(BlockDriverState *bs,
 void qcow2_remove_persistent_dirty_bitmap(BlockDriverState *bs,
                                           const char *name,
                                           Error **errp);
+BdrvDirtyBitmap *qcow2_load_persistent_dirty_bitmap(BlockDriverState *bs,
+                                                    const char *name,
+                                                    Error **errp);
 
 #endif
@@ -286,6 +286,49 @@ static int coroutine_fn raw_co_pdiscard(BlockDriverState *bs,
     return bdrv_co_pdiscard(bs->file->bs, offset, bytes);
 }
 
+static int coroutine_fn raw_co_copy_range_from(BlockDriverState *bs,
+                                               BdrvChild *src,
+                                               uint64_t src_offset,
+                                               BdrvChild *dst,
+                                               uint64_t dst_offset,
+                                               uint64_t bytes,
+                                               BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (src_offset > UINT64_MAX - s->offset) {
+        return -EINVAL;
+    }
+    return bdrv_co_copy_range_from(bs->file, src_offset + s->offset,
+                                   dst, dst_offset, bytes, flags);
+}
+
+static int coroutine_fn raw_co_copy_range_to(BlockDriverState *bs,
+                                             BdrvChild *src,
+                                             uint64_t src_offset,
+                                             BdrvChild *dst,
+                                             uint64_t dst_offset,
+                                             uint64_t bytes,
+                                             BdrvRequestFlags flags)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->has_size &&
+        (dst_offset > s->size || bytes > (s->size - dst_offset))) {
+        return -ENOSPC;
+    }
+    if (dst_offset > UINT64_MAX - s->offset) {
+        return -EINVAL;
+    }
+    if (bs->probed && dst_offset < BLOCK_PROBE_BUF_SIZE && bytes) {
+        /* The data never passes through us, so the first sector cannot be
+         * checked against format probing; let the caller use plain I/O. */
+        return -ENOTSUP;
+    }
+    return bdrv_co_copy_range_to(src, src_offset, bs->file,
+                                 dst_offset + s->offset, bytes, flags);
+}
+
 static int64_t raw_getlength(BlockDriverState *bs)
 {
     int64_t len;
@@ -342,6 +385,18 @@ static int raw_get_info(BlockDriverState *bs, BlockDriverInfo *bdi)
     return bdrv_get_info(bs->file->bs, bdi);
 }
 
+static int raw_get_host_fd(BlockDriverState *bs, int64_t *host_offset)
+{
+    BDRVRawState *s = bs->opaque;
+    int fd;
+
+    fd = bdrv_get_host_fd(bs->file->bs, host_offset);
+    if (fd >= 0) {
+        *host_offset += s->offset;
+    }
+    return fd;
+}
+
 static void raw_refresh_limits(BlockDriverState *bs, Error **errp)
 {
     if (bs->probed) {
@@ -496,12 +551,15 @@ BlockDriver bdrv_raw = {
     .bdrv_co_pwritev      = &raw_co_pwritev,
     .bdrv_co_pwrite_zeroes = &raw_co_pwrite_zeroes,
     .bdrv_co_pdiscard     = &raw_co_pdiscard,
+    .bdrv_co_copy_range_from = &raw_co_copy_range_from,
+    .bdrv_co_copy_range_to  = &raw_co_copy_range_to,
     .bdrv_co_get_block_status = &raw_co_get_block_status,
     .bdrv_truncate        = &raw_truncate,
     .bdrv_getlength       = &raw_getlength,
     .has_variable_length  = true,
     .bdrv_measure         = &raw_measure,
     .bdrv_get_info        = &raw_get_info,
+    .bdrv_get_host_fd     = &raw_get_host_fd,
     .bdrv_refresh_limits  = &raw_refresh_limits,
     .bdrv_probe_blocksizes = &raw_probe_blocksizes,
     .bdrv_probe_geometry  = &raw_probe_geometry,
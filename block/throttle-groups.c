@@ -60,6 +60,14 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp);
  * blk_set_aio_context()). Therefore in this file a thread will
  * access some other ThrottleGroupMember's timers only after verifying that
  * that ThrottleGroupMember has throttled requests in the queue.
+ *
+ * Groups can be nested (e.g. tenant > VM > disk).  A request must then
+ * satisfy the limits of its group and of all the groups above it, and
+ * sibling groups share their parent's limits in proportion to their
+ * weights.  A group that may borrow can exceed its own limits while its
+ * parent has capacity left.  All the groups in a tree are protected by
+ * the lock of the root group, and only one timer is armed for the whole
+ * tree at a time.
  */
 typedef struct ThrottleGroup {
     Object parent_obj;
@@ -67,12 +75,28 @@ typedef struct ThrottleGroup {
     /* refuse individual property change if initialization is complete */
     bool is_initialized;
     char *name; /* This is constant during the lifetime of the group */
+    char *parent_name;
+    struct ThrottleGroup *parent; /* Constant after initialization */
 
-    QemuMutex lock; /* This lock protects the following four fields */
+    QemuMutex lock; /* The root's lock protects the following fields */
     ThrottleState ts;
     QLIST_HEAD(, ThrottleGroupMember) head;
     ThrottleGroupMember *tokens[2];
-    bool any_timer_armed[2];
+    QLIST_HEAD(, ThrottleGroup) children;
+    QLIST_ENTRY(ThrottleGroup) sibling;
+    uint32_t weight;
+    bool borrow;
+    /* Number of throttled requests in this group and the groups below it */
+    unsigned pending_reqs[2];
+    /* Service received for the weight, and the start tag of the last
+     * request served in this group (start-time fair queueing) */
+    uint64_t vtime[2];
+    uint64_t vclock[2];
+    /* Same as vtime, for the direct members taken together */
+    uint64_t members_vtime[2];
+    /* Only used in the root: the member whose timer is armed, if any */
+    ThrottleGroupMember *armed[2];
+    int64_t armed_deadline[2];
     QEMUClockType clock_type;
 
     /* This field is protected by the global QEMU mutex */
@@ -84,6 +108,9 @@ static QTAILQ_HEAD(, ThrottleGroup) throttle_groups =
     QTAILQ_HEAD_INITIALIZER(throttle_groups);
 
 
+#define THROTTLE_GROUP_DEFAULT_WEIGHT 100
+#define THROTTLE_GROUP_MAX_WEIGHT     10000
+
 /* This function reads throttle_groups and must be called under the global
  * mutex.
  */
@@ -168,10 +195,27 @@ const char *throttle_group_get_name(ThrottleGroupMember *tgm)
     return tg->name;
 }
 
+/* Return the group at the top of the tree a ThrottleGroup belongs to. Its
+ * lock protects the whole tree.
+ */
+static ThrottleGroup *throttle_group_root(ThrottleGroup *tg)
+{
+    while (tg->parent) {
+        tg = tg->parent;
+    }
+    return tg;
+}
+
+static ThrottleGroup *tgm_root(ThrottleGroupMember *tgm)
+{
+    return throttle_group_root(container_of(tgm->throttle_state,
+                                            ThrottleGroup, ts));
+}
+
 /* Return the next ThrottleGroupMember in the round-robin sequence, simulating
  * a circular list.
  *
- * This assumes that tg->lock is held.
+ * This assumes that the root lock is held.
  *
  * @tgm: the current ThrottleGroupMember
  * @ret: the next ThrottleGroupMember in the sequence
@@ -192,7 +236,7 @@ static ThrottleGroupMember *throttle_group_next_tgm(ThrottleGroupMember *tgm)
 /*
  * Return whether a ThrottleGroupMember has pending requests.
  *
- * This assumes that tg->lock is held.
+ * This assumes that the root lock is held.
  *
  * @tgm:        the ThrottleGroupMember
  * @is_write:   the type of operation (read/write)
@@ -207,7 +251,7 @@ static inline bool tgm_has_pending_reqs(ThrottleGroupMember *tgm,
 /* Return the next ThrottleGroupMember in the round-robin sequence with pending
  * I/O requests.
  *
- * This assumes that tg->lock is held.
+ * This assumes that the root lock is held.
  *
  * @tgm:       the current ThrottleGroupMember
  * @is_write:  the type of operation (read/write)
@@ -243,42 +287,189 @@ static ThrottleGroupMember *next_throttle_token(ThrottleGroupMember *tgm,
     return token;
 }
 
+/* Update the number of throttled requests of a ThrottleGroupMember and of
+ * the groups above it.
+ *
+ * This assumes that the root lock is held.
+ */
+static void tgm_add_pending_reqs(ThrottleGroupMember *tgm, bool is_write,
+                                 int delta)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+
+    tgm->pending_reqs[is_write] += delta;
+    for (; tg; tg = tg->parent) {
+        tg->pending_reqs[is_write] += delta;
+    }
+}
+
+/* Return how long the next I/O request of a ThrottleGroupMember has to wait
+ * for the limits of its group and of the groups above it.
+ *
+ * This assumes that the root lock is held.
+ */
+static int64_t tgm_compute_wait(ThrottleGroupMember *tgm, bool is_write,
+                                int64_t now)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    int64_t wait = 0;
+
+    for (; tg; tg = tg->parent) {
+        int64_t own_wait = throttle_compute_wait_at(&tg->ts, is_write, now);
+
+        /* A group that borrows is only held back by its ancestors */
+        if (!(tg->borrow && tg->parent)) {
+            wait = MAX(wait, own_wait);
+        }
+    }
+
+    return wait;
+}
+
+/* A candidate for the next I/O request to run in a tree of groups */
+typedef struct ThrottleGroupPick {
+    ThrottleGroupMember *tgm;
+    int64_t wait;   /* how long it has to wait */
+    bool borrowing; /* whether it is over the limits of some group */
+    uint64_t vtime; /* service received by its branch, for the weights */
+} ThrottleGroupPick;
+
+/* Return whether candidate @a should run before candidate @b. Requests that
+ * can run right away go first, and among those the ones within their own
+ * limits. Ties go to the branch that has received the least service for
+ * its weight.
+ */
+static bool throttle_group_pick_before(ThrottleGroupPick *a,
+                                       ThrottleGroupPick *b)
+{
+    if ((a->wait == 0) != (b->wait == 0)) {
+        return a->wait == 0;
+    }
+    if (a->wait == 0 && a->borrowing != b->borrowing) {
+        return !a->borrowing;
+    }
+    if (a->wait != b->wait) {
+        return a->wait < b->wait;
+    }
+    return a->vtime < b->vtime;
+}
+
+/* Choose the I/O request that should run next among the ones throttled in
+ * a group and the groups below it. The direct members of the group take
+ * turns in round-robin fashion, and compete with the child groups as a
+ * single child with the default weight.
+ *
+ * This assumes that the root lock is held.
+ *
+ * @tg:        the group at the top of the subtree
+ * @is_write:  the type of operation (read/write)
+ * @now:       the current clock timestamp
+ * @best:      the chosen candidate is stored here
+ * @ret:       false if there are no throttled requests in the subtree
+ */
+static bool throttle_group_pick(ThrottleGroup *tg, bool is_write, int64_t now,
+                                ThrottleGroupPick *best)
+{
+    ThrottleGroup *child;
+    ThrottleGroupPick cand;
+    bool found = false;
+    int64_t own_wait;
+
+    if (!tg->pending_reqs[is_write]) {
+        return false;
+    }
+
+    if (tg->tokens[is_write]) {
+        ThrottleGroupMember *token = next_throttle_token(tg->tokens[is_write],
+                                                         is_write);
+        if (tgm_has_pending_reqs(token, is_write)) {
+            best->tgm = token;
+            best->wait = 0;
+            best->borrowing = false;
+            best->vtime = MAX(tg->members_vtime[is_write],
+                              tg->vclock[is_write]);
+            found = true;
+        }
+    }
+
+    QLIST_FOREACH(child, &tg->children, sibling) {
+        if (!throttle_group_pick(child, is_write, now, &cand)) {
+            continue;
+        }
+        cand.vtime = MAX(child->vtime[is_write], tg->vclock[is_write]);
+        if (!found || throttle_group_pick_before(&cand, best)) {
+            *best = cand;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return false;
+    }
+
+    own_wait = throttle_compute_wait_at(&tg->ts, is_write, now);
+    if (own_wait && tg->borrow && tg->parent) {
+        best->borrowing = true;
+    } else {
+        best->wait = MAX(best->wait, own_wait);
+    }
+    return true;
+}
+
+/* Arm the timer of the ThrottleGroupMember chosen to run next, unless the
+ * timer that is already armed in the tree fires first.
+ *
+ * This assumes that the root lock is held.
+ */
+static void throttle_group_arm_timer(ThrottleGroup *root,
+                                     ThrottleGroupPick *next,
+                                     bool is_write, int64_t now)
+{
+    ThrottleGroup *tg = container_of(next->tgm->throttle_state,
+                                     ThrottleGroup, ts);
+    ThrottleGroupMember *armed = root->armed[is_write];
+    int64_t deadline = now + next->wait;
+
+    if (armed) {
+        if (root->armed_deadline[is_write] <= deadline) {
+            return;
+        }
+        if (armed != next->tgm) {
+            timer_del(armed->throttle_timers.timers[is_write]);
+        }
+    }
+
+    timer_mod(next->tgm->throttle_timers.timers[is_write], deadline);
+    root->armed[is_write] = next->tgm;
+    root->armed_deadline[is_write] = deadline;
+    tg->tokens[is_write] = next->tgm;
+}
+
 /* Check if the next I/O request for a ThrottleGroupMember needs to be
- * throttled or not. If there's no timer set in this group, set one and update
- * the token accordingly.
+ * throttled or not.
  *
- * This assumes that tg->lock is held.
+ * This assumes that the root lock is held.
  *
  * @tgm:        the current ThrottleGroupMember
  * @is_write:   the type of operation (read/write)
+ * @now:        the current clock timestamp
  * @ret:        whether the I/O request needs to be throttled or not
  */
-static bool throttle_group_schedule_timer(ThrottleGroupMember *tgm,
-                                          bool is_write)
+static bool throttle_group_must_wait(ThrottleGroupMember *tgm, bool is_write,
+                                     int64_t now)
 {
-    ThrottleState *ts = tgm->throttle_state;
-    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    ThrottleTimers *tt = &tgm->throttle_timers;
-    bool must_wait;
+    ThrottleGroup *root = tgm_root(tgm);
 
     if (atomic_read(&tgm->io_limits_disabled)) {
         return false;
     }
 
-    /* Check if any of the timers in this group is already armed */
-    if (tg->any_timer_armed[is_write]) {
+    /* Another request is being woken up right now, it goes first */
+    if (root->armed[is_write] && root->armed_deadline[is_write] <= now) {
         return true;
     }
 
-    must_wait = throttle_schedule_timer(ts, tt, is_write);
-
-    /* If a timer just got armed, set tgm as the current token */
-    if (must_wait) {
-        tg->tokens[is_write] = tgm;
-        tg->any_timer_armed[is_write] = true;
-    }
-
-    return must_wait;
+    return tgm_compute_wait(tgm, is_write, now) > 0;
 }
 
 /* Start the next pending I/O request for a ThrottleGroupMember. Return whether
@@ -301,7 +492,7 @@ static bool coroutine_fn throttle_group_co_restart_queue(ThrottleGroupMember *tg
 
 /* Look for the next pending I/O request and schedule it.
  *
- * This assumes that tg->lock is held.
+ * This assumes that the root lock is held.
  *
  * @tgm:       the current ThrottleGroupMember
  * @is_write:  the type of operation (read/write)
@@ -310,37 +501,57 @@ static void schedule_next_request(ThrottleGroupMember *tgm, bool is_write)
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    bool must_wait;
-    ThrottleGroupMember *token;
+    ThrottleGroup *root = throttle_group_root(tg);
+    int64_t now = qemu_clock_get_ns(root->clock_type);
+    ThrottleGroupPick next;
 
     /* Check if there's any pending request to schedule next */
-    token = next_throttle_token(tgm, is_write);
-    if (!tgm_has_pending_reqs(token, is_write)) {
+    if (!throttle_group_pick(root, is_write, now, &next)) {
+        return;
+    }
+
+    /* If it doesn't have to wait, give preference to requests from the
+     * current tgm */
+    if (!next.wait && !root->armed[is_write] && qemu_in_coroutine() &&
+        next.tgm->throttle_state == ts &&
+        throttle_group_co_restart_queue(tgm, is_write)) {
+        tg->tokens[is_write] = tgm;
         return;
     }
 
-    /* Set a timer for the request if it needs to be throttled */
-    must_wait = throttle_group_schedule_timer(token, is_write);
-
-    /* If it doesn't have to wait, queue it for immediate execution */
-    if (!must_wait) {
-        /* Give preference to requests from the current tgm */
-        if (qemu_in_coroutine() &&
-            throttle_group_co_restart_queue(tgm, is_write)) {
-            token = tgm;
-        } else {
-            ThrottleTimers *tt = &token->throttle_timers;
-            int64_t now = qemu_clock_get_ns(tg->clock_type);
-            timer_mod(tt->timers[is_write], now);
-            tg->any_timer_armed[is_write] = true;
+    /* Otherwise set a timer for it, which may be immediate */
+    throttle_group_arm_timer(root, &next, is_write, now);
+}
+
+/* Charge an I/O request to the groups of a ThrottleGroupMember, both to
+ * their limits and to their share of their parents.
+ *
+ * This assumes that the root lock is held.
+ */
+static void throttle_group_account(ThrottleGroupMember *tgm, bool is_write,
+                                   unsigned int bytes)
+{
+    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    uint64_t start;
+
+    start = MAX(tg->members_vtime[is_write], tg->vclock[is_write]);
+    tg->members_vtime[is_write] = start + bytes;
+    tg->vclock[is_write] = start;
+
+    for (; tg; tg = tg->parent) {
+        throttle_account(&tg->ts, is_write, bytes);
+
+        if (tg->parent) {
+            start = MAX(tg->vtime[is_write], tg->parent->vclock[is_write]);
+            tg->vtime[is_write] = start + (uint64_t) bytes *
+                THROTTLE_GROUP_DEFAULT_WEIGHT / tg->weight;
+            tg->parent->vclock[is_write] = start;
         }
-        tg->tokens[is_write] = token;
     }
 }
 
 /* Check if an I/O request needs to be throttled, wait and set a timer
- * if necessary, and schedule the next request using a round robin
- * algorithm.
+ * if necessary, and schedule the next request.
  *
  * @tgm:       the current ThrottleGroupMember
  * @bytes:     the number of bytes for this I/O
@@ -351,33 +562,42 @@ void coroutine_fn throttle_group_co_io_limits_intercept(ThrottleGroupMember *tgm
                                                         bool is_write)
 {
     bool must_wait;
-    ThrottleGroupMember *token;
-    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
-    qemu_mutex_lock(&tg->lock);
+    ThrottleGroup *root = tgm_root(tgm);
+    int64_t now;
+
+    qemu_mutex_lock(&root->lock);
 
     /* First we check if this I/O has to be throttled. */
-    token = next_throttle_token(tgm, is_write);
-    must_wait = throttle_group_schedule_timer(token, is_write);
+    now = qemu_clock_get_ns(root->clock_type);
+    must_wait = throttle_group_must_wait(tgm, is_write, now);
 
     /* Wait if there's a timer set or queued requests of this type */
     if (must_wait || tgm->pending_reqs[is_write]) {
-        tgm->pending_reqs[is_write]++;
-        qemu_mutex_unlock(&tg->lock);
+        ThrottleGroupPick next;
+
+        tgm_add_pending_reqs(tgm, is_write, 1);
+
+        /* Make sure that a timer is armed for whoever goes next */
+        if (throttle_group_pick(root, is_write, now, &next)) {
+            throttle_group_arm_timer(root, &next, is_write, now);
+        }
+
+        qemu_mutex_unlock(&root->lock);
         qemu_co_mutex_lock(&tgm->throttled_reqs_lock);
         qemu_co_queue_wait(&tgm->throttled_reqs[is_write],
                            &tgm->throttled_reqs_lock);
         qemu_co_mutex_unlock(&tgm->throttled_reqs_lock);
-        qemu_mutex_lock(&tg->lock);
-        tgm->pending_reqs[is_write]--;
+        qemu_mutex_lock(&root->lock);
+        tgm_add_pending_reqs(tgm, is_write, -1);
     }
 
     /* The I/O will be executed, so do the accounting */
-    throttle_account(tgm->throttle_state, is_write, bytes);
+    throttle_group_account(tgm, is_write, bytes);
 
     /* Schedule the next request */
     schedule_next_request(tgm, is_write);
 
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 }
 
 typedef struct {
@@ -389,8 +609,7 @@ static void coroutine_fn throttle_group_restart_queue_entry(void *opaque)
 {
     RestartData *data = opaque;
     ThrottleGroupMember *tgm = data->tgm;
-    ThrottleState *ts = tgm->throttle_state;
-    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroup *root = tgm_root(tgm);
     bool is_write = data->is_write;
     bool empty_queue;
 
@@ -399,9 +618,9 @@ static void coroutine_fn throttle_group_restart_queue_entry(void *opaque)
     /* If the request queue was empty then we have to take care of
      * scheduling the next one */
     if (empty_queue) {
-        qemu_mutex_lock(&tg->lock);
+        qemu_mutex_lock(&root->lock);
         schedule_next_request(tgm, is_write);
-        qemu_mutex_unlock(&tg->lock);
+        qemu_mutex_unlock(&root->lock);
     }
 
     g_free(data);
@@ -438,9 +657,10 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    qemu_mutex_lock(&tg->lock);
+    ThrottleGroup *root = throttle_group_root(tg);
+    qemu_mutex_lock(&root->lock);
     throttle_config(ts, tg->clock_type, cfg);
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 
     throttle_group_restart_tgm(tgm);
 }
@@ -455,10 +675,10 @@ void throttle_group_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
 void throttle_group_get_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
 {
     ThrottleState *ts = tgm->throttle_state;
-    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
-    qemu_mutex_lock(&tg->lock);
+    ThrottleGroup *root = tgm_root(tgm);
+    qemu_mutex_lock(&root->lock);
     throttle_get_config(ts, cfg);
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 }
 
 /* ThrottleTimers callback. This wakes up a request that was waiting
@@ -469,13 +689,21 @@ void throttle_group_get_config(ThrottleGroupMember *tgm, ThrottleConfig *cfg)
  */
 static void timer_cb(ThrottleGroupMember *tgm, bool is_write)
 {
-    ThrottleState *ts = tgm->throttle_state;
-    ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroup *root = tgm_root(tgm);
+    bool superseded;
+
+    /* The timer has just been fired, so we can update the flag. If another
+     * member's timer was armed in the meantime, that one runs instead. */
+    qemu_mutex_lock(&root->lock);
+    superseded = root->armed[is_write] != tgm;
+    if (!superseded) {
+        root->armed[is_write] = NULL;
+    }
+    qemu_mutex_unlock(&root->lock);
 
-    /* The timer has just been fired, so we can update the flag */
-    qemu_mutex_lock(&tg->lock);
-    tg->any_timer_armed[is_write] = false;
-    qemu_mutex_unlock(&tg->lock);
+    if (superseded) {
+        return;
+    }
 
     /* Run the request that was waiting for this timer */
     throttle_group_restart_queue(tgm, is_write);
@@ -509,11 +737,12 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     int i;
     ThrottleState *ts = throttle_group_incref(groupname);
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroup *root = throttle_group_root(tg);
 
     tgm->throttle_state = ts;
     tgm->aio_context = ctx;
 
-    qemu_mutex_lock(&tg->lock);
+    qemu_mutex_lock(&root->lock);
     /* If the ThrottleGroup is new set this ThrottleGroupMember as the token */
     for (i = 0; i < 2; i++) {
         if (!tg->tokens[i]) {
@@ -533,7 +762,7 @@ void throttle_group_register_tgm(ThrottleGroupMember *tgm,
     qemu_co_queue_init(&tgm->throttled_reqs[0]);
     qemu_co_queue_init(&tgm->throttled_reqs[1]);
 
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 }
 
 /* Unregister a ThrottleGroupMember from its group, removing it from the list,
@@ -550,6 +779,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
 {
     ThrottleState *ts = tgm->throttle_state;
     ThrottleGroup *tg = container_of(ts, ThrottleGroup, ts);
+    ThrottleGroup *root;
     ThrottleGroupMember *token;
     int i;
 
@@ -562,7 +792,15 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
     assert(qemu_co_queue_empty(&tgm->throttled_reqs[0]));
     assert(qemu_co_queue_empty(&tgm->throttled_reqs[1]));
 
-    qemu_mutex_lock(&tg->lock);
+    root = throttle_group_root(tg);
+    qemu_mutex_lock(&root->lock);
+    for (i = 0; i < 2; i++) {
+        /* Hand over the timer to the other members of the tree */
+        if (root->armed[i] == tgm) {
+            root->armed[i] = NULL;
+            schedule_next_request(tgm, i);
+        }
+    }
     for (i = 0; i < 2; i++) {
         if (tg->tokens[i] == tgm) {
             token = throttle_group_next_tgm(tgm);
@@ -577,7 +815,7 @@ void throttle_group_unregister_tgm(ThrottleGroupMember *tgm)
     /* remove the current tgm from the list */
     QLIST_REMOVE(tgm, round_robin);
     throttle_timers_destroy(&tgm->throttle_timers);
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 
     throttle_group_unref(&tg->ts);
     tgm->throttle_state = NULL;
@@ -593,7 +831,7 @@ void throttle_group_attach_aio_context(ThrottleGroupMember *tgm,
 
 void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
 {
-    ThrottleGroup *tg = container_of(tgm->throttle_state, ThrottleGroup, ts);
+    ThrottleGroup *root = tgm_root(tgm);
     ThrottleTimers *tt = &tgm->throttle_timers;
     int i;
 
@@ -603,14 +841,15 @@ void throttle_group_detach_aio_context(ThrottleGroupMember *tgm)
     assert(qemu_co_queue_empty(&tgm->throttled_reqs[1]));
 
     /* Kick off next ThrottleGroupMember, if necessary */
-    qemu_mutex_lock(&tg->lock);
+    qemu_mutex_lock(&root->lock);
     for (i = 0; i < 2; i++) {
-        if (timer_pending(tt->timers[i])) {
-            tg->any_timer_armed[i] = false;
+        if (root->armed[i] == tgm) {
+            timer_del(tt->timers[i]);
+            root->armed[i] = NULL;
             schedule_next_request(tgm, i);
         }
     }
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 
     throttle_timers_detach_aio_context(tt);
     tgm->aio_context = NULL;
@@ -722,9 +961,11 @@ static void throttle_group_obj_init(Object *obj)
         tg->clock_type = QEMU_CLOCK_VIRTUAL;
     }
     tg->is_initialized = false;
+    tg->weight = THROTTLE_GROUP_DEFAULT_WEIGHT;
     qemu_mutex_init(&tg->lock);
     throttle_init(&tg->ts);
     QLIST_INIT(&tg->head);
+    QLIST_INIT(&tg->children);
 }
 
 /* This function edits throttle_groups and must be called under the global
@@ -752,6 +993,25 @@ static void throttle_group_obj_complete(UserCreatable *obj, Error **errp)
     if (!throttle_is_valid(&cfg, errp)) {
         return;
     }
+
+    if (tg->parent_name) {
+        ThrottleGroup *parent = throttle_group_by_name(tg->parent_name);
+        ThrottleGroup *root;
+
+        if (!parent) {
+            error_setg(errp, "Throttle group '%s' not found", tg->parent_name);
+            return;
+        }
+
+        /* The parent cannot go away while it has children */
+        object_ref(OBJECT(parent));
+        tg->parent = parent;
+        root = throttle_group_root(parent);
+        qemu_mutex_lock(&root->lock);
+        QLIST_INSERT_HEAD(&parent->children, tg, sibling);
+        qemu_mutex_unlock(&root->lock);
+    }
+
     throttle_config(&tg->ts, tg->clock_type, &cfg);
     QTAILQ_INSERT_TAIL(&throttle_groups, tg, list);
     tg->is_initialized = true;
@@ -765,7 +1025,17 @@ static void throttle_group_obj_finalize(Object *obj)
     if (tg->is_initialized) {
         QTAILQ_REMOVE(&throttle_groups, tg, list);
     }
+    assert(QLIST_EMPTY(&tg->children));
+    if (tg->parent) {
+        ThrottleGroup *root = throttle_group_root(tg->parent);
+
+        qemu_mutex_lock(&root->lock);
+        QLIST_REMOVE(tg, sibling);
+        qemu_mutex_unlock(&root->lock);
+        object_unref(OBJECT(tg->parent));
+    }
     qemu_mutex_destroy(&tg->lock);
+    g_free(tg->parent_name);
     g_free(tg->name);
 }
 
@@ -857,6 +1127,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
 
 {
     ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroup *root = throttle_group_root(tg);
     ThrottleConfig cfg;
     ThrottleLimits arg = { 0 };
     ThrottleLimits *argp = &arg;
@@ -866,7 +1137,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
     if (local_err) {
         goto ret;
     }
-    qemu_mutex_lock(&tg->lock);
+    qemu_mutex_lock(&root->lock);
     throttle_get_config(&tg->ts, &cfg);
     throttle_limits_to_config(argp, &cfg, &local_err);
     if (local_err) {
@@ -875,7 +1146,7 @@ static void throttle_group_set_limits(Object *obj, Visitor *v,
     throttle_config(&tg->ts, tg->clock_type, &cfg);
 
 unlock:
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 ret:
     error_propagate(errp, local_err);
     return;
@@ -886,19 +1157,95 @@ static void throttle_group_get_limits(Object *obj, Visitor *v,
                                       Error **errp)
 {
     ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroup *root = throttle_group_root(tg);
     ThrottleConfig cfg;
     ThrottleLimits arg = { 0 };
     ThrottleLimits *argp = &arg;
 
-    qemu_mutex_lock(&tg->lock);
+    qemu_mutex_lock(&root->lock);
     throttle_get_config(&tg->ts, &cfg);
-    qemu_mutex_unlock(&tg->lock);
+    qemu_mutex_unlock(&root->lock);
 
     throttle_config_to_limits(&cfg, argp);
 
     visit_type_ThrottleLimits(v, name, &argp, errp);
 }
 
+static char *throttle_group_get_parent(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    return g_strdup(tg->parent_name ?: "");
+}
+
+static void throttle_group_set_parent(Object *obj, const char *value,
+                                      Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    /* The tree is shared by the members of the group, so it is fixed once
+     * the group is in use */
+    if (tg->is_initialized) {
+        error_setg(errp, "Property cannot be set after initialization");
+        return;
+    }
+
+    g_free(tg->parent_name);
+    tg->parent_name = *value ? g_strdup(value) : NULL;
+}
+
+static void throttle_group_get_weight(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    uint32_t value = tg->weight;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void throttle_group_set_weight(Object *obj, Visitor *v,
+                                      const char *name, void *opaque,
+                                      Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroup *root = throttle_group_root(tg);
+    Error *local_err = NULL;
+    uint32_t value;
+
+    visit_type_uint32(v, name, &value, &local_err);
+    if (local_err) {
+        error_propagate(errp, local_err);
+        return;
+    }
+    if (value < 1 || value > THROTTLE_GROUP_MAX_WEIGHT) {
+        error_setg(errp, "%s value must be in the range [1, %u]", name,
+                   THROTTLE_GROUP_MAX_WEIGHT);
+        return;
+    }
+
+    qemu_mutex_lock(&root->lock);
+    tg->weight = value;
+    qemu_mutex_unlock(&root->lock);
+}
+
+static bool throttle_group_get_borrow(Object *obj, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+
+    return tg->borrow;
+}
+
+static void throttle_group_set_borrow(Object *obj, bool value, Error **errp)
+{
+    ThrottleGroup *tg = THROTTLE_GROUP(obj);
+    ThrottleGroup *root = throttle_group_root(tg);
+
+    qemu_mutex_lock(&root->lock);
+    tg->borrow = value;
+    qemu_mutex_unlock(&root->lock);
+}
+
 static bool throttle_group_can_be_deleted(UserCreatable *uc)
 {
     return OBJECT(uc)->ref == 1;
@@ -930,6 +1277,22 @@ static void throttle_group_obj_class_init(ObjectClass *klass, void *class_data)
                               throttle_group_set_limits,
                               NULL, NULL,
                               &error_abort);
+
+    /* Nesting and sharing of the parent's limits */
+    object_class_property_add_str(klass, "parent",
+                                  throttle_group_get_parent,
+                                  throttle_group_set_parent,
+                                  &error_abort);
+    object_class_property_add(klass,
+                              "weight", "uint32",
+                              throttle_group_get_weight,
+                              throttle_group_set_weight,
+                              NULL, NULL,
+                              &error_abort);
+    object_class_property_add_bool(klass, "borrow",
+                                   throttle_group_get_borrow,
+                                   throttle_group_set_borrow,
+                                   &error_abort);
 }
 
 static const TypeInfo throttle_group_info = {
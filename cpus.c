@@ -46,6 +46,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/bitmap.h"
 #include "qemu/seqlock.h"
+#include "qemu/histogram.h"
 #include "tcg.h"
 #include "qapi-event.h"
 #include "hw/nmi.h"
@@ -1257,7 +1258,9 @@ static void process_icount_data(CPUState *cpu)
 
 static int tcg_cpu_exec(CPUState *cpu)
 {
+    static QHistogram *exec_histogram;
     int ret;
+    int64_t start;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
@@ -1266,9 +1269,15 @@ static int tcg_cpu_exec(CPUState *cpu)
     ti = profile_getclock();
 #endif
     qemu_mutex_unlock_iothread();
+    start = qemu_histogram_start();
     cpu_exec_start(cpu);
     ret = cpu_exec(cpu);
     cpu_exec_end(cpu);
+    if (start) {
+        qemu_histogram_record(qemu_histogram_get_cached(&exec_histogram,
+                                                        "tcg-exec"),
+                              start);
+    }
     qemu_mutex_lock_iothread();
 #ifdef CONFIG_PROFILER
     tcg_time += profile_getclock() - ti;
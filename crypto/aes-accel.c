@@ -0,0 +1,486 @@
+/*
+ * QEMU Crypto AES using host CPU instructions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "qemu/cpuinfo.h"
+#include "crypto/cipher.h"
+#include "aesaccelpriv.h"
+
+/*
+ * Number of independent blocks that are kept in flight by the
+ * parallelizable modes (ECB, CBC decryption and XTS).  This is
+ * enough to hide the latency of the AES round instructions on
+ * current CPUs.
+ */
+#define AES_ACCEL_LANES 8
+
+void qcrypto_aes_accel_key_init(QCryptoAESAccelKey *dst, const AES_KEY *src)
+{
+    int i;
+
+    /* aes.c keeps the round keys as big endian words */
+    for (i = 0; i < 4 * (src->rounds + 1); i++) {
+        stl_be_p(&dst->rk[i / 4][(i % 4) * 4], src->rd_key[i]);
+    }
+    dst->rounds = src->rounds;
+}
+
+#ifdef CONFIG_AESNI_OPT
+#pragma GCC push_options
+#pragma GCC target("aes,sse2")
+#include <emmintrin.h>
+#include <wmmintrin.h>
+
+typedef void AESNICrypt8Func(const QCryptoAESAccelKey *key, __m128i *b);
+
+static inline __m128i aesni_load(const uint8_t *p)
+{
+    return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void aesni_store(uint8_t *p, __m128i v)
+{
+    _mm_storeu_si128((__m128i *)p, v);
+}
+
+/* Multiply the XTS tweak by x in GF(2^128) */
+static inline __m128i aesni_xts_mul_x(__m128i t)
+{
+    const __m128i poly = _mm_set_epi32(0, 1, 0, 0x87);
+    __m128i carry = _mm_srai_epi32(_mm_shuffle_epi32(t, 0x13), 31);
+
+    return _mm_xor_si128(_mm_add_epi64(t, t), _mm_and_si128(carry, poly));
+}
+
+static inline __m128i aesni_encrypt1(const QCryptoAESAccelKey *key,
+                                     __m128i b)
+{
+    int i;
+
+    b = _mm_xor_si128(b, aesni_load(key->rk[0]));
+    for (i = 1; i < key->rounds; i++) {
+        b = _mm_aesenc_si128(b, aesni_load(key->rk[i]));
+    }
+    return _mm_aesenclast_si128(b, aesni_load(key->rk[key->rounds]));
+}
+
+static inline __m128i aesni_decrypt1(const QCryptoAESAccelKey *key,
+                                     __m128i b)
+{
+    int i;
+
+    b = _mm_xor_si128(b, aesni_load(key->rk[0]));
+    for (i = 1; i < key->rounds; i++) {
+        b = _mm_aesdec_si128(b, aesni_load(key->rk[i]));
+    }
+    return _mm_aesdeclast_si128(b, aesni_load(key->rk[key->rounds]));
+}
+
+static inline void aesni_encrypt8(const QCryptoAESAccelKey *key, __m128i *b)
+{
+    __m128i k = aesni_load(key->rk[0]);
+    int i, j;
+
+    for (j = 0; j < AES_ACCEL_LANES; j++) {
+        b[j] = _mm_xor_si128(b[j], k);
+    }
+    for (i = 1; i < key->rounds; i++) {
+        k = aesni_load(key->rk[i]);
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            b[j] = _mm_aesenc_si128(b[j], k);
+        }
+    }
+    k = aesni_load(key->rk[key->rounds]);
+    for (j = 0; j < AES_ACCEL_LANES; j++) {
+        b[j] = _mm_aesenclast_si128(b[j], k);
+    }
+}
+
+static inline void aesni_decrypt8(const QCryptoAESAccelKey *key, __m128i *b)
+{
+    __m128i k = aesni_load(key->rk[0]);
+    int i, j;
+
+    for (j = 0; j < AES_ACCEL_LANES; j++) {
+        b[j] = _mm_xor_si128(b[j], k);
+    }
+    for (i = 1; i < key->rounds; i++) {
+        k = aesni_load(key->rk[i]);
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            b[j] = _mm_aesdec_si128(b[j], k);
+        }
+    }
+    k = aesni_load(key->rk[key->rounds]);
+    for (j = 0; j < AES_ACCEL_LANES; j++) {
+        b[j] = _mm_aesdeclast_si128(b[j], k);
+    }
+}
+
+/*
+ * The mode templates below are shared by the AES-NI and VAES
+ * implementations, which only differ in how they process a group
+ * of AES_ACCEL_LANES blocks.  They are always inlined so that
+ * @crypt8 becomes a direct call that can be inlined as well.
+ */
+static inline __attribute__((always_inline)) void
+aesni_ecb_tmpl(const QCryptoAESAccelKey *key, const uint8_t *in,
+               uint8_t *out, size_t nblocks, bool enc,
+               AESNICrypt8Func *crypt8)
+{
+    __m128i b[AES_ACCEL_LANES];
+    int j;
+
+    for (; nblocks >= AES_ACCEL_LANES; nblocks -= AES_ACCEL_LANES) {
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            b[j] = aesni_load(in + j * AES_BLOCK_SIZE);
+        }
+        crypt8(key, b);
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            aesni_store(out + j * AES_BLOCK_SIZE, b[j]);
+        }
+        in += AES_ACCEL_LANES * AES_BLOCK_SIZE;
+        out += AES_ACCEL_LANES * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b[0] = aesni_load(in);
+        b[0] = enc ? aesni_encrypt1(key, b[0]) : aesni_decrypt1(key, b[0]);
+        aesni_store(out, b[0]);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+}
+
+static inline __attribute__((always_inline)) void
+aesni_cbc_decrypt_tmpl(const QCryptoAESAccelKey *key, uint8_t *ivp,
+                       const uint8_t *in, uint8_t *out, size_t nblocks,
+                       AESNICrypt8Func *decrypt8)
+{
+    __m128i iv = aesni_load(ivp);
+    __m128i b[AES_ACCEL_LANES], c[AES_ACCEL_LANES];
+    int j;
+
+    for (; nblocks >= AES_ACCEL_LANES; nblocks -= AES_ACCEL_LANES) {
+        /* Load all of the cipher text first, @in may be equal to @out */
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            b[j] = c[j] = aesni_load(in + j * AES_BLOCK_SIZE);
+        }
+        decrypt8(key, b);
+        aesni_store(out, _mm_xor_si128(b[0], iv));
+        for (j = 1; j < AES_ACCEL_LANES; j++) {
+            aesni_store(out + j * AES_BLOCK_SIZE,
+                        _mm_xor_si128(b[j], c[j - 1]));
+        }
+        iv = c[AES_ACCEL_LANES - 1];
+        in += AES_ACCEL_LANES * AES_BLOCK_SIZE;
+        out += AES_ACCEL_LANES * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        c[0] = aesni_load(in);
+        aesni_store(out, _mm_xor_si128(aesni_decrypt1(key, c[0]), iv));
+        iv = c[0];
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+
+    aesni_store(ivp, iv);
+}
+
+static inline __attribute__((always_inline)) void
+aesni_xts_tmpl(const QCryptoAESAccelKey *key, uint8_t *tweak,
+               const uint8_t *in, uint8_t *out, size_t nblocks, bool enc,
+               AESNICrypt8Func *crypt8)
+{
+    __m128i t = aesni_load(tweak);
+    __m128i b[AES_ACCEL_LANES], tw[AES_ACCEL_LANES];
+    int j;
+
+    for (; nblocks >= AES_ACCEL_LANES; nblocks -= AES_ACCEL_LANES) {
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            tw[j] = t;
+            b[j] = _mm_xor_si128(aesni_load(in + j * AES_BLOCK_SIZE), t);
+            t = aesni_xts_mul_x(t);
+        }
+        crypt8(key, b);
+        for (j = 0; j < AES_ACCEL_LANES; j++) {
+            aesni_store(out + j * AES_BLOCK_SIZE, _mm_xor_si128(b[j], tw[j]));
+        }
+        in += AES_ACCEL_LANES * AES_BLOCK_SIZE;
+        out += AES_ACCEL_LANES * AES_BLOCK_SIZE;
+    }
+
+    for (; nblocks; nblocks--) {
+        b[0] = _mm_xor_si128(aesni_load(in), t);
+        b[0] = enc ? aesni_encrypt1(key, b[0]) : aesni_decrypt1(key, b[0]);
+        aesni_store(out, _mm_xor_si128(b[0], t));
+        t = aesni_xts_mul_x(t);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+
+    aesni_store(tweak, t);
+}
+
+static void aesni_ecb_encrypt(const QCryptoAESAccelKey *key,
+                              const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_ecb_tmpl(key, in, out, nblocks, true, aesni_encrypt8);
+}
+
+static void aesni_ecb_decrypt(const QCryptoAESAccelKey *key,
+                              const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_ecb_tmpl(key, in, out, nblocks, false, aesni_decrypt8);
+}
+
+/* CBC encryption is inherently serial, so there is no 8-way variant */
+static void aesni_cbc_encrypt(const QCryptoAESAccelKey *key, uint8_t *ivp,
+                              const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    __m128i iv = aesni_load(ivp);
+
+    for (; nblocks; nblocks--) {
+        iv = aesni_encrypt1(key, _mm_xor_si128(aesni_load(in), iv));
+        aesni_store(out, iv);
+        in += AES_BLOCK_SIZE;
+        out += AES_BLOCK_SIZE;
+    }
+
+    aesni_store(ivp, iv);
+}
+
+static void aesni_cbc_decrypt(const QCryptoAESAccelKey *key, uint8_t *ivp,
+                              const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_cbc_decrypt_tmpl(key, ivp, in, out, nblocks, aesni_decrypt8);
+}
+
+static void aesni_xts_encrypt(const QCryptoAESAccelKey *key, uint8_t *tweak,
+                              const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_xts_tmpl(key, tweak, in, out, nblocks, true, aesni_encrypt8);
+}
+
+static void aesni_xts_decrypt(const QCryptoAESAccelKey *key, uint8_t *tweak,
+                              const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_xts_tmpl(key, tweak, in, out, nblocks, false, aesni_decrypt8);
+}
+
+static const QCryptoAESAccel qcrypto_aes_accel_aesni = {
+    .name = "aesni",
+    .ecb_encrypt = aesni_ecb_encrypt,
+    .ecb_decrypt = aesni_ecb_decrypt,
+    .cbc_encrypt = aesni_cbc_encrypt,
+    .cbc_decrypt = aesni_cbc_decrypt,
+    .xts_encrypt = aesni_xts_encrypt,
+    .xts_decrypt = aesni_xts_decrypt,
+};
+#pragma GCC pop_options
+
+#ifdef CONFIG_VAES_OPT
+#pragma GCC push_options
+#pragma GCC target("aes,vaes,avx2")
+#include <immintrin.h>
+
+/*
+ * VAES runs the AES rounds on two blocks per 256-bit register, so
+ * a group of AES_ACCEL_LANES blocks takes half the instructions.
+ */
+static inline void vaes_pack(__m256i *v, const __m128i *b)
+{
+    int j;
+
+    for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+        v[j] = _mm256_inserti128_si256(_mm256_castsi128_si256(b[2 * j]),
+                                       b[2 * j + 1], 1);
+    }
+}
+
+static inline void vaes_unpack(__m128i *b, const __m256i *v)
+{
+    int j;
+
+    for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+        b[2 * j] = _mm256_castsi256_si128(v[j]);
+        b[2 * j + 1] = _mm256_extracti128_si256(v[j], 1);
+    }
+}
+
+static inline __m256i vaes_round_key(const QCryptoAESAccelKey *key, int i)
+{
+    return _mm256_broadcastsi128_si256(aesni_load(key->rk[i]));
+}
+
+static inline void vaes_encrypt8(const QCryptoAESAccelKey *key, __m128i *b)
+{
+    __m256i v[AES_ACCEL_LANES / 2], k;
+    int i, j;
+
+    vaes_pack(v, b);
+    k = vaes_round_key(key, 0);
+    for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+        v[j] = _mm256_xor_si256(v[j], k);
+    }
+    for (i = 1; i < key->rounds; i++) {
+        k = vaes_round_key(key, i);
+        for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+            v[j] = _mm256_aesenc_epi128(v[j], k);
+        }
+    }
+    k = vaes_round_key(key, key->rounds);
+    for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+        v[j] = _mm256_aesenclast_epi128(v[j], k);
+    }
+    vaes_unpack(b, v);
+}
+
+static inline void vaes_decrypt8(const QCryptoAESAccelKey *key, __m128i *b)
+{
+    __m256i v[AES_ACCEL_LANES / 2], k;
+    int i, j;
+
+    vaes_pack(v, b);
+    k = vaes_round_key(key, 0);
+    for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+        v[j] = _mm256_xor_si256(v[j], k);
+    }
+    for (i = 1; i < key->rounds; i++) {
+        k = vaes_round_key(key, i);
+        for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+            v[j] = _mm256_aesdec_epi128(v[j], k);
+        }
+    }
+    k = vaes_round_key(key, key->rounds);
+    for (j = 0; j < AES_ACCEL_LANES / 2; j++) {
+        v[j] = _mm256_aesdeclast_epi128(v[j], k);
+    }
+    vaes_unpack(b, v);
+}
+
+static void vaes_ecb_encrypt(const QCryptoAESAccelKey *key,
+                             const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_ecb_tmpl(key, in, out, nblocks, true, vaes_encrypt8);
+}
+
+static void vaes_ecb_decrypt(const QCryptoAESAccelKey *key,
+                             const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_ecb_tmpl(key, in, out, nblocks, false, vaes_decrypt8);
+}
+
+static void vaes_cbc_decrypt(const QCryptoAESAccelKey *key, uint8_t *ivp,
+                             const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_cbc_decrypt_tmpl(key, ivp, in, out, nblocks, vaes_decrypt8);
+}
+
+static void vaes_xts_encrypt(const QCryptoAESAccelKey *key, uint8_t *tweak,
+                             const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_xts_tmpl(key, tweak, in, out, nblocks, true, vaes_encrypt8);
+}
+
+static void vaes_xts_decrypt(const QCryptoAESAccelKey *key, uint8_t *tweak,
+                             const uint8_t *in, uint8_t *out, size_t nblocks)
+{
+    aesni_xts_tmpl(key, tweak, in, out, nblocks, false, vaes_decrypt8);
+}
+
+static const QCryptoAESAccel qcrypto_aes_accel_vaes = {
+    .name = "vaes",
+    .ecb_encrypt = vaes_ecb_encrypt,
+    .ecb_decrypt = vaes_ecb_decrypt,
+    .cbc_encrypt = aesni_cbc_encrypt,
+    .cbc_decrypt = vaes_cbc_decrypt,
+    .xts_encrypt = vaes_xts_encrypt,
+    .xts_decrypt = vaes_xts_decrypt,
+};
+#pragma GCC pop_options
+#endif /* CONFIG_VAES_OPT */
+#endif /* CONFIG_AESNI_OPT */
+
+/*
+ * Lower bits are the faster implementations, so that clearing the
+ * lowest set bit falls back to the next best one.
+ */
+#define CACHE_VAES    1
+#define CACHE_AESNI   2
+
+static unsigned cpuid_host;
+static unsigned cpuid_cache;
+const QCryptoAESAccel *qcrypto_aes_accel;
+
+static void init_accel(unsigned cache)
+{
+    qcrypto_aes_accel = NULL;
+#ifdef CONFIG_VAES_OPT
+    if (cache & CACHE_VAES) {
+        qcrypto_aes_accel = &qcrypto_aes_accel_vaes;
+        return;
+    }
+#endif
+#ifdef CONFIG_AESNI_OPT
+    if (cache & CACHE_AESNI) {
+        qcrypto_aes_accel = &qcrypto_aes_accel_aesni;
+        return;
+    }
+#endif
+}
+
+#ifdef CONFIG_AESNI_OPT
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned info = cpuinfo_init();
+    unsigned cache = 0;
+
+    if (info & CPUINFO_AES) {
+        cache |= CACHE_AESNI;
+    }
+#ifdef CONFIG_VAES_OPT
+    if (info & CPUINFO_VAES) {
+        cache |= CACHE_VAES;
+    }
+#endif
+    cpuid_host = cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif
+
+bool test_qcrypto_cipher_next_accel(void)
+{
+    /* If no bits set, we just tested the table based code, and there
+       are no more acceleration options to test.  Start over with the
+       best one for the next caller.  */
+    if (!cpuinfo_next_accel(&cpuid_cache)) {
+        cpuid_cache = cpuid_host;
+        init_accel(cpuid_cache);
+        return false;
+    }
+    /* Select the next accelerator.  */
+    init_accel(cpuid_cache);
+    return true;
+}
+
+const char *test_qcrypto_cipher_accel_name(void)
+{
+    return qcrypto_aes_accel ? qcrypto_aes_accel->name : "builtin";
+}
@@ -0,0 +1,74 @@
+/*
+ * QEMU Crypto AES using host CPU instructions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef QCRYPTO_AESACCELPRIV_H
+#define QCRYPTO_AESACCELPRIV_H
+
+#include "crypto/aes.h"
+
+/*
+ * Expanded key in the layout used by the AES instructions: one
+ * 16 byte round key per round, in memory byte order.  Decryption
+ * keys use the "equivalent inverse cipher" schedule that is also
+ * produced by AES_set_decrypt_key().
+ */
+typedef struct QCryptoAESAccelKey QCryptoAESAccelKey;
+struct QCryptoAESAccelKey {
+    uint8_t rk[AES_MAXNR + 1][AES_BLOCK_SIZE];
+    int rounds;
+};
+
+/*
+ * All functions operate on a whole number of @nblocks AES blocks.
+ * The CBC functions update @iv and the XTS functions update @tweak
+ * (the already encrypted tweak value T) so that a later call
+ * continues where this one stopped.
+ */
+typedef struct QCryptoAESAccel QCryptoAESAccel;
+struct QCryptoAESAccel {
+    const char *name;
+    void (*ecb_encrypt)(const QCryptoAESAccelKey *key,
+                        const uint8_t *in, uint8_t *out, size_t nblocks);
+    void (*ecb_decrypt)(const QCryptoAESAccelKey *key,
+                        const uint8_t *in, uint8_t *out, size_t nblocks);
+    void (*cbc_encrypt)(const QCryptoAESAccelKey *key, uint8_t *iv,
+                        const uint8_t *in, uint8_t *out, size_t nblocks);
+    void (*cbc_decrypt)(const QCryptoAESAccelKey *key, uint8_t *iv,
+                        const uint8_t *in, uint8_t *out, size_t nblocks);
+    void (*xts_encrypt)(const QCryptoAESAccelKey *key, uint8_t *tweak,
+                        const uint8_t *in, uint8_t *out, size_t nblocks);
+    void (*xts_decrypt)(const QCryptoAESAccelKey *key, uint8_t *tweak,
+                        const uint8_t *in, uint8_t *out, size_t nblocks);
+};
+
+/*
+ * The fastest implementation supported by the host, or NULL if
+ * the table based code in aes.c must be used.
+ */
+extern const QCryptoAESAccel *qcrypto_aes_accel;
+
+/**
+ * qcrypto_aes_accel_key_init:
+ * @dst: the key to initialize
+ * @src: a key expanded by AES_set_encrypt_key() or AES_set_decrypt_key()
+ *
+ * Convert an expanded key to the layout used by QCryptoAESAccel.
+ */
+void qcrypto_aes_accel_key_init(QCryptoAESAccelKey *dst, const AES_KEY *src);
+
+#endif /* QCRYPTO_AESACCELPRIV_H */
@@ -23,11 +23,15 @@
 #include "crypto/desrfb.h"
 #include "crypto/xts.h"
 #include "cipherpriv.h"
+#include "aesaccelpriv.h"
 
 typedef struct QCryptoCipherBuiltinAESContext QCryptoCipherBuiltinAESContext;
 struct QCryptoCipherBuiltinAESContext {
     AES_KEY enc;
     AES_KEY dec;
+    /* The same keys, for use with qcrypto_aes_accel */
+    QCryptoAESAccelKey accel_enc;
+    QCryptoAESAccelKey accel_dec;
 };
 typedef struct QCryptoCipherBuiltinAES QCryptoCipherBuiltinAES;
 struct QCryptoCipherBuiltinAES {
@@ -150,6 +154,64 @@ static void qcrypto_cipher_aes_xts_decrypt(const void *ctx,
 }
 
 
+static void qcrypto_cipher_encrypt_aes_accel(const QCryptoAESAccel *accel,
+                                             QCryptoCipherBuiltinAES *aes,
+                                             QCryptoCipherMode mode,
+                                             const void *in,
+                                             void *out,
+                                             size_t len)
+{
+    size_t nblocks = len / AES_BLOCK_SIZE;
+    uint8_t tweak[AES_BLOCK_SIZE];
+
+    switch (mode) {
+    case QCRYPTO_CIPHER_MODE_ECB:
+        accel->ecb_encrypt(&aes->key.accel_enc, in, out, nblocks);
+        break;
+    case QCRYPTO_CIPHER_MODE_CBC:
+        accel->cbc_encrypt(&aes->key.accel_enc, aes->iv, in, out, nblocks);
+        break;
+    case QCRYPTO_CIPHER_MODE_XTS:
+        /* Leave the IV in the same state as xts_encrypt() does */
+        accel->ecb_encrypt(&aes->key_tweak.accel_enc, aes->iv, tweak, 1);
+        accel->xts_encrypt(&aes->key.accel_enc, tweak, in, out, nblocks);
+        accel->ecb_decrypt(&aes->key_tweak.accel_dec, tweak, aes->iv, 1);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+
+static void qcrypto_cipher_decrypt_aes_accel(const QCryptoAESAccel *accel,
+                                             QCryptoCipherBuiltinAES *aes,
+                                             QCryptoCipherMode mode,
+                                             const void *in,
+                                             void *out,
+                                             size_t len)
+{
+    size_t nblocks = len / AES_BLOCK_SIZE;
+    uint8_t tweak[AES_BLOCK_SIZE];
+
+    switch (mode) {
+    case QCRYPTO_CIPHER_MODE_ECB:
+        accel->ecb_decrypt(&aes->key.accel_dec, in, out, nblocks);
+        break;
+    case QCRYPTO_CIPHER_MODE_CBC:
+        accel->cbc_decrypt(&aes->key.accel_dec, aes->iv, in, out, nblocks);
+        break;
+    case QCRYPTO_CIPHER_MODE_XTS:
+        /* Leave the IV in the same state as xts_decrypt() does */
+        accel->ecb_encrypt(&aes->key_tweak.accel_enc, aes->iv, tweak, 1);
+        accel->xts_decrypt(&aes->key.accel_dec, tweak, in, out, nblocks);
+        accel->ecb_decrypt(&aes->key_tweak.accel_dec, tweak, aes->iv, 1);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+
 static int qcrypto_cipher_encrypt_aes(QCryptoCipher *cipher,
                                       const void *in,
                                       void *out,
@@ -157,6 +219,13 @@ static int qcrypto_cipher_encrypt_aes(QCryptoCipher *cipher,
                                       Error **errp)
 {
     QCryptoCipherBuiltin *ctxt = cipher->opaque;
+    const QCryptoAESAccel *accel = qcrypto_aes_accel;
+
+    if (accel) {
+        qcrypto_cipher_encrypt_aes_accel(accel, &ctxt->state.aes,
+                                         cipher->mode, in, out, len);
+        return 0;
+    }
 
     switch (cipher->mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
@@ -191,6 +260,13 @@ static int qcrypto_cipher_decrypt_aes(QCryptoCipher *cipher,
                                       Error **errp)
 {
     QCryptoCipherBuiltin *ctxt = cipher->opaque;
+    const QCryptoAESAccel *accel = qcrypto_aes_accel;
+
+    if (accel) {
+        qcrypto_cipher_decrypt_aes_accel(accel, &ctxt->state.aes,
+                                         cipher->mode, in, out, len);
+        return 0;
+    }
 
     switch (cipher->mode) {
     case QCRYPTO_CIPHER_MODE_ECB:
@@ -287,6 +363,17 @@ qcrypto_cipher_init_aes(QCryptoCipherMode mode,
         }
     }
 
+    qcrypto_aes_accel_key_init(&ctxt->state.aes.key.accel_enc,
+                               &ctxt->state.aes.key.enc);
+    qcrypto_aes_accel_key_init(&ctxt->state.aes.key.accel_dec,
+                               &ctxt->state.aes.key.dec);
+    if (mode == QCRYPTO_CIPHER_MODE_XTS) {
+        qcrypto_aes_accel_key_init(&ctxt->state.aes.key_tweak.accel_enc,
+                                   &ctxt->state.aes.key_tweak.enc);
+        qcrypto_aes_accel_key_init(&ctxt->state.aes.key_tweak.accel_dec,
+                                   &ctxt->state.aes.key_tweak.dec);
+    }
+
     ctxt->blocksize = AES_BLOCK_SIZE;
     ctxt->free = qcrypto_cipher_free_aes;
     ctxt->setiv = qcrypto_cipher_setiv_aes;
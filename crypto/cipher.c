@@ -157,6 +157,23 @@ qcrypto_cipher_munge_des_rfb_key(const uint8_t *key,
 #include "crypto/cipher-builtin.c"
 #endif
 
+#if defined(CONFIG_GCRYPT) || defined(CONFIG_NETTLE)
+/* The built-in AES implementations live in aes-accel.c */
+bool test_qcrypto_cipher_next_accel(void)
+{
+    return false;
+}
+
+const char *test_qcrypto_cipher_accel_name(void)
+{
+#ifdef CONFIG_GCRYPT
+    return "gcrypt";
+#else
+    return "nettle";
+#endif
+}
+#endif /* CONFIG_GCRYPT || CONFIG_NETTLE */
+
 QCryptoCipher *qcrypto_cipher_new(QCryptoCipherAlgorithm alg,
                                   QCryptoCipherMode mode,
                                   const uint8_t *key, size_t nkey,
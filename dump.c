@@ -35,6 +35,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -1281,6 +1284,11 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
     }
     return 0;
 }
@@ -1293,20 +1301,348 @@ static inline bool is_zero_page(const uint8_t *buf, size_t page_size)
     return buffer_is_zero(buf, page_size);
 }
 
+/*
+ * Number of pages handed to a compression worker at a time.  Batches are
+ * written to the vmcore in the order they were filled, so the page
+ * descriptors stay sorted by pfn no matter which worker finishes first.
+ */
+#define DUMP_BATCH_PAGES        256
+/* number of batches in flight per compression thread */
+#define DUMP_BATCHES_PER_THREAD 2
+
+typedef struct DumpPageBatch {
+    uint8_t *pages[DUMP_BATCH_PAGES];   /* host address of each page */
+    uint32_t sizes[DUMP_BATCH_PAGES];   /* 0 for zero pages */
+    uint32_t flags[DUMP_BATCH_PAGES];   /* DUMP_DH_COMPRESSED_*, 0 if plain */
+    size_t nr_pages;
+    uint8_t *data;                      /* len_buf_out bytes per page */
+    bool done;
+} DumpPageBatch;
+
+/* per-thread compression state */
+typedef struct DumpCompressor {
+    struct DumpCompressQueue *queue;
+    QemuThread thread;
+#ifdef CONFIG_LZO
+    lzo_bytep wrkmem;
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd_ctx;
+#endif
+} DumpCompressor;
+
+typedef struct DumpCompressQueue {
+    DumpState *s;
+    size_t len_buf_out;
+
+    DumpPageBatch *batches;
+    int nr_batches;
+
+    /*
+     * Batches are used as a ring, indexed modulo nr_batches:
+     *   head <= take <= fill <= head + nr_batches
+     * [head, take) are being compressed or wait to be written,
+     * [take, fill) wait for a compression thread.
+     */
+    QemuMutex lock;
+    QemuCond work_cond;                 /* signalled when fill advances */
+    QemuCond done_cond;                 /* signalled when a batch is done */
+    uint64_t head;
+    uint64_t take;
+    uint64_t fill;
+    bool quit;
+
+    DumpCompressor *threads;
+    int nr_threads;
+} DumpCompressQueue;
+
+static bool dump_compressor_init(DumpCompressor *c, DumpCompressQueue *q,
+                                 Error **errp)
+{
+    c->queue = q;
+#ifdef CONFIG_LZO
+    c->wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    c->zstd_ctx = ZSTD_createCCtx();
+    if (!c->zstd_ctx) {
+        error_setg(errp, "dump: failed to create zstd compression context");
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void dump_compressor_cleanup(DumpCompressor *c)
+{
+#ifdef CONFIG_LZO
+    g_free(c->wrkmem);
+#endif
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(c->zstd_ctx);
+#endif
+}
+
+/*
+ * Compress one page into buf_out.  Return the compression format used and
+ * store the compressed size in *size_out, or return 0 when the page should
+ * be saved in plaintext because compression failed or did not pay off.
+ */
+static uint32_t dump_compress_page(DumpCompressor *c, uint32_t flag_compress,
+                                   uint8_t *buf, size_t page_size,
+                                   uint8_t *buf_out, size_t len_buf_out,
+                                   size_t *size_out)
+{
+    size_t size = len_buf_out;
+
+    /*
+     * only one compression format will be used here, for
+     * s->flag_compress is set.
+     */
+    if (flag_compress & DUMP_DH_COMPRESSED_ZLIB) {
+        uLongf zlib_size = len_buf_out;
+
+        if (compress2(buf_out, &zlib_size, buf, page_size,
+                      Z_BEST_SPEED) != Z_OK) {
+            return 0;
+        }
+        size = zlib_size;
+#ifdef CONFIG_LZO
+    } else if (flag_compress & DUMP_DH_COMPRESSED_LZO) {
+        lzo_uint lzo_size = len_buf_out;
+
+        if (lzo1x_1_compress(buf, page_size, buf_out, &lzo_size,
+                             c->wrkmem) != LZO_E_OK) {
+            return 0;
+        }
+        size = lzo_size;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if (flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
+        if (snappy_compress((char *)buf, page_size,
+                            (char *)buf_out, &size) != SNAPPY_OK) {
+            return 0;
+        }
+#endif
+#ifdef CONFIG_ZSTD
+    } else if (flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        size = ZSTD_compressCCtx(c->zstd_ctx, buf_out, len_buf_out,
+                                 buf, page_size, 1);
+        if (ZSTD_isError(size)) {
+            return 0;
+        }
+#endif
+    } else {
+        return 0;
+    }
+
+    if (size >= page_size) {
+        return 0;
+    }
+
+    *size_out = size;
+    return flag_compress;
+}
+
+static void dump_compress_batch(DumpCompressor *c, DumpPageBatch *batch)
+{
+    DumpCompressQueue *q = c->queue;
+    DumpState *s = q->s;
+    size_t page_size = s->dump_info.page_size;
+    size_t i, size_out;
+
+    for (i = 0; i < batch->nr_pages; i++) {
+        if (is_zero_page(batch->pages[i], page_size)) {
+            batch->sizes[i] = 0;
+            batch->flags[i] = 0;
+            continue;
+        }
+
+        batch->flags[i] = dump_compress_page(c, s->flag_compress,
+                                             batch->pages[i], page_size,
+                                             batch->data + i * q->len_buf_out,
+                                             q->len_buf_out, &size_out);
+        /*
+         * when compression fails to work, we fall back to save in
+         * plaintext, the size is the target's page size then
+         */
+        batch->sizes[i] = batch->flags[i] ? size_out : page_size;
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressor *c = opaque;
+    DumpCompressQueue *q = c->queue;
+    DumpPageBatch *batch;
+
+    qemu_mutex_lock(&q->lock);
+    for (;;) {
+        while (!q->quit && q->take == q->fill) {
+            qemu_cond_wait(&q->work_cond, &q->lock);
+        }
+        if (q->quit) {
+            break;
+        }
+        batch = &q->batches[q->take++ % q->nr_batches];
+        qemu_mutex_unlock(&q->lock);
+
+        dump_compress_batch(c, batch);
+
+        qemu_mutex_lock(&q->lock);
+        batch->done = true;
+        qemu_cond_broadcast(&q->done_cond);
+    }
+    qemu_mutex_unlock(&q->lock);
+
+    return NULL;
+}
+
+static bool dump_compress_queue_init(DumpCompressQueue *q, DumpState *s,
+                                     size_t len_buf_out, Error **errp)
+{
+    int i;
+
+    q->s = s;
+    q->len_buf_out = len_buf_out;
+    q->nr_threads = s->compress_threads;
+
+    q->threads = g_new0(DumpCompressor, q->nr_threads);
+    for (i = 0; i < q->nr_threads; i++) {
+        if (!dump_compressor_init(&q->threads[i], q, errp)) {
+            /* the failed one may be partially initialized, too */
+            for (; i >= 0; i--) {
+                dump_compressor_cleanup(&q->threads[i]);
+            }
+            g_free(q->threads);
+            q->threads = NULL;
+            return false;
+        }
+    }
+
+    q->nr_batches = q->nr_threads * DUMP_BATCHES_PER_THREAD;
+    q->batches = g_new0(DumpPageBatch, q->nr_batches);
+    for (i = 0; i < q->nr_batches; i++) {
+        q->batches[i].data = g_malloc(len_buf_out * DUMP_BATCH_PAGES);
+    }
+
+    qemu_mutex_init(&q->lock);
+    qemu_cond_init(&q->work_cond);
+    qemu_cond_init(&q->done_cond);
+
+    /* with a single thread, compress in the dump thread itself */
+    if (q->nr_threads > 1) {
+        for (i = 0; i < q->nr_threads; i++) {
+            qemu_thread_create(&q->threads[i].thread, "dump_compress",
+                               dump_compress_thread, &q->threads[i],
+                               QEMU_THREAD_JOINABLE);
+        }
+    }
+    return true;
+}
+
+static void dump_compress_queue_cleanup(DumpCompressQueue *q)
+{
+    int i;
+
+    if (!q->threads) {
+        /* dump_compress_queue_init() failed */
+        return;
+    }
+
+    if (q->nr_threads > 1) {
+        qemu_mutex_lock(&q->lock);
+        q->quit = true;
+        qemu_cond_broadcast(&q->work_cond);
+        qemu_mutex_unlock(&q->lock);
+
+        for (i = 0; i < q->nr_threads; i++) {
+            qemu_thread_join(&q->threads[i].thread);
+        }
+    }
+
+    for (i = 0; i < q->nr_threads; i++) {
+        dump_compressor_cleanup(&q->threads[i]);
+    }
+    g_free(q->threads);
+
+    qemu_cond_destroy(&q->done_cond);
+    qemu_cond_destroy(&q->work_cond);
+    qemu_mutex_destroy(&q->lock);
+
+    for (i = 0; i < q->nr_batches; i++) {
+        g_free(q->batches[i].data);
+    }
+    g_free(q->batches);
+}
+
+/*
+ * Fill the next free batch with up to DUMP_BATCH_PAGES pages and queue it
+ * for compression.  Return false once all pages have been queued.
+ */
+static bool dump_compress_queue_fill(DumpCompressQueue *q,
+                                     GuestPhysBlock **block_iter,
+                                     uint64_t *pfn_iter)
+{
+    DumpPageBatch *batch = &q->batches[q->fill % q->nr_batches];
+    bool more_pages = true;
+
+    batch->nr_pages = 0;
+    batch->done = false;
+    while (batch->nr_pages < DUMP_BATCH_PAGES) {
+        if (!get_next_page(block_iter, pfn_iter,
+                           &batch->pages[batch->nr_pages], q->s)) {
+            more_pages = false;
+            break;
+        }
+        batch->nr_pages++;
+    }
+
+    if (!batch->nr_pages) {
+        return false;
+    }
+
+    if (q->nr_threads > 1) {
+        qemu_mutex_lock(&q->lock);
+        q->fill++;
+        qemu_cond_signal(&q->work_cond);
+        qemu_mutex_unlock(&q->lock);
+    } else {
+        dump_compress_batch(&q->threads[0], batch);
+        batch->done = true;
+        q->fill++;
+        q->take++;
+    }
+    return more_pages;
+}
+
+/* Wait for the oldest queued batch to be compressed and return it. */
+static DumpPageBatch *dump_compress_queue_wait(DumpCompressQueue *q)
+{
+    DumpPageBatch *batch = &q->batches[q->head % q->nr_batches];
+
+    qemu_mutex_lock(&q->lock);
+    while (!batch->done) {
+        qemu_cond_wait(&q->done_cond, &q->lock);
+    }
+    qemu_mutex_unlock(&q->lock);
+
+    return batch;
+}
+
 static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    DumpCompressQueue queue = {};
+    DumpPageBatch *batch;
+    size_t len_buf_out, i;
     off_t offset_desc, offset_data;
     PageDescriptor pd, pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
+    bool more_pages = true;
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1319,11 +1655,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     len_buf_out = get_len_buf_out(s->dump_info.page_size, s->flag_compress);
     assert(len_buf_out != 0);
 
-#ifdef CONFIG_LZO
-    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
-#endif
-
-    buf_out = g_malloc(len_buf_out);
+    if (!dump_compress_queue_init(&queue, s, len_buf_out, errp)) {
+        goto out;
+    }
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1345,99 +1679,65 @@ static void write_dump_pages(DumpState *s, Error **errp)
 
     /*
      * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * first page of page section.
+     *
+     * Zero page detection and compression run in the compression threads;
+     * this thread only fills batches and writes them out in order.
      */
-    while (get_next_page(&block_iter, &pfn_iter, &buf, s)) {
-        /* check zero page */
-        if (is_zero_page(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
+    while (more_pages || queue.head != queue.fill) {
+        while (more_pages && queue.fill - queue.head < queue.nr_batches) {
+            more_pages = dump_compress_queue_fill(&queue, &block_iter,
+                                                  &pfn_iter);
+        }
+        if (queue.head == queue.fill) {
+            break;
+        }
+
+        batch = dump_compress_queue_wait(&queue);
+        for (i = 0; i < batch->nr_pages; i++) {
+            if (!batch->sizes[i]) {
+                ret = write_cache(&page_desc, &pd_zero,
+                                  sizeof(PageDescriptor), false);
+                if (ret < 0) {
+                    error_setg(errp, "dump: failed to write page desc");
+                    goto out;
+                }
+                s->written_size += s->dump_info.page_size;
+                continue;
             }
-        } else {
+
             /*
              * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
+             * 1. write the compressed (or plaintext) page into the cache of
+             *    page_data
+             * 2. get page desc of the page and write it into the cache of
+             *    page_desc
              */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
+            if (batch->flags[i]) {
+                buf = batch->data + i * len_buf_out;
             } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
+                buf = batch->pages[i];
+            }
+            ret = write_cache(&page_data, buf, batch->sizes[i], false);
+            if (ret < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                goto out;
             }
 
-            /* get and write page desc here */
+            pd.flags = cpu_to_dump32(s, batch->flags[i]);
+            pd.size = cpu_to_dump32(s, batch->sizes[i]);
             pd.page_flags = cpu_to_dump64(s, 0);
             pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+            offset_data += batch->sizes[i];
 
             ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
             if (ret < 0) {
                 error_setg(errp, "dump: failed to write page desc");
                 goto out;
             }
+            s->written_size += s->dump_info.page_size;
         }
-        s->written_size += s->dump_info.page_size;
+        queue.head++;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
@@ -1452,14 +1752,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
 out:
+    dump_compress_queue_cleanup(&queue);
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
-
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
-#endif
-
-    g_free(buf_out);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1629,7 +1924,8 @@ static void vmcoreinfo_update_phys_base(DumpState *s)
 
 static void dump_init(DumpState *s, int fd, bool has_format,
                       DumpGuestMemoryFormat format, bool paging, bool has_filter,
-                      int64_t begin, int64_t length, Error **errp)
+                      int64_t begin, int64_t length, int compress_threads,
+                      Error **errp)
 {
     VMCoreInfoState *vmci = vmcoreinfo_find();
     CPUState *cpu;
@@ -1639,6 +1935,7 @@ static void dump_init(DumpState *s, int fd, bool has_format,
 
     s->has_format = has_format;
     s->format = format;
+    s->compress_threads = compress_threads;
     s->written_size = 0;
 
     /* kdump-compressed is conflict with paging and filter */
@@ -1792,6 +2089,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -1904,7 +2205,9 @@ void qmp_dump_guest_memory(bool paging, const char *file,
                            bool has_detach, bool detach,
                            bool has_begin, int64_t begin, bool has_length,
                            int64_t length, bool has_format,
-                           DumpGuestMemoryFormat format, Error **errp)
+                           DumpGuestMemoryFormat format,
+                           bool has_compress_threads, int64_t compress_threads,
+                           Error **errp)
 {
     const char *p;
     int fd = -1;
@@ -1945,8 +2248,22 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     if (has_detach) {
         detach_p = detach;
     }
+    if (has_compress_threads) {
+        if (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF) {
+            error_setg(errp, "compress-threads is only supported with "
+                             "kdump-compressed format");
+            return;
+        }
+        if (compress_threads < 1 || compress_threads > 255) {
+            error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "compress-threads",
+                       "is invalid, it should be in the range of 1 to 255");
+            return;
+        }
+    } else {
+        compress_threads = 1;
+    }
 
-    /* check whether lzo/snappy is supported */
+    /* check whether lzo/snappy/zstd is supported */
 #ifndef CONFIG_LZO
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_LZO) {
         error_setg(errp, "kdump-lzo is not available now");
@@ -1961,6 +2278,13 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
 #if !defined(WIN32)
     if (strstart(file, "fd:", &p)) {
         fd = monitor_get_fd(cur_mon, p, errp);
@@ -1987,7 +2311,7 @@ void qmp_dump_guest_memory(bool paging, const char *file,
     dump_state_prepare(s);
 
     dump_init(s, fd, has_format, format, paging, has_begin,
-              begin, length, &local_err);
+              begin, length, compress_threads, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
         atomic_set(&s->status, DUMP_STATUS_FAILED);
@@ -2035,5 +2359,12 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    item->next = g_malloc0(sizeof(DumpGuestMemoryFormatList));
+    item = item->next;
+    item->value = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+#endif
+
     return cap;
 }
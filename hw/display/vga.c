@@ -30,6 +30,7 @@
 #include "vga_regs.h"
 #include "ui/pixel_ops.h"
 #include "qemu/timer.h"
+#include "qemu/cutils.h"
 #include "hw/xen/xen.h"
 #include "trace.h"
 
@@ -1466,8 +1467,8 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     int width, height, shift_control, bwidth, bits;
     ram_addr_t page0, page1, region_start, region_end;
     DirtyBitmapSnapshot *snap = NULL;
-    int disp_width, multi_scan, multi_run;
-    uint8_t *d;
+    int disp_width, multi_scan, multi_run, line_bytes;
+    uint8_t *d, *line_buf = NULL;
     uint32_t v, addr1, addr;
     vga_draw_line_func *vga_draw_line = NULL;
     bool share_surface, force_shadow = false;
@@ -1635,6 +1636,16 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
     y1 = 0;
 
     if (!full_update) {
+        /*
+         * Render dirty scanlines to a line buffer and only copy them to
+         * the surface if they changed.  Guests often rewrite video memory
+         * with the same contents, and this keeps the updates sent to the
+         * display backends small.
+         */
+        if (!is_buffer_shared(surface)) {
+            line_bytes = disp_width * surface_bytes_per_pixel(surface);
+            line_buf = g_malloc(linesize);
+        }
         vga_sync_dirty_bitmap(s);
         if (s->line_compare < height) {
             /* split screen mode */
@@ -1674,14 +1685,21 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         }
         /* explicit invalidation for the hardware cursor (cirrus only) */
         update |= vga_scanline_invalidated(s, y);
+        if (update && line_buf) {
+            vga_draw_line(s, line_buf, addr, width);
+            if (s->cursor_draw_line) {
+                s->cursor_draw_line(s, line_buf, y);
+            }
+            update = buffer_cmpcpy(d, line_buf, line_bytes);
+        } else if (update && !is_buffer_shared(surface)) {
+            vga_draw_line(s, d, addr, width);
+            if (s->cursor_draw_line) {
+                s->cursor_draw_line(s, d, y);
+            }
+        }
         if (update) {
             if (y_start < 0)
                 y_start = y;
-            if (!(is_buffer_shared(surface))) {
-                vga_draw_line(s, d, addr, width);
-                if (s->cursor_draw_line)
-                    s->cursor_draw_line(s, d, y);
-            }
         } else {
             if (y_start >= 0) {
                 /* flush to display */
@@ -1709,6 +1727,7 @@ static void vga_draw_graphic(VGACommonState *s, int full_update)
         dpy_gfx_update(s->con, 0, y_start,
                        disp_width, y - y_start);
     }
+    g_free(line_buf);
     g_free(snap);
     memset(s->invalidated_y_table, 0, sizeof(s->invalidated_y_table));
 }
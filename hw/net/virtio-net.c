@@ -36,6 +36,9 @@
 #define VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE 256
 #define VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE 256
 
+/* Number of TX packets handed to the peer in one go */
+#define VIRTIO_NET_TX_BATCH 32
+
 /* for now, only allow larger queues; with virtio-1, guest can downsize */
 #define VIRTIO_NET_RX_QUEUE_MIN_SIZE VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE
 #define VIRTIO_NET_TX_QUEUE_MIN_SIZE VIRTIO_NET_TX_QUEUE_DEFAULT_SIZE
@@ -1271,7 +1274,11 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    if (nc->receive_batch) {
+        q->rx_notify_pending = true;
+    } else {
+        virtio_notify(vdev, q->rx_vq);
+    }
 
     return size;
 }
@@ -1287,6 +1294,17 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     return r;
 }
 
+static void virtio_net_receive_flush(NetClientState *nc)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    VirtIONetQueue *q = virtio_net_get_subqueue(nc);
+
+    if (q->rx_notify_pending) {
+        q->rx_notify_pending = false;
+        virtio_notify(VIRTIO_DEVICE(n), q->rx_vq);
+    }
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
@@ -1306,13 +1324,59 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 }
 
 /* TX */
+
+/* Completed TX elements go to the used ring right away, but the ring is
+ * only flushed, and the guest notified, once per virtio_net_flush_tx().
+ */
+static void virtio_net_tx_fill(VirtIONetQueue *q, VirtQueueElement *elem,
+                               unsigned int *num_used)
+{
+    rcu_read_lock();
+    virtqueue_fill(q->tx_vq, elem, 0, (*num_used)++);
+    rcu_read_unlock();
+    g_free(elem);
+}
+
+/* Returns false if the peer stopped taking packets.  In that case the
+ * element it queued is kept in async_tx, and the ones after it go back
+ * to the virtqueue; the caller must not pop anything else.
+ */
+static bool virtio_net_tx_send_batch(VirtIONetQueue *q, NetClientState *nc,
+                                     VirtQueueElement **elems,
+                                     const NetPacketIOV *pkts,
+                                     int count, unsigned int *num_used)
+{
+    int sent, i;
+
+    sent = qemu_sendv_packets_async(nc, pkts, count, virtio_net_tx_complete);
+    for (i = 0; i < sent; i++) {
+        virtio_net_tx_fill(q, elems[i], num_used);
+    }
+    if (sent == count) {
+        return true;
+    }
+
+    q->async_tx.elem = elems[sent];
+    for (i = sent + 1; i < count; i++) {
+        virtqueue_unpop(q->tx_vq, elems[i], 0);
+        g_free(elems[i]);
+    }
+    return false;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
     VirtIONet *n = q->n;
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     VirtQueueElement *elem;
+    VirtQueueElement *batch[VIRTIO_NET_TX_BATCH];
+    NetPacketIOV pkts[VIRTIO_NET_TX_BATCH];
+    int num_batch = 0;
+    unsigned int num_used = 0;
     int32_t num_packets = 0;
+    int32_t err = 0;
     int queue_index = vq2q(virtio_get_queue_index(q->tx_vq));
+    NetClientState *nc = qemu_get_subqueue(n->nic, queue_index);
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK)) {
         return num_packets;
     }
@@ -1323,7 +1387,6 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
     }
 
     for (;;) {
-        ssize_t ret;
         unsigned int out_num;
         struct iovec sg[VIRTQUEUE_MAX_SIZE], sg2[VIRTQUEUE_MAX_SIZE + 1], *out_sg;
         struct virtio_net_hdr_mrg_rxbuf mhdr;
@@ -1339,7 +1402,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             virtio_error(vdev, "virtio-net header not in first element");
             virtqueue_detach_element(q->tx_vq, elem, 0);
             g_free(elem);
-            return -EINVAL;
+            err = -EINVAL;
+            break;
         }
 
         if (n->has_vnet_hdr) {
@@ -1348,7 +1412,8 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                 virtio_error(vdev, "virtio-net header incorrect");
                 virtqueue_detach_element(q->tx_vq, elem, 0);
                 g_free(elem);
-                return -EINVAL;
+                err = -EINVAL;
+                break;
             }
             if (n->needs_vnet_hdr_swap) {
                 virtio_net_hdr_swap(vdev, (void *) &mhdr);
@@ -1358,11 +1423,26 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
                                    out_sg, out_num,
                                    n->guest_hdr_len, -1);
                 if (out_num == VIRTQUEUE_MAX_SIZE) {
-                    goto drop;
-		}
+                    /* Send the batch before dropping this packet: if the
+                     * peer stalls, virtqueue_unpop() can only give back
+                     * the elements that were popped last.
+                     */
+                    if (num_batch &&
+                        !virtio_net_tx_send_batch(q, nc, batch, pkts,
+                                                  num_batch, &num_used)) {
+                        virtqueue_unpop(q->tx_vq, elem, 0);
+                        g_free(elem);
+                        num_batch = 0;
+                        err = -EBUSY;
+                        break;
+                    }
+                    num_batch = 0;
+                    virtio_net_tx_fill(q, elem, &num_used);
+                    goto next;
+                }
                 out_num += 1;
                 out_sg = sg2;
-	    }
+            }
         }
         /*
          * If host wants to see the guest header as is, we can
@@ -1381,24 +1461,60 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             out_sg = sg;
         }
 
-        ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
-                                      out_sg, out_num, virtio_net_tx_complete);
-        if (ret == 0) {
-            virtio_queue_set_notification(q->tx_vq, 0);
-            q->async_tx.elem = elem;
-            return -EBUSY;
+        if (out_sg != elem->out_sg) {
+            /* sg and sg2 are reused by the next packet, so this one cannot
+             * wait in the batch.
+             */
+            if (num_batch &&
+                !virtio_net_tx_send_batch(q, nc, batch, pkts, num_batch,
+                                          &num_used)) {
+                virtqueue_unpop(q->tx_vq, elem, 0);
+                g_free(elem);
+                num_batch = 0;
+                err = -EBUSY;
+                break;
+            }
+            num_batch = 0;
         }
 
-drop:
-        virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
-        g_free(elem);
+        batch[num_batch] = elem;
+        pkts[num_batch].iov = out_sg;
+        pkts[num_batch].iovcnt = out_num;
+        num_batch++;
+
+        if (out_sg != elem->out_sg || num_batch == VIRTIO_NET_TX_BATCH) {
+            bool sent = virtio_net_tx_send_batch(q, nc, batch, pkts, num_batch,
+                                                 &num_used);
+            num_batch = 0;
+            if (!sent) {
+                err = -EBUSY;
+                break;
+            }
+        }
 
+next:
         if (++num_packets >= n->tx_burst) {
             break;
         }
     }
-    return num_packets;
+
+    if (num_batch &&
+        !virtio_net_tx_send_batch(q, nc, batch, pkts, num_batch, &num_used) &&
+        !err) {
+        err = -EBUSY;
+    }
+
+    if (num_used) {
+        rcu_read_lock();
+        virtqueue_flush(q->tx_vq, num_used);
+        rcu_read_unlock();
+        virtio_notify(vdev, q->tx_vq);
+    }
+
+    if (err == -EBUSY) {
+        virtio_queue_set_notification(q->tx_vq, 0);
+    }
+    return err ? err : num_packets;
 }
 
 static void virtio_net_handle_tx_timer(VirtIODevice *vdev, VirtQueue *vq)
@@ -1881,6 +1997,7 @@ static NetClientInfo net_virtio_info = {
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_flush = virtio_net_receive_flush,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
 };
@@ -1510,9 +1510,13 @@ static bool virtio_queue_notify_aio_vq(VirtQueue *vq)
 {
     if (vq->vring.desc && vq->handle_aio_output) {
         VirtIODevice *vdev = vq->vdev;
+        int64_t start = qemu_histogram_start();
+        bool ret;
 
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
-        return vq->handle_aio_output(vdev, vq);
+        ret = vq->handle_aio_output(vdev, vq);
+        qemu_histogram_record(vdev->notify_histogram, start);
+        return ret;
     }
 
     return false;
@@ -1522,13 +1526,16 @@ static void virtio_queue_notify_vq(VirtQueue *vq)
 {
     if (vq->vring.desc && vq->handle_output) {
         VirtIODevice *vdev = vq->vdev;
+        int64_t start;
 
         if (unlikely(vdev->broken)) {
             return;
         }
 
         trace_virtio_queue_notify(vdev, vq - vdev->vq, vq);
+        start = qemu_histogram_start();
         vq->handle_output(vdev, vq);
+        qemu_histogram_record(vdev->notify_histogram, start);
     }
 }
 
@@ -1544,7 +1551,10 @@ void virtio_queue_notify(VirtIODevice *vdev, int n)
     if (vq->handle_aio_output) {
         event_notifier_set(&vq->host_notifier);
     } else if (vq->handle_output) {
+        int64_t start = qemu_histogram_start();
+
         vq->handle_output(vdev, vq);
+        qemu_histogram_record(vdev->notify_histogram, start);
     }
 }
 
@@ -2242,6 +2252,7 @@ void virtio_init(VirtIODevice *vdev, const char *name,
     VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
     int i;
     int nvectors = k->query_nvectors ? k->query_nvectors(qbus->parent) : 0;
+    char *histogram_name, *path;
 
     if (nvectors) {
         vdev->vector_queues =
@@ -2273,6 +2284,13 @@ void virtio_init(VirtIODevice *vdev, const char *name,
                                                      vdev);
     vdev->device_endian = virtio_default_endian();
     vdev->use_guest_notifier_mask = true;
+
+    /* One histogram per device; the QOM path includes the proxy's id */
+    path = object_get_canonical_path(OBJECT(vdev));
+    histogram_name = g_strdup_printf("virtio-notify:%s", path);
+    vdev->notify_histogram = qemu_histogram_get(histogram_name);
+    g_free(histogram_name);
+    g_free(path);
 }
 
 hwaddr virtio_queue_get_desc_addr(VirtIODevice *vdev, int n)
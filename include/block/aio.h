@@ -43,6 +43,8 @@ void qemu_aio_unref(void *p);
 void qemu_aio_ref(void *p);
 
 typedef struct AioHandler AioHandler;
+typedef QLIST_HEAD(, AioHandler) AioHandlerList;
+typedef struct FDMonOps FDMonOps;
 typedef void QEMUBHFunc(void *opaque);
 typedef bool AioPollFn(void *opaque);
 typedef void IOHandler(void *opaque);
@@ -58,7 +60,10 @@ struct AioContext {
     QemuRecMutex lock;
 
     /* The list of registered AIO handlers.  Protected by ctx->list_lock. */
-    QLIST_HEAD(, AioHandler) aio_handlers;
+    AioHandlerList aio_handlers;
+
+    /* The list of AIO handlers to be deleted.  Protected by ctx->list_lock. */
+    AioHandlerList deleted_aio_handlers;
 
     /* Used to avoid unnecessary event_notifier_set calls in aio_notify;
      * accessed with atomic primitives.  If this field is 0, everything
@@ -112,6 +117,11 @@ struct AioContext {
     QSLIST_HEAD(, Coroutine) scheduled_coroutines;
     QEMUBH *co_schedule_bh;
 
+    /* Terminated coroutines for reuse by qemu_coroutine_create().  Has its
+     * own locking.
+     */
+    struct CoroutinePool *co_pool;
+
     /* Thread pool for performing work and receiving completion callbacks.
      * Has its own locking.
      */
@@ -143,10 +153,16 @@ struct AioContext {
     /* Are we in polling mode or monitoring file descriptors? */
     bool poll_started;
 
+    /* How file descriptors are monitored, see util/aio-posix.h */
+    const FDMonOps *fdmon_ops;
+
     /* epoll(7) state used when built with CONFIG_EPOLL */
     int epollfd;
-    bool epoll_enabled;
-    bool epoll_available;
+
+#ifdef CONFIG_LINUX_IO_URING
+    /* io_uring(7) state, see util/fdmon-io_uring.c */
+    struct FDMonIoUring *fdmon_io_uring;
+#endif
 };
 
 /**
@@ -551,6 +567,14 @@ static inline bool aio_context_in_iothread(AioContext *ctx)
  */
 void aio_context_setup(AioContext *ctx);
 
+/**
+ * aio_context_destroy:
+ * @ctx: the aio context
+ *
+ * Release the resources acquired by aio_context_setup().
+ */
+void aio_context_destroy(AioContext *ctx);
+
 /**
  * aio_context_set_poll_params:
  * @ctx: the aio context
@@ -564,4 +588,15 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/**
+ * aio_context_set_coroutine_stack_size:
+ * @ctx: the aio context
+ * @stack_size: stack size in bytes of coroutines created in @ctx
+ *
+ * Smaller stacks save memory when many coroutines are in flight, for
+ * example with many parallel requests in an IOThread.
+ */
+void aio_context_set_coroutine_stack_size(AioContext *ctx, size_t stack_size,
+                                          Error **errp);
+
 #endif
@@ -83,6 +83,26 @@ typedef struct BdrvTrackedRequest {
     struct BdrvTrackedRequest *waiting_for;
 } BdrvTrackedRequest;
 
+#define BDRV_BLOCK_STATUS_CACHE_SIZE 16
+
+/* One result of bdrv_co_get_block_status, in bytes */
+typedef struct BdrvBlockStatusCacheEntry {
+    int64_t offset;
+    int64_t bytes;              /* 0 if the entry is unused */
+    int status;                 /* BDRV_BLOCK_* flags without the offset */
+    int64_t map;                /* host offset of @offset if OFFSET_VALID */
+    BlockDriverState *file;
+} BdrvBlockStatusCacheEntry;
+
+typedef struct BdrvBlockStatusCache {
+    QemuSpin lock;
+    /* Bumped by every invalidation, so that a lookup that raced with a write
+     * does not store its (possibly outdated) result */
+    uint64_t gen;
+    unsigned int next;          /* next entry to be replaced */
+    BdrvBlockStatusCacheEntry entries[BDRV_BLOCK_STATUS_CACHE_SIZE];
+} BdrvBlockStatusCache;
+
 struct BlockDriver {
     const char *format_name;
     int instance_size;
@@ -201,6 +221,37 @@ struct BlockDriver {
     int coroutine_fn (*bdrv_co_pdiscard)(BlockDriverState *bs,
         int64_t offset, int bytes);
 
+    /* Map [offset, offset + nbytes) range onto a child of @bs to copy from,
+     * and invoke bdrv_co_copy_range_from(child, ...), or invoke
+     * bdrv_co_copy_range_to() if @bs is the leaf child to copy data from.
+     *
+     * See the comment of bdrv_co_copy_range for the parameter and return value
+     * semantics.
+     */
+    int coroutine_fn (*bdrv_co_copy_range_from)(BlockDriverState *bs,
+                                                BdrvChild *src,
+                                                uint64_t offset,
+                                                BdrvChild *dst,
+                                                uint64_t dst_offset,
+                                                uint64_t bytes,
+                                                BdrvRequestFlags flags);
+
+    /* Map [offset, offset + nbytes) range onto a child of bs to copy data to,
+     * and invoke bdrv_co_copy_range_to(child, src, ...), or perform the copy
+     * operation if @bs is the leaf and @src has the same BlockDriver.  Return
+     * -ENOTSUP if @bs is the leaf but @src has a different BlockDriver.
+     *
+     * See the comment of bdrv_co_copy_range for the parameter and return value
+     * semantics.
+     */
+    int coroutine_fn (*bdrv_co_copy_range_to)(BlockDriverState *bs,
+                                              BdrvChild *src,
+                                              uint64_t src_offset,
+                                              BdrvChild *dst,
+                                              uint64_t dst_offset,
+                                              uint64_t bytes,
+                                              BdrvRequestFlags flags);
+
     /*
      * Building block for bdrv_block_status[_above] and
      * bdrv_is_allocated[_above].  The driver should answer only
@@ -213,6 +264,14 @@ struct BlockDriver {
     int64_t coroutine_fn (*bdrv_co_get_block_status)(BlockDriverState *bs,
         int64_t sector_num, int nb_sectors, int *pnum,
         BlockDriverState **file);
+    /*
+     * Set if the results of bdrv_co_get_block_status only change through
+     * writes, discards and truncation of this node, so that the block layer
+     * can cache them (see bdrv_bsc_invalidate_range()).  Format drivers whose
+     * metadata can be changed behind the back of the request path (make_empty,
+     * amend, repair, ...) must not set this.
+     */
+    bool bdrv_cache_block_status;
 
     /*
      * Invalidate any cached meta-data.
@@ -269,6 +328,12 @@ struct BlockDriver {
                                   Error **errp);
     int (*bdrv_get_info)(BlockDriverState *bs, BlockDriverInfo *bdi);
     ImageInfoSpecific *(*bdrv_get_specific_info)(BlockDriverState *bs);
+    /*
+     * Return a host file descriptor that holds the image data linearly,
+     * starting at *@host_offset, so that callers can read it without going
+     * through the block layer.  The descriptor stays owned by @bs.
+     */
+    int (*bdrv_get_host_fd)(BlockDriverState *bs, int64_t *host_offset);
 
     int coroutine_fn (*bdrv_save_vmstate)(BlockDriverState *bs,
                                           QEMUIOVector *qiov,
@@ -445,6 +510,13 @@ struct BlockDriver {
     void (*bdrv_remove_persistent_dirty_bitmap)(BlockDriverState *bs,
                                                 const char *name,
                                                 Error **errp);
+    /**
+     * Load the stored bitmap @name into a new read-only, disabled
+     * BdrvDirtyBitmap, whether or not it is marked for autoloading.
+     */
+    BdrvDirtyBitmap *(*bdrv_load_persistent_dirty_bitmap)(BlockDriverState *bs,
+                                                          const char *name,
+                                                          Error **errp);
 
     QLIST_ENTRY(BlockDriver) list;
 };
@@ -687,6 +759,9 @@ struct BlockDriverState {
     QemuMutex dirty_bitmap_mutex;
     QLIST_HEAD(, BdrvDirtyBitmap) dirty_bitmaps;
 
+    /* Recent bdrv_co_get_block_status results, if the driver allows it */
+    BdrvBlockStatusCache block_status_cache;
+
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
@@ -941,6 +1016,7 @@ void commit_active_start(const char *job_id, BlockDriverState *bs,
  * @filter_node_name: The node name that should be assigned to the filter
  * driver that the mirror job inserts into the graph above @bs. NULL means that
  * a node name should be autogenerated.
+ * @copy_mode: When to trigger writes to the target.
  * @errp: Error object.
  *
  * Start a mirroring operation on @bs.  Clusters that are allocated
@@ -954,7 +1030,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   BlockdevOnError on_source_error,
                   BlockdevOnError on_target_error,
-                  bool unmap, const char *filter_node_name, Error **errp);
+                  bool unmap, const char *filter_node_name,
+                  MirrorCopyMode copy_mode, Error **errp);
 
 /*
  * backup_job_create:
@@ -1047,6 +1124,10 @@ bool blk_dev_is_medium_locked(BlockBackend *blk);
 void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes);
 bool bdrv_requests_pending(BlockDriverState *bs);
 
+void bdrv_bsc_invalidate_range(BlockDriverState *bs,
+                               int64_t offset, int64_t bytes);
+void bdrv_bsc_invalidate_all(BlockDriverState *bs);
+
 void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out);
 void bdrv_undo_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *in);
 
@@ -1055,4 +1136,11 @@ void bdrv_dec_in_flight(BlockDriverState *bs);
 
 void blockdev_close_all_bdrv_states(void);
 
+int coroutine_fn bdrv_co_copy_range_from(BdrvChild *src, uint64_t src_offset,
+                                         BdrvChild *dst, uint64_t dst_offset,
+                                         uint64_t bytes, BdrvRequestFlags flags);
+int coroutine_fn bdrv_co_copy_range_to(BdrvChild *src, uint64_t src_offset,
+                                       BdrvChild *dst, uint64_t dst_offset,
+                                       uint64_t bytes, BdrvRequestFlags flags);
+
 #endif /* BLOCK_INT_H */
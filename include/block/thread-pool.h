@@ -34,4 +34,19 @@ int coroutine_fn thread_pool_submit_co(ThreadPool *pool,
         ThreadPoolFunc *func, void *arg);
 void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg);
 
+/**
+ * thread_pool_set_affinity:
+ * @pool: the thread pool
+ * @host_cpus: bitmap of host CPUs the workers may run on, or %NULL
+ * @nbits: size of @host_cpus in bits
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Restrict the worker threads of @pool to @host_cpus, for example the
+ * CPUs of the host NUMA node that the I/O is done on.  By default the
+ * workers inherit the affinity of the thread that runs the pool's
+ * AioContext.  The mask applies to workers started after the call.
+ */
+void thread_pool_set_affinity(ThreadPool *pool, const unsigned long *host_cpus,
+                              unsigned long nbits, Error **errp);
+
 #endif
@@ -75,6 +75,7 @@ typedef enum {
  * @readfunc: callback for reading data from the volume
  * @opaque: data to pass to @readfunc
  * @flags: bitmask of QCryptoBlockOpenFlags values
+ * @n_threads: allow concurrent I/O from up to @n_threads threads
  * @errp: pointer to a NULL-initialized error object
  *
  * Create a new block encryption object for an existing
@@ -94,6 +95,11 @@ typedef enum {
  * metadata such as the payload offset. There will be
  * no cipher or ivgen objects available.
  *
+ * The payload cipher is instantiated @n_threads times, so
+ * that up to @n_threads callers can run qcrypto_block_encrypt()
+ * and qcrypto_block_decrypt() on the object at the same time.
+ * Further concurrent callers wait for a cipher to be released.
+ *
  * If any part of initializing the encryption context
  * fails an error will be returned. This could be due
  * to the volume being in the wrong format, a cipher
@@ -107,6 +113,7 @@ QCryptoBlock *qcrypto_block_open(QCryptoBlockOpenOptions *options,
                                  QCryptoBlockReadFunc readfunc,
                                  void *opaque,
                                  unsigned int flags,
+                                 size_t n_threads,
                                  Error **errp);
 
 /**
@@ -170,6 +177,11 @@ QCryptoBlockInfo *qcrypto_block_get_info(QCryptoBlock *block,
  * plain text back into @buf. @len and @offset must be
  * a multiple of the encryption format sector size.
  *
+ * This may be called from any thread. All sectors of @buf
+ * are processed with a single cipher instance, so callers
+ * wanting parallelism should split large buffers into
+ * sector aligned chunks.
+ *
  * Returns 0 on success, -1 on failure
  */
 int qcrypto_block_decrypt(QCryptoBlock *block,
@@ -190,6 +202,11 @@ int qcrypto_block_decrypt(QCryptoBlock *block,
  * cipher text back into @buf. @len and @offset must be
  * a multiple of the encryption format sector size.
  *
+ * This may be called from any thread. All sectors of @buf
+ * are processed with a single cipher instance, so callers
+ * wanting parallelism should split large buffers into
+ * sector aligned chunks.
+ *
  * Returns 0 on success, -1 on failure
  */
 int qcrypto_block_encrypt(QCryptoBlock *block,
@@ -202,9 +219,11 @@ int qcrypto_block_encrypt(QCryptoBlock *block,
  * qcrypto_block_get_cipher:
  * @block: the block encryption object
  *
- * Get the cipher to use for payload encryption
+ * Get the cipher to use for payload encryption. If the
+ * object was opened for multiple threads, this returns
+ * the first instance of the cipher pool.
  *
- * Returns: the cipher object
+ * Returns: the cipher object, or NULL if there is none
  */
 QCryptoCipher *qcrypto_block_get_cipher(QCryptoBlock *block);
 
@@ -233,4 +233,23 @@ int qcrypto_cipher_setiv(QCryptoCipher *cipher,
                          const uint8_t *iv, size_t niv,
                          Error **errp);
 
+/**
+ * test_qcrypto_cipher_next_accel:
+ *
+ * Switch the built-in AES backend to the next less optimized
+ * implementation.  Returns false if the table based one was
+ * already in use, in which case the best implementation is
+ * selected again, or if an external crypto library provides
+ * the ciphers.  For tests and benchmarks only.
+ */
+bool test_qcrypto_cipher_next_accel(void);
+
+/**
+ * test_qcrypto_cipher_accel_name:
+ *
+ * Returns the name of the AES implementation currently used by
+ * the cipher objects.  For tests and benchmarks only.
+ */
+const char *test_qcrypto_cipher_accel_name(void);
+
 #endif /* QCRYPTO_CIPHER_H */
@@ -49,6 +49,7 @@ typedef struct VirtIONetQueue {
     QEMUTimer *tx_timer;
     QEMUBH *tx_bh;
     uint32_t tx_waiting;
+    bool rx_notify_pending;
     struct {
         VirtQueueElement *elem;
     } async_tx;
@@ -248,4 +248,32 @@ qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
 
+/**
+ * qio_channel_socket_sendfile:
+ * @ioc: the socket channel object
+ * @in_fd: the file descriptor to read data from
+ * @offset: the offset in @in_fd to start reading at
+ * @count: the maximum number of bytes to send
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Send up to @count bytes from @in_fd to the socket
+ * without copying them through a userspace buffer.
+ * The file offset of @in_fd is not changed. As with
+ * qio_channel_writev(), the data may be only partially
+ * sent. If the platform cannot send from @in_fd this
+ * way, the call fails without sending anything, and
+ * the caller should fall back to a regular write.
+ *
+ * Returns: the number of bytes sent, 0 at end of file,
+ * QIO_CHANNEL_ERR_BLOCK if no data can be sent without
+ * blocking, or -1 on error
+ */
+ssize_t
+qio_channel_socket_sendfile(QIOChannelSocket *ioc,
+                            int in_fd,
+                            off_t offset,
+                            size_t count,
+                            Error **errp);
+
+
 #endif /* QIO_CHANNEL_SOCKET_H */
@@ -45,7 +45,21 @@ typedef ssize_t (NetQueueDeliverFunc)(NetClientState *sender,
                                       int iovcnt,
                                       void *opaque);
 
+/* Called around a run of deliveries, so that the receiver can defer
+ * per-packet completion work (e.g. guest notifications) to the end.
+ */
+typedef void (NetQueueBatchFunc)(void *opaque);
+
+/* One packet of a multi-packet send */
+typedef struct NetPacketIOV {
+    const struct iovec *iov;
+    int iovcnt;
+} NetPacketIOV;
+
 NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque);
+void qemu_net_queue_set_batch_handlers(NetQueue *queue,
+                                       NetQueueBatchFunc *begin,
+                                       NetQueueBatchFunc *end);
 
 void qemu_net_queue_append_iov(NetQueue *queue,
                                NetClientState *sender,
@@ -70,6 +84,13 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
                                 int iovcnt,
                                 NetPacketSent *sent_cb);
 
+int qemu_net_queue_send_iov_batch(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  const NetPacketIOV *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb);
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from);
 bool qemu_net_queue_flush(NetQueue *queue);
 
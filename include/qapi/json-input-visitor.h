@@ -0,0 +1,39 @@
+/*
+ * JSON Input Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#ifndef JSON_INPUT_VISITOR_H
+#define JSON_INPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+#include "qapi/qmp/json-streamer.h"
+
+typedef struct JSONInputVisitor JSONInputVisitor;
+
+/*
+ * Create a JSON input visitor for the JSON value made of @tokens
+ *
+ * This works like qobject_input_visitor_new() on the QObject that
+ * json_parser_parse() would build from @tokens, but walks the tokens
+ * directly instead, so that no QObject is created except for type
+ * 'any'.  @tokens must stay valid until the visitor is freed.
+ *
+ * On a syntax error, store an error through @errp and return NULL.
+ *
+ * The caller is responsible for freeing the visitor with
+ * visit_free().
+ */
+Visitor *json_input_visitor_new(GArray *tokens, Error **errp);
+
+/*
+ * Create a JSON input visitor for parsing the JSON text @str.
+ *
+ * On failure, store an error through @errp and return NULL.
+ */
+Visitor *json_input_visitor_new_str(const char *str, Error **errp);
+
+#endif
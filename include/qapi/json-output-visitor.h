@@ -0,0 +1,37 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#ifndef JSON_OUTPUT_VISITOR_H
+#define JSON_OUTPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+#include "qapi/qmp/qstring.h"
+
+typedef struct JSONOutputVisitor JSONOutputVisitor;
+
+/*
+ * Create a JSON output visitor that appends JSON text to @str
+ *
+ * The text is what qobject_to_json() (or, if @pretty,
+ * qobject_to_json_pretty()) would produce for the QObject built by
+ * qobject_output_visitor_new(), except that object members come in
+ * the order they are visited.  No QObject is created along the way,
+ * except by the caller for type 'any'.
+ *
+ * @str is not reset, so the text can be spliced into a larger JSON
+ * document.  visit_complete() with @str as argument checks that a
+ * complete JSON value has been written.
+ *
+ * Errors are not expected to happen.
+ *
+ * The caller is responsible for freeing the visitor with
+ * visit_free().
+ */
+Visitor *json_output_visitor_new(bool pretty, QString *str);
+
+#endif
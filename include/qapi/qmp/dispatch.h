@@ -16,9 +16,17 @@
 
 #include "qapi/qmp/qobject.h"
 #include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qstring.h"
 
 typedef void (QmpCommandFunc)(QDict *, QObject **, Error **);
 
+/*
+ * Like QmpCommandFunc, but append the return value to the QString as
+ * JSON text instead of returning it as QObject, pretty-printed if the
+ * bool is true.  On error, what has been appended is discarded.
+ */
+typedef void (QmpCommandJSONFunc)(QDict *, QString *, bool, Error **);
+
 typedef enum QmpCommandOptions
 {
     QCO_NO_OPTIONS = 0x0,
@@ -29,6 +37,7 @@ typedef struct QmpCommand
 {
     const char *name;
     QmpCommandFunc *fn;
+    QmpCommandJSONFunc *json_fn;    /* optional */
     QmpCommandOptions options;
     QTAILQ_ENTRY(QmpCommand) node;
     bool enabled;
@@ -38,9 +47,13 @@ typedef QTAILQ_HEAD(QmpCommandList, QmpCommand) QmpCommandList;
 
 void qmp_register_command(QmpCommandList *cmds, const char *name,
                           QmpCommandFunc *fn, QmpCommandOptions options);
+void qmp_register_command_json(QmpCommandList *cmds, const char *name,
+                               QmpCommandJSONFunc *json_fn);
 void qmp_unregister_command(QmpCommandList *cmds, const char *name);
 QmpCommand *qmp_find_command(QmpCommandList *cmds, const char *name);
 QObject *qmp_dispatch(QmpCommandList *cmds, QObject *request);
+QString *qmp_dispatch_json(QmpCommandList *cmds, QObject *request,
+                           QObject *id, bool pretty);
 void qmp_disable_command(QmpCommandList *cmds, const char *name);
 void qmp_enable_command(QmpCommandList *cmds, const char *name);
 
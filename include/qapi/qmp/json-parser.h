@@ -16,8 +16,16 @@
 
 #include "qemu-common.h"
 #include "qapi/qmp/qlist.h"
+#include "qapi/qmp/json-streamer.h"
 
-QObject *json_parser_parse(GQueue *tokens, va_list *ap);
-QObject *json_parser_parse_err(GQueue *tokens, va_list *ap, Error **errp);
+QObject *json_parser_parse(GArray *tokens, va_list *ap);
+QObject *json_parser_parse_err(GArray *tokens, va_list *ap, Error **errp);
+
+/* Parse the value made of the @count tokens at @tokens */
+QObject *json_parser_parse_tokens(const JSONToken *tokens, size_t count,
+                                  Error **errp);
+
+/* Return the unescaped contents of the JSON_STRING @token */
+char *json_parser_parse_string(const JSONToken *token, Error **errp);
 
 #endif
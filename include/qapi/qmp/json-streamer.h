@@ -20,21 +20,31 @@ typedef struct JSONToken {
     int type;
     int x;
     int y;
-    char str[];
+    size_t len;
+    const char *str;
 } JSONToken;
 
 typedef struct JSONMessageParser
 {
-    void (*emit)(struct JSONMessageParser *parser, GQueue *tokens);
+    void (*emit)(struct JSONMessageParser *parser, GArray *tokens);
     JSONLexer lexer;
     int brace_count;
     int bracket_count;
-    GQueue *tokens;
+    GArray *tokens;             /* JSONToken of the current message */
+    GString *text;              /* Their NUL-terminated strings */
+    bool emitted;               /* @tokens and @text hold an old message */
     uint64_t token_size;
 } JSONMessageParser;
 
+/*
+ * @func is called with an array of JSONToken for every complete
+ * message, or with NULL for invalid input.  The tokens are owned by
+ * @parser and remain valid until it is fed more input or destroyed.
+ * They are kept in buffers that are reused for the next message, so
+ * that parsing a message does not allocate memory for each token.
+ */
 void json_message_parser_init(JSONMessageParser *parser,
-                              void (*func)(JSONMessageParser *, GQueue *));
+                              void (*func)(JSONMessageParser *, GArray *));
 
 int json_message_parser_feed(JSONMessageParser *parser,
                              const char *buffer, size_t size);
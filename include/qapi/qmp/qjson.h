@@ -25,4 +25,14 @@ QObject *qobject_from_jsonv(const char *string, va_list *ap, Error **errp)
 QString *qobject_to_json(const QObject *obj);
 QString *qobject_to_json_pretty(const QObject *obj);
 
+/*
+ * Append @obj to @json as JSON text, formatted like qobject_to_json()
+ * or, if @pretty, like qobject_to_json_pretty() nested @indent levels
+ * deep.
+ */
+void qjson_append(QString *json, const QObject *obj, bool pretty, int indent);
+
+/* Append @str to @json as a JSON string literal */
+void qjson_append_str(QString *json, const char *str);
+
 #endif /* QJSON_H */
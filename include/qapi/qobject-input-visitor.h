@@ -74,7 +74,8 @@ Visitor *qobject_input_visitor_new_keyval(QObject *obj);
  * If @str looks like JSON, parse it as JSON, else as KEY=VALUE,...
  * @implied_key applies to KEY=VALUE, and works as in keyval_parse().
  * On failure, store an error through @errp and return NULL.
- * On success, return a new QObject input visitor for the parse.
+ * On success, return a new input visitor for the parse: a JSON input
+ * visitor for JSON, else a QObject input visitor.
  */
 Visitor *qobject_input_visitor_new_str(const char *str,
                                        const char *implied_key,
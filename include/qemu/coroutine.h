@@ -70,6 +70,42 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque);
  */
 void qemu_coroutine_enter(Coroutine *coroutine);
 
+typedef struct CoroutinePool CoroutinePool;
+
+/* Default and limits for qemu_coroutine_pool_set_stack_size() */
+#define COROUTINE_STACK_SIZE (1 << 20)
+#define COROUTINE_STACK_SIZE_MIN (32 * 1024)
+#define COROUTINE_STACK_SIZE_MAX (64 * 1024 * 1024)
+
+/**
+ * Create a coroutine pool
+ *
+ * Terminated coroutines are kept in a pool so that the next
+ * qemu_coroutine_create() can reuse them and their stack.  Each AioContext
+ * has its own pool; qemu_coroutine_create() uses the pool of the current
+ * AioContext.  The pool grows with the number of coroutines in flight.
+ */
+CoroutinePool *qemu_coroutine_pool_new(void);
+
+/**
+ * Drop the caller's reference to a coroutine pool
+ *
+ * The pool is freed once the coroutines created from it have terminated.
+ */
+void qemu_coroutine_pool_unref(CoroutinePool *pool);
+
+/**
+ * Set the stack size of coroutines created from a pool
+ *
+ * Stacks smaller than the 1 MiB default save memory when many coroutines
+ * are in flight; small stacks have no guard page and are checked for
+ * overflows when their coroutine terminates instead.  Build with
+ * --enable-debug-stack-usage to see how much stack is actually used.
+ */
+void qemu_coroutine_pool_set_stack_size(CoroutinePool *pool,
+                                        size_t stack_size, Error **errp);
+size_t qemu_coroutine_pool_get_stack_size(CoroutinePool *pool);
+
 /**
  * Transfer control to a coroutine if it's not active (i.e. part of the call
  * stack of the running coroutine). Otherwise, do nothing.
@@ -28,8 +28,6 @@
 #include "qemu/queue.h"
 #include "qemu/coroutine.h"
 
-#define COROUTINE_STACK_SIZE (1 << 20)
-
 typedef enum {
     COROUTINE_YIELD = 1,
     COROUTINE_TERMINATE = 2,
@@ -44,6 +42,10 @@ struct Coroutine {
     /* Only used when the coroutine has terminated.  */
     QSLIST_ENTRY(Coroutine) pool_next;
 
+    /* The pool this coroutine was created from, NULL once terminated */
+    CoroutinePool *pool;
+    size_t stack_size;
+
     size_t locks_held;
 
     /* Only used when the coroutine has yielded.  */
@@ -64,8 +66,14 @@ struct Coroutine {
     QSLIST_ENTRY(Coroutine) co_scheduled_next;
 };
 
-Coroutine *qemu_coroutine_new(void);
+Coroutine *qemu_coroutine_new(size_t stack_size);
 void qemu_coroutine_delete(Coroutine *co);
+
+/*
+ * Called when a coroutine terminates.  Aborts if its stack overflowed
+ * and returns the maximum stack usage if it can be measured, else 0.
+ */
+size_t qemu_coroutine_check_stack(Coroutine *co);
 CoroutineAction qemu_coroutine_switch(Coroutine *from, Coroutine *to,
                                       CoroutineAction action);
 void coroutine_fn qemu_co_queue_run_restart(Coroutine *co);
@@ -31,6 +31,9 @@
 #ifndef bit_MOVBE
 #define bit_MOVBE       (1 << 22)
 #endif
+#ifndef bit_AES
+#define bit_AES         (1 << 25)
+#endif
 #ifndef bit_OSXSAVE
 #define bit_OSXSAVE     (1 << 27)
 #endif
@@ -49,6 +52,11 @@
 #define bit_BMI2        (1 << 8)
 #endif
 
+/* Leaf 7, %ecx */
+#ifndef bit_VAES
+#define bit_VAES        (1 << 9)
+#endif
+
 /* Leaf 0x80000001, %ecx */
 #ifndef bit_LZCNT
 #define bit_LZCNT       (1 << 5)
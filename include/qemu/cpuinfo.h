@@ -0,0 +1,42 @@
+/*
+ * cpuinfo.h - host CPU features for run-time selection of accelerated code
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_CPUINFO_H
+#define QEMU_CPUINFO_H
+
+#define CPUINFO_ALWAYS  (1u << 0)   /* set once cpuinfo_init() has run */
+#define CPUINFO_SSE2    (1u << 1)
+#define CPUINFO_SSE4    (1u << 2)
+#define CPUINFO_AVX2    (1u << 3)   /* only if the OS saves the AVX state */
+#define CPUINFO_AES     (1u << 4)
+#define CPUINFO_VAES    (1u << 5)   /* implies AES and AVX2 */
+
+extern unsigned cpuinfo;
+
+/*
+ * Probe the host CPU on the first call and return the CPUINFO_* bits.
+ * Constructors that pick an accelerated implementation call this instead
+ * of reading cpuinfo, because constructors run in no particular order.
+ */
+unsigned cpuinfo_init(void);
+
+/*
+ * Users keep the accelerators that they can use as a mask, where the
+ * least significant bit is the most preferred one.  For the test suite,
+ * drop the accelerator in use from @cache; return false if there was none
+ * left, i.e. the generic C code was in use.
+ */
+static inline bool cpuinfo_next_accel(unsigned *cache)
+{
+    if (*cache == 0) {
+        return false;
+    }
+    *cache &= *cache - 1;
+    return true;
+}
+
+#endif
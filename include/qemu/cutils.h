@@ -155,6 +155,8 @@ int qemu_strtosz_metric(const char *nptr, char **end, uint64_t *result);
 
 bool buffer_is_zero(const void *buf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
+bool buffer_cmpcpy(void *dst, const void *src, size_t len);
+bool test_buffer_cmpcpy_next_accel(void);
 
 /*
  * Implementation of ULEB128 (http://en.wikipedia.org/wiki/LEB128)
@@ -252,6 +252,15 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
  */
 void hbitmap_deserialize_finish(HBitmap *hb);
 
+/**
+ * test_hbitmap_next_accel:
+ *
+ * Switch to the next less optimized implementation of the bulk bitmap
+ * operations.  Returns false if the plain C one was already in use.
+ * For tests only.
+ */
+bool test_hbitmap_next_accel(void);
+
 /**
  * hbitmap_sha256:
  * @bitmap: HBitmap to operate on.
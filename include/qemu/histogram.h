@@ -0,0 +1,140 @@
+/*
+ * Lock-free latency histograms
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_HISTOGRAM_H
+#define QEMU_HISTOGRAM_H
+
+#include "qemu/atomic.h"
+#include "qemu/timer.h"
+
+/*
+ * Values are counted in log-linear buckets: values below
+ * QEMU_HISTOGRAM_SUB_BUCKETS have a bucket each, then every power of two
+ * is split into QEMU_HISTOGRAM_SUB_BUCKETS buckets of equal width, which
+ * bounds the relative error to 1 / QEMU_HISTOGRAM_SUB_BUCKETS.  Values of
+ * 2^QEMU_HISTOGRAM_MAX_BITS and above (about 68 seconds for nanosecond
+ * latencies) share the last bucket.
+ */
+#define QEMU_HISTOGRAM_SUB_BITS     4
+#define QEMU_HISTOGRAM_SUB_BUCKETS  (1 << QEMU_HISTOGRAM_SUB_BITS)
+#define QEMU_HISTOGRAM_MAX_BITS     36
+#define QEMU_HISTOGRAM_BUCKETS \
+    (((QEMU_HISTOGRAM_MAX_BITS - QEMU_HISTOGRAM_SUB_BITS + 1) \
+      << QEMU_HISTOGRAM_SUB_BITS) + 1)
+
+typedef struct QHistogram QHistogram;
+
+extern bool qemu_histograms_enabled;
+
+/**
+ * qemu_histogram_get:
+ * @name: the name under which the histogram is reported
+ *
+ * Look up the histogram called @name, creating it if it does not exist yet.
+ * Histograms are never freed, so the result can be cached by the caller.
+ */
+QHistogram *qemu_histogram_get(const char *name);
+
+/**
+ * qemu_histogram_get_cached:
+ * @cache: where to cache the histogram, initially NULL
+ * @fmt: printf format for the name under which the histogram is reported
+ *
+ * Like qemu_histogram_get(), but only format the name and look it up the
+ * first time.
+ */
+QHistogram *qemu_histogram_get_cached(QHistogram **cache, const char *fmt, ...)
+    GCC_FMT_ATTR(2, 3);
+
+/**
+ * qemu_histogram_add:
+ * @h: the histogram
+ * @value: the value to count
+ *
+ * Count @value in @h.  Each thread updates its own copy of the buckets
+ * without atomic read-modify-write operations, the copies are only summed
+ * up when the histogram is queried.
+ */
+void qemu_histogram_add(QHistogram *h, uint64_t value);
+
+/**
+ * qemu_histograms_set_enabled:
+ * @enable: whether qemu_histogram_start() should start measurements
+ * @reset: whether to clear all histograms
+ */
+void qemu_histograms_set_enabled(bool enable, bool reset);
+
+/**
+ * qemu_histogram_bucket:
+ * @value: a value
+ *
+ * Returns: the index of the bucket that counts @value.
+ */
+static inline unsigned qemu_histogram_bucket(uint64_t value)
+{
+    unsigned e;
+
+    if (value < QEMU_HISTOGRAM_SUB_BUCKETS) {
+        return value;
+    }
+    e = 63 - clz64(value);
+    if (e >= QEMU_HISTOGRAM_MAX_BITS) {
+        return QEMU_HISTOGRAM_BUCKETS - 1;
+    }
+    return ((e - QEMU_HISTOGRAM_SUB_BITS + 1) << QEMU_HISTOGRAM_SUB_BITS) +
+           ((value >> (e - QEMU_HISTOGRAM_SUB_BITS)) &
+            (QEMU_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+/**
+ * qemu_histogram_bucket_lower:
+ * @bucket: a bucket index
+ *
+ * Returns: the smallest value counted in @bucket.
+ */
+static inline uint64_t qemu_histogram_bucket_lower(unsigned bucket)
+{
+    unsigned group = bucket >> QEMU_HISTOGRAM_SUB_BITS;
+    unsigned sub = bucket & (QEMU_HISTOGRAM_SUB_BUCKETS - 1);
+
+    if (bucket == QEMU_HISTOGRAM_BUCKETS - 1) {
+        return 1ULL << QEMU_HISTOGRAM_MAX_BITS;
+    }
+    if (group == 0) {
+        return bucket;
+    }
+    return (uint64_t)(QEMU_HISTOGRAM_SUB_BUCKETS + sub) << (group - 1);
+}
+
+/**
+ * qemu_histogram_start:
+ *
+ * Start a latency measurement for qemu_histogram_record().  This only
+ * reads the clock if histograms are enabled.
+ *
+ * Returns: the start timestamp, or 0 if histograms are disabled.
+ */
+static inline int64_t qemu_histogram_start(void)
+{
+    return unlikely(atomic_read(&qemu_histograms_enabled)) ? get_clock() : 0;
+}
+
+/**
+ * qemu_histogram_record:
+ * @h: the histogram
+ * @start: the value returned by qemu_histogram_start()
+ *
+ * Count the time elapsed since @start in @h, in nanoseconds.
+ */
+static inline void qemu_histogram_record(QHistogram *h, int64_t start)
+{
+    if (unlikely(start)) {
+        qemu_histogram_add(h, get_clock() - start);
+    }
+}
+
+#endif
@@ -147,6 +147,9 @@ void throttle_get_config(ThrottleState *ts, ThrottleConfig *cfg);
 void throttle_config_init(ThrottleConfig *cfg);
 
 /* usage */
+int64_t throttle_compute_wait_at(ThrottleState *ts, bool is_write,
+                                 int64_t now);
+
 bool throttle_schedule_timer(ThrottleState *ts,
                              ThrottleTimers *tt,
                              bool is_write);
@@ -380,7 +380,7 @@ typedef void (ObjectUnparent)(Object *obj);
  */
 typedef void (ObjectFree)(void *obj);
 
-#define OBJECT_CLASS_CAST_CACHE 4
+#define OBJECT_CLASS_CAST_CACHE 8
 
 /**
  * ObjectClass:
@@ -516,11 +516,17 @@ struct TypeInfo
  * this object type.
  *
  * If an invalid object is passed to this function, a run time assert will be
- * generated.
+ * generated.  Without CONFIG_QOM_CAST_DEBUG, @object_dynamic_cast_assert
+ * checks nothing, so this is just a pointer cast.
  */
+#ifdef CONFIG_QOM_CAST_DEBUG
 #define OBJECT_CHECK(type, obj, name) \
     ((type *)object_dynamic_cast_assert(OBJECT(obj), (name), \
                                         __FILE__, __LINE__, __func__))
+#else
+#define OBJECT_CHECK(type, obj, name) \
+    ((void)(name), (type *)OBJECT(obj))
+#endif
 
 /**
  * OBJECT_CLASS_CHECK:
@@ -591,10 +597,17 @@ struct InterfaceClass
  * @name: the interface type name
  *
  * Returns: @obj casted to @interface if cast is valid, otherwise raise error.
+ * Like OBJECT_CHECK(), this is just a pointer cast without
+ * CONFIG_QOM_CAST_DEBUG.
  */
+#ifdef CONFIG_QOM_CAST_DEBUG
 #define INTERFACE_CHECK(interface, obj, name) \
     ((interface *)object_dynamic_cast_assert(OBJECT((obj)), (name), \
                                              __FILE__, __LINE__, __func__))
+#else
+#define INTERFACE_CHECK(interface, obj, name) \
+    ((void)(name), (interface *)OBJECT(obj))
+#endif
 
 /**
  * object_new:
@@ -30,6 +30,7 @@
 #define DUMP_DH_COMPRESSED_ZLIB     (0x1)
 #define DUMP_DH_COMPRESSED_LZO      (0x2)
 #define DUMP_DH_COMPRESSED_SNAPPY   (0x4)
+#define DUMP_DH_COMPRESSED_ZSTD     (0x20)
 
 #define KDUMP_SIGNATURE             "KDUMP   "
 #define SIG_LEN                     (sizeof(KDUMP_SIGNATURE) - 1)
@@ -178,6 +179,7 @@ typedef struct DumpState {
     off_t offset_page;          /* offset of page part in vmcore */
     size_t num_dumpable;        /* number of page that can be dumped */
     uint32_t flag_compress;     /* indicate the compression format */
+    int compress_threads;       /* number of threads compressing pages */
     DumpStatus status;          /* current dump status */
 
     bool has_format;              /* whether format is provided */
@@ -37,6 +37,13 @@ typedef struct {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Stack size of coroutines created in the AioContext */
+    uint64_t coroutine_stack_size;
+
+    /* Host CPUs and NUMA nodes that the thread pool workers run on */
+    unsigned long *thread_pool_cpus;
+    unsigned long *thread_pool_nodes;
 } IOThread;
 
 #define IOTHREAD(obj) \
@@ -53,6 +53,9 @@ typedef struct timeval qemu_timeval;
 
 bool is_daemonized(void);
 
+/* Stacks smaller than this have no guard page, see qemu_alloc_stack() */
+#define QEMU_STACK_GUARD_MIN_SIZE (256 * 1024)
+
 /**
  * qemu_alloc_stack:
  * @sz: pointer to a size_t holding the requested usable stack size
@@ -64,12 +67,29 @@ bool is_daemonized(void);
  * Note that the memory required for the guard page and alignment
  * and minimal stack size restrictions will increase the value of sz.
  *
+ * Stacks smaller than QEMU_STACK_GUARD_MIN_SIZE get no guard page, so
+ * that thousands of them do not need two mappings each.  A canary is
+ * placed instead and checked by qemu_check_stack().
+ *
  * The allocated stack must be freed with qemu_free_stack().
  *
  * Returns: pointer to (the lowest address of) the stack memory.
  */
 void *qemu_alloc_stack(size_t *sz);
 
+/**
+ * qemu_check_stack:
+ * @stack: stack allocated via qemu_alloc_stack()
+ * @sz: size of stack in bytes
+ *
+ * Abort if a stack without guard page has overflowed.  Call this when the
+ * stack is not in use, e.g. each time a coroutine terminates.
+ *
+ * Returns: the maximum number of bytes used so far with
+ * CONFIG_DEBUG_STACK_USAGE, 0 otherwise.
+ */
+size_t qemu_check_stack(void *stack, size_t sz);
+
 /**
  * qemu_free_stack:
  * @stack: stack to free
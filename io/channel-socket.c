@@ -24,6 +24,9 @@
 #include "io/channel-watch.h"
 #include "trace.h"
 #include "qapi/clone-visitor.h"
+#ifdef CONFIG_SENDFILE
+#include <sys/sendfile.h>
+#endif
 
 #define SOCKET_MAX_FDS 16
 
@@ -649,6 +652,39 @@ qio_channel_socket_set_blocking(QIOChannel *ioc,
 }
 
 
+ssize_t
+qio_channel_socket_sendfile(QIOChannelSocket *ioc,
+                            int in_fd,
+                            off_t offset,
+                            size_t count,
+                            Error **errp)
+{
+#ifdef CONFIG_SENDFILE
+    ssize_t ret;
+
+ retry:
+    ret = sendfile(ioc->fd, in_fd, &offset, count);
+    if (ret < 0) {
+        if (errno == EAGAIN) {
+            return QIO_CHANNEL_ERR_BLOCK;
+        }
+        if (errno == EINTR) {
+            goto retry;
+        }
+        error_setg_errno(errp, errno,
+                         "Unable to send file to socket");
+        return -1;
+    }
+    trace_qio_channel_socket_sendfile(ioc, in_fd, offset - ret, count, ret);
+    return ret;
+#else
+    error_setg_errno(errp, ENOSYS,
+                     "Sending files to sockets is not supported");
+    return -1;
+#endif
+}
+
+
 static void
 qio_channel_socket_set_delay(QIOChannel *ioc,
                              bool enabled)
@@ -22,6 +22,14 @@
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/bitmap.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "qapi/visitor.h"
+#include "qapi-visit.h"
+#include "block/thread-pool.h"
+#include "qemu/coroutine.h"
+#include "sysemu/sysemu.h"
 
 typedef ObjectClass IOThreadClass;
 
@@ -36,6 +44,8 @@ typedef ObjectClass IOThreadClass;
  */
 #define IOTHREAD_POLL_MAX_NS_DEFAULT 32768ULL
 
+#define IOTHREAD_MAX_HOST_CPUS 4096
+
 static __thread IOThread *my_iothread;
 
 AioContext *qemu_get_current_aio_context(void)
@@ -117,6 +127,9 @@ static void iothread_instance_init(Object *obj)
     IOThread *iothread = IOTHREAD(obj);
 
     iothread->poll_max_ns = IOTHREAD_POLL_MAX_NS_DEFAULT;
+    iothread->coroutine_stack_size = COROUTINE_STACK_SIZE;
+    iothread->thread_pool_cpus = bitmap_new(IOTHREAD_MAX_HOST_CPUS);
+    iothread->thread_pool_nodes = bitmap_new(MAX_NODES);
 }
 
 static void iothread_instance_finalize(Object *obj)
@@ -130,12 +143,94 @@ static void iothread_instance_finalize(Object *obj)
     }
     qemu_cond_destroy(&iothread->init_done_cond);
     qemu_mutex_destroy(&iothread->init_done_lock);
+    g_free(iothread->thread_pool_cpus);
+    g_free(iothread->thread_pool_nodes);
     if (!iothread->ctx) {
         return;
     }
     aio_context_unref(iothread->ctx);
 }
 
+/* Add the CPUs of host NUMA node @node to @cpus.  */
+static bool iothread_add_node_cpus(unsigned long *cpus, unsigned long node,
+                                   Error **errp)
+{
+#ifdef CONFIG_LINUX
+    char *path;
+    gchar *contents = NULL;
+    const char *p;
+    bool ret = false;
+
+    path = g_strdup_printf("/sys/devices/system/node/node%lu/cpulist", node);
+    if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+        error_setg(errp, "Host NUMA node %lu does not exist", node);
+        goto out;
+    }
+
+    /* A comma separated list of CPUs and CPU ranges, e.g. "0-3,8-11" */
+    p = contents;
+    while (*p && *p != '\n') {
+        unsigned long first, last;
+
+        if (qemu_strtoul(p, &p, 10, &first) < 0) {
+            goto parse_error;
+        }
+        last = first;
+        if (*p == '-' && qemu_strtoul(p + 1, &p, 10, &last) < 0) {
+            goto parse_error;
+        }
+        if (last < first || last >= IOTHREAD_MAX_HOST_CPUS) {
+            goto parse_error;
+        }
+        bitmap_set(cpus, first, last - first + 1);
+        if (*p == ',') {
+            p++;
+        } else if (*p && *p != '\n') {
+            goto parse_error;
+        }
+    }
+    ret = true;
+    goto out;
+
+parse_error:
+    error_setg(errp, "Cannot parse CPU list of host NUMA node %lu", node);
+out:
+    g_free(contents);
+    g_free(path);
+    return ret;
+#else
+    error_setg(errp, "Host NUMA node binding is not supported on this host");
+    return false;
+#endif
+}
+
+static void iothread_init_thread_pool(IOThread *iothread, Error **errp)
+{
+    unsigned long *cpus;
+    unsigned long node;
+
+    if (bitmap_empty(iothread->thread_pool_cpus, IOTHREAD_MAX_HOST_CPUS) &&
+        bitmap_empty(iothread->thread_pool_nodes, MAX_NODES)) {
+        return;
+    }
+
+    cpus = bitmap_new(IOTHREAD_MAX_HOST_CPUS);
+    bitmap_copy(cpus, iothread->thread_pool_cpus, IOTHREAD_MAX_HOST_CPUS);
+    for (node = find_first_bit(iothread->thread_pool_nodes, MAX_NODES);
+         node < MAX_NODES;
+         node = find_next_bit(iothread->thread_pool_nodes, MAX_NODES,
+                              node + 1)) {
+        if (!iothread_add_node_cpus(cpus, node, errp)) {
+            goto out;
+        }
+    }
+
+    thread_pool_set_affinity(aio_get_thread_pool(iothread->ctx), cpus,
+                             IOTHREAD_MAX_HOST_CPUS, errp);
+out:
+    g_free(cpus);
+}
+
 static void iothread_complete(UserCreatable *obj, Error **errp)
 {
     Error *local_error = NULL;
@@ -156,6 +251,14 @@ static void iothread_complete(UserCreatable *obj, Error **errp)
                                 iothread->poll_grow,
                                 iothread->poll_shrink,
                                 &local_error);
+    if (!local_error) {
+        aio_context_set_coroutine_stack_size(iothread->ctx,
+                                             iothread->coroutine_stack_size,
+                                             &local_error);
+    }
+    if (!local_error) {
+        iothread_init_thread_pool(iothread, &local_error);
+    }
     if (local_error) {
         error_propagate(errp, local_error);
         aio_context_unref(iothread->ctx);
@@ -245,6 +348,118 @@ out:
     error_propagate(errp, local_err);
 }
 
+static void iothread_get_coroutine_stack_size(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_size(v, name, &iothread->coroutine_stack_size, errp);
+}
+
+static void iothread_set_coroutine_stack_size(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    Error *local_err = NULL;
+    uint64_t value;
+
+    visit_type_size(v, name, &value, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    if (value < COROUTINE_STACK_SIZE_MIN || value > COROUTINE_STACK_SIZE_MAX) {
+        error_setg(&local_err, "%s value must be in range [%d, %d]",
+                   name, COROUTINE_STACK_SIZE_MIN, COROUTINE_STACK_SIZE_MAX);
+        goto out;
+    }
+
+    iothread->coroutine_stack_size = value;
+
+    /* Coroutines already in the pool are freed as they are found */
+    if (iothread->ctx) {
+        aio_context_set_coroutine_stack_size(iothread->ctx, value, &local_err);
+    }
+
+out:
+    error_propagate(errp, local_err);
+}
+
+typedef struct {
+    const char *name;
+    ptrdiff_t offset; /* field's byte offset in IOThread struct */
+    unsigned long nbits;
+} HostBitmapInfo;
+
+static HostBitmapInfo thread_pool_cpus_info = {
+    "thread-pool-cpus", offsetof(IOThread, thread_pool_cpus),
+    IOTHREAD_MAX_HOST_CPUS,
+};
+static HostBitmapInfo thread_pool_host_nodes_info = {
+    "thread-pool-host-nodes", offsetof(IOThread, thread_pool_nodes),
+    MAX_NODES,
+};
+
+static void iothread_get_host_bitmap(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    HostBitmapInfo *info = opaque;
+    unsigned long **field = (void *)iothread + info->offset;
+    unsigned long *bitmap = *field;
+    uint16List *list = NULL;
+    uint16List **tail = &list;
+    unsigned long value;
+
+    for (value = find_first_bit(bitmap, info->nbits); value < info->nbits;
+         value = find_next_bit(bitmap, info->nbits, value + 1)) {
+        *tail = g_malloc0(sizeof(**tail));
+        (*tail)->value = value;
+        tail = &(*tail)->next;
+    }
+
+    visit_type_uint16List(v, name, &list, errp);
+    qapi_free_uint16List(list);
+}
+
+static void iothread_set_host_bitmap(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    HostBitmapInfo *info = opaque;
+    unsigned long **field = (void *)iothread + info->offset;
+    unsigned long *bitmap = *field;
+    uint16List *list = NULL, *l;
+    Error *local_err = NULL;
+
+    if (iothread->ctx) {
+        error_setg(&local_err, "cannot change property value");
+        goto out;
+    }
+
+    visit_type_uint16List(v, name, &list, &local_err);
+    if (local_err) {
+        goto out;
+    }
+
+    for (l = list; l; l = l->next) {
+        if (l->value >= info->nbits) {
+            error_setg(&local_err, "%s value must be in range [0, %lu]",
+                       info->name, info->nbits - 1);
+            goto out;
+        }
+    }
+
+    bitmap_zero(bitmap, info->nbits);
+    for (l = list; l; l = l->next) {
+        bitmap_set(bitmap, l->value, 1);
+    }
+
+out:
+    qapi_free_uint16List(list);
+    error_propagate(errp, local_err);
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(klass);
@@ -262,6 +477,19 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info, &error_abort);
+    object_class_property_add(klass, "coroutine-stack-size", "size",
+                              iothread_get_coroutine_stack_size,
+                              iothread_set_coroutine_stack_size,
+                              NULL, NULL, &error_abort);
+    object_class_property_add(klass, "thread-pool-cpus", "int",
+                              iothread_get_host_bitmap,
+                              iothread_set_host_bitmap,
+                              NULL, &thread_pool_cpus_info, &error_abort);
+    object_class_property_add(klass, "thread-pool-host-nodes", "int",
+                              iothread_get_host_bitmap,
+                              iothread_set_host_bitmap,
+                              NULL, &thread_pool_host_nodes_info,
+                              &error_abort);
 }
 
 static const TypeInfo iothread_info = {
@@ -33,6 +33,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/main-loop.h"
+#include "qemu/histogram.h"
 #include "xbzrle.h"
 #include "ram.h"
 #include "migration.h"
@@ -2249,9 +2250,11 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
 {
     RAMState **temp = opaque;
     RAMState *rs = *temp;
+    static QHistogram *iterate_histogram;
     int ret;
     int i;
     int64_t t0;
+    int64_t start = qemu_histogram_start();
     int done = 0;
 
     rcu_read_lock();
@@ -2303,6 +2306,13 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
     ram_counters.transferred += 8;
 
+    if (start) {
+        qemu_histogram_record(
+            qemu_histogram_get_cached(&iterate_histogram,
+                                      "migration-ram-iterate"),
+            start);
+    }
+
     ret = qemu_file_get_error(f);
     if (ret < 0) {
         return ret;
@@ -328,19 +328,17 @@ void monitor_flush(Monitor *mon)
 /* flush at every end of line */
 static void monitor_puts(Monitor *mon, const char *str)
 {
-    char c;
+    size_t len;
 
     qemu_mutex_lock(&mon->out_lock);
-    for(;;) {
-        c = *str++;
-        if (c == '\0')
-            break;
-        if (c == '\n') {
-            qstring_append_chr(mon->outbuf, '\r');
-        }
-        qstring_append_chr(mon->outbuf, c);
-        if (c == '\n') {
+    while (*str) {
+        len = strcspn(str, "\n");
+        qstring_append_len(mon->outbuf, str, len);
+        str += len;
+        if (*str == '\n') {
+            qstring_append(mon->outbuf, "\r\n");
             monitor_flush_locked(mon);
+            str++;
         }
     }
     qemu_mutex_unlock(&mon->out_lock);
@@ -379,6 +377,13 @@ int monitor_fprintf(FILE *stream, const char *fmt, ...)
     return 0;
 }
 
+/* Emit the JSON text in @json, which gains a trailing newline */
+static void monitor_json_emitter_str(Monitor *mon, QString *json)
+{
+    qstring_append_chr(json, '\n');
+    monitor_puts(mon, qstring_get_str(json));
+}
+
 static void monitor_json_emitter(Monitor *mon, const QObject *data)
 {
     QString *json;
@@ -387,8 +392,7 @@ static void monitor_json_emitter(Monitor *mon, const QObject *data)
                                              qobject_to_json(data);
     assert(json != NULL);
 
-    qstring_append_chr(json, '\n');
-    monitor_puts(mon, qstring_get_str(json));
+    monitor_json_emitter_str(mon, json);
 
     QDECREF(json);
 }
@@ -956,6 +960,21 @@ static void qmp_query_qmp_schema(QDict *qdict, QObject **ret_data,
     *ret_data = qobject_from_json(qmp_schema_json, &error_abort);
 }
 
+/* qmp_schema_json is already in the format qobject_to_json() produces */
+static void qmp_query_qmp_schema_json(QDict *qdict, QString *ret_json,
+                                      bool pretty, Error **errp)
+{
+    QObject *schema;
+
+    if (!pretty) {
+        qstring_append(ret_json, qmp_schema_json);
+        return;
+    }
+    schema = qobject_from_json(qmp_schema_json, &error_abort);
+    qjson_append(ret_json, schema, true, 0);
+    qobject_decref(schema);
+}
+
 /*
  * We used to define commands in qmp-commands.hx in addition to the
  * QAPI schema.  This permitted defining some of them only in certain
@@ -1014,6 +1033,8 @@ void monitor_init_qmp_commands(void)
     qmp_register_command(&qmp_commands, "query-qmp-schema",
                          qmp_query_qmp_schema,
                          QCO_NO_OPTIONS);
+    qmp_register_command_json(&qmp_commands, "query-qmp-schema",
+                              qmp_query_qmp_schema_json);
     qmp_register_command(&qmp_commands, "device_add", qmp_device_add,
                          QCO_NO_OPTIONS);
     qmp_register_command(&qmp_commands, "netdev_add", qmp_netdev_add,
@@ -3807,9 +3828,10 @@ static int monitor_can_read(void *opaque)
     return (mon->suspend_cnt == 0) ? 1 : 0;
 }
 
-static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
+static void handle_qmp_command(JSONMessageParser *parser, GArray *tokens)
 {
     QObject *req, *rsp = NULL, *id = NULL;
+    QString *rsp_json;
     QDict *qdict = NULL;
     Monitor *mon = cur_mon;
     Error *err = NULL;
@@ -3836,6 +3858,17 @@ static void handle_qmp_command(JSONMessageParser *parser, GQueue *tokens)
         QDECREF(req_json);
     }
 
+    if (mon->qmp.commands != &qmp_cap_negotiation_commands) {
+        /* Skip the QObject response where commands support that */
+        rsp_json = qmp_dispatch_json(mon->qmp.commands, req, id,
+                                     mon->flags & MONITOR_USE_PRETTY);
+        if (rsp_json) {
+            monitor_json_emitter_str(mon, rsp_json);
+            QDECREF(rsp_json);
+        }
+        goto out;
+    }
+
     rsp = qmp_dispatch(cur_mon->qmp.commands, req);
 
     if (mon->qmp.commands == &qmp_cap_negotiation_commands) {
@@ -3867,6 +3900,7 @@ err_out:
         monitor_json_emitter(mon, rsp);
     }
 
+out:
     qobject_decref(id);
     qobject_decref(rsp);
     qobject_decref(req);
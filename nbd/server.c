@@ -19,6 +19,7 @@
 
 #include "qemu/osdep.h"
 #include "qapi/error.h"
+#include "block/block_int.h"
 #include "trace.h"
 #include "nbd-internal.h"
 
@@ -59,6 +60,8 @@ struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    int fd;             /* Private descriptor to send read data from, or -1 */
+    off_t fd_offset;    /* Offset of the requested data in fd */
 };
 
 struct NBDExport {
@@ -71,6 +74,7 @@ struct NBDExport {
     off_t dev_offset;
     off_t size;
     uint16_t nbdflags;
+    bool zero_copy;
     QTAILQ_HEAD(, NBDClient) clients;
     QTAILQ_ENTRY(NBDExport) next;
 
@@ -78,10 +82,24 @@ struct NBDExport {
 
     BlockBackend *eject_notifier_blk;
     Notifier eject_notifier;
+
+    BdrvDirtyBitmap *export_bitmap;
+    char *export_bitmap_context;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
 
+/* NBDExportMetaContexts represents a list of contexts to be exported,
+ * as selected by NBD_OPT_SET_META_CONTEXT. Also used for
+ * NBD_OPT_LIST_META_CONTEXT. */
+typedef struct NBDExportMetaContexts {
+    char export_name[NBD_MAX_NAME_SIZE + 1];
+    bool valid; /* means that negotiation of the option finished without
+                   errors */
+    bool base_allocation; /* export base:allocation context (block status) */
+    bool bitmap; /* export qemu:dirty-bitmap:<export_bitmap name> */
+} NBDExportMetaContexts;
+
 struct NBDClient {
     int refcount;
     void (*close_fn)(NBDClient *client, bool negotiated);
@@ -91,6 +109,7 @@ struct NBDClient {
     char *tlsaclname;
     QIOChannelSocket *sioc; /* The underlying data channel */
     QIOChannel *ioc; /* The current I/O channel which may differ (eg TLS) */
+    AioContext *io_ctx; /* Serves the socket after negotiation, if non-NULL */
 
     Coroutine *recv_coroutine;
 
@@ -102,6 +121,7 @@ struct NBDClient {
     bool closing;
 
     bool structured_reply;
+    NBDExportMetaContexts export_meta;
 };
 
 /* That's all folks */
@@ -269,6 +289,15 @@ static int nbd_negotiate_handle_list(NBDClient *client, Error **errp)
     return nbd_negotiate_send_rep(client->ioc, NBD_REP_ACK, NBD_OPT_LIST, errp);
 }
 
+/* Meta contexts negotiated by NBD_OPT_SET_META_CONTEXT only apply to the
+ * export they were requested for; forget them if the client then selects
+ * a different export. */
+static void nbd_check_meta_export_name(NBDClient *client)
+{
+    client->export_meta.valid &= !strcmp(client->exp->name,
+                                         client->export_meta.export_name);
+}
+
 /* Send a reply to NBD_OPT_EXPORT_NAME.
  * Return -errno on error, 0 on success. */
 static int nbd_negotiate_handle_export_name(NBDClient *client, uint32_t length,
@@ -305,6 +334,7 @@ static int nbd_negotiate_handle_export_name(NBDClient *client, uint32_t length,
         error_setg(errp, "export not found");
         return -EINVAL;
     }
+    nbd_check_meta_export_name(client);
 
     trace_nbd_negotiate_new_style_size_flags(client->exp->size,
                                              client->exp->nbdflags | myflags);
@@ -511,6 +541,7 @@ static int nbd_negotiate_handle_info(NBDClient *client, uint32_t length,
         client->exp = exp;
         QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
         nbd_export_get(client->exp);
+        nbd_check_meta_export_name(client);
         rc = 1;
     }
     return rc;
@@ -524,6 +555,217 @@ static int nbd_negotiate_handle_info(NBDClient *client, uint32_t length,
 }
 
 
+/* Context IDs handed out by NBD_OPT_SET_META_CONTEXT.  At most one
+ * dirty bitmap is exported per export, so the IDs can be fixed. */
+#define NBD_META_ID_BASE_ALLOCATION 0
+#define NBD_META_ID_DIRTY_BITMAP    1
+
+/* Send one NBD_REP_META_CONTEXT reply to NBD_OPT_{LIST,SET}_META_CONTEXT.
+ * For NBD_OPT_LIST_META_CONTEXT @context_id is ignored, 0 is used instead.
+ * Return -errno on error, 0 on success. */
+static int nbd_negotiate_send_meta_context(NBDClient *client, uint32_t opt,
+                                           const char *context,
+                                           uint32_t context_id,
+                                           Error **errp)
+{
+    size_t len = strlen(context);
+    int rc;
+
+    if (opt == NBD_OPT_LIST_META_CONTEXT) {
+        context_id = 0;
+    }
+
+    trace_nbd_negotiate_meta_query_reply(context, context_id);
+    rc = nbd_negotiate_send_rep_len(client->ioc, NBD_REP_META_CONTEXT, opt,
+                                    sizeof(context_id) + len, errp);
+    if (rc < 0) {
+        return rc;
+    }
+    cpu_to_be32s(&context_id);
+    if (nbd_write(client->ioc, &context_id, sizeof(context_id), errp) < 0) {
+        return -EIO;
+    }
+    if (nbd_write(client->ioc, context, len, errp) < 0) {
+        return -EIO;
+    }
+    return 0;
+}
+
+/* Match a single query against the contexts offered by @exp and record
+ * any hit in @meta.  Queries for unknown contexts are silently ignored, as
+ * required by the NBD spec.  For NBD_OPT_LIST_META_CONTEXT, a bare
+ * namespace ("base:" or "qemu:dirty-bitmap:") matches every context in
+ * it. */
+static void nbd_meta_query(NBDExportMetaContexts *meta, NBDExport *exp,
+                           uint32_t opt, const char *query)
+{
+    bool list = opt == NBD_OPT_LIST_META_CONTEXT;
+
+    trace_nbd_negotiate_meta_query_parse(query);
+    if (!strcmp(query, "base:allocation") ||
+        (list && !strcmp(query, "base:"))) {
+        meta->base_allocation = true;
+    } else if (exp->export_bitmap &&
+               (!strcmp(query, exp->export_bitmap_context) ||
+                (list && !strcmp(query, "qemu:dirty-bitmap:")))) {
+        meta->bitmap = true;
+    } else {
+        trace_nbd_negotiate_meta_query_skip(query);
+    }
+}
+
+/* Handle NBD_OPT_LIST_META_CONTEXT and NBD_OPT_SET_META_CONTEXT.
+ * A successful NBD_OPT_SET_META_CONTEXT replaces the client's selection;
+ * NBD_OPT_LIST_META_CONTEXT leaves it untouched.
+ * Return -errno on error, 0 if ready for next option. */
+static int nbd_negotiate_meta_queries(NBDClient *client, uint32_t length,
+                                      uint32_t opt, Error **errp)
+{
+    int rc;
+    char name[NBD_MAX_NAME_SIZE + 1];
+    NBDExport *exp;
+    NBDExportMetaContexts local_meta;
+    NBDExportMetaContexts *meta;
+    uint32_t namelen;
+    uint32_t nb_queries;
+    uint32_t query_len;
+    char *query;
+    const char *msg;
+
+    if (!client->structured_reply) {
+        if (nbd_drop(client->ioc, length, errp) < 0) {
+            return -EIO;
+        }
+        return nbd_negotiate_send_rep_err(client->ioc, NBD_REP_ERR_INVALID,
+                                          opt, errp,
+                                          "structured replies not negotiated");
+    }
+
+    meta = opt == NBD_OPT_SET_META_CONTEXT ? &client->export_meta
+                                           : &local_meta;
+    memset(meta, 0, sizeof(*meta));
+
+    /* Client sends:
+        4 bytes: L, export name length
+        L bytes: export name
+        4 bytes: N, number of queries (can be 0)
+        N times:
+            4 bytes: Q, query length
+            Q bytes: query
+    */
+    if (length < sizeof(namelen) + sizeof(nb_queries)) {
+        msg = "overall request too short";
+        goto invalid;
+    }
+    if (nbd_read(client->ioc, &namelen, sizeof(namelen), errp) < 0) {
+        return -EIO;
+    }
+    be32_to_cpus(&namelen);
+    length -= sizeof(namelen);
+    if (namelen > length - sizeof(nb_queries)) {
+        msg = "name length is incorrect";
+        goto invalid;
+    }
+    if (namelen >= sizeof(name)) {
+        msg = "name too long for qemu";
+        goto invalid;
+    }
+    if (nbd_read(client->ioc, name, namelen, errp) < 0) {
+        return -EIO;
+    }
+    name[namelen] = '\0';
+    length -= namelen;
+    trace_nbd_negotiate_meta_context(nbd_opt_lookup(opt), name);
+
+    exp = nbd_export_find(name);
+    if (!exp) {
+        if (nbd_drop(client->ioc, length, errp) < 0) {
+            return -EIO;
+        }
+        return nbd_negotiate_send_rep_err(client->ioc, NBD_REP_ERR_UNKNOWN,
+                                          opt, errp, "export '%s' not present",
+                                          name);
+    }
+
+    if (nbd_read(client->ioc, &nb_queries, sizeof(nb_queries), errp) < 0) {
+        return -EIO;
+    }
+    be32_to_cpus(&nb_queries);
+    length -= sizeof(nb_queries);
+
+    if (!nb_queries && opt == NBD_OPT_LIST_META_CONTEXT) {
+        /* An empty list asks for everything the export has to offer */
+        meta->base_allocation = true;
+        meta->bitmap = !!exp->export_bitmap;
+    }
+
+    while (nb_queries--) {
+        if (length < sizeof(query_len)) {
+            msg = "query list is truncated";
+            goto invalid;
+        }
+        if (nbd_read(client->ioc, &query_len, sizeof(query_len), errp) < 0) {
+            return -EIO;
+        }
+        be32_to_cpus(&query_len);
+        length -= sizeof(query_len);
+        if (query_len > length) {
+            msg = "query length is incorrect";
+            goto invalid;
+        }
+
+        query = g_malloc(query_len + 1);
+        if (nbd_read(client->ioc, query, query_len, errp) < 0) {
+            g_free(query);
+            return -EIO;
+        }
+        query[query_len] = '\0';
+        length -= query_len;
+
+        nbd_meta_query(meta, exp, opt, query);
+        g_free(query);
+    }
+    if (length) {
+        msg = "trailing data after query list";
+        goto invalid;
+    }
+
+    if (meta->base_allocation) {
+        rc = nbd_negotiate_send_meta_context(client, opt, "base:allocation",
+                                             NBD_META_ID_BASE_ALLOCATION,
+                                             errp);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    if (meta->bitmap) {
+        rc = nbd_negotiate_send_meta_context(client, opt,
+                                             exp->export_bitmap_context,
+                                             NBD_META_ID_DIRTY_BITMAP,
+                                             errp);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    rc = nbd_negotiate_send_rep(client->ioc, NBD_REP_ACK, opt, errp);
+    if (rc == 0 && opt == NBD_OPT_SET_META_CONTEXT) {
+        pstrcpy(meta->export_name, sizeof(meta->export_name), name);
+        meta->valid = true;
+    }
+    return rc;
+
+ invalid:
+    memset(meta, 0, sizeof(*meta));
+    if (nbd_drop(client->ioc, length, errp) < 0) {
+        return -EIO;
+    }
+    return nbd_negotiate_send_rep_err(client->ioc, NBD_REP_ERR_INVALID, opt,
+                                      errp, "%s", msg);
+}
+
+
 /* Handle NBD_OPT_STARTTLS. Return NULL to drop connection, or else the
  * new channel for all further (now-encrypted) communication. */
 static QIOChannel *nbd_negotiate_handle_starttls(NBDClient *client,
@@ -799,6 +1041,12 @@ static int nbd_negotiate_options(NBDClient *client, uint16_t myflags,
                 }
                 break;
 
+            case NBD_OPT_LIST_META_CONTEXT:
+            case NBD_OPT_SET_META_CONTEXT:
+                ret = nbd_negotiate_meta_queries(client, length, option,
+                                                 errp);
+                break;
+
             default:
                 if (nbd_drop(client->ioc, length, errp) < 0) {
                     return -EIO;
@@ -943,42 +1191,70 @@ static int nbd_receive_request(QIOChannel *ioc, NBDRequest *request,
 
 #define MAX_NBD_REQUESTS 16
 
+/* Clients with their own I/O context drop their last reference and
+ * close from that context's thread, but the export's client list and the
+ * close_fn callbacks belong to the main loop.
+ */
+static bool nbd_client_off_main_loop(NBDClient *client)
+{
+    return client->io_ctx &&
+           qemu_get_current_aio_context() != qemu_get_aio_context();
+}
+
 void nbd_client_get(NBDClient *client)
 {
-    client->refcount++;
+    atomic_inc(&client->refcount);
+}
+
+static void nbd_client_free(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    qio_channel_detach_aio_context(client->ioc);
+    object_unref(OBJECT(client->sioc));
+    object_unref(OBJECT(client->ioc));
+    if (client->tlscreds) {
+        object_unref(OBJECT(client->tlscreds));
+    }
+    g_free(client->tlsaclname);
+    if (client->exp) {
+        QTAILQ_REMOVE(&client->exp->clients, client, next);
+        nbd_export_put(client->exp);
+    }
+    g_free(client);
 }
 
 void nbd_client_put(NBDClient *client)
 {
-    if (--client->refcount == 0) {
+    if (atomic_fetch_dec(&client->refcount) == 1) {
         /* The last reference should be dropped by client->close,
          * which is called by client_close.
          */
-        assert(client->closing);
+        assert(atomic_read(&client->closing));
 
-        qio_channel_detach_aio_context(client->ioc);
-        object_unref(OBJECT(client->sioc));
-        object_unref(OBJECT(client->ioc));
-        if (client->tlscreds) {
-            object_unref(OBJECT(client->tlscreds));
-        }
-        g_free(client->tlsaclname);
-        if (client->exp) {
-            QTAILQ_REMOVE(&client->exp->clients, client, next);
-            nbd_export_put(client->exp);
+        if (nbd_client_off_main_loop(client)) {
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    nbd_client_free, client);
+        } else {
+            nbd_client_free(client);
         }
-        g_free(client);
     }
 }
 
+static void client_close_bh(void *opaque)
+{
+    NBDClient *client = opaque;
+
+    /* Only transmission-phase failures are detected off the main loop */
+    client->close_fn(client, true);
+}
+
 static void client_close(NBDClient *client, bool negotiated)
 {
-    if (client->closing) {
+    if (atomic_xchg(&client->closing, true)) {
         return;
     }
 
-    client->closing = true;
-
     /* Force requests to finish.  They will drop their own references,
      * then we'll close the socket and free the NBDClient.
      */
@@ -987,8 +1263,48 @@ static void client_close(NBDClient *client, bool negotiated)
 
     /* Also tell the client, so that they release their reference.  */
     if (client->close_fn) {
-        client->close_fn(client, negotiated);
+        if (nbd_client_off_main_loop(client)) {
+            assert(negotiated);
+            aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                                    client_close_bh, client);
+        } else {
+            client->close_fn(client, negotiated);
+        }
+    }
+}
+
+typedef struct NBDCoMove {
+    AioContext *ctx;
+    Coroutine *co;
+} NBDCoMove;
+
+static void nbd_co_move_bh(void *opaque)
+{
+    NBDCoMove *move = opaque;
+
+    aio_co_schedule(move->ctx, move->co);
+}
+
+/* For clients served from their own I/O context, hop the calling
+ * coroutine over to @ctx.  Block layer requests must run in the export's
+ * AioContext, socket I/O in the client's.  The coroutine is only handed
+ * over from a bottom half in the current context, so that the target
+ * thread cannot enter it before it has yielded.
+ */
+static void coroutine_fn nbd_co_move_to(NBDClient *client, AioContext *ctx)
+{
+    AioContext *cur = qemu_get_current_aio_context();
+    NBDCoMove move = {
+        .ctx = ctx,
+        .co = qemu_coroutine_self(),
+    };
+
+    if (!client->io_ctx || cur == ctx) {
+        return;
     }
+
+    aio_bh_schedule_oneshot(cur, nbd_co_move_bh, &move);
+    qemu_coroutine_yield();
 }
 
 static NBDRequestData *nbd_request_get(NBDClient *client)
@@ -1001,6 +1317,7 @@ static NBDRequestData *nbd_request_get(NBDClient *client)
     req = g_new0(NBDRequestData, 1);
     nbd_client_get(client);
     req->client = client;
+    req->fd = -1;
     return req;
 }
 
@@ -1011,6 +1328,9 @@ static void nbd_request_put(NBDRequestData *req)
     if (req->data) {
         qemu_vfree(req->data);
     }
+    if (req->fd >= 0) {
+        close(req->fd);
+    }
     g_free(req);
 
     client->nb_requests--;
@@ -1029,6 +1349,9 @@ static void blk_aio_attached(AioContext *ctx, void *opaque)
     exp->ctx = ctx;
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
+        if (client->io_ctx) {
+            continue;
+        }
         qio_channel_attach_aio_context(client->ioc, ctx);
         if (client->recv_coroutine) {
             aio_co_schedule(ctx, client->recv_coroutine);
@@ -1047,7 +1370,9 @@ static void blk_aio_detach(void *opaque)
     trace_nbd_blk_aio_detach(exp->name, exp->ctx);
 
     QTAILQ_FOREACH(client, &exp->clients, next) {
-        qio_channel_detach_aio_context(client->ioc);
+        if (!client->io_ctx) {
+            qio_channel_detach_aio_context(client->ioc);
+        }
     }
 
     exp->ctx = NULL;
@@ -1164,6 +1489,13 @@ void nbd_export_set_description(NBDExport *exp, const char *description)
     exp->description = g_strdup(description);
 }
 
+/* Allow read replies to be sent straight from the image file, for clients
+ * without TLS, whenever the export is a raw file without throttling. */
+void nbd_export_set_zero_copy(NBDExport *exp, bool zero_copy)
+{
+    exp->zero_copy = zero_copy;
+}
+
 void nbd_export_close(NBDExport *exp)
 {
     NBDClient *client, *next;
@@ -1198,6 +1530,11 @@ void nbd_export_put(NBDExport *exp)
             exp->close(exp);
         }
 
+        if (exp->export_bitmap) {
+            bdrv_dirty_bitmap_set_qmp_locked(exp->export_bitmap, false);
+            g_free(exp->export_bitmap_context);
+        }
+
         if (exp->blk) {
             if (exp->eject_notifier_blk) {
                 notifier_remove(&exp->eject_notifier);
@@ -1227,6 +1564,51 @@ void nbd_export_close_all(void)
     }
 }
 
+/* Export the dirty bitmap @bitmap_name of the export's node (or of one of
+ * the nodes below it) as the qemu:dirty-bitmap:@bitmap_export_name meta
+ * context.  The bitmap stays locked against QMP modification until the
+ * export goes away. */
+void nbd_export_bitmap(NBDExport *exp, const char *bitmap,
+                       const char *bitmap_export_name, Error **errp)
+{
+    BdrvDirtyBitmap *bm = NULL;
+    BlockDriverState *bs = blk_bs(exp->blk);
+
+    if (exp->export_bitmap) {
+        error_setg(errp, "Export bitmap is already set");
+        return;
+    }
+
+    while (bs) {
+        bm = bdrv_find_dirty_bitmap(bs, bitmap);
+        if (bm != NULL) {
+            break;
+        }
+
+        bs = backing_bs(bs);
+    }
+
+    if (bm == NULL) {
+        error_setg(errp, "Bitmap '%s' is not found", bitmap);
+        return;
+    }
+
+    if (bdrv_dirty_bitmap_frozen(bm)) {
+        error_setg(errp, "Bitmap '%s' is frozen", bitmap);
+        return;
+    }
+
+    if (bdrv_dirty_bitmap_qmp_locked(bm)) {
+        error_setg(errp, "Bitmap '%s' is locked", bitmap);
+        return;
+    }
+
+    bdrv_dirty_bitmap_set_qmp_locked(bm, true);
+    exp->export_bitmap = bm;
+    exp->export_bitmap_context =
+            g_strdup_printf("qemu:dirty-bitmap:%s", bitmap_export_name);
+}
+
 static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
                                         unsigned niov, Error **errp)
 {
@@ -1320,6 +1702,110 @@ static int coroutine_fn nbd_co_send_structured_read(NBDClient *client,
     return nbd_co_send_iov(client, iov, 2, errp);
 }
 
+/* Take a private duplicate of the descriptor holding the image data, so
+ * that the reply to @request can be spliced from it even if the block
+ * graph changes in the meantime.  Return false if the data has to go
+ * through the block layer instead. */
+static bool nbd_request_dup_file(NBDRequestData *req, NBDRequest *request)
+{
+    NBDClient *client = req->client;
+    NBDExport *exp = client->exp;
+    BlockDriverState *bs = blk_bs(exp->blk);
+    int64_t host_offset;
+    int fd;
+
+    if (!exp->zero_copy || !request->len ||
+        client->ioc != QIO_CHANNEL(client->sioc) ||
+        blk_get_public(exp->blk)->throttle_group_member.throttle_state ||
+        !bs) {
+        return false;
+    }
+
+    fd = bdrv_get_host_fd(bs, &host_offset);
+    if (fd < 0) {
+        return false;
+    }
+
+    req->fd = qemu_dup(fd);
+    if (req->fd < 0) {
+        return false;
+    }
+    req->fd_offset = host_offset + exp->dev_offset + request->from;
+    return true;
+}
+
+/* Send the reply to a read request whose data is to be taken from req->fd
+ * without copying it through userspace.  If the kernel cannot do so, the
+ * data is read through the block layer into req->data instead. */
+static int coroutine_fn nbd_co_send_file_read(NBDRequestData *req,
+                                              NBDRequest *request,
+                                              Error **errp)
+{
+    NBDClient *client = req->client;
+    NBDExport *exp = client->exp;
+    NBDStructuredReadData chunk;
+    NBDSimpleReply reply;
+    struct iovec iov;
+    size_t done = 0;
+    ssize_t len;
+    int ret;
+
+    trace_nbd_co_send_file_read(request->handle, request->from, request->len);
+    if (client->structured_reply) {
+        set_be_chunk(&chunk.h, NBD_REPLY_FLAG_DONE, NBD_REPLY_TYPE_OFFSET_DATA,
+                     request->handle,
+                     sizeof(chunk) - sizeof(chunk.h) + request->len);
+        stq_be_p(&chunk.offset, request->from);
+        iov.iov_base = &chunk;
+        iov.iov_len = sizeof(chunk);
+    } else {
+        set_be_simple_reply(&reply, 0, request->handle);
+        iov.iov_base = &reply;
+        iov.iov_len = sizeof(reply);
+    }
+
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    ret = qio_channel_writev_all(client->ioc, &iov, 1, errp);
+    while (ret == 0 && done < request->len) {
+        len = qio_channel_socket_sendfile(client->sioc, req->fd,
+                                          req->fd_offset + done,
+                                          request->len - done,
+                                          done ? errp : NULL);
+        if (len == QIO_CHANNEL_ERR_BLOCK) {
+            qio_channel_yield(client->ioc, G_IO_OUT);
+        } else if (len > 0) {
+            done += len;
+        } else if (done) {
+            if (len == 0) {
+                error_setg(errp, "Unexpected end of file");
+            }
+            ret = -1;
+        } else {
+            /* Nothing sent yet, so the payload can still come from the
+             * bounce buffer */
+            trace_nbd_co_send_file_read_fallback(request->handle);
+            nbd_co_move_to(client, exp->ctx);
+            ret = blk_pread(exp->blk, request->from + exp->dev_offset,
+                            req->data, request->len);
+            nbd_co_move_to(client, client->io_ctx);
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "reading from file failed");
+                break;
+            }
+            ret = qio_channel_write_all(client->ioc, (char *)req->data,
+                                        request->len, errp);
+            break;
+        }
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret < 0 ? -EIO : 0;
+}
+
 static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
                                                      uint64_t handle,
                                                      uint32_t error,
@@ -1344,6 +1830,177 @@ static int coroutine_fn nbd_co_send_structured_error(NBDClient *client,
     return nbd_co_send_iov(client, iov, 1 + !!iov[1].iov_len, errp);
 }
 
+/* Upper bound on the number of extents sent in a single
+ * NBD_REPLY_TYPE_BLOCK_STATUS chunk; the client is free to ask again for
+ * whatever remains of the range. */
+#define NBD_MAX_BITMAP_EXTENTS (0x100000 / sizeof(NBDExtent))
+
+/* Fill @extents with the allocation status of @bytes starting at @offset,
+ * merging neighbouring areas with equal flags.  Set *@nb_extents to the
+ * number of extents used (at most its input value).
+ * Return -errno on failure, 0 on success. */
+static int blockstatus_to_extents(BlockDriverState *bs, uint64_t offset,
+                                  uint64_t bytes, NBDExtent *extents,
+                                  unsigned int *nb_extents)
+{
+    unsigned int i = 0;
+
+    while (bytes) {
+        uint32_t flags;
+        int64_t num;
+        int ret = bdrv_block_status_above(bs, NULL, offset, bytes, &num,
+                                          NULL, NULL);
+        if (ret < 0) {
+            return ret;
+        }
+
+        flags = (ret & BDRV_BLOCK_ALLOCATED ? 0 : NBD_STATE_HOLE) |
+                (ret & BDRV_BLOCK_ZERO      ? NBD_STATE_ZERO : 0);
+
+        if (i > 0 && extents[i - 1].flags == flags) {
+            extents[i - 1].length += num;
+        } else if (i < *nb_extents) {
+            extents[i].length = num;
+            extents[i].flags = flags;
+            i++;
+        } else {
+            break;
+        }
+
+        offset += num;
+        bytes -= num;
+    }
+
+    *nb_extents = i;
+    return 0;
+}
+
+/* Fill @extents with the dirty status of @length bytes of @bitmap starting
+ * at @offset.  Return the number of extents used (at most @nb_extents). */
+static unsigned int bitmap_to_extents(BdrvDirtyBitmap *bitmap,
+                                      uint64_t offset, uint64_t length,
+                                      NBDExtent *extents,
+                                      unsigned int nb_extents)
+{
+    uint64_t begin = offset, end = offset + length;
+    uint64_t size = bdrv_dirty_bitmap_size(bitmap);
+    BdrvDirtyBitmapIter *it;
+    unsigned int i = 0;
+    bool dirty;
+
+    end = MIN(end, size);
+
+    bdrv_dirty_bitmap_lock(bitmap);
+    it = bdrv_dirty_iter_new(bitmap);
+    dirty = begin < end && bdrv_get_dirty_locked(NULL, bitmap, begin);
+
+    while (begin < end && i < nb_extents) {
+        int64_t next;
+
+        if (dirty) {
+            next = bdrv_dirty_bitmap_next_zero(bitmap, begin);
+        } else {
+            bdrv_set_dirty_iter(it, begin);
+            next = bdrv_dirty_iter_next(it);
+        }
+        if (next < 0 || next > end || next <= begin) {
+            next = end;
+        }
+
+        extents[i].length = next - begin;
+        extents[i].flags = dirty ? NBD_STATE_DIRTY : 0;
+        i++;
+
+        begin = next;
+        dirty = !dirty;
+    }
+
+    bdrv_dirty_iter_free(it);
+    bdrv_dirty_bitmap_unlock(bitmap);
+
+    return i;
+}
+
+static int coroutine_fn nbd_co_send_extents(NBDClient *client,
+                                            uint64_t handle,
+                                            NBDExtent *extents,
+                                            unsigned int nb_extents,
+                                            uint32_t context_id,
+                                            bool last,
+                                            Error **errp)
+{
+    NBDStructuredMeta chunk;
+    unsigned int i;
+    struct iovec iov[] = {
+        {.iov_base = &chunk, .iov_len = sizeof(chunk)},
+        {.iov_base = extents, .iov_len = nb_extents * sizeof(extents[0])}
+    };
+
+    trace_nbd_co_send_extents(handle, nb_extents, context_id, last);
+    for (i = 0; i < nb_extents; i++) {
+        cpu_to_be32s(&extents[i].length);
+        cpu_to_be32s(&extents[i].flags);
+    }
+
+    set_be_chunk(&chunk.h, last ? NBD_REPLY_FLAG_DONE : 0,
+                 NBD_REPLY_TYPE_BLOCK_STATUS,
+                 handle, sizeof(chunk) - sizeof(chunk.h) + iov[1].iov_len);
+    stl_be_p(&chunk.context_id, context_id);
+
+    return nbd_co_send_iov(client, iov, 2, errp);
+}
+
+/* Reply to NBD_CMD_BLOCK_STATUS with one chunk per negotiated meta
+ * context.  Errors from the block layer are reported to the client as a
+ * structured error.
+ * Return -errno if sending failed, 0 on success. */
+static int coroutine_fn nbd_co_send_block_status(NBDClient *client,
+                                                 NBDRequest *request,
+                                                 Error **errp)
+{
+    NBDExport *exp = client->exp;
+    uint64_t offset = request->from + exp->dev_offset;
+    unsigned int max_extents = request->flags & NBD_CMD_FLAG_REQ_ONE ?
+                               1 : NBD_MAX_BITMAP_EXTENTS;
+    NBDExtent *extents = g_new(NBDExtent, max_extents);
+    unsigned int nb_extents;
+    int ret = 0;
+
+    if (client->export_meta.base_allocation) {
+        nb_extents = max_extents;
+        ret = blockstatus_to_extents(blk_bs(exp->blk), offset, request->len,
+                                     extents, &nb_extents);
+        nbd_co_move_to(client, client->io_ctx);
+        if (ret < 0) {
+            ret = nbd_co_send_structured_error(client, request->handle, -ret,
+                                               "can't get block status",
+                                               errp);
+            goto out;
+        }
+
+        ret = nbd_co_send_extents(client, request->handle, extents,
+                                  nb_extents, NBD_META_ID_BASE_ALLOCATION,
+                                  !client->export_meta.bitmap, errp);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    if (client->export_meta.bitmap) {
+        nbd_co_move_to(client, exp->ctx);
+        nb_extents = bitmap_to_extents(exp->export_bitmap, offset,
+                                       request->len, extents, max_extents);
+        nbd_co_move_to(client, client->io_ctx);
+        ret = nbd_co_send_extents(client, request->handle, extents,
+                                  nb_extents, NBD_META_ID_DIRTY_BITMAP,
+                                  true, errp);
+    }
+
+out:
+    g_free(extents);
+    return ret;
+}
+
 /* nbd_co_receive_request
  * Collect a client request. Return 0 if request looks valid, -EIO to drop
  * connection right away, and any other negative value to report an error to
@@ -1421,6 +2078,8 @@ static int nbd_co_receive_request(NBDRequestData *req, NBDRequest *request,
         valid_flags |= NBD_CMD_FLAG_DF;
     } else if (request->type == NBD_CMD_WRITE_ZEROES) {
         valid_flags |= NBD_CMD_FLAG_NO_HOLE;
+    } else if (request->type == NBD_CMD_BLOCK_STATUS) {
+        valid_flags |= NBD_CMD_FLAG_REQ_ONE;
     }
     if (request->flags & ~valid_flags) {
         error_setg(errp, "unsupported flags for command %s (got 0x%x)",
@@ -1445,7 +2104,7 @@ static coroutine_fn void nbd_trip(void *opaque)
     char *msg = NULL;
 
     trace_nbd_trip();
-    if (client->closing) {
+    if (atomic_read(&client->closing)) {
         nbd_client_put(client);
         return;
     }
@@ -1462,7 +2121,7 @@ static coroutine_fn void nbd_trip(void *opaque)
         goto reply;
     }
 
-    if (client->closing) {
+    if (atomic_read(&client->closing)) {
         /*
          * The client may be closed when we are blocked in
          * nbd_co_receive_request()
@@ -1470,6 +2129,8 @@ static coroutine_fn void nbd_trip(void *opaque)
         goto done;
     }
 
+    nbd_co_move_to(client, exp->ctx);
+
     switch (request.type) {
     case NBD_CMD_READ:
         /* XXX: NBD Protocol only documents use of FUA with WRITE */
@@ -1481,6 +2142,11 @@ static coroutine_fn void nbd_trip(void *opaque)
             }
         }
 
+        if (nbd_request_dup_file(req, &request)) {
+            reply_data_len = request.len;
+            break;
+        }
+
         ret = blk_pread(exp->blk, request.from + exp->dev_offset,
                         req->data, request.len);
         if (ret < 0) {
@@ -1537,12 +2203,32 @@ static coroutine_fn void nbd_trip(void *opaque)
         }
 
         break;
+    case NBD_CMD_BLOCK_STATUS:
+        if (!client->export_meta.valid ||
+            (!client->export_meta.base_allocation &&
+             !client->export_meta.bitmap)) {
+            error_setg(&local_err, "CMD_BLOCK_STATUS not negotiated");
+            ret = -EINVAL;
+            break;
+        }
+
+        /* The reply is sent (possibly as several chunks) right here, and
+         * we are back in the client's context afterwards */
+        ret = nbd_co_send_block_status(client, &request, &local_err);
+        if (ret < 0) {
+            error_prepend(&local_err, "Failed to send reply: ");
+            goto disconnect;
+        }
+        goto done;
+
     default:
         error_setg(&local_err, "invalid request type (%" PRIu32 ") received",
                    request.type);
         ret = -EINVAL;
     }
 
+    nbd_co_move_to(client, client->io_ctx);
+
 reply:
     if (local_err) {
         /* If we get here, local_err was not a fatal error, and should be sent
@@ -1553,8 +2239,10 @@ reply:
         local_err = NULL;
     }
 
-    if (client->structured_reply &&
-        (ret < 0 || request.type == NBD_CMD_READ)) {
+    if (req->fd >= 0 && ret >= 0) {
+        ret = nbd_co_send_file_read(req, &request, &local_err);
+    } else if (client->structured_reply &&
+               (ret < 0 || request.type == NBD_CMD_READ)) {
         if (ret < 0) {
             ret = nbd_co_send_structured_error(req->client, request.handle,
                                                -ret, msg, &local_err);
@@ -1604,7 +2292,8 @@ static void nbd_client_receive_next_request(NBDClient *client)
     if (!client->recv_coroutine && client->nb_requests < MAX_NBD_REQUESTS) {
         nbd_client_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, client);
-        aio_co_schedule(client->exp->ctx, client->recv_coroutine);
+        aio_co_schedule(client->io_ctx ?: client->exp->ctx,
+                        client->recv_coroutine);
     }
 }
 
@@ -1628,6 +2317,9 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
         return;
     }
 
+    if (client->io_ctx) {
+        qio_channel_attach_aio_context(client->ioc, client->io_ctx);
+    }
     nbd_client_receive_next_request(client);
 }
 
@@ -1635,12 +2327,15 @@ static coroutine_fn void nbd_co_client_start(void *opaque)
  * Create a new client listener on the given export @exp, using the
  * given channel @sioc.  Begin servicing it in a coroutine.  When the
  * connection closes, call @close_fn with an indication of whether the
- * client completed negotiation.
+ * client completed negotiation.  If @io_ctx is non-NULL, the socket is
+ * served from that context once negotiation is over, while the block
+ * layer is still accessed from the export's AioContext.
  */
 void nbd_client_new(NBDExport *exp,
                     QIOChannelSocket *sioc,
                     QCryptoTLSCreds *tlscreds,
                     const char *tlsaclname,
+                    AioContext *io_ctx,
                     void (*close_fn)(NBDClient *, bool))
 {
     NBDClient *client;
@@ -1658,6 +2353,7 @@ void nbd_client_new(NBDExport *exp,
     object_ref(OBJECT(client->sioc));
     client->ioc = QIO_CHANNEL(sioc);
     object_ref(OBJECT(client->ioc));
+    client->io_ctx = io_ctx;
     client->close_fn = close_fn;
 
     co = qemu_coroutine_create(nbd_co_client_start, client);
@@ -0,0 +1,606 @@
+/*
+ * AF_XDP network backend.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/sockios.h>
+#include <xdp/xsk.h>
+
+#include "net/net.h"
+#include "clients.h"
+#include "block/aio.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "sysemu/iothread.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "qemu/iov.h"
+#include "qemu/cutils.h"
+
+/* Number of descriptors processed at once */
+#define AF_XDP_BATCH_SIZE 64
+
+typedef struct AFXDPState {
+    NetClientState       nc;
+
+    struct xsk_socket    *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+
+    char                 ifname[IFNAMSIZ];
+    IOThread             *iothread;
+    AioContext           *ctx;
+    QemuEvent            detached;
+    bool                 read_poll;
+    bool                 write_poll;
+    bool                 tx_kick;
+    uint32_t             outstanding_tx;
+
+    /* Free UMEM frames */
+    uint64_t             *pool;
+    uint32_t             n_pool;
+    char                 *buffer;
+    struct xsk_umem      *umem;
+} AFXDPState;
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+static bool af_xdp_poll_rings(void *opaque);
+
+/* Set the event-loop handlers for the AF_XDP socket.  In an IOThread,
+ * aio_poll() busy-waits on the rings through af_xdp_poll_rings() before
+ * it goes to sleep in ppoll().  This can be called from the IOThread or,
+ * with the BQL held, from the main loop.
+ */
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk), false,
+                       s->read_poll ? af_xdp_send : NULL,
+                       s->write_poll ? af_xdp_writable : NULL,
+                       s->read_poll || s->write_poll ? af_xdp_poll_rings
+                                                     : NULL,
+                       s);
+}
+
+/* The handlers may run in an IOThread, but the net layer and the peer
+ * expect the BQL.  Return whether it was taken, for af_xdp_unlock().
+ */
+static bool af_xdp_lock(void)
+{
+    if (qemu_mutex_iothread_locked()) {
+        return false;
+    }
+    qemu_mutex_lock_iothread();
+    return true;
+}
+
+static void af_xdp_unlock(bool taken)
+{
+    if (taken) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+/* Update the read handler. */
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Update the write handler. */
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll  = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Return the frames of transmitted packets to the pool. */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, AF_XDP_BATCH_SIZE, &idx);
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+        s->outstanding_tx -= done;
+    }
+}
+
+static void af_xdp_kick_tx(AFXDPState *s)
+{
+    s->tx_kick = false;
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        sendto(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, 0);
+    }
+}
+
+/*
+ * The fd_write() callback, invoked if the fd is marked as
+ * writable after a poll. Unregister the handler and flush any
+ * buffered packets.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+    bool taken = af_xdp_lock();
+
+    af_xdp_complete_tx(s);
+    af_xdp_write_poll(s, false);
+    qemu_flush_queued_packets(&s->nc);
+    af_xdp_unlock(taken);
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    size_t size = iov_size(iov, iovcnt);
+    struct xdp_desc *desc;
+    uint32_t idx;
+
+    if (unlikely(size > XSK_UMEM__DEFAULT_FRAME_SIZE)) {
+        /* Drop. */
+        return size;
+    }
+
+    af_xdp_complete_tx(s);
+
+    if (!s->n_pool || !xsk_ring_prod__reserve(&s->tx, 1, &idx)) {
+        /* No free frames or TX descriptors, wait for completions. */
+        if (s->tx_kick) {
+            af_xdp_kick_tx(s);
+        }
+        af_xdp_write_poll(s, true);
+        return 0;
+    }
+
+    desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = size;
+    iov_to_buf(iov, iovcnt, 0, xsk_umem__get_data(s->buffer, desc->addr),
+               size);
+
+    xsk_ring_prod__submit(&s->tx, 1);
+    s->outstanding_tx++;
+
+    /* Within a batch, wake up the kernel only once at the end. */
+    s->tx_kick = true;
+    if (!nc->receive_batch) {
+        af_xdp_kick_tx(s);
+    }
+
+    return size;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+static void af_xdp_receive_flush(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->tx_kick) {
+        af_xdp_kick_tx(s);
+    }
+}
+
+/* Give free frames to the kernel for receiving. */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t i, idx = 0;
+
+    /* Leave one frame in reserve for sending. */
+    if (!n || !s->n_pool || s->n_pool - 1 < n) {
+        return;
+    }
+
+    if (xsk_ring_prod__reserve(&s->fq, n, &idx) != n) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (s->xsk && xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Receive was blocked by not having enough buffers.  Wake it up. */
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+    }
+}
+
+/* Complete a previous send (backend --> guest) and enable the
+   fd_read callback. */
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    struct iovec iov[AF_XDP_BATCH_SIZE];
+    NetPacketIOV pkts[AF_XDP_BATCH_SIZE];
+    uint32_t i, n, sent, idx = 0;
+    bool taken = af_xdp_lock();
+
+    n = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n) {
+        af_xdp_unlock(taken);
+        return;
+    }
+
+    /* The peer reads the packets straight out of the UMEM. */
+    for (i = 0; i < n; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx + i);
+
+        iov[i].iov_base = xsk_umem__get_data(s->buffer, desc->addr);
+        iov[i].iov_len = desc->len;
+        pkts[i].iov = &iov[i];
+        pkts[i].iovcnt = 1;
+    }
+
+    sent = qemu_sendv_packets_async(&s->nc, pkts, n, af_xdp_send_completed);
+    if (sent < n) {
+        /* The peer does not receive anymore.  The next packet was copied
+         * into its queue; leave the rest in the RX ring and stop reading
+         * until af_xdp_send_completed().
+         */
+        xsk_ring_cons__cancel(&s->rx, n - sent - 1);
+        n = sent + 1;
+        af_xdp_read_poll(s, false);
+    }
+
+    for (i = 0; i < n; i++) {
+        s->pool[s->n_pool++] = xsk_ring_cons__rx_desc(&s->rx, idx + i)->addr;
+    }
+    xsk_ring_cons__release(&s->rx, n);
+
+    af_xdp_fq_refill(s, n);
+    af_xdp_unlock(taken);
+}
+
+/* Whether the kernel has produced entries that were not consumed yet.
+ * Only the indices are read, so this is safe without the BQL.
+ */
+static bool af_xdp_ring_pending(struct xsk_ring_cons *r)
+{
+    return atomic_load_acquire(r->producer) != atomic_read(r->consumer);
+}
+
+/* The io_poll() callback: look for received packets in the RX ring and,
+ * while waiting for free TX descriptors, for completions in the
+ * completion ring.  Taking the BQL is left to the handlers, so that
+ * polling an idle socket does not contend with the vCPUs.
+ */
+static bool af_xdp_poll_rings(void *opaque)
+{
+    AFXDPState *s = opaque;
+    bool progress = false;
+
+    if (atomic_read(&s->read_poll) && af_xdp_ring_pending(&s->rx)) {
+        af_xdp_send(s);
+        progress = true;
+    }
+    if (atomic_read(&s->write_poll) && af_xdp_ring_pending(&s->cq)) {
+        af_xdp_writable(s);
+        progress = true;
+    }
+    return progress;
+}
+
+static void af_xdp_detach_bh(void *opaque)
+{
+    AFXDPState *s = opaque;
+
+    aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk), false,
+                       NULL, NULL, NULL, NULL);
+    qemu_event_set(&s->detached);
+}
+
+/* Remove the event-loop handlers.  A handler may be running in the
+ * IOThread, possibly waiting for the BQL; remove them from a bottom half
+ * in the IOThread and drop the BQL until that has run, so that none of
+ * them is still using @s afterwards.
+ */
+static void af_xdp_detach(AFXDPState *s)
+{
+    s->read_poll = false;
+    s->write_poll = false;
+
+    if (!s->iothread || s->iothread->stopping) {
+        af_xdp_update_fd_handler(s);
+        return;
+    }
+
+    qemu_event_init(&s->detached, false);
+    aio_bh_schedule_oneshot(s->ctx, af_xdp_detach_bh, s);
+    qemu_mutex_unlock_iothread();
+    qemu_event_wait(&s->detached);
+    qemu_mutex_lock_iothread();
+    qemu_event_destroy(&s->detached);
+}
+
+/* Flush and close. */
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_detach(s);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    if (s->iothread) {
+        object_unref(OBJECT(s->iothread));
+        s->iothread = NULL;
+    }
+    if (s->umem) {
+        xsk_umem__delete(s->umem);
+        s->umem = NULL;
+    }
+    qemu_vfree(s->buffer);
+    s->buffer = NULL;
+    g_free(s->pool);
+    s->pool = NULL;
+}
+
+static int af_xdp_umem_create(AFXDPState *s, Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = XSK_UMEM__DEFAULT_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    uint64_t n_descs;
+    uint64_t size;
+    int64_t i;
+    int ret;
+
+    /* Number of descriptors if all 4 queues (rx, tx, cq, fq) are full. */
+    n_descs = (XSK_RING_PROD__DEFAULT_NUM_DESCS
+               + XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2;
+    size = n_descs * XSK_UMEM__DEFAULT_FRAME_SIZE;
+
+    s->buffer = qemu_memalign(getpagesize(), size);
+    memset(s->buffer, 0, size);
+
+    ret = xsk_umem__create(&s->umem, s->buffer, size,
+                           &s->fq, &s->cq, &config);
+    if (ret) {
+        qemu_vfree(s->buffer);
+        s->buffer = NULL;
+        error_setg_errno(errp, -ret,
+                         "failed to create AF_XDP UMEM for %s", s->ifname);
+        return -1;
+    }
+
+    s->pool = g_new(uint64_t, n_descs);
+    /* Fill the pool in the opposite order, because it's a LIFO queue. */
+    for (i = n_descs - 1; i >= 0; i--) {
+        s->pool[i] = i * XSK_UMEM__DEFAULT_FRAME_SIZE;
+    }
+    s->n_pool = n_descs;
+
+    af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+
+    return 0;
+}
+
+static int af_xdp_socket_create(AFXDPState *s, int queue_id,
+                                const NetdevAFXDPOptions *opts, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .libxdp_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int ret = -1;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    if (!opts->has_mode || opts->mode == AFXDP_MODE_NATIVE) {
+        /* Try zero-copy first, then copy mode in the same attach mode. */
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+        if (!(cfg.bind_flags & XDP_COPY)) {
+            cfg.bind_flags |= XDP_ZEROCOPY;
+            ret = xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                     s->umem, &s->rx, &s->tx, &cfg);
+            cfg.bind_flags &= ~XDP_ZEROCOPY;
+        }
+        if (ret) {
+            ret = xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                     s->umem, &s->rx, &s->tx, &cfg);
+        }
+        cfg.xdp_flags &= ~XDP_FLAGS_DRV_MODE;
+    }
+
+    if (ret && (!opts->has_mode || opts->mode == AFXDP_MODE_SKB)) {
+        /* No need to try zero-copy in generic mode. */
+        cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+        ret = xsk_socket__create(&s->xsk, s->ifname, queue_id,
+                                 s->umem, &s->rx, &s->tx, &cfg);
+    }
+
+    if (ret) {
+        s->xsk = NULL;
+        error_setg_errno(errp, -ret,
+                         "failed to create AF_XDP socket for %s queue_id: %d",
+                         s->ifname, queue_id);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Return the number of queues of @ifname, or -errno if the driver
+ * does not report it.
+ */
+static int af_xdp_get_channels(const char *ifname)
+{
+    struct ethtool_channels channels = { .cmd = ETHTOOL_GCHANNELS };
+    struct ifreq ifr = { .ifr_data = (void *)&channels };
+    int fd, ret;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        return -errno;
+    }
+
+    pstrcpy(ifr.ifr_name, sizeof(ifr.ifr_name), ifname);
+    ret = ioctl(fd, SIOCETHTOOL, &ifr);
+    if (ret < 0) {
+        ret = -errno;
+    } else {
+        ret = channels.combined_count +
+              MAX(channels.rx_count, channels.tx_count);
+    }
+    close(fd);
+    return ret;
+}
+
+/* NetClientInfo methods */
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .receive_flush = af_xdp_receive_flush,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+};
+
+/* The exported init function
+ *
+ * ... -netdev af-xdp,ifname="..."
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    int64_t i, queues, start_queue;
+    int channels;
+    IOThread *iothread = NULL;
+    Error *err = NULL;
+    AFXDPState *s;
+
+    if (!if_nametoindex(opts->ifname)) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    queues = opts->has_queues ? opts->queues : 1;
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "invalid number of queues (%" PRIi64 ") for '%s'",
+                   queues, opts->ifname);
+        return -1;
+    }
+
+    start_queue = opts->has_start_queue ? opts->start_queue : 0;
+    if (start_queue < 0) {
+        error_setg(errp, "invalid start queue (%" PRIi64 ") for '%s'",
+                   start_queue, opts->ifname);
+        return -1;
+    }
+
+    if (opts->has_iothread) {
+        iothread = iothread_by_id(opts->iothread);
+        if (!iothread) {
+            error_setg(errp, "iothread '%s' not found", opts->iothread);
+            return -1;
+        }
+    }
+
+    /* If the driver does not tell, binding the socket will fail instead. */
+    channels = af_xdp_get_channels(opts->ifname);
+    if (channels > 0 && start_queue + queues > channels) {
+        error_setg(errp, "start queue %" PRIi64 " and %" PRIi64 " queues "
+                   "exceed the %d queues of '%s'",
+                   start_queue, queues, channels, opts->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        int queue_id = start_queue + i;
+
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "af-xdp%"PRIi64" to %s", i, opts->ifname);
+        if (!i) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        if (iothread) {
+            s->iothread = iothread;
+            object_ref(OBJECT(iothread));
+            s->ctx = iothread_get_aio_context(iothread);
+        } else {
+            s->ctx = iohandler_get_aio_context();
+        }
+
+        if (af_xdp_umem_create(s, &err) ||
+            af_xdp_socket_create(s, queue_id, opts, &err)) {
+            goto err;
+        }
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    return 0;
+
+err:
+    if (nc0) {
+        qemu_del_net_client(nc0);
+    }
+    error_propagate(errp, err);
+    return -1;
+}
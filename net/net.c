@@ -249,6 +249,23 @@ static void qemu_net_client_destructor(NetClientState *nc)
     g_free(nc);
 }
 
+static void qemu_receive_batch_begin(void *opaque)
+{
+    NetClientState *nc = opaque;
+
+    nc->receive_batch++;
+}
+
+static void qemu_receive_batch_end(void *opaque)
+{
+    NetClientState *nc = opaque;
+
+    assert(nc->receive_batch > 0);
+    if (--nc->receive_batch == 0 && nc->info->receive_flush) {
+        nc->info->receive_flush(nc);
+    }
+}
+
 static void qemu_net_client_setup(NetClientState *nc,
                                   NetClientInfo *info,
                                   NetClientState *peer,
@@ -272,6 +289,9 @@ static void qemu_net_client_setup(NetClientState *nc,
     QTAILQ_INSERT_TAIL(&net_clients, nc, next);
 
     nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov, nc);
+    qemu_net_queue_set_batch_handlers(nc->incoming_queue,
+                                      qemu_receive_batch_begin,
+                                      qemu_receive_batch_end);
     nc->destructor = destructor;
     QTAILQ_INIT(&nc->filters);
 }
@@ -790,6 +810,58 @@ qemu_sendv_packet(NetClientState *nc, const struct iovec *iov, int iovcnt)
     return qemu_sendv_packet_async(nc, iov, iovcnt, NULL);
 }
 
+/* Bracket a run of sends from @nc, so that the peer can defer per-packet
+ * completion work until qemu_net_batch_end().
+ */
+void qemu_net_batch_begin(NetClientState *nc)
+{
+    if (nc->peer) {
+        qemu_receive_batch_begin(nc->peer);
+    }
+}
+
+void qemu_net_batch_end(NetClientState *nc)
+{
+    if (nc->peer) {
+        qemu_receive_batch_end(nc->peer);
+    }
+}
+
+/* Send @count packets.  Returns the number of packets that were delivered
+ * or dropped; if this is less than @count, the next packet has been queued
+ * and the caller must wait for @sent_cb before resubmitting the rest.
+ */
+int qemu_sendv_packets_async(NetClientState *sender,
+                             const NetPacketIOV *pkts, int count,
+                             NetPacketSent *sent_cb)
+{
+    int i;
+
+    if (sender->link_down || !sender->peer) {
+        return count;
+    }
+
+    if (QTAILQ_EMPTY(&sender->filters) &&
+        QTAILQ_EMPTY(&sender->peer->filters)) {
+        return qemu_net_queue_send_iov_batch(sender->peer->incoming_queue,
+                                             sender,
+                                             QEMU_NET_PACKET_FLAG_NONE,
+                                             pkts, count, sent_cb);
+    }
+
+    /* Filters work on one packet at a time */
+    qemu_net_batch_begin(sender);
+    for (i = 0; i < count; i++) {
+        if (qemu_sendv_packet_async(sender, pkts[i].iov, pkts[i].iovcnt,
+                                    sent_cb) == 0 && sent_cb) {
+            break;
+        }
+    }
+    qemu_net_batch_end(sender);
+
+    return i;
+}
+
 NetClientState *qemu_find_netdev(const char *id)
 {
     NetClientState *nc;
@@ -963,6 +1035,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #endif
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
+#endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
 #endif
         [NET_CLIENT_DRIVER_DUMP]      = net_init_dump,
 #ifdef CONFIG_NET_BRIDGE
@@ -38,6 +38,9 @@
  *
  * If a sent callback isn't provided, we just drop the packet to avoid
  * unbounded queueing.
+ *
+ * The same rules apply to each packet of a multi-packet send; the first
+ * packet that cannot be delivered stops the batch.
  */
 
 struct NetPacket {
@@ -54,6 +57,8 @@ struct NetQueue {
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
+    NetQueueBatchFunc *batch_begin;
+    NetQueueBatchFunc *batch_end;
 
     QTAILQ_HEAD(packets, NetPacket) packets;
 
@@ -78,6 +83,28 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     return queue;
 }
 
+void qemu_net_queue_set_batch_handlers(NetQueue *queue,
+                                       NetQueueBatchFunc *begin,
+                                       NetQueueBatchFunc *end)
+{
+    queue->batch_begin = begin;
+    queue->batch_end = end;
+}
+
+static void qemu_net_queue_batch_begin(NetQueue *queue)
+{
+    if (queue->batch_begin) {
+        queue->batch_begin(queue->opaque);
+    }
+}
+
+static void qemu_net_queue_batch_end(NetQueue *queue)
+{
+    if (queue->batch_end) {
+        queue->batch_end(queue->opaque);
+    }
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
@@ -232,6 +259,76 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/* Queue what is left of a batch.  With a sent callback only the first
+ * packet is queued, and the caller resubmits the rest once the callback
+ * has run.  Returns the number of packets consumed.
+ */
+static int qemu_net_queue_append_batch(NetQueue *queue,
+                                       NetClientState *sender,
+                                       unsigned flags,
+                                       const NetPacketIOV *pkts,
+                                       int count,
+                                       NetPacketSent *sent_cb)
+{
+    int i;
+
+    if (sent_cb) {
+        qemu_net_queue_append_iov(queue, sender, flags,
+                                  pkts[0].iov, pkts[0].iovcnt, sent_cb);
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        qemu_net_queue_append_iov(queue, sender, flags,
+                                  pkts[i].iov, pkts[i].iovcnt, NULL);
+    }
+    return count;
+}
+
+/* Returns the number of packets that were delivered or dropped.  If this
+ * is less than @count, the next packet has been queued and @sent_cb will
+ * be invoked for it.
+ */
+int qemu_net_queue_send_iov_batch(NetQueue *queue,
+                                  NetClientState *sender,
+                                  unsigned flags,
+                                  const NetPacketIOV *pkts,
+                                  int count,
+                                  NetPacketSent *sent_cb)
+{
+    bool stalled = false;
+    ssize_t ret;
+    int i;
+
+    if (queue->delivering) {
+        return qemu_net_queue_append_batch(queue, sender, flags,
+                                           pkts, count, sent_cb);
+    }
+
+    qemu_net_queue_batch_begin(queue);
+    for (i = 0; i < count; i++) {
+        if (!qemu_can_send_packet(sender)) {
+            ret = 0;
+        } else {
+            ret = qemu_net_queue_deliver_iov(queue, sender, flags,
+                                             pkts[i].iov, pkts[i].iovcnt);
+        }
+        if (ret == 0) {
+            i += qemu_net_queue_append_batch(queue, sender, flags,
+                                             pkts + i, count - i, sent_cb);
+            stalled = true;
+            break;
+        }
+    }
+
+    if (!stalled) {
+        qemu_net_queue_flush(queue);
+    }
+    qemu_net_queue_batch_end(queue);
+
+    return i;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
@@ -250,6 +347,13 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 
 bool qemu_net_queue_flush(NetQueue *queue)
 {
+    bool flushed = true;
+
+    if (QTAILQ_EMPTY(&queue->packets)) {
+        return true;
+    }
+
+    qemu_net_queue_batch_begin(queue);
     while (!QTAILQ_EMPTY(&queue->packets)) {
         NetPacket *packet;
         int ret;
@@ -266,7 +370,8 @@ bool qemu_net_queue_flush(NetQueue *queue)
         if (ret == 0) {
             queue->nq_count++;
             QTAILQ_INSERT_HEAD(&queue->packets, packet, entry);
-            return false;
+            flushed = false;
+            break;
         }
 
         if (packet->sent_cb) {
@@ -275,5 +380,7 @@ bool qemu_net_queue_flush(NetQueue *queue)
 
         g_free(packet);
     }
-    return true;
+    qemu_net_queue_batch_end(queue);
+
+    return flushed;
 }
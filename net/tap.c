@@ -185,6 +185,10 @@ static void tap_send(void *opaque)
     int size;
     int packets = 0;
 
+    /* Let the peer coalesce its completion work (e.g. guest interrupts)
+     * over all the packets read in this callback.
+     */
+    qemu_net_batch_begin(&s->nc);
     while (true) {
         uint8_t *buf = s->buf;
 
@@ -217,6 +221,7 @@ static void tap_send(void *opaque)
             break;
         }
     }
+    qemu_net_batch_end(&s->nc);
 }
 
 static bool tap_has_ufo(NetClientState *nc)
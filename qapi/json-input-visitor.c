@@ -0,0 +1,748 @@
+/*
+ * JSON Input Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/json-input-visitor.h"
+#include "qapi/visitor-impl.h"
+#include "qemu/queue.h"
+#include "qemu-common.h"
+#include "qapi/qmp/json-parser.h"
+#include "qapi/qmp/types.h"
+#include "qapi/qmp/qerror.h"
+#include "qemu/cutils.h"
+
+typedef struct JSONMember {
+    size_t key;                 /* Index of the key token */
+    size_t value;               /* Index of the first token of the value */
+    bool visited;
+} JSONMember;
+
+typedef struct StackObject {
+    const char *name;           /* Name of the container in its parent */
+    size_t start;               /* Index of its opening token */
+    void *qapi; /* sanity check that caller uses same pointer */
+
+    JSONMember *members;        /* If object: its members */
+    size_t nb_members;
+
+    size_t next;                /* If array: index of the next element */
+    unsigned index;             /* If array: list index of @next */
+
+    QSLIST_ENTRY(StackObject) node; /* parent */
+} StackObject;
+
+struct JSONInputVisitor {
+    Visitor visitor;
+
+    const JSONToken *tokens;
+    size_t nb_tokens;
+
+    /* For objects and arrays: the index past their closing token */
+    size_t *end;
+
+    /* Set up by json_input_visitor_new_str(), owns @tokens */
+    JSONMessageParser parser;
+    bool has_parser;
+    GArray *parsed;
+    unsigned nb_parsed;
+
+    /* Stack of objects and arrays being visited */
+    QSLIST_HEAD(, StackObject) stack;
+
+    GString *errname;           /* Accumulator for full_name() */
+};
+
+static JSONInputVisitor *to_jiv(Visitor *v)
+{
+    return container_of(v, JSONInputVisitor, visitor);
+}
+
+static bool json_input_is_object(JSONInputVisitor *jiv, StackObject *so)
+{
+    return jiv->tokens[so->start].type == JSON_LCURLY;
+}
+
+static size_t json_input_value_end(JSONInputVisitor *jiv, size_t i)
+{
+    switch (jiv->tokens[i].type) {
+    case JSON_LCURLY:
+    case JSON_LSQUARE:
+        return jiv->end[i];
+    default:
+        return i + 1;
+    }
+}
+
+/*
+ * Find the full name of something @jiv is currently visiting.
+ * Works like full_name_nth() in qobject-input-visitor.c.
+ */
+static const char *full_name_nth(JSONInputVisitor *jiv, const char *name,
+                                 int n)
+{
+    StackObject *so;
+    char buf[32];
+
+    if (jiv->errname) {
+        g_string_truncate(jiv->errname, 0);
+    } else {
+        jiv->errname = g_string_new("");
+    }
+
+    QSLIST_FOREACH(so , &jiv->stack, node) {
+        if (n) {
+            n--;
+        } else if (json_input_is_object(jiv, so)) {
+            g_string_prepend(jiv->errname, name ?: "<anonymous>");
+            g_string_prepend_c(jiv->errname, '.');
+        } else {
+            snprintf(buf, sizeof(buf), "[%u]", so->index);
+            g_string_prepend(jiv->errname, buf);
+        }
+        name = so->name;
+    }
+    assert(!n);
+
+    if (name) {
+        g_string_prepend(jiv->errname, name);
+    } else if (jiv->errname->str[0] == '.') {
+        g_string_erase(jiv->errname, 0, 1);
+    } else if (!jiv->errname->str[0]) {
+        return "<anonymous>";
+    }
+
+    return jiv->errname->str;
+}
+
+static const char *full_name(JSONInputVisitor *jiv, const char *name)
+{
+    return full_name_nth(jiv, name, 0);
+}
+
+/* Does the JSON_STRING @token unescape to @name? */
+static bool json_input_key_equal(const JSONToken *token, const char *name)
+{
+    char *key;
+    bool equal;
+
+    if (!memchr(token->str, '\\', token->len)) {
+        /* Compare without the quotes */
+        size_t len = token->len - 2;
+
+        return !strncmp(token->str + 1, name, len) && !name[len];
+    }
+
+    key = json_parser_parse_string(token, NULL);
+    equal = key && !strcmp(key, name);
+    g_free(key);
+    return equal;
+}
+
+static const JSONToken *json_input_try_get_token(JSONInputVisitor *jiv,
+                                                 const char *name,
+                                                 bool consume)
+{
+    StackObject *tos;
+    const JSONToken *ret = NULL;
+    size_t i;
+
+    if (QSLIST_EMPTY(&jiv->stack)) {
+        /* Starting at root, name is ignored. */
+        return &jiv->tokens[0];
+    }
+
+    /* We are in a container; find the next element. */
+    tos = QSLIST_FIRST(&jiv->stack);
+
+    if (json_input_is_object(jiv, tos)) {
+        assert(name);
+        for (i = 0; i < tos->nb_members; i++) {
+            JSONMember *m = &tos->members[i];
+
+            /* Like with qdict_put(), the last duplicate wins */
+            if (json_input_key_equal(&jiv->tokens[m->key], name)) {
+                ret = &jiv->tokens[m->value];
+                m->visited |= consume;
+            }
+        }
+    } else {
+        assert(!name);
+        if (jiv->tokens[tos->next].type != JSON_RSQUARE) {
+            ret = &jiv->tokens[tos->next];
+            if (consume) {
+                tos->next = json_input_value_end(jiv, tos->next);
+                if (jiv->tokens[tos->next].type == JSON_COMMA) {
+                    tos->next++;
+                }
+            }
+        }
+        if (consume) {
+            tos->index++;
+        }
+    }
+
+    return ret;
+}
+
+static const JSONToken *json_input_get_token(JSONInputVisitor *jiv,
+                                             const char *name,
+                                             bool consume, Error **errp)
+{
+    const JSONToken *token = json_input_try_get_token(jiv, name, consume);
+
+    if (!token) {
+        error_setg(errp, QERR_MISSING_PARAMETER, full_name(jiv, name));
+    }
+    return token;
+}
+
+static void json_input_push(JSONInputVisitor *jiv, const char *name,
+                            const JSONToken *token, void *qapi)
+{
+    StackObject *tos = g_new0(StackObject, 1);
+    size_t i = token - jiv->tokens;
+
+    tos->name = name;
+    tos->start = i;
+    tos->qapi = qapi;
+
+    if (token->type == JSON_LCURLY) {
+        size_t end = jiv->end[i] - 1;
+        size_t n = 0;
+
+        /* Every member takes at least four tokens, counting the comma */
+        tos->members = g_new(JSONMember, (end - i) / 4 + 1);
+        for (i++; i < end; n++) {
+            tos->members[n].key = i;
+            tos->members[n].value = i + 2;
+            tos->members[n].visited = false;
+            i = json_input_value_end(jiv, i + 2);
+            if (jiv->tokens[i].type == JSON_COMMA) {
+                i++;
+            }
+        }
+        tos->nb_members = n;
+    } else {
+        assert(token->type == JSON_LSQUARE);
+        tos->next = i + 1;
+        tos->index = -1;
+    }
+
+    QSLIST_INSERT_HEAD(&jiv->stack, tos, node);
+}
+
+static void json_input_check_struct(Visitor *v, Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    StackObject *tos = QSLIST_FIRST(&jiv->stack);
+    size_t i;
+
+    assert(tos && json_input_is_object(jiv, tos));
+
+    for (i = 0; i < tos->nb_members; i++) {
+        if (!tos->members[i].visited) {
+            char *key = json_parser_parse_string(
+                &jiv->tokens[tos->members[i].key], &error_abort);
+
+            error_setg(errp, "Parameter '%s' is unexpected",
+                       full_name(jiv, key));
+            g_free(key);
+            return;
+        }
+    }
+}
+
+static void json_input_stack_object_free(StackObject *tos)
+{
+    g_free(tos->members);
+    g_free(tos);
+}
+
+static void json_input_pop(Visitor *v, void **obj)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    StackObject *tos = QSLIST_FIRST(&jiv->stack);
+
+    assert(tos && tos->qapi == obj);
+    QSLIST_REMOVE_HEAD(&jiv->stack, node);
+    json_input_stack_object_free(tos);
+}
+
+static void json_input_start_struct(Visitor *v, const char *name, void **obj,
+                                    size_t size, Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+
+    if (obj) {
+        *obj = NULL;
+    }
+    if (!token) {
+        return;
+    }
+    if (token->type != JSON_LCURLY) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "object");
+        return;
+    }
+
+    json_input_push(jiv, name, token, obj);
+
+    if (obj) {
+        *obj = g_malloc0(size);
+    }
+}
+
+static void json_input_end_struct(Visitor *v, void **obj)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    StackObject *tos = QSLIST_FIRST(&jiv->stack);
+
+    assert(json_input_is_object(jiv, tos));
+    json_input_pop(v, obj);
+}
+
+static void json_input_start_list(Visitor *v, const char *name,
+                                  GenericList **list, size_t size,
+                                  Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+
+    if (list) {
+        *list = NULL;
+    }
+    if (!token) {
+        return;
+    }
+    if (token->type != JSON_LSQUARE) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "array");
+        return;
+    }
+
+    json_input_push(jiv, name, token, list);
+    if (token[1].type != JSON_RSQUARE && list) {
+        *list = g_malloc0(size);
+    }
+}
+
+static GenericList *json_input_next_list(Visitor *v, GenericList *tail,
+                                         size_t size)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    StackObject *tos = QSLIST_FIRST(&jiv->stack);
+
+    assert(tos && !json_input_is_object(jiv, tos));
+
+    if (jiv->tokens[tos->next].type == JSON_RSQUARE) {
+        return NULL;
+    }
+    tail->next = g_malloc0(size);
+    return tail->next;
+}
+
+static void json_input_check_list(Visitor *v, Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    StackObject *tos = QSLIST_FIRST(&jiv->stack);
+
+    assert(tos && !json_input_is_object(jiv, tos));
+
+    if (jiv->tokens[tos->next].type != JSON_RSQUARE) {
+        error_setg(errp, "Only %u list elements expected in %s",
+                   tos->index + 1, full_name_nth(jiv, NULL, 1));
+    }
+}
+
+static void json_input_end_list(Visitor *v, void **obj)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    StackObject *tos = QSLIST_FIRST(&jiv->stack);
+
+    assert(!json_input_is_object(jiv, tos));
+    json_input_pop(v, obj);
+}
+
+static QType json_input_token_qtype(const JSONToken *token)
+{
+    switch (token->type) {
+    case JSON_LCURLY:
+        return QTYPE_QDICT;
+    case JSON_LSQUARE:
+        return QTYPE_QLIST;
+    case JSON_STRING:
+        return QTYPE_QSTRING;
+    case JSON_INTEGER:
+    case JSON_FLOAT:
+        return QTYPE_QNUM;
+    case JSON_KEYWORD:
+        return !strcmp(token->str, "null") ? QTYPE_QNULL : QTYPE_QBOOL;
+    default:
+        abort();
+    }
+}
+
+static void json_input_start_alternate(Visitor *v, const char *name,
+                                       GenericAlternate **obj, size_t size,
+                                       Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, false, errp);
+
+    if (!token) {
+        *obj = NULL;
+        return;
+    }
+    *obj = g_malloc0(size);
+    (*obj)->type = json_input_token_qtype(token);
+}
+
+static void json_input_type_int64(Visitor *v, const char *name, int64_t *obj,
+                                  Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+    int64_t val;
+
+    if (!token) {
+        return;
+    }
+    if (token->type != JSON_INTEGER ||
+        qemu_strtoi64(token->str, NULL, 10, &val) < 0) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "integer");
+        return;
+    }
+    *obj = val;
+}
+
+static void json_input_type_uint64(Visitor *v, const char *name,
+                                   uint64_t *obj, Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+    int64_t val;
+    uint64_t uval;
+
+    if (!token) {
+        return;
+    }
+    if (token->type != JSON_INTEGER) {
+        goto err;
+    }
+
+    /* Need to accept negative values for backward compatibility */
+    if (!qemu_strtoi64(token->str, NULL, 10, &val)) {
+        *obj = val;
+        return;
+    }
+    if (token->str[0] != '-' &&
+        !qemu_strtou64(token->str, NULL, 10, &uval)) {
+        *obj = uval;
+        return;
+    }
+
+err:
+    error_setg(errp, QERR_INVALID_PARAMETER_VALUE,
+               full_name(jiv, name), "uint64");
+}
+
+static void json_input_type_bool(Visitor *v, const char *name, bool *obj,
+                                 Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+
+    if (!token) {
+        return;
+    }
+    if (json_input_token_qtype(token) != QTYPE_QBOOL) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "boolean");
+        return;
+    }
+
+    *obj = !strcmp(token->str, "true");
+}
+
+static void json_input_type_str(Visitor *v, const char *name, char **obj,
+                                Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+
+    *obj = NULL;
+    if (!token) {
+        return;
+    }
+    if (token->type != JSON_STRING) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "string");
+        return;
+    }
+
+    *obj = json_parser_parse_string(token, errp);
+}
+
+static void json_input_type_number(Visitor *v, const char *name, double *obj,
+                                   Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+
+    if (!token) {
+        return;
+    }
+    if (token->type != JSON_INTEGER && token->type != JSON_FLOAT) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "number");
+        return;
+    }
+
+    /* FIXME dependent on locale, like the JSON parser */
+    *obj = strtod(token->str, NULL);
+}
+
+static void json_input_type_any(Visitor *v, const char *name, QObject **obj,
+                                Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+    size_t i;
+
+    *obj = NULL;
+    if (!token) {
+        return;
+    }
+
+    i = token - jiv->tokens;
+    *obj = json_parser_parse_tokens(token, json_input_value_end(jiv, i) - i,
+                                    errp);
+}
+
+static void json_input_type_null(Visitor *v, const char *name,
+                                 QNull **obj, Error **errp)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+    const JSONToken *token = json_input_get_token(jiv, name, true, errp);
+
+    *obj = NULL;
+    if (!token) {
+        return;
+    }
+
+    if (json_input_token_qtype(token) != QTYPE_QNULL) {
+        error_setg(errp, QERR_INVALID_PARAMETER_TYPE,
+                   full_name(jiv, name), "null");
+        return;
+    }
+    *obj = qnull();
+}
+
+static void json_input_optional(Visitor *v, const char *name, bool *present)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+
+    *present = json_input_try_get_token(jiv, name, false) != NULL;
+}
+
+static void json_input_free(Visitor *v)
+{
+    JSONInputVisitor *jiv = to_jiv(v);
+
+    while (!QSLIST_EMPTY(&jiv->stack)) {
+        StackObject *tos = QSLIST_FIRST(&jiv->stack);
+
+        QSLIST_REMOVE_HEAD(&jiv->stack, node);
+        json_input_stack_object_free(tos);
+    }
+
+    if (jiv->has_parser) {
+        json_message_parser_destroy(&jiv->parser);
+    }
+    g_free(jiv->end);
+    if (jiv->errname) {
+        g_string_free(jiv->errname, TRUE);
+    }
+    g_free(jiv);
+}
+
+/*
+ * Check the syntax of the value starting at token @i and record where
+ * objects and arrays end.  Return the index past the value, or 0 on
+ * error.
+ */
+static size_t json_input_check_value(JSONInputVisitor *jiv, size_t i,
+                                     Error **errp)
+{
+    const JSONToken *tokens = jiv->tokens;
+    size_t start = i;
+    int close;
+
+    if (i == jiv->nb_tokens) {
+        error_setg(errp, "JSON parse error, premature EOI");
+        return 0;
+    }
+
+    switch (tokens[i].type) {
+    case JSON_LCURLY:
+        close = JSON_RCURLY;
+        break;
+    case JSON_LSQUARE:
+        close = JSON_RSQUARE;
+        break;
+    case JSON_KEYWORD:
+        if (strcmp(tokens[i].str, "true") && strcmp(tokens[i].str, "false") &&
+            strcmp(tokens[i].str, "null")) {
+            error_setg(errp, "JSON parse error, invalid keyword '%s'",
+                       tokens[i].str);
+            return 0;
+        }
+        /* fall through */
+    case JSON_INTEGER:
+    case JSON_FLOAT:
+    case JSON_STRING:
+        return i + 1;
+    default:
+        error_setg(errp, "JSON parse error, expecting value");
+        return 0;
+    }
+
+    i++;
+    if (i < jiv->nb_tokens && tokens[i].type == close) {
+        jiv->end[start] = i + 1;
+        return i + 1;
+    }
+
+    for (;;) {
+        if (close == JSON_RCURLY) {
+            if (i == jiv->nb_tokens || tokens[i].type != JSON_STRING) {
+                error_setg(errp,
+                           "JSON parse error, key is not a string in object");
+                return 0;
+            }
+            i++;
+            if (i == jiv->nb_tokens || tokens[i].type != JSON_COLON) {
+                error_setg(errp, "JSON parse error, missing : in object pair");
+                return 0;
+            }
+            i++;
+        }
+
+        i = json_input_check_value(jiv, i, errp);
+        if (!i) {
+            return 0;
+        }
+        if (i == jiv->nb_tokens) {
+            error_setg(errp, "JSON parse error, premature EOI");
+            return 0;
+        }
+        if (tokens[i].type == close) {
+            break;
+        }
+        if (tokens[i].type != JSON_COMMA) {
+            error_setg(errp, "JSON parse error, expected separator in %s",
+                       close == JSON_RCURLY ? "dict" : "list");
+            return 0;
+        }
+        i++;
+    }
+
+    jiv->end[start] = i + 1;
+    return i + 1;
+}
+
+static JSONInputVisitor *json_input_visitor_alloc(void)
+{
+    JSONInputVisitor *v = g_malloc0(sizeof(*v));
+
+    v->visitor.type = VISITOR_INPUT;
+    v->visitor.start_struct = json_input_start_struct;
+    v->visitor.check_struct = json_input_check_struct;
+    v->visitor.end_struct = json_input_end_struct;
+    v->visitor.start_list = json_input_start_list;
+    v->visitor.next_list = json_input_next_list;
+    v->visitor.check_list = json_input_check_list;
+    v->visitor.end_list = json_input_end_list;
+    v->visitor.start_alternate = json_input_start_alternate;
+    v->visitor.type_int64 = json_input_type_int64;
+    v->visitor.type_uint64 = json_input_type_uint64;
+    v->visitor.type_bool = json_input_type_bool;
+    v->visitor.type_str = json_input_type_str;
+    v->visitor.type_number = json_input_type_number;
+    v->visitor.type_any = json_input_type_any;
+    v->visitor.type_null = json_input_type_null;
+    v->visitor.optional = json_input_optional;
+    v->visitor.free = json_input_free;
+
+    return v;
+}
+
+static bool json_input_visitor_init(JSONInputVisitor *jiv, GArray *tokens,
+                                    Error **errp)
+{
+    if (!tokens || !tokens->len) {
+        error_setg(errp, QERR_JSON_PARSING);
+        return false;
+    }
+
+    jiv->tokens = &g_array_index(tokens, JSONToken, 0);
+    jiv->nb_tokens = tokens->len;
+    jiv->end = g_new(size_t, tokens->len);
+
+    if (json_input_check_value(jiv, 0, errp) != jiv->nb_tokens) {
+        if (errp && !*errp) {
+            error_setg(errp, QERR_JSON_PARSING);
+        }
+        return false;
+    }
+    return true;
+}
+
+Visitor *json_input_visitor_new(GArray *tokens, Error **errp)
+{
+    JSONInputVisitor *jiv = json_input_visitor_alloc();
+
+    if (!json_input_visitor_init(jiv, tokens, errp)) {
+        visit_free(&jiv->visitor);
+        return NULL;
+    }
+    return &jiv->visitor;
+}
+
+static void json_input_parsed(JSONMessageParser *parser, GArray *tokens)
+{
+    JSONInputVisitor *jiv = container_of(parser, JSONInputVisitor, parser);
+
+    jiv->parsed = tokens;
+    jiv->nb_parsed++;
+}
+
+Visitor *json_input_visitor_new_str(const char *str, Error **errp)
+{
+    JSONInputVisitor *jiv = json_input_visitor_alloc();
+
+    json_message_parser_init(&jiv->parser, json_input_parsed);
+    jiv->has_parser = true;
+    json_message_parser_feed(&jiv->parser, str, strlen(str));
+    json_message_parser_flush(&jiv->parser);
+
+    /* The tokens stay valid since the parser is not fed any more */
+    if (jiv->nb_parsed != 1) {
+        error_setg(errp, QERR_JSON_PARSING);
+        visit_free(&jiv->visitor);
+        return NULL;
+    }
+    if (!json_input_visitor_init(jiv, jiv->parsed, errp)) {
+        visit_free(&jiv->visitor);
+        return NULL;
+    }
+    return &jiv->visitor;
+}
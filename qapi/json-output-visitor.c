@@ -0,0 +1,240 @@
+/*
+ * JSON Output Visitor
+ *
+ * Writes JSON text directly instead of building a QObject first and
+ * converting it with qobject_to_json().
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/visitor-impl.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qnum.h"
+
+struct JSONOutputVisitor {
+    Visitor visitor;
+    QString *str;       /* Where the text goes */
+    bool pretty;
+    unsigned depth;     /* Number of unfinished objects and arrays */
+    bool empty;         /* Innermost unfinished one has no members yet */
+    bool done;          /* The root value has been written */
+};
+
+static JSONOutputVisitor *to_jov(Visitor *v)
+{
+    return container_of(v, JSONOutputVisitor, visitor);
+}
+
+static void json_output_newline(JSONOutputVisitor *jov)
+{
+    unsigned i;
+
+    qstring_append_chr(jov->str, '\n');
+    for (i = 0; i < jov->depth; i++) {
+        qstring_append(jov->str, "    ");
+    }
+}
+
+/* Write what goes before a value: separator, indentation and key */
+static void json_output_begin(JSONOutputVisitor *jov, const char *name)
+{
+    if (!jov->depth) {
+        /* Don't allow reuse of visitor on more than one root */
+        assert(!jov->done);
+        return;
+    }
+
+    if (!jov->empty) {
+        qstring_append(jov->str, jov->pretty ? "," : ", ");
+    }
+    jov->empty = false;
+    if (jov->pretty) {
+        json_output_newline(jov);
+    }
+    /* Members of lists are nameless, members of structs are not */
+    if (name) {
+        qjson_append_str(jov->str, name);
+        qstring_append(jov->str, ": ");
+    }
+}
+
+static void json_output_end(JSONOutputVisitor *jov)
+{
+    if (!jov->depth) {
+        jov->done = true;
+    }
+}
+
+static void json_output_push(JSONOutputVisitor *jov, const char *name,
+                             char open)
+{
+    json_output_begin(jov, name);
+    qstring_append_chr(jov->str, open);
+    jov->depth++;
+    jov->empty = true;
+}
+
+static void json_output_pop(JSONOutputVisitor *jov, char close)
+{
+    assert(jov->depth);
+    jov->depth--;
+    if (jov->pretty) {
+        json_output_newline(jov);
+    }
+    qstring_append_chr(jov->str, close);
+    jov->empty = false;
+    json_output_end(jov);
+}
+
+static void json_output_start_struct(Visitor *v, const char *name,
+                                     void **obj, size_t unused, Error **errp)
+{
+    json_output_push(to_jov(v), name, '{');
+}
+
+static void json_output_end_struct(Visitor *v, void **obj)
+{
+    json_output_pop(to_jov(v), '}');
+}
+
+static void json_output_start_list(Visitor *v, const char *name,
+                                   GenericList **listp, size_t size,
+                                   Error **errp)
+{
+    json_output_push(to_jov(v), name, '[');
+}
+
+static GenericList *json_output_next_list(Visitor *v, GenericList *tail,
+                                          size_t size)
+{
+    return tail->next;
+}
+
+static void json_output_end_list(Visitor *v, void **obj)
+{
+    json_output_pop(to_jov(v), ']');
+}
+
+static void json_output_type_int64(Visitor *v, const char *name,
+                                   int64_t *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_begin(jov, name);
+    qstring_append_int(jov->str, *obj);
+    json_output_end(jov);
+}
+
+static void json_output_type_uint64(Visitor *v, const char *name,
+                                    uint64_t *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    char num[32];
+
+    json_output_begin(jov, name);
+    snprintf(num, sizeof(num), "%" PRIu64, *obj);
+    qstring_append(jov->str, num);
+    json_output_end(jov);
+}
+
+static void json_output_type_bool(Visitor *v, const char *name, bool *obj,
+                                  Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_begin(jov, name);
+    qstring_append(jov->str, *obj ? "true" : "false");
+    json_output_end(jov);
+}
+
+static void json_output_type_str(Visitor *v, const char *name, char **obj,
+                                 Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_begin(jov, name);
+    qjson_append_str(jov->str, *obj ? *obj : "");
+    json_output_end(jov);
+}
+
+static void json_output_type_number(Visitor *v, const char *name,
+                                    double *obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+    QNum *qn = qnum_from_double(*obj);
+    char *num;
+
+    /* Rare enough to take the detour, and guarantees identical output */
+    num = qnum_to_string(qn);
+    json_output_begin(jov, name);
+    qstring_append(jov->str, num);
+    json_output_end(jov);
+    g_free(num);
+    QDECREF(qn);
+}
+
+static void json_output_type_any(Visitor *v, const char *name,
+                                 QObject **obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_begin(jov, name);
+    qjson_append(jov->str, *obj, jov->pretty, jov->depth);
+    json_output_end(jov);
+}
+
+static void json_output_type_null(Visitor *v, const char *name,
+                                  QNull **obj, Error **errp)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    json_output_begin(jov, name);
+    qstring_append(jov->str, "null");
+    json_output_end(jov);
+}
+
+static void json_output_complete(Visitor *v, void *opaque)
+{
+    JSONOutputVisitor *jov = to_jov(v);
+
+    /* A visit must have occurred, with each start paired with end.  */
+    assert(jov->done && !jov->depth);
+    assert(opaque == jov->str);
+}
+
+static void json_output_free(Visitor *v)
+{
+    g_free(to_jov(v));
+}
+
+Visitor *json_output_visitor_new(bool pretty, QString *str)
+{
+    JSONOutputVisitor *v;
+
+    v = g_malloc0(sizeof(*v));
+
+    v->visitor.type = VISITOR_OUTPUT;
+    v->visitor.start_struct = json_output_start_struct;
+    v->visitor.end_struct = json_output_end_struct;
+    v->visitor.start_list = json_output_start_list;
+    v->visitor.next_list = json_output_next_list;
+    v->visitor.end_list = json_output_end_list;
+    v->visitor.type_int64 = json_output_type_int64;
+    v->visitor.type_uint64 = json_output_type_uint64;
+    v->visitor.type_bool = json_output_type_bool;
+    v->visitor.type_str = json_output_type_str;
+    v->visitor.type_number = json_output_type_number;
+    v->visitor.type_any = json_output_type_any;
+    v->visitor.type_null = json_output_type_null;
+    v->visitor.complete = json_output_complete;
+    v->visitor.free = json_output_free;
+
+    v->str = str;
+    v->pretty = pretty;
+
+    return &v->visitor;
+}
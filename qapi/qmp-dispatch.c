@@ -67,14 +67,17 @@ static QDict *qmp_dispatch_check_obj(const QObject *request, Error **errp)
     return dict;
 }
 
-static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
-                                Error **errp)
+/*
+ * Look up the command @request wants to execute.  On success, return it
+ * and store a new reference to its arguments in @args.
+ */
+static QmpCommand *qmp_dispatch_lookup(QmpCommandList *cmds,
+                                       QObject *request, QDict **args,
+                                       Error **errp)
 {
-    Error *local_err = NULL;
     const char *command;
-    QDict *args, *dict;
+    QDict *dict;
     QmpCommand *cmd;
-    QObject *ret = NULL;
 
     dict = qmp_dispatch_check_obj(request, errp);
     if (!dict) {
@@ -95,12 +98,20 @@ static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
     }
 
     if (!qdict_haskey(dict, "arguments")) {
-        args = qdict_new();
+        *args = qdict_new();
     } else {
-        args = qdict_get_qdict(dict, "arguments");
-        QINCREF(args);
+        *args = qdict_get_qdict(dict, "arguments");
+        QINCREF(*args);
     }
 
+    return cmd;
+}
+
+static QObject *do_qmp_dispatch(QmpCommand *cmd, QDict *args, Error **errp)
+{
+    Error *local_err = NULL;
+    QObject *ret = NULL;
+
     cmd->fn(args, &ret, &local_err);
     if (local_err) {
         error_propagate(errp, local_err);
@@ -110,8 +121,6 @@ static QObject *do_qmp_dispatch(QmpCommandList *cmds, QObject *request,
         ret = QOBJECT(qdict_new());
     }
 
-    QDECREF(args);
-
     return ret;
 }
 
@@ -122,14 +131,10 @@ QObject *qmp_build_error_object(Error *err)
                               error_get_pretty(err));
 }
 
-QObject *qmp_dispatch(QmpCommandList *cmds, QObject *request)
+static QDict *qmp_build_response(QObject *ret, Error *err)
 {
-    Error *err = NULL;
-    QObject *ret;
     QDict *rsp;
 
-    ret = do_qmp_dispatch(cmds, request, &err);
-
     rsp = qdict_new();
     if (err) {
         qdict_put_obj(rsp, "error", qmp_build_error_object(err));
@@ -141,5 +146,98 @@ QObject *qmp_dispatch(QmpCommandList *cmds, QObject *request)
         return NULL;
     }
 
-    return QOBJECT(rsp);
+    return rsp;
+}
+
+QObject *qmp_dispatch(QmpCommandList *cmds, QObject *request)
+{
+    Error *err = NULL;
+    QObject *ret = NULL;
+    QmpCommand *cmd;
+    QDict *args;
+
+    cmd = qmp_dispatch_lookup(cmds, request, &args, &err);
+    if (cmd) {
+        ret = do_qmp_dispatch(cmd, args, &err);
+        QDECREF(args);
+    }
+
+    return QOBJECT(qmp_build_response(ret, err));
+}
+
+/*
+ * Append @str to @json, indented by one more level.  The pretty JSON
+ * writers only emit newlines as part of the indentation.
+ */
+static void qmp_append_indented(QString *json, const char *str)
+{
+    const char *nl;
+
+    while ((nl = strchr(str, '\n'))) {
+        qstring_append_len(json, str, nl - str);
+        qstring_append(json, "\n    ");
+        str = nl + 1;
+    }
+    qstring_append(json, str);
+}
+
+/*
+ * Like qmp_dispatch(), but return the response as JSON text, with
+ * member "id": @id added unless @id is null.  Pretty-print it like
+ * qobject_to_json_pretty() if @pretty is true.
+ *
+ * Commands that have a QmpCommandJSONFunc write their return value
+ * straight into the response, without building a QObject first.
+ * Either way, the members of the response are "return" and then "id".
+ */
+QString *qmp_dispatch_json(QmpCommandList *cmds, QObject *request,
+                           QObject *id, bool pretty)
+{
+    Error *err = NULL;
+    QObject *ret = NULL;
+    QmpCommand *cmd;
+    QDict *args, *rsp;
+    QString *json, *val;
+
+    cmd = qmp_dispatch_lookup(cmds, request, &args, &err);
+    if (cmd && cmd->json_fn) {
+        json = qstring_from_str(pretty ? "{\n    \"return\": "
+                                       : "{\"return\": ");
+        if (pretty) {
+            /* The return value goes one level deeper than it is written */
+            val = qstring_new();
+            cmd->json_fn(args, val, true, &err);
+            qmp_append_indented(json, qstring_get_str(val));
+            QDECREF(val);
+        } else {
+            cmd->json_fn(args, json, false, &err);
+        }
+        QDECREF(args);
+        if (!err) {
+            if (id) {
+                qstring_append(json, pretty ? ",\n    \"id\": "
+                                            : ", \"id\": ");
+                qjson_append(json, id, pretty, 1);
+            }
+            qstring_append(json, pretty ? "\n}" : "}");
+            return json;
+        }
+        QDECREF(json);
+    } else if (cmd) {
+        ret = do_qmp_dispatch(cmd, args, &err);
+        QDECREF(args);
+    }
+
+    rsp = qmp_build_response(ret, err);
+    if (!rsp) {
+        return NULL;
+    }
+    if (id) {
+        qobject_incref(id);
+        qdict_put_obj(rsp, "id", id);
+    }
+    json = pretty ? qobject_to_json_pretty(QOBJECT(rsp))
+                  : qobject_to_json(QOBJECT(rsp));
+    QDECREF(rsp);
+    return json;
 }
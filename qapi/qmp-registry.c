@@ -27,6 +27,19 @@ void qmp_register_command(QmpCommandList *cmds, const char *name,
     QTAILQ_INSERT_TAIL(cmds, cmd, node);
 }
 
+/*
+ * Let command @name, which must have been registered already, serialize
+ * its return value itself when dispatched by qmp_dispatch_json().
+ */
+void qmp_register_command_json(QmpCommandList *cmds, const char *name,
+                               QmpCommandJSONFunc *json_fn)
+{
+    QmpCommand *cmd = qmp_find_command(cmds, name);
+
+    assert(cmd && !(cmd->options & QCO_NO_SUCCESS_RESP));
+    cmd->json_fn = json_fn;
+}
+
 void qmp_unregister_command(QmpCommandList *cmds, const char *name)
 {
     QmpCommand *cmd = qmp_find_command(cmds, name);
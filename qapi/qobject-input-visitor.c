@@ -16,10 +16,10 @@
 #include <math.h>
 #include "qapi/error.h"
 #include "qapi/qobject-input-visitor.h"
+#include "qapi/json-input-visitor.h"
 #include "qapi/visitor-impl.h"
 #include "qemu/queue.h"
 #include "qemu-common.h"
-#include "qapi/qmp/qjson.h"
 #include "qapi/qmp/types.h"
 #include "qapi/qmp/qerror.h"
 #include "qemu/cutils.h"
@@ -715,30 +715,19 @@ Visitor *qobject_input_visitor_new_str(const char *str,
                                        Error **errp)
 {
     bool is_json = str[0] == '{';
-    QObject *obj;
     QDict *args;
     Visitor *v;
 
     if (is_json) {
-        obj = qobject_from_json(str, errp);
-        if (!obj) {
-            /* Work around qobject_from_json() lossage TODO fix that */
-            if (errp && !*errp) {
-                error_setg(errp, "JSON parse error");
-                return NULL;
-            }
-            return NULL;
-        }
-        args = qobject_to_qdict(obj);
-        assert(args);
-        v = qobject_input_visitor_new(QOBJECT(args));
-    } else {
-        args = keyval_parse(str, implied_key, errp);
-        if (!args) {
-            return NULL;
-        }
-        v = qobject_input_visitor_new_keyval(QOBJECT(args));
+        /* Visit the JSON tokens directly, without building a QDict */
+        return json_input_visitor_new_str(str, errp);
+    }
+
+    args = keyval_parse(str, implied_key, errp);
+    if (!args) {
+        return NULL;
     }
+    v = qobject_input_visitor_new_keyval(QOBJECT(args));
     QDECREF(args);
 
     return v;
@@ -65,6 +65,8 @@ enum {
     OPTION_SIZE = 264,
     OPTION_PREALLOCATION = 265,
     OPTION_SHRINK = 266,
+    OPTION_BITMAP = 267,
+    OPTION_TARGET_IS_INCREMENTAL = 268,
 };
 
 typedef enum OutputFormat {
@@ -178,6 +180,11 @@ static void QEMU_NORETURN help(void)
            "  '-m' specifies how many coroutines work in parallel during the convert\n"
            "       process (defaults to 8)\n"
            "  '-W' allow to write to the target out of order rather than sequential\n"
+           "  '-C' use copy offloading to copy data regions to the target\n"
+           "  '--bitmap' copies only the extents that are dirty in the named persistent\n"
+           "       bitmap of the source image\n"
+           "  '--target-is-incremental' updates an existing target (requires '-n') that\n"
+           "       matches the source except for the extents dirty in '--bitmap'\n"
            "\n"
            "Parameters to snapshot subcommand:\n"
            "  'snapshot' is the name of the snapshot to create, apply or delete\n"
@@ -190,6 +197,12 @@ static void QEMU_NORETURN help(void)
            "  '-f' first image format\n"
            "  '-F' second image format\n"
            "  '-s' run in Strict mode - fail on different image size or sector allocation\n"
+           "  '-m' specifies how many coroutines compare the images in parallel\n"
+           "       (defaults to 8)\n"
+           "\n"
+           "Parameters to map subcommand:\n"
+           "  '-m' specifies how many coroutines query the allocation status in\n"
+           "       parallel (defaults to 8)\n"
            "\n"
            "Parameters to dd subcommand:\n"
            "  'bs=BYTES' read and write up to BYTES bytes at a time "
@@ -1185,25 +1198,26 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 }
 
 #define IO_BUF_SIZE (2 * 1024 * 1024)
+#define MAX_COROUTINES 16
 
 /*
  * Check if passed sectors are empty (not allocated or contain only 0 bytes)
  *
  * Intended for use by 'qemu-img compare': Returns 0 in case sectors are
  * filled with 0, 1 if sectors contain non-zero data (this is a comparison
- * failure), and 4 on error (the exit status for read errors), after emitting
- * an error message.
+ * failure) and stores its offset in @mismatch, and 4 on error (the exit
+ * status for read errors), after emitting an error message.
  *
  * @param blk:  BlockBackend for the image
  * @param offset: Starting offset to check
  * @param bytes: Number of bytes to check
  * @param filename: Name of disk file we are checking (logging purpose)
  * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
+ * @param mismatch: Offset of the first non-zero byte
  */
 static int check_empty_sectors(BlockBackend *blk, int64_t offset,
                                int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+                               uint8_t *buffer, int64_t *mismatch)
 {
     int ret = 0;
     int64_t idx;
@@ -1216,14 +1230,174 @@ static int check_empty_sectors(BlockBackend *blk, int64_t offset,
     }
     idx = find_nonzero(buffer, bytes);
     if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
+        *mismatch = offset + idx;
         return 1;
     }
 
     return 0;
 }
 
+typedef struct ImgCompareState {
+    BlockBackend *blk1;
+    BlockBackend *blk2;
+    const char *filename1;
+    const char *filename2;
+    int64_t total_size1;
+    int64_t total_size2;
+    int64_t total_size;
+    uint64_t progress_base;
+    bool strict;
+    long num_coroutines;
+    int running_coroutines;
+    CoMutex lock;
+    /* next offset to be handed out to a coroutine */
+    int64_t offset;
+    /* lowest offset at which a difference was found, INT64_MAX if none */
+    int64_t mismatch;
+    /* whether @mismatch is a block status (rather than content) mismatch */
+    bool status_mismatch;
+    /* exit status of the first error, 0 if none */
+    int ret;
+} ImgCompareState;
+
+static void compare_set_mismatch(ImgCompareState *s, int64_t offset,
+                                 bool status_mismatch)
+{
+    /* Chunks complete out of order, but the lowest offset is what a
+     * sequential comparison would have reported */
+    if (offset < s->mismatch) {
+        s->mismatch = offset;
+        s->status_mismatch = status_mismatch;
+    }
+}
+
+/*
+ * Looks up the block status of both images at s->offset and hands out the
+ * next chunk to compare. Returns 0 on success, 1 on a block status mismatch in
+ * strict mode and 3 on error. Called with s->lock held.
+ */
+static int compare_next_chunk(ImgCompareState *s, int64_t *offset,
+                              int64_t *chunk, int *status1, int *status2)
+{
+    int64_t pnum1, pnum2;
+
+    *offset = s->offset;
+
+    *status1 = bdrv_block_status_above(blk_bs(s->blk1), NULL, *offset,
+                                       s->total_size1 - *offset, &pnum1,
+                                       NULL, NULL);
+    if (*status1 < 0) {
+        error_report("Sector allocation test failed for %s", s->filename1);
+        return 3;
+    }
+
+    *status2 = bdrv_block_status_above(blk_bs(s->blk2), NULL, *offset,
+                                       s->total_size2 - *offset, &pnum2,
+                                       NULL, NULL);
+    if (*status2 < 0) {
+        error_report("Sector allocation test failed for %s", s->filename2);
+        return 3;
+    }
+
+    assert(pnum1 && pnum2);
+    *chunk = MIN(pnum1, pnum2);
+
+    if (s->strict && *status1 != *status2) {
+        compare_set_mismatch(s, *offset, true);
+        return 1;
+    }
+
+    /* Only chunks that need reading are bounded by the buffer size */
+    if (!((*status1 & BDRV_BLOCK_ZERO) && (*status2 & BDRV_BLOCK_ZERO)) &&
+        ((*status1 | *status2) & BDRV_BLOCK_ALLOCATED)) {
+        *chunk = MIN(*chunk, IO_BUF_SIZE);
+    }
+
+    s->offset += *chunk;
+    return 0;
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    ImgCompareState *s = opaque;
+    uint8_t *buf1, *buf2;
+    int ret;
+
+    s->running_coroutines++;
+    buf1 = blk_blockalign(s->blk1, IO_BUF_SIZE);
+    buf2 = blk_blockalign(s->blk2, IO_BUF_SIZE);
+
+    while (1) {
+        int64_t offset, chunk, pnum, mismatch;
+        int status1, status2, allocated1, allocated2;
+
+        qemu_co_mutex_lock(&s->lock);
+        if (s->ret || s->offset >= s->total_size || s->offset >= s->mismatch) {
+            qemu_co_mutex_unlock(&s->lock);
+            break;
+        }
+        ret = compare_next_chunk(s, &offset, &chunk, &status1, &status2);
+        if (ret > 1) {
+            s->ret = ret;
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        if (ret) {
+            break;
+        }
+
+        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
+        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
+
+        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
+            /* nothing to do */
+        } else if (allocated1 == allocated2) {
+            if (allocated1) {
+                ret = blk_pread(s->blk1, offset, buf1, chunk);
+                if (ret < 0) {
+                    error_report("Error while reading offset %" PRId64
+                                 " of %s: %s",
+                                 offset, s->filename1, strerror(-ret));
+                    s->ret = 4;
+                    break;
+                }
+                ret = blk_pread(s->blk2, offset, buf2, chunk);
+                if (ret < 0) {
+                    error_report("Error while reading offset %" PRId64
+                                 " of %s: %s",
+                                 offset, s->filename2, strerror(-ret));
+                    s->ret = 4;
+                    break;
+                }
+                ret = compare_buffers(buf1, buf2, chunk, &pnum);
+                if (ret || pnum != chunk) {
+                    compare_set_mismatch(s, offset + (ret ? 0 : pnum), false);
+                    break;
+                }
+            }
+        } else {
+            if (allocated1) {
+                ret = check_empty_sectors(s->blk1, offset, chunk,
+                                          s->filename1, buf1, &mismatch);
+            } else {
+                ret = check_empty_sectors(s->blk2, offset, chunk,
+                                          s->filename2, buf1, &mismatch);
+            }
+            if (ret == 1) {
+                compare_set_mismatch(s, mismatch, false);
+                break;
+            } else if (ret) {
+                s->ret = ret;
+                break;
+            }
+        }
+        qemu_progress_print(((float) chunk / s->progress_base) * 100, 100);
+    }
+
+    qemu_vfree(buf1);
+    qemu_vfree(buf2);
+    s->running_coroutines--;
+}
+
 /*
  * Compares two images. Exit codes:
  *
@@ -1235,11 +1409,8 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
     int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
+    uint8_t *buf1 = NULL;
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
@@ -1247,10 +1418,12 @@ static int img_compare(int argc, char **argv)
     int64_t total_size;
     int64_t offset = 0;
     int64_t chunk;
-    int c;
+    int c, i;
     uint64_t progress_base;
     bool image_opts = false;
     bool force_share = false;
+    long num_coroutines = 8;
+    ImgCompareState s;
 
     cache = BDRV_DEFAULT_CACHE;
     for (;;) {
@@ -1261,7 +1434,7 @@ static int img_compare(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:T:pqsm:U",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1294,6 +1467,15 @@ static int img_compare(int argc, char **argv)
         case 's':
             strict = true;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                ret = 2;
+                goto out4;
+            }
+            break;
         case 'U':
             force_share = true;
             break;
@@ -1355,11 +1537,8 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
     buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
     total_size1 = blk_getlength(blk1);
     if (total_size1 < 0) {
         error_report("Can't get size of %s: %s",
@@ -1385,87 +1564,46 @@ static int img_compare(int argc, char **argv)
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
+    /* Compare the common part with a pool of coroutines, each one taking the
+     * next chunk as soon as it is done with its previous one */
+    s = (ImgCompareState) {
+        .blk1           = blk1,
+        .blk2           = blk2,
+        .filename1      = filename1,
+        .filename2      = filename2,
+        .total_size1    = total_size1,
+        .total_size2    = total_size2,
+        .total_size     = total_size,
+        .progress_base  = progress_base,
+        .strict         = strict,
+        .num_coroutines = num_coroutines,
+        .mismatch       = INT64_MAX,
+    };
+    qemu_co_mutex_init(&s.lock);
+    for (i = 0; i < s.num_coroutines; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(compare_co_do_compare, &s));
+    }
 
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
+    while (s.running_coroutines) {
+        main_loop_wait(false);
+    }
 
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, buf1, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, buf2, chunk);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
+    if (s.ret) {
+        ret = s.ret;
+        goto out;
+    }
+    if (s.mismatch != INT64_MAX) {
+        if (s.status_mismatch) {
+            qprintf(quiet, "Strict mode: Offset %" PRId64
+                    " block status mismatch!\n", s.mismatch);
         } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
+            qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
+                    s.mismatch);
         }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+        ret = 1;
+        goto out;
     }
+    offset = total_size;
 
     if (total_size1 != total_size2) {
         BlockBackend *blk_over;
@@ -1492,9 +1630,15 @@ static int img_compare(int argc, char **argv)
 
             }
             if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
+                int64_t mismatch;
+
                 chunk = MIN(chunk, IO_BUF_SIZE);
                 ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
+                                          filename_over, buf1, &mismatch);
+                if (ret == 1) {
+                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
+                            mismatch);
+                }
                 if (ret) {
                     goto out;
                 }
@@ -1509,7 +1653,6 @@ static int img_compare(int argc, char **argv)
 
 out:
     qemu_vfree(buf1);
-    qemu_vfree(buf2);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
@@ -1523,10 +1666,9 @@ enum ImgConvertBlockStatus {
     BLK_DATA,
     BLK_ZERO,
     BLK_BACKING_FILE,
+    BLK_CLEAN,
 };
 
-#define MAX_COROUTINES 16
-
 typedef struct ImgConvertState {
     BlockBackend **src;
     int64_t *src_sectors;
@@ -1543,6 +1685,10 @@ typedef struct ImgConvertState {
     bool compressed;
     bool target_has_backing;
     bool wr_in_order;
+    bool copy_range;
+    bool target_is_incremental;
+    BdrvDirtyBitmap *bitmap;
+    BdrvDirtyBitmapIter *bitmap_iter;
     int min_sparse;
     size_t cluster_sectors;
     size_t buf_sectors;
@@ -1566,6 +1712,35 @@ static void convert_select_part(ImgConvertState *s, int64_t sector_num,
     }
 }
 
+/* Returns whether @sector_num is dirty in s->bitmap and stores in @end the
+ * first sector after it whose state differs. */
+static bool convert_bitmap_extent(ImgConvertState *s, int64_t sector_num,
+                                  int64_t *end)
+{
+    int64_t offset = sector_num * BDRV_SECTOR_SIZE;
+    int64_t next;
+    bool dirty;
+
+    bdrv_dirty_bitmap_lock(s->bitmap);
+    dirty = bdrv_get_dirty_locked(NULL, s->bitmap, offset);
+    if (dirty) {
+        next = bdrv_dirty_bitmap_next_zero(s->bitmap, offset);
+    } else {
+        bdrv_set_dirty_iter(s->bitmap_iter, offset);
+        next = bdrv_dirty_iter_next(s->bitmap_iter);
+    }
+    bdrv_dirty_bitmap_unlock(s->bitmap);
+
+    if (next < 0) {
+        *end = s->total_sectors;
+    } else {
+        *end = MIN(DIV_ROUND_UP(next, BDRV_SECTOR_SIZE), s->total_sectors);
+    }
+    assert(*end > sector_num);
+
+    return dirty;
+}
+
 static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
 {
     int64_t src_cur_offset;
@@ -1576,6 +1751,19 @@ static int convert_iteration_sectors(ImgConvertState *s, int64_t sector_num)
     assert(s->total_sectors > sector_num);
     n = MIN(s->total_sectors - sector_num, BDRV_REQUEST_MAX_SECTORS);
 
+    if (s->bitmap) {
+        int64_t bitmap_end;
+
+        /* Extents that are clean in the bitmap are already up to date in the
+         * target; only dirty ones go through the block status lookup below */
+        if (!convert_bitmap_extent(s, sector_num, &bitmap_end)) {
+            s->status = BLK_CLEAN;
+            s->sector_next_status = bitmap_end;
+            return MIN(n, bitmap_end - sector_num);
+        }
+        n = MIN(n, bitmap_end - sector_num);
+    }
+
     if (s->sector_next_status <= sector_num) {
         int64_t count = n * BDRV_SECTOR_SIZE;
 
@@ -1681,6 +1869,11 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
         BdrvRequestFlags flags = s->compressed ? BDRV_REQ_WRITE_COMPRESSED : 0;
 
         switch (status) {
+        case BLK_CLEAN:
+            /* Unchanged since the target was last synchronised */
+            assert(s->bitmap);
+            break;
+
         case BLK_BACKING_FILE:
             /* If we have a backing file, leave clusters unallocated that are
              * unallocated in the source image, so that the backing file is
@@ -1736,6 +1929,38 @@ static int coroutine_fn convert_co_write(ImgConvertState *s, int64_t sector_num,
     return 0;
 }
 
+static int coroutine_fn convert_co_copy_range(ImgConvertState *s,
+                                              int64_t sector_num,
+                                              int nb_sectors)
+{
+    int n, ret;
+
+    while (nb_sectors > 0) {
+        BlockBackend *blk;
+        int src_cur;
+        int64_t bs_sectors, src_cur_offset;
+        int64_t offset;
+
+        convert_select_part(s, sector_num, &src_cur, &src_cur_offset);
+        offset = (sector_num - src_cur_offset) << BDRV_SECTOR_BITS;
+        blk = s->src[src_cur];
+        bs_sectors = s->src_sectors[src_cur];
+
+        n = MIN(nb_sectors, bs_sectors - (sector_num - src_cur_offset));
+
+        ret = blk_co_copy_range(blk, offset, s->target,
+                                sector_num << BDRV_SECTOR_BITS,
+                                n << BDRV_SECTOR_BITS, 0);
+        if (ret < 0) {
+            return ret;
+        }
+
+        sector_num += n;
+        nb_sectors -= n;
+    }
+    return 0;
+}
+
 static void coroutine_fn convert_co_do_copy(void *opaque)
 {
     ImgConvertState *s = opaque;
@@ -1758,6 +1983,7 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         int n;
         int64_t sector_num;
         enum ImgConvertBlockStatus status;
+        bool copy_range;
 
         qemu_co_mutex_lock(&s->lock);
         if (s->ret != -EINPROGRESS || s->sector_num >= s->total_sectors) {
@@ -1781,13 +2007,17 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         s->sector_num += n;
         qemu_co_mutex_unlock(&s->lock);
 
+        /* Data regions are copied without passing through our buffer when
+         * offloading; zero and backing regions take the normal path. */
+        copy_range = s->copy_range && status == BLK_DATA;
+
         if (status == BLK_DATA || (!s->min_sparse && status == BLK_ZERO)) {
             s->allocated_done += n;
             qemu_progress_print(100.0 * s->allocated_done /
                                         s->allocated_sectors, 0);
         }
 
-        if (status == BLK_DATA) {
+        if (status == BLK_DATA && !copy_range) {
             ret = convert_co_read(s, sector_num, n, buf);
             if (ret < 0) {
                 error_report("error while reading sector %" PRId64
@@ -1809,7 +2039,11 @@ static void coroutine_fn convert_co_do_copy(void *opaque)
         }
 
         if (s->ret == -EINPROGRESS) {
-            ret = convert_co_write(s, sector_num, n, buf, status);
+            if (copy_range) {
+                ret = convert_co_copy_range(s, sector_num, n);
+            } else {
+                ret = convert_co_write(s, sector_num, n, buf, status);
+            }
             if (ret < 0) {
                 error_report("error while writing sector %" PRId64
                              ": %s", sector_num, strerror(-ret));
@@ -1849,12 +2083,15 @@ static int convert_do_copy(ImgConvertState *s)
     int ret, i, n;
     int64_t sector_num = 0;
 
-    /* Check whether we have zero initialisation or can get it efficiently */
-    s->has_zero_init = s->min_sparse && !s->target_has_backing
+    /* Check whether we have zero initialisation or can get it efficiently.
+     * An incremental target already holds data, so neither applies. */
+    s->has_zero_init = s->min_sparse && !s->target_has_backing &&
+                       !s->target_is_incremental
                      ? bdrv_has_zero_init(blk_bs(s->target))
                      : false;
 
     if (!s->has_zero_init && !s->target_has_backing &&
+        !s->target_is_incremental &&
         bdrv_can_write_zeroes_with_unmap(blk_bs(s->target)))
     {
         ret = blk_make_zero(s->target, BDRV_REQ_MAY_UNMAP);
@@ -1916,7 +2153,8 @@ static int img_convert(int argc, char **argv)
     int c, bs_i, flags, src_flags = 0;
     const char *fmt = NULL, *out_fmt = NULL, *cache = "unsafe",
                *src_cache = BDRV_DEFAULT_CACHE, *out_baseimg = NULL,
-               *out_filename, *out_baseimg_param, *snapshot_name = NULL;
+               *out_filename, *out_baseimg_param, *snapshot_name = NULL,
+               *bitmap_name = NULL;
     BlockDriver *drv = NULL, *proto_drv = NULL;
     BlockDriverInfo bdi;
     BlockDriverState *out_bs;
@@ -1944,9 +2182,12 @@ static int img_convert(int argc, char **argv)
             {"image-opts", no_argument, 0, OPTION_IMAGE_OPTS},
             {"force-share", no_argument, 0, 'U'},
             {"target-image-opts", no_argument, 0, OPTION_TARGET_IMAGE_OPTS},
+            {"bitmap", required_argument, 0, OPTION_BITMAP},
+            {"target-is-incremental", no_argument, 0,
+             OPTION_TARGET_IS_INCREMENTAL},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:O:B:co:s:l:S:pt:T:qnm:WU",
+        c = getopt_long(argc, argv, ":hf:O:B:Cco:s:l:S:pt:T:qnm:WU",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1970,6 +2211,9 @@ static int img_convert(int argc, char **argv)
         case 'B':
             out_baseimg = optarg;
             break;
+        case 'C':
+            s.copy_range = true;
+            break;
         case 'c':
             s.compressed = true;
             break;
@@ -2059,6 +2303,12 @@ static int img_convert(int argc, char **argv)
         case OPTION_TARGET_IMAGE_OPTS:
             tgt_image_opts = true;
             break;
+        case OPTION_BITMAP:
+            bitmap_name = optarg;
+            break;
+        case OPTION_TARGET_IS_INCREMENTAL:
+            s.target_is_incremental = true;
+            break;
         }
     }
 
@@ -2077,11 +2327,45 @@ static int img_convert(int argc, char **argv)
         goto fail_getopt;
     }
 
+    if (s.compressed && s.copy_range) {
+        error_report("Cannot enable copy offloading when -c is used");
+        goto fail_getopt;
+    }
+
     if (tgt_image_opts && !skip_create) {
         error_report("--target-image-opts requires use of -n flag");
         goto fail_getopt;
     }
 
+    if (s.target_is_incremental) {
+        if (!bitmap_name) {
+            error_report("--target-is-incremental requires --bitmap");
+            goto fail_getopt;
+        }
+        if (!skip_create) {
+            error_report("--target-is-incremental requires use of -n flag");
+            goto fail_getopt;
+        }
+        /* Only dirty extents are written, so their order doesn't matter */
+        s.wr_in_order = false;
+    }
+
+    if (bitmap_name) {
+        if (s.compressed) {
+            error_report("--bitmap and -c are mutually exclusive");
+            goto fail_getopt;
+        }
+        if (!s.target_is_incremental && !out_baseimg) {
+            error_report("--bitmap requires either --target-is-incremental or "
+                         "a backing file for the target");
+            goto fail_getopt;
+        }
+        if (snapshot_name || sn_opts) {
+            error_report("--bitmap cannot be used with snapshots");
+            goto fail_getopt;
+        }
+    }
+
     s.src_num = argc - optind - 1;
     out_filename = s.src_num >= 1 ? argv[argc - 1] : NULL;
 
@@ -2222,6 +2506,32 @@ static int img_convert(int argc, char **argv)
         goto out;
     }
 
+    if (bitmap_name) {
+        BlockDriverState *src_bs = blk_bs(s.src[0]);
+
+        if (s.src_num > 1) {
+            error_report("--bitmap cannot be used when concatenating multiple "
+                         "input images");
+            ret = -1;
+            goto out;
+        }
+
+        /* Bitmaps flagged for autoloading are already attached to the node,
+         * others are read from the image on demand */
+        s.bitmap = bdrv_find_dirty_bitmap(src_bs, bitmap_name);
+        if (!s.bitmap) {
+            s.bitmap = bdrv_load_persistent_dirty_bitmap(src_bs, bitmap_name,
+                                                         &local_err);
+            if (!s.bitmap) {
+                error_reportf_err(local_err, "Could not load bitmap '%s': ",
+                                  bitmap_name);
+                ret = -1;
+                goto out;
+            }
+        }
+        s.bitmap_iter = bdrv_dirty_iter_new(s.bitmap);
+    }
+
     /* Check if compression is supported */
     if (s.compressed) {
         bool encryption =
@@ -2339,6 +2649,9 @@ out:
     qemu_opts_free(create_opts);
     qemu_opts_del(sn_opts);
     blk_unref(s.target);
+    if (s.bitmap_iter) {
+        bdrv_dirty_iter_free(s.bitmap_iter);
+    }
     if (s.src) {
         for (bs_i = 0; bs_i < s.src_num; bs_i++) {
             blk_unref(s.src[bs_i]);
@@ -2727,18 +3040,108 @@ static inline bool entry_mergeable(const MapEntry *curr, const MapEntry *next)
     return true;
 }
 
+/* img_map probes the image in segments of this size, each one handed to the
+ * next free coroutine */
+#define MAP_SEGMENT_SIZE (1 << 30)
+
+typedef struct ImgMapSegment {
+    GArray *entries;
+    bool done;
+} ImgMapSegment;
+
+typedef struct ImgMapState {
+    BlockDriverState *bs;
+    OutputFormat output_format;
+    int64_t length;
+    ImgMapSegment *segments;
+    int nb_segments;
+    /* next segment to be probed */
+    int next_segment;
+    /* next segment to be printed; output stays in offset order */
+    int next_dump;
+    /* last entry seen, still waiting to be merged with the following ones */
+    MapEntry curr;
+    int running_coroutines;
+    int ret;
+} ImgMapState;
+
+static void map_dump_segments(ImgMapState *s)
+{
+    while (s->next_dump < s->nb_segments && s->segments[s->next_dump].done) {
+        GArray *entries = s->segments[s->next_dump].entries;
+        int i;
+
+        for (i = 0; i < entries->len; i++) {
+            MapEntry *next = &g_array_index(entries, MapEntry, i);
+
+            if (entry_mergeable(&s->curr, next)) {
+                s->curr.length += next->length;
+                continue;
+            }
+
+            if (s->curr.length > 0) {
+                dump_map_entry(s->output_format, &s->curr, next);
+            }
+            s->curr = *next;
+        }
+
+        g_array_free(entries, true);
+        s->segments[s->next_dump].entries = NULL;
+        s->next_dump++;
+    }
+}
+
+static void coroutine_fn map_co_do_map(void *opaque)
+{
+    ImgMapState *s = opaque;
+
+    s->running_coroutines++;
+
+    while (!s->ret && s->next_segment < s->nb_segments) {
+        ImgMapSegment *seg = &s->segments[s->next_segment];
+        int64_t offset = (int64_t)s->next_segment * MAP_SEGMENT_SIZE;
+        int64_t end = MIN(offset + MAP_SEGMENT_SIZE, s->length);
+
+        s->next_segment++;
+        seg->entries = g_array_new(false, false, sizeof(MapEntry));
+
+        while (offset < end) {
+            MapEntry e;
+            int64_t n;
+            int ret;
+
+            n = QEMU_ALIGN_DOWN(end - offset, BDRV_SECTOR_SIZE);
+            ret = get_block_status(s->bs, offset, n, &e);
+            if (ret < 0) {
+                if (!s->ret) {
+                    s->ret = ret;
+                }
+                goto out;
+            }
+            g_array_append_val(seg->entries, e);
+            offset += e.length;
+        }
+
+        seg->done = true;
+        map_dump_segments(s);
+    }
+
+out:
+    s->running_coroutines--;
+}
+
 static int img_map(int argc, char **argv)
 {
-    int c;
+    int c, i;
     OutputFormat output_format = OFORMAT_HUMAN;
     BlockBackend *blk;
-    BlockDriverState *bs;
     const char *filename, *fmt, *output;
     int64_t length;
-    MapEntry curr = { .length = 0 }, next;
     int ret = 0;
     bool image_opts = false;
     bool force_share = false;
+    long num_coroutines = 8;
+    ImgMapState s;
 
     fmt = NULL;
     output = NULL;
@@ -2753,7 +3156,7 @@ static int img_map(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":f:hU",
+        c = getopt_long(argc, argv, ":f:hm:U",
                         long_options, &option_index);
         if (c == -1) {
             break;
@@ -2771,6 +3174,14 @@ static int img_map(int argc, char **argv)
         case 'f':
             fmt = optarg;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &num_coroutines) ||
+                num_coroutines < 1 || num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                return 1;
+            }
+            break;
         case 'U':
             force_share = true;
             break;
@@ -2814,40 +3225,53 @@ static int img_map(int argc, char **argv)
     if (!blk) {
         return 1;
     }
-    bs = blk_bs(blk);
 
     if (output_format == OFORMAT_HUMAN) {
         printf("%-16s%-16s%-16s%s\n", "Offset", "Length", "Mapped to", "File");
     }
 
     length = blk_getlength(blk);
-    while (curr.start + curr.length < length) {
-        int64_t offset = curr.start + curr.length;
-        int64_t n;
-
-        /* Probe up to 1 GiB at a time.  */
-        n = QEMU_ALIGN_DOWN(MIN(1 << 30, length - offset), BDRV_SECTOR_SIZE);
-        ret = get_block_status(bs, offset, n, &next);
+    if (length < 0) {
+        error_report("Could not get size of %s: %s", filename,
+                     strerror(-length));
+        blk_unref(blk);
+        return 1;
+    }
 
-        if (ret < 0) {
-            error_report("Could not read file metadata: %s", strerror(-ret));
-            goto out;
-        }
+    /* Segments are probed concurrently, which hides the latency of each
+     * block status call on deep backing chains and remote images.  They are
+     * merged and printed in order as soon as all previous ones are done. */
+    s = (ImgMapState) {
+        .bs             = blk_bs(blk),
+        .output_format  = output_format,
+        .length         = length,
+        .nb_segments    = DIV_ROUND_UP(length, MAP_SEGMENT_SIZE),
+        .curr           = { .length = 0 },
+    };
+    s.segments = g_new0(ImgMapSegment, s.nb_segments);
+    for (i = 0; i < num_coroutines; i++) {
+        qemu_coroutine_enter(qemu_coroutine_create(map_co_do_map, &s));
+    }
 
-        if (entry_mergeable(&curr, &next)) {
-            curr.length += next.length;
-            continue;
-        }
+    while (s.running_coroutines) {
+        main_loop_wait(false);
+    }
 
-        if (curr.length > 0) {
-            dump_map_entry(output_format, &curr, &next);
-        }
-        curr = next;
+    ret = s.ret;
+    if (ret < 0) {
+        error_report("Could not read file metadata: %s", strerror(-ret));
+        goto out;
     }
 
-    dump_map_entry(output_format, &curr, NULL);
+    dump_map_entry(output_format, &s.curr, NULL);
 
 out:
+    for (i = s.next_dump; i < s.nb_segments; i++) {
+        if (s.segments[i].entries) {
+            g_array_free(s.segments[i].entries, true);
+        }
+    }
+    g_free(s.segments);
     blk_unref(blk);
     return ret < 0;
 }
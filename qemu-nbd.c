@@ -33,6 +33,7 @@
 #include "qemu/bswap.h"
 #include "qemu/log.h"
 #include "qemu/systemd.h"
+#include "sysemu/iothread.h"
 #include "block/snapshot.h"
 #include "qapi/qmp/qstring.h"
 #include "qom/object_interfaces.h"
@@ -50,6 +51,8 @@
 #define QEMU_NBD_OPT_TLSCREDS      261
 #define QEMU_NBD_OPT_IMAGE_OPTS    262
 #define QEMU_NBD_OPT_FORK          263
+#define QEMU_NBD_OPT_IOTHREADS     264
+#define QEMU_NBD_OPT_ZERO_COPY     265
 
 #define MBR_SIZE 512
 
@@ -65,6 +68,9 @@ static int nb_fds;
 static QIOChannelSocket *server_ioc;
 static int server_watch = -1;
 static QCryptoTLSCreds *tlscreds;
+static IOThread **iothreads;
+static int nb_iothreads;
+static int next_iothread;
 
 static void usage(const char *name)
 {
@@ -81,10 +87,14 @@ static void usage(const char *name)
 "  -k, --socket=PATH         path to the unix socket\n"
 "                            (default '"SOCKET_PATH"')\n"
 "  -e, --shared=NUM          device can be shared by NUM clients (default '1')\n"
+"      --iothreads=NUM       serve client connections from NUM I/O threads\n"
+"      --zero-copy           send read data straight from raw image files\n"
 "  -t, --persistent          don't exit on the last connection\n"
 "  -v, --verbose             display extra debugging information\n"
 "  -x, --export-name=NAME    expose export by name\n"
 "  -D, --description=TEXT    with -x, also export a human-readable description\n"
+"  -B, --bitmap=NAME         with -x, also export dirty bitmap NAME as\n"
+"                            'qemu:dirty-bitmap:NAME'\n"
 "\n"
 "Exposing part of the image:\n"
 "  -o, --offset=OFFSET       offset into the image\n"
@@ -347,6 +357,7 @@ static void nbd_client_closed(NBDClient *client, bool negotiated)
 static gboolean nbd_accept(QIOChannel *ioc, GIOCondition cond, gpointer opaque)
 {
     QIOChannelSocket *cioc;
+    AioContext *io_ctx = NULL;
 
     cioc = qio_channel_socket_accept(QIO_CHANNEL_SOCKET(ioc),
                                      NULL);
@@ -361,8 +372,12 @@ static gboolean nbd_accept(QIOChannel *ioc, GIOCondition cond, gpointer opaque)
 
     nb_fds++;
     nbd_update_server_watch();
+    if (nb_iothreads) {
+        io_ctx = iothread_get_aio_context(iothreads[next_iothread]);
+        next_iothread = (next_iothread + 1) % nb_iothreads;
+    }
     nbd_client_new(newproto ? NULL : exp, cioc,
-                   tlscreds, NULL, nbd_client_closed);
+                   tlscreds, NULL, io_ctx, nbd_client_closed);
     object_unref(OBJECT(cioc));
 
     return TRUE;
@@ -514,7 +529,7 @@ int main(int argc, char **argv)
     off_t fd_size;
     QemuOpts *sn_opts = NULL;
     const char *sn_id_or_name = NULL;
-    const char *sopt = "hVb:o:p:rsnP:c:dvk:e:f:tl:x:T:D:";
+    const char *sopt = "hVb:o:p:rsnP:c:dvk:e:f:tl:x:T:D:B:";
     struct option lopt[] = {
         { "help", no_argument, NULL, 'h' },
         { "version", no_argument, NULL, 'V' },
@@ -541,10 +556,13 @@ int main(int argc, char **argv)
         { "object", required_argument, NULL, QEMU_NBD_OPT_OBJECT },
         { "export-name", required_argument, NULL, 'x' },
         { "description", required_argument, NULL, 'D' },
+        { "bitmap", required_argument, NULL, 'B' },
         { "tls-creds", required_argument, NULL, QEMU_NBD_OPT_TLSCREDS },
         { "image-opts", no_argument, NULL, QEMU_NBD_OPT_IMAGE_OPTS },
         { "trace", required_argument, NULL, 'T' },
         { "fork", no_argument, NULL, QEMU_NBD_OPT_FORK },
+        { "iothreads", required_argument, NULL, QEMU_NBD_OPT_IOTHREADS },
+        { "zero-copy", no_argument, NULL, QEMU_NBD_OPT_ZERO_COPY },
         { NULL, 0, NULL, 0 }
     };
     int ch;
@@ -563,11 +581,13 @@ int main(int argc, char **argv)
     QDict *options = NULL;
     const char *export_name = NULL;
     const char *export_description = NULL;
+    const char *bitmap = NULL;
     const char *tlscredsid = NULL;
     bool imageOpts = false;
     bool writethrough = true;
     char *trace_file = NULL;
     bool fork_process = false;
+    bool zero_copy = false;
     int old_stderr = -1;
     unsigned socket_activation;
 
@@ -735,6 +755,9 @@ int main(int argc, char **argv)
         case 'D':
             export_description = optarg;
             break;
+        case 'B':
+            bitmap = optarg;
+            break;
         case 'v':
             verbose = 1;
             break;
@@ -770,6 +793,16 @@ int main(int argc, char **argv)
         case QEMU_NBD_OPT_FORK:
             fork_process = true;
             break;
+        case QEMU_NBD_OPT_IOTHREADS:
+            nb_iothreads = strtol(optarg, &end, 0);
+            if (*end || nb_iothreads < 0) {
+                error_report("Invalid number of I/O threads '%s'", optarg);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case QEMU_NBD_OPT_ZERO_COPY:
+            zero_copy = true;
+            break;
         }
     }
 
@@ -942,6 +975,22 @@ int main(int argc, char **argv)
     bdrv_init();
     atexit(bdrv_close_all);
 
+    if (nb_iothreads) {
+        int i;
+
+        iothreads = g_new0(IOThread *, nb_iothreads);
+        for (i = 0; i < nb_iothreads; i++) {
+            char *id = g_strdup_printf("nbd-iothread%d", i);
+
+            iothreads[i] = iothread_create(id, &local_err);
+            g_free(id);
+            if (!iothreads[i]) {
+                error_report_err(local_err);
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+
     srcpath = argv[optind];
     if (imageOpts) {
         QemuOpts *opts;
@@ -1013,12 +1062,19 @@ int main(int argc, char **argv)
         }
     }
 
+    /* Every connection goes through the same BlockBackend, so it is safe
+     * for clients to spread their requests over several of them */
+    if (shared > 1) {
+        nbdflags |= NBD_FLAG_CAN_MULTI_CONN;
+    }
+
     exp = nbd_export_new(bs, dev_offset, fd_size, nbdflags, nbd_export_closed,
                          writethrough, NULL, &local_err);
     if (!exp) {
         error_report_err(local_err);
         exit(EXIT_FAILURE);
     }
+    nbd_export_set_zero_copy(exp, zero_copy);
     if (export_name) {
         nbd_export_set_name(exp, export_name);
         nbd_export_set_description(exp, export_description);
@@ -1028,6 +1084,18 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
+    if (bitmap) {
+        if (!export_name) {
+            error_report("Exporting a bitmap requires an export name");
+            exit(EXIT_FAILURE);
+        }
+        nbd_export_bitmap(exp, bitmap, bitmap, &local_err);
+        if (local_err) {
+            error_report_err(local_err);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     if (device) {
         int ret;
 
@@ -1067,6 +1135,16 @@ int main(int argc, char **argv)
         }
     } while (state != TERMINATED);
 
+    if (nb_iothreads) {
+        int i;
+
+        for (i = 0; i < nb_iothreads; i++) {
+            iothread_stop(iothreads[i]);
+            iothread_destroy(iothreads[i]);
+        }
+        g_free(iothreads);
+    }
+
     blk_unref(blk);
     if (sockpath) {
         unlink(sockpath);
@@ -593,7 +593,7 @@ static void process_command(GAState *s, QDict *req)
 }
 
 /* handle requests/control events coming in over the channel */
-static void process_event(JSONMessageParser *parser, GQueue *tokens)
+static void process_event(JSONMessageParser *parser, GArray *tokens)
 {
     GAState *s = container_of(parser, GAState, parser);
     QDict *qdict;
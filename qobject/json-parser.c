@@ -23,8 +23,9 @@
 typedef struct JSONParserContext
 {
     Error *err;
-    JSONToken *current;
-    GQueue *buf;
+    const JSONToken *tokens;
+    size_t count;
+    size_t pos;
 } JSONParserContext;
 
 #define BUG_ON(cond) assert(!(cond))
@@ -44,7 +45,8 @@ static QObject *parse_value(JSONParserContext *ctxt, va_list *ap);
  * Error handler
  */
 static void GCC_FMT_ATTR(3, 4) parse_error(JSONParserContext *ctxt,
-                                           JSONToken *token, const char *msg, ...)
+                                           const JSONToken *token,
+                                           const char *msg, ...)
 {
     va_list ap;
     char message[1024];
@@ -122,11 +124,9 @@ static int hex2decimal(char ch)
  *      \t
  *      \u four-hex-digits 
  */
-static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
-                                         JSONToken *token)
+static bool unescape_str(const JSONToken *token, GString *str, Error **errp)
 {
     const char *ptr = token->str;
-    QString *str;
     int double_quote = 1;
 
     if (*ptr == '"') {
@@ -136,47 +136,46 @@ static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
     }
     ptr++;
 
-    str = qstring_new();
-    while (*ptr && 
+    while (*ptr &&
            ((double_quote && *ptr != '"') || (!double_quote && *ptr != '\''))) {
         if (*ptr == '\\') {
             ptr++;
 
             switch (*ptr) {
             case '"':
-                qstring_append(str, "\"");
+                g_string_append_c(str, '"');
                 ptr++;
                 break;
             case '\'':
-                qstring_append(str, "'");
+                g_string_append_c(str, '\'');
                 ptr++;
                 break;
             case '\\':
-                qstring_append(str, "\\");
+                g_string_append_c(str, '\\');
                 ptr++;
                 break;
             case '/':
-                qstring_append(str, "/");
+                g_string_append_c(str, '/');
                 ptr++;
                 break;
             case 'b':
-                qstring_append(str, "\b");
+                g_string_append_c(str, '\b');
                 ptr++;
                 break;
             case 'f':
-                qstring_append(str, "\f");
+                g_string_append_c(str, '\f');
                 ptr++;
                 break;
             case 'n':
-                qstring_append(str, "\n");
+                g_string_append_c(str, '\n');
                 ptr++;
                 break;
             case 'r':
-                qstring_append(str, "\r");
+                g_string_append_c(str, '\r');
                 ptr++;
                 break;
             case 't':
-                qstring_append(str, "\t");
+                g_string_append_c(str, '\t');
                 ptr++;
                 break;
             case 'u': {
@@ -190,80 +189,80 @@ static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
                     if (qemu_isxdigit(*ptr)) {
                         unicode_char |= hex2decimal(*ptr) << ((3 - i) * 4);
                     } else {
-                        parse_error(ctxt, token,
-                                    "invalid hex escape sequence in string");
-                        goto out;
+                        error_setg(errp, "JSON parse error, "
+                                   "invalid hex escape sequence in string");
+                        return false;
                     }
                     ptr++;
                 }
 
                 wchar_to_utf8(unicode_char, utf8_char, sizeof(utf8_char));
-                qstring_append(str, utf8_char);
+                g_string_append(str, utf8_char);
             }   break;
             default:
-                parse_error(ctxt, token, "invalid escape sequence in string");
-                goto out;
+                error_setg(errp, "JSON parse error, "
+                           "invalid escape sequence in string");
+                return false;
             }
         } else {
-            char dummy[2];
+            /* Copy everything up to the next escape or quote at once */
+            size_t n = strcspn(ptr, double_quote ? "\\\"" : "\\'");
 
-            dummy[0] = *ptr++;
-            dummy[1] = 0;
-
-            qstring_append(str, dummy);
+            g_string_append_len(str, ptr, n);
+            ptr += n;
         }
     }
 
-    return str;
-
-out:
-    QDECREF(str);
-    return NULL;
+    return true;
 }
 
-/* Note: the token object returned by parser_context_peek_token or
- * parser_context_pop_token is deleted as soon as parser_context_pop_token
- * is called again.
- */
-static JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
+char *json_parser_parse_string(const JSONToken *token, Error **errp)
 {
-    g_free(ctxt->current);
-    assert(!g_queue_is_empty(ctxt->buf));
-    ctxt->current = g_queue_pop_head(ctxt->buf);
-    return ctxt->current;
-}
+    GString *str = g_string_sized_new(token->len);
 
-static JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
-{
-    assert(!g_queue_is_empty(ctxt->buf));
-    return g_queue_peek_head(ctxt->buf);
+    assert(token->type == JSON_STRING);
+    if (!unescape_str(token, str, errp)) {
+        g_string_free(str, true);
+        return NULL;
+    }
+    return g_string_free(str, false);
 }
 
-static JSONParserContext *parser_context_new(GQueue *tokens)
+static QString *qstring_from_escaped_str(JSONParserContext *ctxt,
+                                         const JSONToken *token)
 {
-    JSONParserContext *ctxt;
+    Error *local_err = NULL;
+    char *unescaped = json_parser_parse_string(token, &local_err);
+    QString *str;
 
-    if (!tokens) {
+    if (!unescaped) {
+        error_free(ctxt->err);
+        ctxt->err = local_err;
         return NULL;
     }
+    str = qstring_from_str(unescaped);
+    g_free(unescaped);
+    return str;
+}
 
-    ctxt = g_malloc0(sizeof(JSONParserContext));
-    ctxt->buf = tokens;
-
-    return ctxt;
+/* Tokens are owned by the caller of json_parser_parse(), so popping
+ * them just moves the cursor.  Both functions return NULL at the end of
+ * the input.
+ */
+static const JSONToken *parser_context_pop_token(JSONParserContext *ctxt)
+{
+    if (ctxt->pos == ctxt->count) {
+        return NULL;
+    }
+    return &ctxt->tokens[ctxt->pos++];
 }
 
-/* to support error propagation, ctxt->err must be freed separately */
-static void parser_context_free(JSONParserContext *ctxt)
+static const JSONToken *parser_context_peek_token(JSONParserContext *ctxt)
 {
-    if (ctxt) {
-        while (!g_queue_is_empty(ctxt->buf)) {
-            parser_context_pop_token(ctxt);
-        }
-        g_free(ctxt->current);
-        g_queue_free(ctxt->buf);
-        g_free(ctxt);
+    if (ctxt->pos == ctxt->count) {
+        return NULL;
     }
+    return &ctxt->tokens[ctxt->pos];
 }
 
 /**
@@ -272,7 +271,7 @@ static void parser_context_free(JSONParserContext *ctxt)
 static int parse_pair(JSONParserContext *ctxt, QDict *dict, va_list *ap)
 {
     QObject *key = NULL, *value;
-    JSONToken *peek, *token;
+    const JSONToken *peek, *token;
 
     peek = parser_context_peek_token(ctxt);
     if (peek == NULL) {
@@ -318,7 +317,7 @@ out:
 static QObject *parse_object(JSONParserContext *ctxt, va_list *ap)
 {
     QDict *dict = NULL;
-    JSONToken *token, *peek;
+    const JSONToken *token, *peek;
 
     token = parser_context_pop_token(ctxt);
     assert(token && token->type == JSON_LCURLY);
@@ -372,7 +371,7 @@ out:
 static QObject *parse_array(JSONParserContext *ctxt, va_list *ap)
 {
     QList *list = NULL;
-    JSONToken *token, *peek;
+    const JSONToken *token, *peek;
 
     token = parser_context_pop_token(ctxt);
     assert(token && token->type == JSON_LSQUARE);
@@ -435,7 +434,7 @@ out:
 
 static QObject *parse_keyword(JSONParserContext *ctxt)
 {
-    JSONToken *token;
+    const JSONToken *token;
 
     token = parser_context_pop_token(ctxt);
     assert(token && token->type == JSON_KEYWORD);
@@ -453,7 +452,7 @@ static QObject *parse_keyword(JSONParserContext *ctxt)
 
 static QObject *parse_escape(JSONParserContext *ctxt, va_list *ap)
 {
-    JSONToken *token;
+    const JSONToken *token;
 
     if (ap == NULL) {
         return NULL;
@@ -490,7 +489,7 @@ static QObject *parse_escape(JSONParserContext *ctxt, va_list *ap)
 
 static QObject *parse_literal(JSONParserContext *ctxt)
 {
-    JSONToken *token;
+    const JSONToken *token;
 
     token = parser_context_pop_token(ctxt);
     assert(token);
@@ -542,7 +541,7 @@ static QObject *parse_literal(JSONParserContext *ctxt)
 
 static QObject *parse_value(JSONParserContext *ctxt, va_list *ap)
 {
-    JSONToken *token;
+    const JSONToken *token;
 
     token = parser_context_peek_token(ctxt);
     if (token == NULL) {
@@ -569,25 +568,39 @@ static QObject *parse_value(JSONParserContext *ctxt, va_list *ap)
     }
 }
 
-QObject *json_parser_parse(GQueue *tokens, va_list *ap)
+static QObject *parse_tokens(const JSONToken *tokens, size_t count,
+                             va_list *ap, Error **errp)
 {
-    return json_parser_parse_err(tokens, ap, NULL);
+    JSONParserContext ctxt = {
+        .tokens = tokens,
+        .count = count,
+    };
+    QObject *result;
+
+    result = parse_value(&ctxt, ap);
+
+    error_propagate(errp, ctxt.err);
+
+    return result;
 }
 
-QObject *json_parser_parse_err(GQueue *tokens, va_list *ap, Error **errp)
+QObject *json_parser_parse(GArray *tokens, va_list *ap)
 {
-    JSONParserContext *ctxt = parser_context_new(tokens);
-    QObject *result;
+    return json_parser_parse_err(tokens, ap, NULL);
+}
 
-    if (!ctxt) {
+QObject *json_parser_parse_err(GArray *tokens, va_list *ap, Error **errp)
+{
+    if (!tokens) {
         return NULL;
     }
 
-    result = parse_value(ctxt, ap);
-
-    error_propagate(errp, ctxt->err);
-
-    parser_context_free(ctxt);
+    return parse_tokens(&g_array_index(tokens, JSONToken, 0), tokens->len,
+                        ap, errp);
+}
 
-    return result;
+QObject *json_parser_parse_tokens(const JSONToken *tokens, size_t count,
+                                  Error **errp)
+{
+    return parse_tokens(tokens, count, NULL, errp);
 }
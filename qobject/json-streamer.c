@@ -20,26 +20,59 @@
 #define MAX_TOKEN_COUNT (2ULL << 20)
 #define MAX_NESTING (1ULL << 10)
 
-static void json_message_free_token(void *token, void *opaque)
+/* Buffers larger than this are not kept around for the next message */
+#define MAX_CACHED_SIZE (64 * 1024)
+
+static void json_message_reset(JSONMessageParser *parser)
 {
-    g_free(token);
+    if (parser->text->allocated_len > MAX_CACHED_SIZE ||
+        parser->tokens->len * sizeof(JSONToken) > MAX_CACHED_SIZE) {
+        g_array_free(parser->tokens, true);
+        g_string_free(parser->text, true);
+        parser->tokens = g_array_new(false, false, sizeof(JSONToken));
+        parser->text = g_string_new(NULL);
+    } else {
+        g_array_set_size(parser->tokens, 0);
+        g_string_truncate(parser->text, 0);
+    }
+    parser->emitted = false;
 }
 
-static void json_message_free_tokens(JSONMessageParser *parser)
+static void json_message_emit(JSONMessageParser *parser, bool bad)
 {
-    if (parser->tokens) {
-        g_queue_foreach(parser->tokens, json_message_free_token, NULL);
-        g_queue_free(parser->tokens);
-        parser->tokens = NULL;
+    GArray *tokens = NULL;
+    const char *str;
+    guint i;
+
+    if (!bad) {
+        /* @text is not resized any more, point the tokens into it */
+        str = parser->text->str;
+        for (i = 0; i < parser->tokens->len; i++) {
+            JSONToken *token = &g_array_index(parser->tokens, JSONToken, i);
+
+            token->str = str;
+            str += token->len + 1;
+        }
+        tokens = parser->tokens;
     }
+
+    /* send current list of tokens to parser and reset tokenizer */
+    parser->brace_count = 0;
+    parser->bracket_count = 0;
+    parser->token_size = 0;
+    parser->emitted = true;
+    parser->emit(parser, tokens);
 }
 
 static void json_message_process_token(JSONLexer *lexer, GString *input,
                                        JSONTokenType type, int x, int y)
 {
     JSONMessageParser *parser = container_of(lexer, JSONMessageParser, lexer);
-    JSONToken *token;
-    GQueue *tokens;
+    JSONToken token;
+
+    if (parser->emitted) {
+        json_message_reset(parser);
+    }
 
     switch (type) {
     case JSON_LCURLY:
@@ -58,61 +91,44 @@ static void json_message_process_token(JSONLexer *lexer, GString *input,
         break;
     }
 
-    token = g_malloc(sizeof(JSONToken) + input->len + 1);
-    token->type = type;
-    memcpy(token->str, input->str, input->len);
-    token->str[input->len] = 0;
-    token->x = x;
-    token->y = y;
+    token.type = type;
+    token.x = x;
+    token.y = y;
+    token.len = input->len;
+    token.str = NULL;
+    g_array_append_val(parser->tokens, token);
+    /* Including the terminating NUL */
+    g_string_append_len(parser->text, input->str, input->len + 1);
 
     parser->token_size += input->len;
 
-    g_queue_push_tail(parser->tokens, token);
-
     if (type == JSON_ERROR) {
-        goto out_emit_bad;
+        /* Tell the parser to emit an error indication */
+        json_message_emit(parser, true);
     } else if (parser->brace_count < 0 ||
         parser->bracket_count < 0 ||
         (parser->brace_count == 0 &&
          parser->bracket_count == 0)) {
-        goto out_emit;
+        json_message_emit(parser, false);
     } else if (parser->token_size > MAX_TOKEN_SIZE ||
-               g_queue_get_length(parser->tokens) > MAX_TOKEN_COUNT ||
+               parser->tokens->len > MAX_TOKEN_COUNT ||
                parser->bracket_count + parser->brace_count > MAX_NESTING) {
         /* Security consideration, we limit total memory allocated per object
          * and the maximum recursion depth that a message can force.
          */
-        goto out_emit_bad;
+        json_message_emit(parser, true);
     }
-
-    return;
-
-out_emit_bad:
-    /*
-     * Clear out token list and tell the parser to emit an error
-     * indication by passing it a NULL list
-     */
-    json_message_free_tokens(parser);
-out_emit:
-    /* send current list of tokens to parser and reset tokenizer */
-    parser->brace_count = 0;
-    parser->bracket_count = 0;
-    /* parser->emit takes ownership of parser->tokens.  Remove our own
-     * reference to parser->tokens before handing it out to parser->emit.
-     */
-    tokens = parser->tokens;
-    parser->tokens = g_queue_new();
-    parser->emit(parser, tokens);
-    parser->token_size = 0;
 }
 
 void json_message_parser_init(JSONMessageParser *parser,
-                              void (*func)(JSONMessageParser *, GQueue *))
+                              void (*func)(JSONMessageParser *, GArray *))
 {
     parser->emit = func;
     parser->brace_count = 0;
     parser->bracket_count = 0;
-    parser->tokens = g_queue_new();
+    parser->tokens = g_array_new(false, false, sizeof(JSONToken));
+    parser->text = g_string_new(NULL);
+    parser->emitted = false;
     parser->token_size = 0;
 
     json_lexer_init(&parser->lexer, json_message_process_token);
@@ -132,5 +148,6 @@ int json_message_parser_flush(JSONMessageParser *parser)
 void json_message_parser_destroy(JSONMessageParser *parser)
 {
     json_lexer_destroy(&parser->lexer);
-    json_message_free_tokens(parser);
+    g_array_free(parser->tokens, true);
+    g_string_free(parser->text, true);
 }
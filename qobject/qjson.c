@@ -28,7 +28,7 @@ typedef struct JSONParsingState
     Error *err;
 } JSONParsingState;
 
-static void parse_json(JSONMessageParser *parser, GQueue *tokens)
+static void parse_json(JSONMessageParser *parser, GArray *tokens)
 {
     JSONParsingState *s = container_of(parser, JSONParsingState, parser);
 
@@ -82,10 +82,79 @@ typedef struct ToJsonIterState
 
 static void to_json(const QObject *obj, QString *str, int pretty, int indent);
 
+void qjson_append_str(QString *json, const char *str)
+{
+    const char *ptr = str;
+    size_t len;
+    int cp;
+    char buf[16];
+    char *end;
+
+    qstring_append_chr(json, '"');
+
+    while (*ptr) {
+        /* Copy runs of characters that need no escaping in one go */
+        for (len = 0; ptr[len] >= 0x20 && ptr[len] < 0x7F; len++) {
+            if (ptr[len] == '"' || ptr[len] == '\\') {
+                break;
+            }
+        }
+        if (len) {
+            qstring_append_len(json, ptr, len);
+            ptr += len;
+            continue;
+        }
+
+        cp = mod_utf8_codepoint(ptr, 6, &end);
+        switch (cp) {
+        case '\"':
+            qstring_append(json, "\\\"");
+            break;
+        case '\\':
+            qstring_append(json, "\\\\");
+            break;
+        case '\b':
+            qstring_append(json, "\\b");
+            break;
+        case '\f':
+            qstring_append(json, "\\f");
+            break;
+        case '\n':
+            qstring_append(json, "\\n");
+            break;
+        case '\r':
+            qstring_append(json, "\\r");
+            break;
+        case '\t':
+            qstring_append(json, "\\t");
+            break;
+        default:
+            if (cp < 0) {
+                cp = 0xFFFD; /* replacement character */
+            }
+            if (cp > 0xFFFF) {
+                /* beyond BMP; need a surrogate pair */
+                snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
+                         0xD800 + ((cp - 0x10000) >> 10),
+                         0xDC00 + ((cp - 0x10000) & 0x3FF));
+            } else if (cp < 0x20 || cp >= 0x7F) {
+                snprintf(buf, sizeof(buf), "\\u%04X", cp);
+            } else {
+                buf[0] = cp;
+                buf[1] = 0;
+            }
+            qstring_append(json, buf);
+        }
+        ptr = end;
+    }
+
+    qstring_append_chr(json, '"');
+}
+
+
 static void to_json_dict_iter(const char *key, QObject *obj, void *opaque)
 {
     ToJsonIterState *s = opaque;
-    QString *qkey;
     int j;
 
     if (s->count) {
@@ -98,10 +167,7 @@ static void to_json_dict_iter(const char *key, QObject *obj, void *opaque)
             qstring_append(s->str, "    ");
     }
 
-    qkey = qstring_from_str(key);
-    to_json(QOBJECT(qkey), s->str, s->pretty, s->indent);
-    QDECREF(qkey);
-
+    qjson_append_str(s->str, key);
     qstring_append(s->str, ": ");
     to_json(obj, s->str, s->pretty, s->indent);
     s->count++;
@@ -139,62 +205,9 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
         g_free(buffer);
         break;
     }
-    case QTYPE_QSTRING: {
-        QString *val = qobject_to_qstring(obj);
-        const char *ptr;
-        int cp;
-        char buf[16];
-        char *end;
-
-        ptr = qstring_get_str(val);
-        qstring_append(str, "\"");
-
-        for (; *ptr; ptr = end) {
-            cp = mod_utf8_codepoint(ptr, 6, &end);
-            switch (cp) {
-            case '\"':
-                qstring_append(str, "\\\"");
-                break;
-            case '\\':
-                qstring_append(str, "\\\\");
-                break;
-            case '\b':
-                qstring_append(str, "\\b");
-                break;
-            case '\f':
-                qstring_append(str, "\\f");
-                break;
-            case '\n':
-                qstring_append(str, "\\n");
-                break;
-            case '\r':
-                qstring_append(str, "\\r");
-                break;
-            case '\t':
-                qstring_append(str, "\\t");
-                break;
-            default:
-                if (cp < 0) {
-                    cp = 0xFFFD; /* replacement character */
-                }
-                if (cp > 0xFFFF) {
-                    /* beyond BMP; need a surrogate pair */
-                    snprintf(buf, sizeof(buf), "\\u%04X\\u%04X",
-                             0xD800 + ((cp - 0x10000) >> 10),
-                             0xDC00 + ((cp - 0x10000) & 0x3FF));
-                } else if (cp < 0x20 || cp >= 0x7F) {
-                    snprintf(buf, sizeof(buf), "\\u%04X", cp);
-                } else {
-                    buf[0] = cp;
-                    buf[1] = 0;
-                }
-                qstring_append(str, buf);
-            }
-        };
-
-        qstring_append(str, "\"");
+    case QTYPE_QSTRING:
+        qjson_append_str(str, qstring_get_str(qobject_to_qstring(obj)));
         break;
-    }
     case QTYPE_QDICT: {
         ToJsonIterState s;
         QDict *val = qobject_to_qdict(obj);
@@ -248,6 +261,11 @@ static void to_json(const QObject *obj, QString *str, int pretty, int indent)
     }
 }
 
+void qjson_append(QString *json, const QObject *obj, bool pretty, int indent)
+{
+    to_json(obj, json, pretty, indent);
+}
+
 QString *qobject_to_json(const QObject *obj)
 {
     QString *str = qstring_new();
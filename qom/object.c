@@ -62,6 +62,14 @@ struct TypeImpl
     const char *parent;
     TypeImpl *parent_type;
 
+    /*
+     * Set up by type_initialize(): the number of ancestors, and the
+     * ancestors themselves from the root down to this type, so that
+     * ancestry can be checked without walking the hierarchy.
+     */
+    int depth;
+    TypeImpl **ancestors;
+
     ObjectClass *class;
 
     int num_interfaces;
@@ -222,6 +230,15 @@ static bool type_is_ancestor(TypeImpl *type, TypeImpl *target_type)
 {
     assert(target_type);
 
+    /*
+     * Ancestors of an initialized type are initialized too, so if
+     * target_type is not, its depth of 0 makes the check fail.
+     */
+    if (type && type->ancestors) {
+        return target_type->depth <= type->depth &&
+               type->ancestors[target_type->depth] == target_type;
+    }
+
     /* Check if target_type is a direct ancestor of type */
     while (type) {
         if (type == target_type) {
@@ -329,6 +346,14 @@ static void type_initialize(TypeImpl *ti)
             g_str_hash, g_str_equal, g_free, object_property_free);
     }
 
+    ti->depth = parent ? parent->depth + 1 : 0;
+    ti->ancestors = g_new(TypeImpl *, ti->depth + 1);
+    if (parent) {
+        memcpy(ti->ancestors, parent->ancestors,
+               ti->depth * sizeof(*ti->ancestors));
+    }
+    ti->ancestors[ti->depth] = ti;
+
     ti->class->type = ti;
 
     while (parent) {
@@ -1040,22 +1065,24 @@ ObjectProperty *object_property_iter_next(ObjectPropertyIterator *iter)
 ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name,
                                            Error **errp)
 {
+    TypeImpl *type = klass->type;
     ObjectProperty *prop;
-    ObjectClass *parent_klass;
+    GHashTable *props;
+    int i;
 
-    parent_klass = object_class_get_parent(klass);
-    if (parent_klass) {
-        prop = object_class_property_find(parent_klass, name, NULL);
-        if (prop) {
-            return prop;
+    /* Search from the root down; most classes add no properties */
+    for (i = 0; i <= type->depth; i++) {
+        props = type->ancestors[i]->class->properties;
+        if (g_hash_table_size(props)) {
+            prop = g_hash_table_lookup(props, name);
+            if (prop) {
+                return prop;
+            }
         }
     }
 
-    prop = g_hash_table_lookup(klass->properties, name);
-    if (!prop) {
-        error_setg(errp, "Property '.%s' not found", name);
-    }
-    return prop;
+    error_setg(errp, "Property '.%s' not found", name);
+    return NULL;
 }
 
 void object_property_del(Object *obj, const char *name, Error **errp)
@@ -53,7 +53,11 @@ def gen_call(name, arg_type, boxed, ret_type):
         goto out;
     }
 
-    qmp_marshal_output_%(c_name)s(retval, ret, &err);
+    if (ret_json) {
+        qmp_marshal_json_output_%(c_name)s(retval, ret_json, pretty, &err);
+    } else {
+        qmp_marshal_output_%(c_name)s(retval, ret, &err);
+    }
 ''',
                      c_name=ret_type.c_name())
     return ret
@@ -78,6 +82,23 @@ static void qmp_marshal_output_%(c_name)s(%(c_type)s ret_in, QObject **ret_out,
     visit_type_%(c_name)s(v, "unused", &ret_in, NULL);
     visit_free(v);
 }
+
+static void qmp_marshal_json_output_%(c_name)s(%(c_type)s ret_in, QString *ret_out, bool pretty, Error **errp)
+{
+    Error *err = NULL;
+    Visitor *v;
+
+    v = json_output_visitor_new(pretty, ret_out);
+    visit_type_%(c_name)s(v, "unused", &ret_in, &err);
+    if (!err) {
+        visit_complete(v, ret_out);
+    }
+    error_propagate(errp, err);
+    visit_free(v);
+    v = qapi_dealloc_visitor_new();
+    visit_type_%(c_name)s(v, "unused", &ret_in, NULL);
+    visit_free(v);
+}
 ''',
                  c_type=ret_type.c_type(), c_name=ret_type.c_name())
 
@@ -87,6 +108,27 @@ def build_marshal_proto(name):
             % c_name(name))
 
 
+def build_do_marshal_proto(name):
+    return ('static void qmp_do_marshal_%s(QDict *args, QObject **ret, '
+            'QString *ret_json, bool pretty, Error **errp)' % c_name(name))
+
+
+def gen_marshal_wrappers(name):
+    return mcgen('''
+
+%(proto)s
+{
+    qmp_do_marshal_%(c_name)s(args, ret, NULL, false, errp);
+}
+
+static void qmp_marshal_json_%(c_name)s(QDict *args, QString *ret, bool pretty, Error **errp)
+{
+    qmp_do_marshal_%(c_name)s(args, NULL, ret, pretty, errp);
+}
+''',
+                 proto=build_marshal_proto(name), c_name=c_name(name))
+
+
 def gen_marshal_decl(name):
     return mcgen('''
 %(proto)s;
@@ -97,13 +139,19 @@ def gen_marshal_decl(name):
 def gen_marshal(name, arg_type, boxed, ret_type):
     have_args = arg_type and not arg_type.is_empty()
 
+    # Commands with a return value can also return it as JSON text
+    if ret_type:
+        proto = build_do_marshal_proto(name)
+    else:
+        proto = build_marshal_proto(name)
+
     ret = mcgen('''
 
 %(proto)s
 {
     Error *err = NULL;
 ''',
-                proto=build_marshal_proto(name))
+                proto=proto)
 
     if ret_type:
         ret += mcgen('''
@@ -189,10 +237,13 @@ out:
     ret += mcgen('''
 }
 ''')
+
+    if ret_type:
+        ret += gen_marshal_wrappers(name)
     return ret
 
 
-def gen_register_command(name, success_response):
+def gen_register_command(name, success_response, ret_type):
     options = 'QCO_NO_OPTIONS'
     if not success_response:
         options = 'QCO_NO_SUCCESS_RESP'
@@ -203,6 +254,12 @@ def gen_register_command(name, success_response):
 ''',
                 name=name, c_name=c_name(name),
                 opts=options)
+    if ret_type:
+        ret += mcgen('''
+    qmp_register_command_json(cmds, "%(name)s",
+                              qmp_marshal_json_%(c_name)s);
+''',
+                     name=name, c_name=c_name(name))
     return ret
 
 
@@ -250,7 +307,8 @@ class QAPISchemaGenCommandVisitor(QAPISchemaVisitor):
             self.defn += gen_marshal_output(ret_type)
         self.decl += gen_marshal_decl(name)
         self.defn += gen_marshal(name, arg_type, boxed, ret_type)
-        self._regy += gen_register_command(name, success_response)
+        self._regy += gen_register_command(name, success_response,
+                                           ret_type)
 
 
 (input_file, output_dir, do_c, do_h, prefix, opts) = parse_command_line()
@@ -296,6 +354,7 @@ fdef.write(mcgen('''
 #include "qapi/visitor.h"
 #include "qapi/qobject-output-visitor.h"
 #include "qapi/qobject-input-visitor.h"
+#include "qapi/json-output-visitor.h"
 #include "qapi/dealloc-visitor.h"
 #include "%(prefix)sqapi-types.h"
 #include "%(prefix)sqapi-visit.h"
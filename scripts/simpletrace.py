@@ -12,18 +12,32 @@
 import struct
 import re
 import inspect
+import mmap
+import time
 from tracetool import read_events, Event
 from tracetool.backend.simple import is_string
 
 header_event_id = 0xffffffffffffffff
 header_magic    = 0xf2b177cb0aa429b4
 dropped_event_id = 0xfffffffffffffffe
+shm_magic       = 0x676e697274756d71
 
 record_type_mapping = 0
 record_type_event = 1
 
 log_header_fmt = '=QQQ'
-rec_header_fmt = '=QQII'
+rec_header_fmt = {
+    4: '=QQII',
+    5: '=QQIIQ',        # adds the thread ID
+}
+shm_header_fmt = '=QQIIII'
+
+class Record(tuple):
+    """A trace record tuple (name, timestamp, pid, arg1, ..., arg6).
+
+    The ID of the thread that emitted the record is available as the `tid`
+    attribute, or None if the trace file does not record it."""
+    tid = None
 
 def read_header(fobj, hfmt):
     '''Read a trace record header'''
@@ -34,10 +48,11 @@ def read_header(fobj, hfmt):
     return struct.unpack(hfmt, hdr)
 
 def get_record(edict, idtoname, rechdr, fobj):
-    """Deserialize a trace record from a file into a tuple
+    """Deserialize a trace record from a file into a Record
        (name, timestamp, pid, arg1, ..., arg6)."""
     if rechdr is None:
         return None
+    tid = rechdr[4] if len(rechdr) > 4 else None
     if rechdr[0] != dropped_event_id:
         event_id = rechdr[0]
         name = idtoname[event_id]
@@ -64,6 +79,8 @@ def get_record(edict, idtoname, rechdr, fobj):
         rec = ("dropped", rechdr[1], rechdr[3])
         (value,) = struct.unpack('=Q', fobj.read(8))
         rec = rec + (value,)
+    rec = Record(rec)
+    rec.tid = tid
     return rec
 
 def get_mapping(fobj):
@@ -73,13 +90,13 @@ def get_mapping(fobj):
 
     return (event_id, name)
 
-def read_record(edict, idtoname, fobj):
-    """Deserialize a trace record from a file into a tuple (event_num, timestamp, pid, arg1, ..., arg6)."""
-    rechdr = read_header(fobj, rec_header_fmt)
+def read_record(edict, idtoname, fobj, log_version=5):
+    """Deserialize a trace record from a file into a Record (event_num, timestamp, pid, arg1, ..., arg6)."""
+    rechdr = read_header(fobj, rec_header_fmt[log_version])
     return get_record(edict, idtoname, rechdr, fobj)
 
 def read_trace_header(fobj):
-    """Read and verify trace file header"""
+    """Read and verify trace file header, returning the format version"""
     header = read_header(fobj, log_header_fmt)
     if header is None:
         raise ValueError('Not a valid trace file!')
@@ -91,13 +108,14 @@ def read_trace_header(fobj):
                          (header[1], header_magic))
 
     log_version = header[2]
-    if log_version not in [0, 2, 3, 4]:
+    if log_version not in [0, 2, 3, 4, 5]:
         raise ValueError('Unknown version of tracelog format!')
-    if log_version != 4:
+    if log_version not in rec_header_fmt:
         raise ValueError('Log format %d not supported with this QEMU release!'
                          % log_version)
+    return log_version
 
-def read_trace_records(edict, idtoname, fobj):
+def read_trace_records(edict, idtoname, fobj, log_version=5):
     """Deserialize trace records from a file, yielding record tuples (event_num, timestamp, pid, arg1, ..., arg6).
 
     Note that `idtoname` is modified if the file contains mapping records.
@@ -106,6 +124,7 @@ def read_trace_records(edict, idtoname, fobj):
         edict (str -> Event): events dict, indexed by name
         idtoname (int -> str): event names dict, indexed by event ID
         fobj (file): input file
+        log_version (int): trace file format version
 
     """
     while True:
@@ -118,10 +137,52 @@ def read_trace_records(edict, idtoname, fobj):
             event_id, name = get_mapping(fobj)
             idtoname[event_id] = name
         else:
-            rec = read_record(edict, idtoname, fobj)
+            rec = read_record(edict, idtoname, fobj, log_version)
 
             yield rec
 
+class ShmReader(object):
+    """A file-like object that consumes the shared memory trace ring set up
+    with -trace shm=NAME.
+
+    The ring carries the same stream as a trace file.  read() busy-waits with
+    short sleeps until enough data is available and never returns a short
+    read, so processing only stops when interrupted."""
+
+    def __init__(self, name, poll_interval=0.001):
+        import os
+        if not name.startswith('/'):
+            name = '/' + name
+        fd = os.open('/dev/shm' + name, os.O_RDWR)
+        try:
+            self.mm = mmap.mmap(fd, 0)
+        finally:
+            os.close(fd)
+        self.hdr_len = struct.calcsize(shm_header_fmt)
+        (magic, version, self.size, head, self.tail, _) = \
+            struct.unpack_from(shm_header_fmt, self.mm, 0)
+        if magic != shm_magic:
+            raise ValueError('Not a valid trace ring, magic %d != %d' %
+                             (magic, shm_magic))
+        if version not in rec_header_fmt:
+            raise ValueError('Trace ring format %d not supported!' % version)
+        self.poll_interval = poll_interval
+
+    def read(self, n):
+        while True:
+            (head,) = struct.unpack_from('=I', self.mm, 20)
+            if (head - self.tail) & 0xffffffff >= n:
+                break
+            time.sleep(self.poll_interval)
+
+        off = self.tail & (self.size - 1)
+        first = min(n, self.size - off)
+        data = self.mm[self.hdr_len + off:self.hdr_len + off + first]
+        data += self.mm[self.hdr_len:self.hdr_len + n - first]
+        self.tail = (self.tail + n) & 0xffffffff
+        struct.pack_into('=I', self.mm, 24, self.tail)
+        return data
+
 class Analyzer(object):
     """A trace file analyzer which processes trace records.
 
@@ -151,6 +212,12 @@ class Analyzer(object):
 
       def runstate_set(self, timestamp, pid, new_state):
           ...
+
+    The thread ID can be included after the pid to tell events from different
+    threads apart::
+
+      def runstate_set(self, timestamp, pid, tid, new_state):
+          ...
     """
 
     def begin(self):
@@ -172,8 +239,9 @@ def process(events, log, analyzer, read_header=True):
     if isinstance(log, str):
         log = open(log, 'rb')
 
+    log_version = 5
     if read_header:
-        read_trace_header(log)
+        log_version = read_trace_header(log)
 
     dropped_event = Event.build("Dropped_Event(uint64_t num_events_dropped)")
     edict = {"dropped": dropped_event}
@@ -197,7 +265,11 @@ def process(events, log, analyzer, read_header=True):
 
         event_argcount = len(event.args)
         fn_argcount = len(inspect.getargspec(fn)[0]) - 1
-        if fn_argcount == event_argcount + 1:
+        if fn_argcount == event_argcount + 3:
+            # Include timestamp, pid and tid
+            return lambda _, rec: fn(*(rec[1:3] + (rec.tid,) +
+                                       rec[3:3 + event_argcount]))
+        elif fn_argcount == event_argcount + 1:
             # Include timestamp as first argument
             return lambda _, rec: fn(*((rec[1:2],) + rec[3:3 + event_argcount]))
         elif fn_argcount == event_argcount + 2:
@@ -209,7 +281,7 @@ def process(events, log, analyzer, read_header=True):
 
     analyzer.begin()
     fn_cache = {}
-    for rec in read_trace_records(edict, idtoname, log):
+    for rec in read_trace_records(edict, idtoname, log, log_version):
         event_num = rec[0]
         event = edict[event_num]
         if event_num not in fn_cache:
@@ -225,16 +297,23 @@ def run(analyzer):
     import sys
 
     read_header = True
+    shm = False
     if len(sys.argv) == 4 and sys.argv[1] == '--no-header':
         read_header = False
         del sys.argv[1]
+    elif len(sys.argv) == 4 and sys.argv[1] == '--shm':
+        shm = True
+        del sys.argv[1]
     elif len(sys.argv) != 3:
-        sys.stderr.write('usage: %s [--no-header] <trace-events> ' \
-                         '<trace-file>\n' % sys.argv[0])
+        sys.stderr.write('usage: %s [--no-header | --shm] <trace-events> ' \
+                         '<trace-file | shm-name>\n' % sys.argv[0])
         sys.exit(1)
 
     events = read_events(open(sys.argv[1], 'r'))
-    process(events, sys.argv[2], analyzer, read_header=read_header)
+    log = sys.argv[2]
+    if shm:
+        log = ShmReader(log)
+    process(events, log, analyzer, read_header=read_header)
 
 if __name__ == '__main__':
     class Formatter(Analyzer):
@@ -250,6 +329,8 @@ if __name__ == '__main__':
 
             fields = [event.name, '%0.3f' % (delta_ns / 1000.0),
                       'pid=%d' % rec[2]]
+            if rec.tid is not None:
+                fields.append('tid=%d' % rec.tid)
             i = 3
             for type, name in event.args:
                 if is_string(type):
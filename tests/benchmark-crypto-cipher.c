@@ -14,17 +14,24 @@
 #include "crypto/init.h"
 #include "crypto/cipher.h"
 
-static void test_cipher_speed(const void *opaque)
+static void test_cipher_speed(QCryptoCipherAlgorithm alg,
+                              QCryptoCipherMode mode,
+                              size_t chunk_size)
 {
     QCryptoCipher *cipher;
     Error *err = NULL;
-    double total = 0.0;
-    size_t chunk_size = (size_t)opaque;
+    double total;
     uint8_t *key = NULL, *iv = NULL;
     uint8_t *plaintext = NULL, *ciphertext = NULL;
-    size_t nkey = qcrypto_cipher_get_key_len(QCRYPTO_CIPHER_ALG_AES_128);
-    size_t niv = qcrypto_cipher_get_iv_len(QCRYPTO_CIPHER_ALG_AES_128,
-                                           QCRYPTO_CIPHER_MODE_CBC);
+    size_t nkey = qcrypto_cipher_get_key_len(alg);
+    size_t niv = qcrypto_cipher_get_iv_len(alg, mode);
+    /* XTS is used for disk encryption, with a new IV per sector */
+    size_t sector_size = mode == QCRYPTO_CIPHER_MODE_XTS ? 512 : chunk_size;
+    size_t offset;
+
+    if (mode == QCRYPTO_CIPHER_MODE_XTS) {
+        nkey *= 2;
+    }
 
     key = g_new0(uint8_t, nkey);
     memset(key, g_test_rand_int(), nkey);
@@ -37,39 +44,58 @@ static void test_cipher_speed(const void *opaque)
     plaintext = g_new0(uint8_t, chunk_size);
     memset(plaintext, g_test_rand_int(), chunk_size);
 
-    cipher = qcrypto_cipher_new(QCRYPTO_CIPHER_ALG_AES_128,
-                                QCRYPTO_CIPHER_MODE_CBC,
-                                key, nkey, &err);
-    g_assert(cipher != NULL);
+    /* Measure each of the AES implementations the host supports */
+    do {
+        cipher = qcrypto_cipher_new(alg, mode, key, nkey, &err);
+        g_assert(cipher != NULL);
 
-    g_assert(qcrypto_cipher_setiv(cipher,
-                                  iv, niv,
-                                  &err) == 0);
+        total = 0.0;
+        g_test_timer_start();
+        do {
+            for (offset = 0; offset < chunk_size; offset += sector_size) {
+                g_assert(qcrypto_cipher_setiv(cipher,
+                                              iv, niv,
+                                              &err) == 0);
+
+                g_assert(qcrypto_cipher_encrypt(cipher,
+                                                plaintext + offset,
+                                                ciphertext + offset,
+                                                sector_size,
+                                                &err) == 0);
+            }
+            total += chunk_size;
+        } while (g_test_timer_elapsed() < 5.0);
+
+        total /= 1024 * 1024; /* to MB */
+
+        g_print("%s(%s) [%s]: ", QCryptoCipherMode_str(mode),
+                QCryptoCipherAlgorithm_str(alg),
+                test_qcrypto_cipher_accel_name());
+        g_print("Testing chunk_size %zu bytes ", chunk_size);
+        g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
+        g_print("%.2f MB/sec\n", total / g_test_timer_last());
+
+        qcrypto_cipher_free(cipher);
+    } while (test_qcrypto_cipher_next_accel());
 
-    g_test_timer_start();
-    do {
-        g_assert(qcrypto_cipher_encrypt(cipher,
-                                        plaintext,
-                                        ciphertext,
-                                        chunk_size,
-                                        &err) == 0);
-        total += chunk_size;
-    } while (g_test_timer_elapsed() < 5.0);
-
-    total /= 1024 * 1024; /* to MB */
-
-    g_print("cbc(aes128): ");
-    g_print("Testing chunk_size %zu bytes ", chunk_size);
-    g_print("done: %.2f MB in %.2f secs: ", total, g_test_timer_last());
-    g_print("%.2f MB/sec\n", total / g_test_timer_last());
-
-    qcrypto_cipher_free(cipher);
     g_free(plaintext);
     g_free(ciphertext);
     g_free(iv);
     g_free(key);
 }
 
+static void test_cipher_speed_cbc_aes128(const void *opaque)
+{
+    test_cipher_speed(QCRYPTO_CIPHER_ALG_AES_128, QCRYPTO_CIPHER_MODE_CBC,
+                      (size_t)opaque);
+}
+
+static void test_cipher_speed_xts_aes256(const void *opaque)
+{
+    test_cipher_speed(QCRYPTO_CIPHER_ALG_AES_256, QCRYPTO_CIPHER_MODE_XTS,
+                      (size_t)opaque);
+}
+
 int main(int argc, char **argv)
 {
     size_t i;
@@ -81,7 +107,17 @@ int main(int argc, char **argv)
     for (i = 512; i <= (64 * 1204); i *= 2) {
         memset(name, 0 , sizeof(name));
         snprintf(name, sizeof(name), "/crypto/cipher/speed-%zu", i);
-        g_test_add_data_func(name, (void *)i, test_cipher_speed);
+        g_test_add_data_func(name, (void *)i, test_cipher_speed_cbc_aes128);
+    }
+
+    if (qcrypto_cipher_supports(QCRYPTO_CIPHER_ALG_AES_256,
+                                QCRYPTO_CIPHER_MODE_XTS)) {
+        for (i = 512; i <= (64 * 1204); i *= 2) {
+            memset(name, 0 , sizeof(name));
+            snprintf(name, sizeof(name), "/crypto/cipher/speed-xts-%zu", i);
+            g_test_add_data_func(name, (void *)i,
+                                 test_cipher_speed_xts_aes256);
+        }
     }
 
     return g_test_run();
@@ -0,0 +1,177 @@
+/*
+ * QOM cast and property lookup speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qom/object.h"
+#include "qemu/module.h"
+
+#define TYPE_BENCH_IF "bench-interface"
+#define TYPE_BENCH_BASE "bench-base"
+#define TYPE_BENCH_LEAF "bench-level-5"
+#define TYPE_BENCH_OTHER "bench-other"
+
+#define BENCH_DEPTH 5
+#define BENCH_BATCH 1000
+
+typedef struct BenchIf BenchIf;
+
+typedef struct BenchIfClass {
+    InterfaceClass parent_class;
+} BenchIfClass;
+
+static const TypeInfo bench_if_info = {
+    .name = TYPE_BENCH_IF,
+    .parent = TYPE_INTERFACE,
+    .class_size = sizeof(BenchIfClass),
+};
+
+static bool bench_get_flag(Object *obj, Error **errp)
+{
+    return true;
+}
+
+static void bench_base_class_init(ObjectClass *oc, void *data)
+{
+    object_class_property_add_bool(oc, "flag", bench_get_flag, NULL,
+                                   &error_abort);
+}
+
+static const TypeInfo bench_base_info = {
+    .name = TYPE_BENCH_BASE,
+    .parent = TYPE_OBJECT,
+    .class_init = bench_base_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_BENCH_IF },
+        { }
+    }
+};
+
+static const TypeInfo bench_other_info = {
+    .name = TYPE_BENCH_OTHER,
+    .parent = TYPE_OBJECT,
+};
+
+static void register_bench_types(void)
+{
+    static char names[BENCH_DEPTH][32];
+    static TypeInfo infos[BENCH_DEPTH];
+    int i;
+
+    type_register_static(&bench_if_info);
+    type_register_static(&bench_base_info);
+    type_register_static(&bench_other_info);
+
+    /* bench-level-1 ... bench-level-5, each deriving from the previous */
+    for (i = 0; i < BENCH_DEPTH; i++) {
+        snprintf(names[i], sizeof(names[i]), "bench-level-%d", i + 1);
+        infos[i].name = names[i];
+        infos[i].parent = i ? names[i - 1] : TYPE_BENCH_BASE;
+        type_register_static(&infos[i]);
+    }
+}
+
+typedef enum {
+    BENCH_OBJECT_CAST,
+    BENCH_OBJECT_CAST_MISS,
+    BENCH_OBJECT_CHECK,
+    BENCH_INTERFACE_CHECK,
+    BENCH_CLASS_CAST,
+    BENCH_CLASS_CAST_INTERFACE,
+    BENCH_PROPERTY_FIND,
+} BenchOp;
+
+typedef struct BenchCase {
+    const char *path;
+    BenchOp op;
+    const char *target;
+} BenchCase;
+
+static const BenchCase bench_cases[] = {
+    { "/qom/cast/object/base", BENCH_OBJECT_CAST, TYPE_BENCH_BASE },
+    { "/qom/cast/object/leaf", BENCH_OBJECT_CAST, TYPE_BENCH_LEAF },
+    { "/qom/cast/object/miss", BENCH_OBJECT_CAST_MISS, TYPE_BENCH_OTHER },
+    { "/qom/cast/object/interface", BENCH_OBJECT_CAST, TYPE_BENCH_IF },
+    /* These are unchecked casts without CONFIG_QOM_CAST_DEBUG */
+    { "/qom/cast/check/object", BENCH_OBJECT_CHECK, TYPE_BENCH_LEAF },
+    { "/qom/cast/check/interface", BENCH_INTERFACE_CHECK, TYPE_BENCH_IF },
+    { "/qom/cast/class/base", BENCH_CLASS_CAST, TYPE_BENCH_BASE },
+    { "/qom/cast/class/interface", BENCH_CLASS_CAST_INTERFACE,
+      TYPE_BENCH_IF },
+    { "/qom/property/find/inherited", BENCH_PROPERTY_FIND, "flag" },
+    { "/qom/property/find/instance", BENCH_PROPERTY_FIND, "type" },
+};
+
+static void test_cast_speed(const void *opaque)
+{
+    const BenchCase *bc = opaque;
+    Object *obj = object_new(TYPE_BENCH_LEAF);
+    ObjectClass *oc = object_get_class(obj);
+    const void *volatile sink;
+    uint64_t total = 0;
+    int i;
+
+    g_test_timer_start();
+    do {
+        for (i = 0; i < BENCH_BATCH; i++) {
+            switch (bc->op) {
+            case BENCH_OBJECT_CAST:
+                sink = object_dynamic_cast(obj, bc->target);
+                g_assert(sink == obj);
+                break;
+            case BENCH_OBJECT_CAST_MISS:
+                sink = object_dynamic_cast(obj, bc->target);
+                g_assert(!sink);
+                break;
+            case BENCH_OBJECT_CHECK:
+                sink = OBJECT_CHECK(Object, obj, bc->target);
+                g_assert(sink == obj);
+                break;
+            case BENCH_INTERFACE_CHECK:
+                sink = INTERFACE_CHECK(BenchIf, obj, bc->target);
+                g_assert(sink == obj);
+                break;
+            case BENCH_CLASS_CAST:
+                sink = object_class_dynamic_cast(oc, bc->target);
+                g_assert(sink == oc);
+                break;
+            case BENCH_CLASS_CAST_INTERFACE:
+                sink = object_class_dynamic_cast(oc, bc->target);
+                g_assert(sink);
+                break;
+            case BENCH_PROPERTY_FIND:
+                sink = object_property_find(obj, bc->target, NULL);
+                g_assert(sink);
+                break;
+            }
+        }
+        total += BENCH_BATCH;
+    } while (g_test_timer_elapsed() < 1.0);
+
+    g_print("%s: %" PRIu64 " ops in %.2f secs: %.2f ns/op\n",
+            bc->path, total, g_test_timer_last(),
+            g_test_timer_last() * 1e9 / total);
+
+    object_unref(obj);
+}
+
+int main(int argc, char **argv)
+{
+    size_t i;
+
+    g_test_init(&argc, &argv, NULL);
+
+    module_call_init(MODULE_INIT_QOM);
+    register_bench_types();
+
+    for (i = 0; i < ARRAY_SIZE(bench_cases); i++) {
+        g_test_add_data_func(bench_cases[i].path, &bench_cases[i],
+                             test_cast_speed);
+    }
+
+    return g_test_run();
+}
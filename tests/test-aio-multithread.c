@@ -14,6 +14,7 @@
 #include "block/aio.h"
 #include "qapi/error.h"
 #include "qemu/coroutine.h"
+#include "qemu/coroutine_int.h"
 #include "qemu/thread.h"
 #include "qemu/error-report.h"
 #include "iothread.h"
@@ -105,6 +106,76 @@ static void test_lifecycle(void)
     join_aio_contexts();
 }
 
+/* Coroutine pool test.  */
+
+#define STACK_TEST_COROUTINES 256
+
+static Coroutine *stack_test_co[STACK_TEST_COROUTINES];
+static size_t stack_test_size;
+static int stack_test_done;
+
+static int __attribute__((noinline)) stack_test_use(int n)
+{
+    volatile char buf[1024];
+
+    buf[0] = n;
+    return n ? stack_test_use(n - 1) + buf[0] : 0;
+}
+
+static void coroutine_fn stack_test_entry(void *opaque)
+{
+    g_assert_cmpint(qemu_coroutine_self()->stack_size, ==, stack_test_size);
+    qemu_coroutine_yield();
+    stack_test_use(16);
+    stack_test_done++;
+}
+
+static void stack_test_create_cb(void *opaque)
+{
+    int i;
+
+    for (i = 0; i < STACK_TEST_COROUTINES; i++) {
+        stack_test_co[i] = qemu_coroutine_create(stack_test_entry, NULL);
+        qemu_coroutine_enter(stack_test_co[i]);
+    }
+}
+
+static void stack_test_finish_cb(void *opaque)
+{
+    int i;
+
+    for (i = 0; i < STACK_TEST_COROUTINES; i++) {
+        qemu_coroutine_enter(stack_test_co[i]);
+    }
+}
+
+static void test_coroutine_stack_size(void)
+{
+    static const size_t sizes[] = {
+        64 * 1024, 64 * 1024, COROUTINE_STACK_SIZE,
+    };
+    Error *local_err = NULL;
+    int i;
+
+    create_aio_contexts();
+
+    aio_context_set_coroutine_stack_size(ctx[0], 1024, &local_err);
+    g_assert(local_err);
+    error_free(local_err);
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+        stack_test_size = sizes[i];
+        stack_test_done = 0;
+        aio_context_set_coroutine_stack_size(ctx[0], stack_test_size,
+                                             &error_abort);
+        ctx_run(0, stack_test_create_cb, NULL);
+        ctx_run(0, stack_test_finish_cb, NULL);
+        g_assert_cmpint(stack_test_done, ==, STACK_TEST_COROUTINES);
+    }
+
+    join_aio_contexts();
+}
+
 /* aio_co_schedule test.  */
 
 static Coroutine *to_schedule[NUM_CONTEXTS];
@@ -440,6 +511,8 @@ int main(int argc, char **argv)
 
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/aio/multi/lifecycle", test_lifecycle);
+    g_test_add_func("/aio/multi/coroutine-stack-size",
+                    test_coroutine_stack_size);
     if (g_test_quick()) {
         g_test_add_func("/aio/multi/schedule", test_multi_co_schedule_1);
         g_test_add_func("/aio/multi/mutex/contended", test_multi_co_mutex_1);
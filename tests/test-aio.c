@@ -381,6 +381,31 @@ static void test_flush_event_notifier(void)
     event_notifier_cleanup(&data.e);
 }
 
+static void test_replace_event_notifier(void)
+{
+    EventNotifierTestData data = { .n = 0, .active = 2 };
+    event_notifier_init(&data.e, false);
+    set_event_notifier(ctx, &data.e, dummy_io_handler_read);
+    event_notifier_set(&data.e);
+
+    /* The old handler must not run once it has been replaced */
+    set_event_notifier(ctx, &data.e, event_ready_cb);
+    g_assert(aio_poll(ctx, false));
+    g_assert_cmpint(data.n, ==, 1);
+    g_assert_cmpint(data.active, ==, 1);
+
+    /* Replace it while the event is pending, twice */
+    event_notifier_set(&data.e);
+    set_event_notifier(ctx, &data.e, dummy_io_handler_read);
+    set_event_notifier(ctx, &data.e, event_ready_cb);
+    wait_until_inactive(&data);
+    g_assert_cmpint(data.n, ==, 2);
+
+    set_event_notifier(ctx, &data.e, NULL);
+    g_assert(!aio_poll(ctx, false));
+    event_notifier_cleanup(&data.e);
+}
+
 static void test_aio_external_client(void)
 {
     int i, j;
@@ -861,6 +886,7 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/wait",              test_wait_event_notifier);
     g_test_add_func("/aio/event/wait/no-flush-cb",  test_wait_event_notifier_noflush);
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
+    g_test_add_func("/aio/event/replace",           test_replace_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
 
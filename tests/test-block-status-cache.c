@@ -0,0 +1,372 @@
+/*
+ * Block status cache tests
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qemu/main-loop.h"
+#include "block/block_int.h"
+#include "sysemu/block-backend.h"
+
+#define TEST_CLUSTER_SIZE   65536
+#define TEST_CLUSTERS       64
+#define TEST_SIZE           (TEST_CLUSTERS * TEST_CLUSTER_SIZE)
+
+/* Clusters (i / 4) % 2 == 1 start out allocated, so the driver reports
+ * extents of four clusters each */
+#define TEST_EXTENT         4
+
+typedef struct BDRVTestState {
+    int64_t size;
+    bool allocated[TEST_CLUSTERS];
+    int status_calls;
+    /* Let a write land on the queried cluster during the next status call */
+    bool race;
+} BDRVTestState;
+
+static void test_set_allocated(BDRVTestState *s, int64_t offset,
+                               int64_t bytes, bool allocated)
+{
+    int64_t i;
+
+    for (i = offset / TEST_CLUSTER_SIZE;
+         i < DIV_ROUND_UP(offset + bytes, TEST_CLUSTER_SIZE) &&
+         i < TEST_CLUSTERS; i++) {
+        s->allocated[i] = allocated;
+    }
+}
+
+static int test_drv_open(BlockDriverState *bs, QDict *options, int flags,
+                         Error **errp)
+{
+    BDRVTestState *s = bs->opaque;
+    int i;
+
+    s->size = TEST_SIZE;
+    for (i = 0; i < TEST_CLUSTERS; i++) {
+        s->allocated[i] = (i / TEST_EXTENT) % 2;
+    }
+    return 0;
+}
+
+static int64_t test_drv_getlength(BlockDriverState *bs)
+{
+    BDRVTestState *s = bs->opaque;
+
+    return s->size;
+}
+
+static int64_t coroutine_fn test_drv_co_get_block_status(BlockDriverState *bs,
+                                                         int64_t sector_num,
+                                                         int nb_sectors,
+                                                         int *pnum,
+                                                         BlockDriverState **file)
+{
+    BDRVTestState *s = bs->opaque;
+    int64_t offset = sector_num * BDRV_SECTOR_SIZE;
+    int64_t end = MIN(offset + nb_sectors * BDRV_SECTOR_SIZE, s->size);
+    int64_t cluster = offset / TEST_CLUSTER_SIZE;
+    int64_t next = cluster + 1;
+    bool allocated = s->allocated[cluster];
+
+    s->status_calls++;
+
+    while (next < TEST_CLUSTERS && next * TEST_CLUSTER_SIZE < end &&
+           s->allocated[next] == allocated) {
+        next++;
+    }
+
+    if (s->race) {
+        /* The write completes while this (now outdated) answer is on its
+         * way back to the block layer */
+        s->race = false;
+        test_set_allocated(s, offset, TEST_CLUSTER_SIZE, !allocated);
+        bdrv_bsc_invalidate_range(bs, offset, TEST_CLUSTER_SIZE);
+    }
+
+    *pnum = (MIN(next * TEST_CLUSTER_SIZE, end) - offset) / BDRV_SECTOR_SIZE;
+    *file = bs;
+    return allocated ? BDRV_BLOCK_DATA : BDRV_BLOCK_ZERO;
+}
+
+static int coroutine_fn test_drv_co_pwritev(BlockDriverState *bs,
+                                            uint64_t offset, uint64_t bytes,
+                                            QEMUIOVector *qiov, int flags)
+{
+    test_set_allocated(bs->opaque, offset, bytes, true);
+    return 0;
+}
+
+static int coroutine_fn test_drv_co_pwrite_zeroes(BlockDriverState *bs,
+                                                  int64_t offset, int bytes,
+                                                  BdrvRequestFlags flags)
+{
+    test_set_allocated(bs->opaque, offset, bytes, false);
+    return 0;
+}
+
+static int coroutine_fn test_drv_co_pdiscard(BlockDriverState *bs,
+                                             int64_t offset, int bytes)
+{
+    test_set_allocated(bs->opaque, offset, bytes, false);
+    return 0;
+}
+
+static int coroutine_fn test_drv_co_copy_range_from(BlockDriverState *bs,
+                                                    BdrvChild *src,
+                                                    uint64_t src_offset,
+                                                    BdrvChild *dst,
+                                                    uint64_t dst_offset,
+                                                    uint64_t bytes,
+                                                    BdrvRequestFlags flags)
+{
+    return bdrv_co_copy_range_to(src, src_offset, dst, dst_offset, bytes,
+                                 flags);
+}
+
+static int coroutine_fn test_drv_co_copy_range_to(BlockDriverState *bs,
+                                                  BdrvChild *src,
+                                                  uint64_t src_offset,
+                                                  BdrvChild *dst,
+                                                  uint64_t dst_offset,
+                                                  uint64_t bytes,
+                                                  BdrvRequestFlags flags)
+{
+    BDRVTestState *s = bs->opaque;
+
+    test_set_allocated(s, dst_offset, bytes,
+                       s->allocated[src_offset / TEST_CLUSTER_SIZE]);
+    return 0;
+}
+
+static int test_drv_truncate(BlockDriverState *bs, int64_t offset,
+                             PreallocMode prealloc, Error **errp)
+{
+    BDRVTestState *s = bs->opaque;
+
+    test_set_allocated(s, offset, TEST_SIZE, false);
+    s->size = offset;
+    return 0;
+}
+
+static BlockDriver bdrv_test = {
+    .format_name                = "test",
+    .instance_size              = sizeof(BDRVTestState),
+    .bdrv_open                  = test_drv_open,
+    .bdrv_getlength             = test_drv_getlength,
+    .bdrv_co_get_block_status   = test_drv_co_get_block_status,
+    .bdrv_cache_block_status    = true,
+    .bdrv_co_pwritev            = test_drv_co_pwritev,
+    .bdrv_co_pwrite_zeroes      = test_drv_co_pwrite_zeroes,
+    .bdrv_co_pdiscard           = test_drv_co_pdiscard,
+    .bdrv_co_copy_range_from    = test_drv_co_copy_range_from,
+    .bdrv_co_copy_range_to      = test_drv_co_copy_range_to,
+    .bdrv_truncate              = test_drv_truncate,
+};
+
+static BlockBackend *test_blk_new(BDRVTestState **s)
+{
+    BlockBackend *blk;
+    BlockDriverState *bs;
+
+    blk = blk_new(BLK_PERM_CONSISTENT_READ | BLK_PERM_WRITE | BLK_PERM_RESIZE,
+                  BLK_PERM_ALL);
+    bs = bdrv_new_open_driver(&bdrv_test, "test-node",
+                              BDRV_O_RDWR | BDRV_O_UNMAP, &error_abort);
+    blk_insert_bs(blk, bs, &error_abort);
+    bdrv_unref(bs);
+
+    *s = bs->opaque;
+    return blk;
+}
+
+/* Returns whether @cluster is allocated according to the block layer, and
+ * checks that it took @calls calls into the driver to find out */
+static bool test_query(BlockBackend *blk, BDRVTestState *s, int64_t cluster,
+                       int calls)
+{
+    int64_t offset = cluster * TEST_CLUSTER_SIZE;
+    int64_t pnum, map;
+    BlockDriverState *file;
+    int old_calls = s->status_calls;
+    int ret;
+
+    /* Ask for the rest of the image, so that whole extents get cached */
+    ret = bdrv_block_status(blk_bs(blk), offset, TEST_SIZE - offset,
+                            &pnum, &map, &file);
+    g_assert_cmpint(ret, >=, 0);
+    g_assert_cmpint(pnum, >=, TEST_CLUSTER_SIZE);
+    g_assert_cmpint(s->status_calls - old_calls, ==, calls);
+
+    g_assert(!(ret & BDRV_BLOCK_DATA) != !(ret & BDRV_BLOCK_ZERO));
+    return ret & BDRV_BLOCK_DATA;
+}
+
+static void test_hit(void)
+{
+    BDRVTestState *s;
+    BlockBackend *blk = test_blk_new(&s);
+
+    g_assert(!test_query(blk, s, 8, 1));
+    /* Anywhere in the cached extent */
+    g_assert(!test_query(blk, s, 8, 0));
+    g_assert(!test_query(blk, s, 11, 0));
+    g_assert(test_query(blk, s, 12, 1));
+    g_assert(test_query(blk, s, 14, 0));
+
+    blk_unref(blk);
+}
+
+typedef struct TestCopyRange {
+    BlockBackend *blk;
+    int64_t src;
+    int64_t dst;
+    int ret;
+    bool done;
+} TestCopyRange;
+
+static void coroutine_fn test_copy_range_entry(void *opaque)
+{
+    TestCopyRange *c = opaque;
+
+    c->ret = blk_co_copy_range(c->blk, c->src, c->blk, c->dst,
+                               TEST_CLUSTER_SIZE, 0);
+    c->done = true;
+}
+
+typedef enum {
+    TEST_OP_WRITE,
+    TEST_OP_WRITE_ZEROES,
+    TEST_OP_DISCARD,
+    TEST_OP_COPY_RANGE,
+    TEST_OP_TRUNCATE,
+} TestOp;
+
+/* Changes @cluster (which must be in an extent of its own) with @op, and
+ * returns whether it is allocated afterwards */
+static bool test_do_op(BlockBackend *blk, TestOp op, int64_t cluster)
+{
+    int64_t offset = cluster * TEST_CLUSTER_SIZE;
+    uint8_t buf[512] = { 0 };
+    TestCopyRange c;
+    Coroutine *co;
+
+    switch (op) {
+    case TEST_OP_WRITE:
+        g_assert_cmpint(blk_pwrite(blk, offset, buf, sizeof(buf), 0), >=, 0);
+        return true;
+    case TEST_OP_WRITE_ZEROES:
+        g_assert_cmpint(blk_pwrite_zeroes(blk, offset, TEST_CLUSTER_SIZE, 0),
+                        >=, 0);
+        return false;
+    case TEST_OP_DISCARD:
+        g_assert_cmpint(blk_pdiscard(blk, offset, TEST_CLUSTER_SIZE), >=, 0);
+        return false;
+    case TEST_OP_COPY_RANGE:
+        /* Cluster 4 is allocated */
+        c = (TestCopyRange) {
+            .blk = blk,
+            .src = TEST_EXTENT * TEST_CLUSTER_SIZE,
+            .dst = offset,
+        };
+        co = qemu_coroutine_create(test_copy_range_entry, &c);
+        qemu_coroutine_enter(co);
+        while (!c.done) {
+            aio_poll(qemu_get_aio_context(), true);
+        }
+        g_assert_cmpint(c.ret, ==, 0);
+        return true;
+    case TEST_OP_TRUNCATE:
+        /* Cut the cluster off, then grow the image back */
+        g_assert_cmpint(blk_truncate(blk, offset, PREALLOC_MODE_OFF,
+                                     &error_abort), ==, 0);
+        g_assert_cmpint(blk_truncate(blk, TEST_SIZE, PREALLOC_MODE_OFF,
+                                     &error_abort), ==, 0);
+        return false;
+    }
+    g_assert_not_reached();
+}
+
+static void test_invalidate(const void *opaque)
+{
+    TestOp op = (uintptr_t)opaque;
+    BDRVTestState *s;
+    BlockBackend *blk = test_blk_new(&s);
+    /* Write to a hole, remove data from an allocated extent */
+    bool writes_data = op == TEST_OP_WRITE || op == TEST_OP_COPY_RANGE;
+    int64_t first = writes_data ? 8 : 44;
+    int64_t cluster = first + 1;
+    int64_t other = 20;
+    bool other_allocated;
+
+    /* Fill the cache */
+    g_assert(test_query(blk, s, cluster, 1) != writes_data);
+    other_allocated = test_query(blk, s, other, 1);
+    g_assert(test_query(blk, s, cluster, 0) != writes_data);
+
+    g_assert(test_do_op(blk, op, cluster) == writes_data);
+
+    /* The extent that was cached for the cluster is gone */
+    g_assert(test_query(blk, s, cluster, 1) == writes_data);
+    if (op != TEST_OP_TRUNCATE) {
+        g_assert(test_query(blk, s, first, 1) != writes_data);
+        /* Only the overlapping entries were dropped */
+        g_assert(test_query(blk, s, other, 0) == other_allocated);
+    }
+
+    blk_unref(blk);
+}
+
+static void test_race(void)
+{
+    BDRVTestState *s;
+    BlockBackend *blk = test_blk_new(&s);
+
+    /* This result is outdated when the driver returns, so it is not kept */
+    s->race = true;
+    g_assert(!test_query(blk, s, 9, 1));
+    g_assert(test_query(blk, s, 9, 1));
+    g_assert(test_query(blk, s, 9, 0));
+
+    blk_unref(blk);
+}
+
+static void test_force_share(void)
+{
+    BDRVTestState *s;
+    BlockBackend *blk = test_blk_new(&s);
+
+    /* Another process may write to the image */
+    blk_bs(blk)->force_share = true;
+    g_assert(!test_query(blk, s, 8, 1));
+    g_assert(!test_query(blk, s, 8, 1));
+
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    qemu_init_main_loop(&error_abort);
+    bdrv_init();
+
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/block-status-cache/hit", test_hit);
+    g_test_add_data_func("/block-status-cache/invalidate/write",
+                         (void *)(uintptr_t)TEST_OP_WRITE, test_invalidate);
+    g_test_add_data_func("/block-status-cache/invalidate/write-zeroes",
+                         (void *)(uintptr_t)TEST_OP_WRITE_ZEROES,
+                         test_invalidate);
+    g_test_add_data_func("/block-status-cache/invalidate/discard",
+                         (void *)(uintptr_t)TEST_OP_DISCARD, test_invalidate);
+    g_test_add_data_func("/block-status-cache/invalidate/copy-range",
+                         (void *)(uintptr_t)TEST_OP_COPY_RANGE,
+                         test_invalidate);
+    g_test_add_data_func("/block-status-cache/invalidate/truncate",
+                         (void *)(uintptr_t)TEST_OP_TRUNCATE, test_invalidate);
+    g_test_add_func("/block-status-cache/race", test_race);
+    g_test_add_func("/block-status-cache/force-share", test_force_share);
+    return g_test_run();
+}
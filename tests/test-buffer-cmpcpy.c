@@ -0,0 +1,86 @@
+/*
+ * QEMU buffer_cmpcpy test
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+
+static char src[64 * 1024];
+static char dst[64 * 1024];
+
+static void test_1(void)
+{
+    size_t s, a, o;
+
+    memset(src, 0, sizeof(src));
+    memset(dst, 0, sizeof(dst));
+
+    /* Equal buffers are left alone.  */
+    g_assert(!buffer_cmpcpy(dst, src, sizeof(src)));
+
+    /* A difference at the very end is found and copied.  */
+    src[sizeof(src) - 1] = 1;
+    g_assert(buffer_cmpcpy(dst, src, sizeof(src)));
+    g_assert(dst[sizeof(dst) - 1] == 1);
+    g_assert(!buffer_cmpcpy(dst, src, sizeof(src)));
+    src[sizeof(src) - 1] = dst[sizeof(dst) - 1] = 0;
+
+    /* Bytes outside the buffers are ignored.  */
+    for (a = 1; a <= 64; a++) {
+        for (s = 1; s < 512; s++) {
+            src[a - 1] = 1;
+            src[a + s] = 1;
+            g_assert(!buffer_cmpcpy(dst + a, src + a, s));
+            g_assert(dst[a - 1] == 0 && dst[a + s] == 0);
+            src[a - 1] = 0;
+            src[a + s] = 0;
+        }
+    }
+
+    /* Every offset of a difference is found and copied.  */
+    for (a = 1; a <= 64; a++) {
+        for (s = 1; s < 512; s++) {
+            for (o = 0; o < s; ++o) {
+                src[a + o] = 1;
+                g_assert(buffer_cmpcpy(dst + a, src + a, s));
+                g_assert(dst[a + o] == 1);
+                g_assert(!buffer_cmpcpy(dst + a, src + a, s));
+                src[a + o] = 0;
+                dst[a + o] = 0;
+            }
+        }
+    }
+}
+
+static void test_2(void)
+{
+    if (g_test_perf()) {
+        test_1();
+    } else {
+        do {
+            test_1();
+        } while (test_buffer_cmpcpy_next_accel());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/cutils/buffer-cmpcpy", test_2);
+
+    return g_test_run();
+}
@@ -24,6 +24,7 @@
 #include "crypto/block.h"
 #include "qemu/buffer.h"
 #include "crypto/secret.h"
+#include "qemu/thread.h"
 #ifndef _WIN32
 #include <sys/resource.h>
 #endif
@@ -272,10 +273,79 @@ static void test_block_assert_setup(const struct QCryptoBlockTestData *data,
 }
 
 
+#define TEST_BLOCK_THREADS 4
+#define TEST_BLOCK_THREAD_LEN (64 * 512)
+
+typedef struct TestBlockThread {
+    QCryptoBlock *blk;
+    uint64_t offset;
+    uint8_t *buf;
+} TestBlockThread;
+
+static void *test_block_thread(void *opaque)
+{
+    TestBlockThread *t = opaque;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        g_assert(qcrypto_block_encrypt(t->blk, t->offset, t->buf,
+                                       TEST_BLOCK_THREAD_LEN,
+                                       &error_abort) == 0);
+        g_assert(qcrypto_block_decrypt(t->blk, t->offset, t->buf,
+                                       TEST_BLOCK_THREAD_LEN,
+                                       &error_abort) == 0);
+    }
+    g_assert(qcrypto_block_encrypt(t->blk, t->offset, t->buf,
+                                   TEST_BLOCK_THREAD_LEN,
+                                   &error_abort) == 0);
+
+    return NULL;
+}
+
+/*
+ * Encrypt disjoint chunks of a buffer concurrently through @blk and
+ * check the result against encrypting the whole buffer in one go
+ * through @ref.
+ */
+static void test_block_threads(QCryptoBlock *blk, QCryptoBlock *ref)
+{
+    QemuThread threads[TEST_BLOCK_THREADS];
+    TestBlockThread data[TEST_BLOCK_THREADS];
+    size_t len = TEST_BLOCK_THREADS * TEST_BLOCK_THREAD_LEN;
+    uint8_t *expect = g_new(uint8_t, len);
+    uint8_t *actual = g_new(uint8_t, len);
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        expect[i] = i * 7;
+    }
+    memcpy(actual, expect, len);
+
+    for (i = 0; i < TEST_BLOCK_THREADS; i++) {
+        data[i] = (TestBlockThread) {
+            .blk = blk,
+            .offset = i * TEST_BLOCK_THREAD_LEN,
+            .buf = actual + i * TEST_BLOCK_THREAD_LEN,
+        };
+        qemu_thread_create(&threads[i], "test-crypto", test_block_thread,
+                           &data[i], QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < TEST_BLOCK_THREADS; i++) {
+        qemu_thread_join(&threads[i]);
+    }
+
+    g_assert(qcrypto_block_encrypt(ref, 0, expect, len, &error_abort) == 0);
+    g_assert(memcmp(expect, actual, len) == 0);
+
+    g_free(expect);
+    g_free(actual);
+}
+
+
 static void test_block(gconstpointer opaque)
 {
     const struct QCryptoBlockTestData *data = opaque;
-    QCryptoBlock *blk;
+    QCryptoBlock *blk, *mtblk;
     Buffer header;
     Object *sec = test_block_secret();
 
@@ -305,6 +375,7 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              0,
+                             1,
                              NULL);
     g_assert(blk == NULL);
 
@@ -313,6 +384,7 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              QCRYPTO_BLOCK_OPEN_NO_IO,
+                             1,
                              &error_abort);
 
     g_assert(qcrypto_block_get_cipher(blk) == NULL);
@@ -327,11 +399,25 @@ static void test_block(gconstpointer opaque)
                              test_block_read_func,
                              &header,
                              0,
+                             1,
                              &error_abort);
     g_assert(blk);
 
     test_block_assert_setup(data, blk);
 
+    /* And with a cipher pool shared by several threads */
+    mtblk = qcrypto_block_open(data->open_opts, NULL,
+                               test_block_read_func,
+                               &header,
+                               0,
+                               TEST_BLOCK_THREADS,
+                               &error_abort);
+    g_assert(mtblk);
+
+    test_block_assert_setup(data, mtblk);
+    test_block_threads(mtblk, blk);
+
+    qcrypto_block_free(mtblk);
     qcrypto_block_free(blk);
 
     object_unparent(sec);
@@ -804,6 +804,7 @@ static void hbitmap_test_serialize_range(TestHBitmapData *data,
             g_assert(!is_set);
         }
     }
+    g_assert_cmpint(hbitmap_count(data->hb), ==, count);
 }
 
 static void test_hbitmap_serialize_basic(TestHBitmapData *data,
@@ -980,6 +981,87 @@ static void test_hbitmap_next_zero_4(TestHBitmapData *data, const void *unused)
     test_hbitmap_next_zero_do(data, 4);
 }
 
+/* Merge B into A, where C was built with the ranges of both.  */
+static void hbitmap_test_merge_check(HBitmap *a, HBitmap *b, HBitmap *c,
+                                     uint64_t size)
+{
+    HBitmapIter hbi_a, hbi_c;
+    int64_t next;
+    uint64_t i;
+
+    g_assert(hbitmap_merge(a, b));
+    g_assert_cmpint(hbitmap_count(a), ==, hbitmap_count(c));
+    for (i = 0; i < size; i++) {
+        g_assert_cmpint(hbitmap_get(a, i), ==, hbitmap_get(c, i));
+    }
+
+    /* Iteration goes through the upper levels, so check them too */
+    hbitmap_iter_init(&hbi_a, a, 0);
+    hbitmap_iter_init(&hbi_c, c, 0);
+    do {
+        next = hbitmap_iter_next(&hbi_a);
+        g_assert_cmpint(next, ==, hbitmap_iter_next(&hbi_c));
+    } while (next >= 0);
+}
+
+static void test_hbitmap_merge(TestHBitmapData *data, const void *unused)
+{
+    /* Unaligned size, so that the last word is partial */
+    uint64_t size = L3 + 7;
+    uint64_t ranges_a[][2] = {
+        { 0, 3 }, { L2 - 5, L1 * 2 }, { L3 - L1, L1 },
+    };
+    uint64_t ranges_b[][2] = {
+        { 1, 1 }, { L2, L2 * 2 + 3 }, { L3 - 2, 9 }, { L2 * 5 + 3, L1 * 7 },
+    };
+    HBitmap *a, *b, *c;
+    uint64_t i;
+
+    do {
+        a = hbitmap_alloc(size, 0);
+        b = hbitmap_alloc(size, 0);
+        c = hbitmap_alloc(size, 0);
+
+        /* Merging an empty bitmap is a no-op */
+        hbitmap_test_merge_check(a, b, c, size);
+
+        for (i = 0; i < ARRAY_SIZE(ranges_a); i++) {
+            hbitmap_set(a, ranges_a[i][0], ranges_a[i][1]);
+            hbitmap_set(c, ranges_a[i][0], ranges_a[i][1]);
+        }
+        for (i = 0; i < ARRAY_SIZE(ranges_b); i++) {
+            hbitmap_set(b, ranges_b[i][0], ranges_b[i][1]);
+            hbitmap_set(c, ranges_b[i][0], ranges_b[i][1]);
+        }
+        /* One bit in every word of B */
+        for (i = 0; i < size; i += L1 + 1) {
+            hbitmap_set(b, i, 1);
+            hbitmap_set(c, i, 1);
+        }
+
+        hbitmap_test_merge_check(a, b, c, size);
+
+        hbitmap_free(a);
+        hbitmap_free(b);
+        hbitmap_free(c);
+    } while (test_hbitmap_next_accel());
+}
+
+static void test_hbitmap_merge_mismatch(TestHBitmapData *data,
+                                        const void *unused)
+{
+    HBitmap *a = hbitmap_alloc(L2, 0);
+    HBitmap *b = hbitmap_alloc(L2 + 1, 0);
+    HBitmap *c = hbitmap_alloc(L2, 1);
+
+    g_assert(!hbitmap_merge(a, b));
+    g_assert(!hbitmap_merge(a, c));
+
+    hbitmap_free(a);
+    hbitmap_free(b);
+    hbitmap_free(c);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -1046,6 +1128,9 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/next_zero/next_zero_4",
                      test_hbitmap_next_zero_4);
 
+    hbitmap_test_add("/hbitmap/merge/general", test_hbitmap_merge);
+    hbitmap_test_add("/hbitmap/merge/mismatch", test_hbitmap_merge_mismatch);
+
     g_test_run();
 
     return 0;
@@ -0,0 +1,169 @@
+/*
+ * Latency histogram tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/histogram.h"
+#include "qemu/thread.h"
+#include "qapi/error.h"
+#include "qmp-commands.h"
+
+static HistogramInfo *query_one(const char *name)
+{
+    HistogramInfoList *list = qmp_query_histograms(true, name, &error_abort);
+    HistogramInfo *info;
+
+    g_assert(list);
+    g_assert(!list->next);
+    info = list->value;
+    list->value = NULL;
+    qapi_free_HistogramInfoList(list);
+    return info;
+}
+
+static void test_buckets(void)
+{
+    uint64_t v;
+    unsigned b, last = 0;
+
+    for (b = 1; b < QEMU_HISTOGRAM_BUCKETS; b++) {
+        g_assert_cmpuint(qemu_histogram_bucket_lower(b), >,
+                         qemu_histogram_bucket_lower(b - 1));
+        g_assert_cmpuint(qemu_histogram_bucket(qemu_histogram_bucket_lower(b)),
+                         ==, b);
+    }
+
+    for (v = 0; v < (1ULL << QEMU_HISTOGRAM_MAX_BITS); v += v / 7 + 1) {
+        b = qemu_histogram_bucket(v);
+        g_assert_cmpuint(b, >=, last);
+        g_assert_cmpuint(b, <, QEMU_HISTOGRAM_BUCKETS - 1);
+        g_assert_cmpuint(qemu_histogram_bucket_lower(b), <=, v);
+        g_assert_cmpuint(qemu_histogram_bucket_lower(b + 1), >, v);
+        /* Relative error bound of the log-linear layout */
+        g_assert_cmpuint(qemu_histogram_bucket_lower(b + 1) -
+                         qemu_histogram_bucket_lower(b), <=,
+                         MAX(1, v / QEMU_HISTOGRAM_SUB_BUCKETS));
+        last = b;
+    }
+
+    g_assert_cmpuint(qemu_histogram_bucket(1ULL << QEMU_HISTOGRAM_MAX_BITS),
+                     ==, QEMU_HISTOGRAM_BUCKETS - 1);
+    g_assert_cmpuint(qemu_histogram_bucket(UINT64_MAX),
+                     ==, QEMU_HISTOGRAM_BUCKETS - 1);
+}
+
+static void test_add(void)
+{
+    QHistogram *h = qemu_histogram_get("test-add");
+    HistogramInfo *info;
+    HistogramBucketList *e;
+
+    g_assert(qemu_histogram_get("test-add") == h);
+
+    qemu_histogram_add(h, 3);
+    qemu_histogram_add(h, 3);
+    qemu_histogram_add(h, 1000);
+    qemu_histogram_add(h, 1ULL << 40);
+
+    info = query_one("test-add");
+    g_assert_cmpstr(info->name, ==, "test-add");
+    g_assert_cmpuint(info->count, ==, 4);
+    g_assert_cmpuint(info->sum, ==, 1006 + (1ULL << 40));
+    g_assert_cmpuint(info->max, ==, 1ULL << 40);
+
+    e = info->buckets;
+    g_assert_cmpuint(e->value->lower, ==, 3);
+    g_assert_cmpuint(e->value->count, ==, 2);
+    e = e->next;
+    g_assert_cmpuint(e->value->lower, ==, 992);
+    g_assert_cmpuint(e->value->count, ==, 1);
+    e = e->next;
+    g_assert_cmpuint(e->value->lower, ==, 1ULL << QEMU_HISTOGRAM_MAX_BITS);
+    g_assert_cmpuint(e->value->count, ==, 1);
+    g_assert(!e->next);
+    qapi_free_HistogramInfo(info);
+}
+
+#define THREADS 8
+#define ADDS_PER_THREAD 100000
+
+static void *add_thread(void *opaque)
+{
+    QHistogram *h = opaque;
+    int i;
+
+    for (i = 0; i < ADDS_PER_THREAD; i++) {
+        qemu_histogram_add(h, i);
+    }
+    return NULL;
+}
+
+static void test_threads(void)
+{
+    QHistogram *h = qemu_histogram_get("test-threads");
+    QemuThread threads[THREADS];
+    HistogramInfo *info;
+    int round, i;
+
+    /* The second round reuses the slots of the exited threads */
+    for (round = 1; round <= 2; round++) {
+        for (i = 0; i < THREADS; i++) {
+            qemu_thread_create(&threads[i], "test", add_thread, h,
+                               QEMU_THREAD_JOINABLE);
+        }
+        for (i = 0; i < THREADS; i++) {
+            qemu_thread_join(&threads[i]);
+        }
+
+        info = query_one("test-threads");
+        g_assert_cmpuint(info->count, ==, round * THREADS * ADDS_PER_THREAD);
+        g_assert_cmpuint(info->sum, ==, round * THREADS *
+                         ((uint64_t)ADDS_PER_THREAD *
+                          (ADDS_PER_THREAD - 1) / 2));
+        g_assert_cmpuint(info->max, ==, ADDS_PER_THREAD - 1);
+        qapi_free_HistogramInfo(info);
+    }
+}
+
+static void test_reset(void)
+{
+    QHistogram *h = qemu_histogram_get("test-reset");
+    HistogramInfo *info;
+
+    g_assert_cmpint(qemu_histogram_start(), ==, 0);
+    qemu_histogram_record(h, qemu_histogram_start());
+
+    qemu_histogram_add(h, 100000);
+    qemu_histograms_set_enabled(true, true);
+
+    info = query_one("test-reset");
+    g_assert_cmpuint(info->count, ==, 0);
+    g_assert_cmpuint(info->sum, ==, 0);
+    g_assert_cmpuint(info->max, ==, 0);
+    g_assert(!info->buckets);
+    qapi_free_HistogramInfo(info);
+
+    qemu_histogram_add(h, 10);
+    qemu_histogram_record(h, qemu_histogram_start());
+
+    info = query_one("test-reset");
+    g_assert_cmpuint(info->count, ==, 2);
+    g_assert_cmpuint(info->max, <, 100000);
+    qapi_free_HistogramInfo(info);
+
+    qemu_histograms_set_enabled(false, false);
+    g_assert_cmpint(qemu_histogram_start(), ==, 0);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_func("/histogram/buckets", test_buckets);
+    g_test_add_func("/histogram/add", test_add);
+    g_test_add_func("/histogram/threads", test_threads);
+    g_test_add_func("/histogram/reset", test_reset);
+    return g_test_run();
+}
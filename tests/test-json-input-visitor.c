@@ -0,0 +1,334 @@
+/*
+ * JSON Input Visitor unit-tests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qapi/json-input-visitor.h"
+#include "test-qapi-types.h"
+#include "test-qapi-visit.h"
+#include "qapi/qmp/types.h"
+#include "qapi/qmp/qjson.h"
+
+typedef struct TestInputVisitorData {
+    Visitor *v;
+} TestInputVisitorData;
+
+static void visitor_input_teardown(TestInputVisitorData *data,
+                                   const void *unused)
+{
+    if (data->v) {
+        visit_free(data->v);
+        data->v = NULL;
+    }
+}
+
+static Visitor *visitor_input_test_init(TestInputVisitorData *data,
+                                        const char *json_string)
+{
+    visitor_input_teardown(data, NULL);
+
+    data->v = json_input_visitor_new_str(json_string, &error_abort);
+    g_assert(data->v);
+    return data->v;
+}
+
+static void test_visitor_in_int(TestInputVisitorData *data,
+                                const void *unused)
+{
+    int64_t res = 0;
+    uint64_t ures = 0;
+    double dbl;
+    Error *err = NULL;
+    Visitor *v;
+
+    v = visitor_input_test_init(data, "-42");
+    visit_type_int(v, NULL, &res, &error_abort);
+    g_assert_cmpint(res, ==, -42);
+
+    v = visitor_input_test_init(data, "-42");
+    visit_type_number(v, NULL, &dbl, &error_abort);
+    g_assert_cmpfloat(dbl, ==, -42.0);
+
+    /* Negative values are accepted for backward compatibility */
+    v = visitor_input_test_init(data, "-42");
+    visit_type_uint64(v, NULL, &ures, &error_abort);
+    g_assert_cmpuint(ures, ==, (uint64_t)-42);
+
+    v = visitor_input_test_init(data, "18446744073709551615");
+    visit_type_uint64(v, NULL, &ures, &error_abort);
+    g_assert_cmpuint(ures, ==, UINT64_MAX);
+
+    v = visitor_input_test_init(data, "18446744073709551615");
+    visit_type_int(v, NULL, &res, &err);
+    error_free_or_abort(&err);
+
+    v = visitor_input_test_init(data, "1.5");
+    visit_type_int(v, NULL, &res, &err);
+    error_free_or_abort(&err);
+
+    v = visitor_input_test_init(data, "1.5");
+    visit_type_number(v, NULL, &dbl, &error_abort);
+    g_assert_cmpfloat(dbl, ==, 1.5);
+}
+
+static void test_visitor_in_scalars(TestInputVisitorData *data,
+                                    const void *unused)
+{
+    bool b = false;
+    char *str;
+    QNull *null;
+    Error *err = NULL;
+    Visitor *v;
+
+    v = visitor_input_test_init(data, "true");
+    visit_type_bool(v, NULL, &b, &error_abort);
+    g_assert(b);
+
+    v = visitor_input_test_init(data, "'\\u00e9\\tx\\\"y'");
+    visit_type_str(v, NULL, &str, &error_abort);
+    g_assert_cmpstr(str, ==, "\xc3\xa9\tx\"y");
+    g_free(str);
+
+    v = visitor_input_test_init(data, "null");
+    visit_type_null(v, NULL, &null, &error_abort);
+    g_assert(qobject_type(QOBJECT(null)) == QTYPE_QNULL);
+    QDECREF(null);
+
+    v = visitor_input_test_init(data, "42");
+    visit_type_str(v, NULL, &str, &err);
+    error_free_or_abort(&err);
+    g_assert(!str);
+}
+
+static void test_visitor_in_struct_nested(TestInputVisitorData *data,
+                                          const void *unused)
+{
+    UserDefTwo *udp = NULL;
+    Visitor *v;
+
+    /* Members come in any order */
+    v = visitor_input_test_init(data, "{ 'dict1': { "
+                                "'dict2': { 'string': 'string2', "
+                                "'userdef': { 'string': 'string', "
+                                "'integer': 42 } }, "
+                                "'string1': 'string1' }, "
+                                "'string0': 'string0' }");
+
+    visit_type_UserDefTwo(v, NULL, &udp, &error_abort);
+
+    g_assert_cmpstr(udp->string0, ==, "string0");
+    g_assert_cmpstr(udp->dict1->string1, ==, "string1");
+    g_assert_cmpint(udp->dict1->dict2->userdef->integer, ==, 42);
+    g_assert_cmpstr(udp->dict1->dict2->userdef->string, ==, "string");
+    g_assert_cmpstr(udp->dict1->dict2->string, ==, "string2");
+    g_assert(udp->dict1->has_dict3 == false);
+
+    qapi_free_UserDefTwo(udp);
+}
+
+static void test_visitor_in_struct_dup(TestInputVisitorData *data,
+                                       const void *unused)
+{
+    UserDefOne *udp = NULL;
+    Visitor *v;
+
+    /* Like for QDict, the last duplicate wins */
+    v = visitor_input_test_init(data, "{ 'integer': 1, 'string': 'a', "
+                                "'integer': 2, 'str\\u0069ng': 'b' }");
+
+    visit_type_UserDefOne(v, NULL, &udp, &error_abort);
+    g_assert_cmpint(udp->integer, ==, 2);
+    g_assert_cmpstr(udp->string, ==, "b");
+    g_assert(!udp->has_enum1);
+
+    qapi_free_UserDefOne(udp);
+}
+
+static void test_visitor_in_list(TestInputVisitorData *data,
+                                 const void *unused)
+{
+    UserDefOneList *item, *head = NULL;
+    Visitor *v;
+    int i;
+
+    v = visitor_input_test_init(data, "[ { 'string': 'string0', 'integer': 42 }, { 'string': 'string1', 'integer': 43 }, { 'string': 'string2', 'integer': 44 } ]");
+
+    visit_type_UserDefOneList(v, NULL, &head, &error_abort);
+    g_assert(head != NULL);
+
+    for (i = 0, item = head; item; item = item->next, i++) {
+        char string[12];
+
+        snprintf(string, sizeof(string), "string%d", i);
+        g_assert_cmpstr(item->value->string, ==, string);
+        g_assert_cmpint(item->value->integer, ==, 42 + i);
+    }
+    g_assert_cmpint(i, ==, 3);
+
+    qapi_free_UserDefOneList(head);
+    head = NULL;
+
+    /* An empty list is valid */
+    v = visitor_input_test_init(data, "[]");
+    visit_type_UserDefOneList(v, NULL, &head, &error_abort);
+    g_assert(!head);
+}
+
+static void test_visitor_in_any(TestInputVisitorData *data,
+                                const void *unused)
+{
+    const char *json = "{ 'integer': -42, 'boolean': true, "
+        "'list': [ 1, 'a', null, { } ], 'string': 'foo' }";
+    QObject *res = NULL, *expected;
+    UserDefOne *udp;
+    Visitor *v;
+
+    v = visitor_input_test_init(data, json);
+    visit_type_any(v, NULL, &res, &error_abort);
+    expected = qobject_from_json(json, &error_abort);
+    g_assert(qobject_is_equal(res, expected));
+    qobject_decref(res);
+    qobject_decref(expected);
+
+    /* A struct member of type 'any' skips the value's tokens */
+    v = visitor_input_test_init(data, "[ { 'string': 'x', 'integer': 1 }, "
+                                "[ [ 2 ], { 'a': [ 3 ] } ], 4 ]");
+    visit_start_list(v, NULL, NULL, 0, &error_abort);
+    visit_type_UserDefOne(v, NULL, &udp, &error_abort);
+    g_assert_cmpint(udp->integer, ==, 1);
+    qapi_free_UserDefOne(udp);
+    visit_type_any(v, NULL, &res, &error_abort);
+    g_assert(qobject_type(res) == QTYPE_QLIST);
+    qobject_decref(res);
+    visit_type_any(v, NULL, &res, &error_abort);
+    g_assert_cmpint(qnum_get_int(qobject_to_qnum(res)), ==, 4);
+    qobject_decref(res);
+    visit_check_list(v, &error_abort);
+    visit_end_list(v, NULL);
+}
+
+static void test_visitor_in_alternate(TestInputVisitorData *data,
+                                      const void *unused)
+{
+    Visitor *v;
+    UserDefAlternate *tmp;
+    WrapAlternate *wrap;
+
+    v = visitor_input_test_init(data, "42");
+    visit_type_UserDefAlternate(v, NULL, &tmp, &error_abort);
+    g_assert_cmpint(tmp->type, ==, QTYPE_QNUM);
+    g_assert_cmpint(tmp->u.i, ==, 42);
+    qapi_free_UserDefAlternate(tmp);
+
+    v = visitor_input_test_init(data, "'value1'");
+    visit_type_UserDefAlternate(v, NULL, &tmp, &error_abort);
+    g_assert_cmpint(tmp->type, ==, QTYPE_QSTRING);
+    g_assert_cmpint(tmp->u.e, ==, ENUM_ONE_VALUE1);
+    qapi_free_UserDefAlternate(tmp);
+
+    v = visitor_input_test_init(data, "null");
+    visit_type_UserDefAlternate(v, NULL, &tmp, &error_abort);
+    g_assert_cmpint(tmp->type, ==, QTYPE_QNULL);
+    qapi_free_UserDefAlternate(tmp);
+
+    v = visitor_input_test_init(data, "{ 'alt': {'integer':1, 'string':'str', "
+                                "'enum1':'value1', 'boolean':true} }");
+    visit_type_WrapAlternate(v, NULL, &wrap, &error_abort);
+    g_assert_cmpint(wrap->alt->type, ==, QTYPE_QDICT);
+    g_assert_cmpint(wrap->alt->u.udfu.integer, ==, 1);
+    g_assert_cmpstr(wrap->alt->u.udfu.string, ==, "str");
+    g_assert_cmpint(wrap->alt->u.udfu.enum1, ==, ENUM_ONE_VALUE1);
+    g_assert_cmpint(wrap->alt->u.udfu.u.value1.boolean, ==, true);
+    qapi_free_WrapAlternate(wrap);
+}
+
+static void test_visitor_in_errors(TestInputVisitorData *data,
+                                   const void *unused)
+{
+    UserDefOne *udp = NULL;
+    UserDefTwo *udt = NULL;
+    Error *err = NULL;
+    Visitor *v;
+
+    v = visitor_input_test_init(data, "{ 'integer': 1, 'string': 'a', "
+                                "'extra': [ 1 ] }");
+    visit_type_UserDefOne(v, NULL, &udp, &err);
+    error_free_or_abort(&err);
+    g_assert(!udp);
+
+    v = visitor_input_test_init(data, "{ 'string0': 'string0', "
+                                "'dict1': { 'string1': 'string1' } }");
+    visit_type_UserDefTwo(v, NULL, &udt, &err);
+    g_assert(strstr(error_get_pretty(err), "dict1.dict2"));
+    error_free(err);
+    err = NULL;
+    g_assert(!udt);
+
+    v = visitor_input_test_init(data, "[ { 'integer': 1, 'string': 'a' }, "
+                                "{ 'integer': 'x', 'string': 'b' } ]");
+    visit_start_list(v, NULL, NULL, 0, &error_abort);
+    visit_type_UserDefOne(v, NULL, &udp, &error_abort);
+    qapi_free_UserDefOne(udp);
+    visit_type_UserDefOne(v, NULL, &udp, &err);
+    g_assert(strstr(error_get_pretty(err), "[1].integer"));
+    error_free(err);
+    visit_end_list(v, NULL);
+}
+
+static void test_visitor_in_syntax(TestInputVisitorData *data,
+                                   const void *unused)
+{
+    static const char *const bad[] = {
+        "", "{", "]", "{ 'a' 1 }", "{ 1: 2 }", "[ 1 2 ]", "[ 1, ]",
+        "{ 'a': 1, }", "[ nul ]", "[ %d ]", "[ } ", "{ 'a': [ 1 } ]", "1 2",
+    };
+    Error *err = NULL;
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(bad); i++) {
+        g_assert(!json_input_visitor_new_str(bad[i], &err));
+        error_free_or_abort(&err);
+    }
+}
+
+static void json_input_visitor_test_add(const char *testpath,
+                                        void (*test_func)(TestInputVisitorData *,
+                                                          const void *))
+{
+    g_test_add(testpath, TestInputVisitorData, NULL, NULL, test_func,
+               visitor_input_teardown);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    json_input_visitor_test_add("/visitor/json-input/int",
+                                test_visitor_in_int);
+    json_input_visitor_test_add("/visitor/json-input/scalars",
+                                test_visitor_in_scalars);
+    json_input_visitor_test_add("/visitor/json-input/struct-nested",
+                                test_visitor_in_struct_nested);
+    json_input_visitor_test_add("/visitor/json-input/struct-dup",
+                                test_visitor_in_struct_dup);
+    json_input_visitor_test_add("/visitor/json-input/list",
+                                test_visitor_in_list);
+    json_input_visitor_test_add("/visitor/json-input/any",
+                                test_visitor_in_any);
+    json_input_visitor_test_add("/visitor/json-input/alternate",
+                                test_visitor_in_alternate);
+    json_input_visitor_test_add("/visitor/json-input/errors",
+                                test_visitor_in_errors);
+    json_input_visitor_test_add("/visitor/json-input/syntax",
+                                test_visitor_in_syntax);
+
+    g_test_run();
+
+    return 0;
+}
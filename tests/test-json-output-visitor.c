@@ -0,0 +1,350 @@
+/*
+ * JSON Output Visitor unit-tests.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qemu-common.h"
+#include "qapi/error.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/qobject-output-visitor.h"
+#include "test-qapi-types.h"
+#include "test-qapi-visit.h"
+#include "qapi/qmp/types.h"
+#include "qapi/qmp/qjson.h"
+
+typedef struct TestOutputVisitorData {
+    Visitor *ov;
+    QString *str;
+} TestOutputVisitorData;
+
+static void visitor_output_setup(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    data->str = qstring_new();
+    data->ov = json_output_visitor_new(false, data->str);
+    g_assert(data->ov);
+}
+
+static void visitor_output_setup_pretty(TestOutputVisitorData *data,
+                                        const void *unused)
+{
+    data->str = qstring_new();
+    data->ov = json_output_visitor_new(true, data->str);
+    g_assert(data->ov);
+}
+
+static void visitor_output_teardown(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    visit_free(data->ov);
+    data->ov = NULL;
+    QDECREF(data->str);
+    data->str = NULL;
+}
+
+static const char *visitor_get(TestOutputVisitorData *data)
+{
+    visit_complete(data->ov, data->str);
+    return qstring_get_str(data->str);
+}
+
+static void visitor_reset(TestOutputVisitorData *data)
+{
+    visitor_output_teardown(data, NULL);
+    visitor_output_setup(data, NULL);
+}
+
+static void test_visitor_out_int(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    int64_t value = -42;
+    uint64_t uvalue = UINT64_MAX;
+
+    visit_type_int(data->ov, NULL, &value, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "-42");
+
+    visitor_reset(data);
+    visit_type_uint64(data->ov, NULL, &uvalue, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "18446744073709551615");
+}
+
+static void test_visitor_out_bool(TestOutputVisitorData *data,
+                                  const void *unused)
+{
+    bool value = true;
+
+    visit_type_bool(data->ov, NULL, &value, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "true");
+}
+
+static void test_visitor_out_number(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    double value = 3.14;
+
+    visit_type_number(data->ov, NULL, &value, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "3.14");
+}
+
+static void test_visitor_out_string(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    char *string = (char *) "Q E M U \"\\\n\t\x01 \xc3\xa9";
+
+    visit_type_str(data->ov, NULL, &string, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "\"Q E M U \\\"\\\\\\n\\t\\u0001 \\u00E9\"");
+}
+
+static void test_visitor_out_no_string(TestOutputVisitorData *data,
+                                       const void *unused)
+{
+    char *string = NULL;
+
+    /* A null string should return "" */
+    visit_type_str(data->ov, NULL, &string, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "\"\"");
+}
+
+static void test_visitor_out_enum(TestOutputVisitorData *data,
+                                  const void *unused)
+{
+    EnumOne i = ENUM_ONE_VALUE2;
+
+    visit_type_EnumOne(data->ov, "unused", &i, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "\"value2\"");
+}
+
+static void test_visitor_out_struct(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    TestStruct test_struct = { .integer = 42,
+                               .boolean = false,
+                               .string = (char *) "foo"};
+    TestStruct *p = &test_struct;
+
+    visit_type_TestStruct(data->ov, NULL, &p, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "{\"integer\": 42, \"boolean\": false, \"string\": \"foo\"}");
+}
+
+static void test_visitor_out_struct_nested(TestOutputVisitorData *data,
+                                           const void *unused)
+{
+    UserDefTwo *ud2;
+    QObject *obj, *expected;
+    Visitor *v;
+
+    ud2 = g_new0(UserDefTwo, 1);
+    ud2->string0 = g_strdup("forty two");
+    ud2->dict1 = g_new0(UserDefTwoDict, 1);
+    ud2->dict1->string1 = g_strdup("forty three");
+    ud2->dict1->dict2 = g_new0(UserDefTwoDictDict, 1);
+    ud2->dict1->dict2->userdef = g_new0(UserDefOne, 1);
+    ud2->dict1->dict2->userdef->string = g_strdup("string");
+    ud2->dict1->dict2->userdef->integer = 42;
+    ud2->dict1->dict2->string = g_strdup("string");
+    ud2->dict1->has_dict3 = true;
+    ud2->dict1->dict3 = g_new0(UserDefTwoDictDict, 1);
+    ud2->dict1->dict3->userdef = g_new0(UserDefOne, 1);
+    ud2->dict1->dict3->userdef->string = g_strdup("string");
+    ud2->dict1->dict3->userdef->integer = 43;
+    ud2->dict1->dict3->string = g_strdup("string");
+
+    visit_type_UserDefTwo(data->ov, "unused", &ud2, &error_abort);
+
+    /* Must agree with the QObject output visitor */
+    obj = qobject_from_json(visitor_get(data), &error_abort);
+    v = qobject_output_visitor_new(&expected);
+    visit_type_UserDefTwo(v, "unused", &ud2, &error_abort);
+    visit_complete(v, &expected);
+    g_assert(qobject_is_equal(obj, expected));
+
+    visit_free(v);
+    qobject_decref(expected);
+    qobject_decref(obj);
+    qapi_free_UserDefTwo(ud2);
+}
+
+static void test_visitor_out_list(TestOutputVisitorData *data,
+                                  const void *unused)
+{
+    intList *head = NULL, *entry;
+    int64_t i;
+
+    visit_type_intList(data->ov, NULL, &head, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "[]");
+
+    for (i = 3; i > 0; i--) {
+        entry = g_new0(intList, 1);
+        entry->value = i;
+        entry->next = head;
+        head = entry;
+    }
+
+    visitor_reset(data);
+    visit_type_intList(data->ov, NULL, &head, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "[1, 2, 3]");
+
+    qapi_free_intList(head);
+}
+
+static void test_visitor_out_any(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    QObject *qobj, *obj;
+
+    qobj = qobject_from_json("{\"a\": [1, {}, \"x\"], \"b\": null}",
+                             &error_abort);
+    visit_type_any(data->ov, NULL, &qobj, &error_abort);
+    obj = qobject_from_json(visitor_get(data), &error_abort);
+    g_assert(qobject_is_equal(obj, qobj));
+    qobject_decref(obj);
+    qobject_decref(qobj);
+}
+
+static void test_visitor_out_union_flat(TestOutputVisitorData *data,
+                                        const void *unused)
+{
+    UserDefFlatUnion *tmp = g_new0(UserDefFlatUnion, 1);
+
+    tmp->enum1 = ENUM_ONE_VALUE1;
+    tmp->string = g_strdup("str");
+    tmp->integer = 41;
+    tmp->u.value1.boolean = true;
+
+    visit_type_UserDefFlatUnion(data->ov, NULL, &tmp, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "{\"integer\": 41, \"string\": \"str\", "
+                    "\"enum1\": \"value1\", \"boolean\": true}");
+
+    qapi_free_UserDefFlatUnion(tmp);
+}
+
+static void test_visitor_out_alternate(TestOutputVisitorData *data,
+                                       const void *unused)
+{
+    UserDefAlternate *tmp;
+
+    tmp = g_new0(UserDefAlternate, 1);
+    tmp->type = QTYPE_QNUM;
+    tmp->u.i = 42;
+
+    visit_type_UserDefAlternate(data->ov, NULL, &tmp, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "42");
+    qapi_free_UserDefAlternate(tmp);
+
+    visitor_reset(data);
+    tmp = g_new0(UserDefAlternate, 1);
+    tmp->type = QTYPE_QNULL;
+    tmp->u.n = qnull();
+
+    visit_type_UserDefAlternate(data->ov, NULL, &tmp, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==, "null");
+    qapi_free_UserDefAlternate(tmp);
+}
+
+static void test_visitor_out_splice(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    int64_t value = 1;
+
+    /* Text is appended to what is already there */
+    qstring_append(data->str, "{\"return\": ");
+    visit_type_int(data->ov, NULL, &value, &error_abort);
+    visit_complete(data->ov, data->str);
+    qstring_append_chr(data->str, '}');
+    g_assert_cmpstr(qstring_get_str(data->str), ==, "{\"return\": 1}");
+}
+
+static void test_visitor_out_pretty(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    TestStruct test_struct = { .integer = 42,
+                               .boolean = true,
+                               .string = (char *) "foo"};
+    TestStructList list = { .value = &test_struct };
+    TestStructList *p = &list;
+    QString *expected;
+    QObject *obj;
+    Visitor *v;
+
+    visit_type_TestStructList(data->ov, NULL, &p, &error_abort);
+    g_assert_cmpstr(visitor_get(data), ==,
+                    "[\n"
+                    "    {\n"
+                    "        \"integer\": 42,\n"
+                    "        \"boolean\": true,\n"
+                    "        \"string\": \"foo\"\n"
+                    "    }\n"
+                    "]");
+
+    /* Empty containers look just like qobject_to_json_pretty() */
+    visitor_output_teardown(data, NULL);
+    visitor_output_setup_pretty(data, NULL);
+    p = NULL;
+    visit_type_TestStructList(data->ov, NULL, &p, &error_abort);
+
+    v = qobject_output_visitor_new(&obj);
+    visit_type_TestStructList(v, NULL, &p, &error_abort);
+    visit_complete(v, &obj);
+    expected = qobject_to_json_pretty(obj);
+    g_assert_cmpstr(visitor_get(data), ==, qstring_get_str(expected));
+
+    QDECREF(expected);
+    qobject_decref(obj);
+    visit_free(v);
+}
+
+static void output_visitor_test_add(const char *testpath,
+                                    TestOutputVisitorData *data,
+                                    void (*test_func)(TestOutputVisitorData *data, const void *user_data))
+{
+    g_test_add(testpath, TestOutputVisitorData, data, visitor_output_setup,
+               test_func, visitor_output_teardown);
+}
+
+int main(int argc, char **argv)
+{
+    TestOutputVisitorData out_visitor_data;
+
+    g_test_init(&argc, &argv, NULL);
+
+    output_visitor_test_add("/visitor/json/output/int",
+                            &out_visitor_data, test_visitor_out_int);
+    output_visitor_test_add("/visitor/json/output/bool",
+                            &out_visitor_data, test_visitor_out_bool);
+    output_visitor_test_add("/visitor/json/output/number",
+                            &out_visitor_data, test_visitor_out_number);
+    output_visitor_test_add("/visitor/json/output/string",
+                            &out_visitor_data, test_visitor_out_string);
+    output_visitor_test_add("/visitor/json/output/no-string",
+                            &out_visitor_data, test_visitor_out_no_string);
+    output_visitor_test_add("/visitor/json/output/enum",
+                            &out_visitor_data, test_visitor_out_enum);
+    output_visitor_test_add("/visitor/json/output/struct",
+                            &out_visitor_data, test_visitor_out_struct);
+    output_visitor_test_add("/visitor/json/output/struct-nested",
+                            &out_visitor_data, test_visitor_out_struct_nested);
+    output_visitor_test_add("/visitor/json/output/list",
+                            &out_visitor_data, test_visitor_out_list);
+    output_visitor_test_add("/visitor/json/output/any",
+                            &out_visitor_data, test_visitor_out_any);
+    output_visitor_test_add("/visitor/json/output/union-flat",
+                            &out_visitor_data, test_visitor_out_union_flat);
+    output_visitor_test_add("/visitor/json/output/alternate",
+                            &out_visitor_data, test_visitor_out_alternate);
+    output_visitor_test_add("/visitor/json/output/splice",
+                            &out_visitor_data, test_visitor_out_splice);
+    g_test_add("/visitor/json/output/pretty", TestOutputVisitorData,
+               &out_visitor_data, visitor_output_setup_pretty,
+               test_visitor_out_pretty, visitor_output_teardown);
+
+    g_test_run();
+
+    return 0;
+}
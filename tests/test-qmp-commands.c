@@ -1,6 +1,8 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
+#include "qapi/error.h"
 #include "qapi/qmp/types.h"
+#include "qapi/qmp/qjson.h"
 #include "test-qmp-commands.h"
 #include "qapi/qmp/dispatch.h"
 #include "qemu/module.h"
@@ -203,6 +205,86 @@ static void test_dispatch_cmd_io(void)
     QDECREF(req);
 }
 
+static char *test_qmp_dispatch_json(QDict *req, QObject *id, bool pretty)
+{
+    QString *resp;
+    char *str;
+
+    resp = qmp_dispatch_json(&qmp_commands, QOBJECT(req), id, pretty);
+    g_assert(resp);
+    str = g_strdup(qstring_get_str(resp));
+    QDECREF(resp);
+    return str;
+}
+
+/* test responses serialized by qmp_dispatch_json() */
+static void test_dispatch_cmd_json(void)
+{
+    QDict *req = qdict_new();
+    QDict *args = qdict_new();
+    QDict *ud1a = qdict_new();
+    QObject *id = QOBJECT(qstring_from_str("x"));
+    char *resp;
+
+    /* return value written by the JSON output visitor */
+    qdict_put_int(ud1a, "integer", 42);
+    qdict_put_str(ud1a, "string", "hello");
+    qdict_put(args, "ud1a", ud1a);
+    qdict_put(req, "arguments", args);
+    qdict_put_str(req, "execute", "user_def_cmd2");
+
+    resp = test_qmp_dispatch_json(req, id, false);
+    g_assert_cmpstr(resp, ==,
+                    "{\"return\": {\"string0\": \"blah1\", \"dict1\": "
+                    "{\"string1\": \"blah2\", \"dict2\": {\"userdef\": "
+                    "{\"integer\": 42, \"string\": \"hello\"}, "
+                    "\"string\": \"blah3\"}, \"dict3\": {\"userdef\": "
+                    "{\"integer\": 0, \"string\": \"blah0\"}, "
+                    "\"string\": \"blah4\"}}}, \"id\": \"x\"}");
+    g_free(resp);
+
+    /* no return value */
+    qdict_del(req, "arguments");
+    qdict_put_str(req, "execute", "user_def_cmd");
+    resp = test_qmp_dispatch_json(req, NULL, false);
+    g_assert_cmpstr(resp, ==, "{\"return\": {}}");
+    g_free(resp);
+
+    /* error */
+    qdict_put_str(req, "execute", "user_def_cmd2");
+    resp = test_qmp_dispatch_json(req, id, false);
+    g_assert(strstr(resp, "\"error\": {"));
+    g_assert(strstr(resp, "\"id\": \"x\""));
+    g_free(resp);
+
+    /* pretty, indented like qobject_to_json_pretty() */
+    args = qdict_new();
+    qdict_put_obj(args, "arg",
+                  qobject_from_json("{'a': [1]}", &error_abort));
+    qdict_put(req, "arguments", args);
+    qdict_put_str(req, "execute", "guest-sync");
+    resp = test_qmp_dispatch_json(req, id, true);
+    g_assert_cmpstr(resp, ==,
+                    "{\n"
+                    "    \"return\": {\n"
+                    "        \"a\": [\n"
+                    "            1\n"
+                    "        ]\n"
+                    "    },\n"
+                    "    \"id\": \"x\"\n"
+                    "}");
+    g_free(resp);
+
+    qdict_del(req, "arguments");
+    qdict_put_str(req, "execute", "user_def_cmd");
+    resp = test_qmp_dispatch_json(req, NULL, true);
+    g_assert_cmpstr(resp, ==, "{\n    \"return\": {\n    }\n}");
+    g_free(resp);
+
+    qobject_decref(id);
+    QDECREF(req);
+}
+
 /* test generated dealloc functions for generated types */
 static void test_dealloc_types(void)
 {
@@ -274,6 +356,7 @@ int main(int argc, char **argv)
     g_test_add_func("/0.15/dispatch_cmd", test_dispatch_cmd);
     g_test_add_func("/0.15/dispatch_cmd_failure", test_dispatch_cmd_failure);
     g_test_add_func("/0.15/dispatch_cmd_io", test_dispatch_cmd_io);
+    g_test_add_func("/0.15/dispatch_cmd_json", test_dispatch_cmd_json);
     g_test_add_func("/0.15/dealloc_types", test_dealloc_types);
     g_test_add_func("/0.15/dealloc_partial", test_dealloc_partial);
 
@@ -135,6 +135,114 @@ static void test_submit_many(void)
     }
 }
 
+static int finished;
+
+static int blocking_cb(void *opaque)
+{
+    /* Wait for all the requests submitted after this one.  */
+    while (atomic_read(&finished) < 200) {
+        g_usleep(1000);
+    }
+    return 0;
+}
+
+static int counting_cb(void *opaque)
+{
+    atomic_inc(&finished);
+    return 0;
+}
+
+static void test_submit_blocked(void)
+{
+    WorkerTestData data[201];
+    int i;
+
+    /* With more requests than threads, some of them are queued behind
+     * blocking_cb.  They can only run if other workers steal them.
+     */
+    finished = 0;
+    for (i = 0; i < 201; i++) {
+        data[i].n = 0;
+        data[i].ret = -EINPROGRESS;
+        thread_pool_submit_aio(pool, i ? counting_cb : blocking_cb, &data[i],
+                               done_cb, &data[i]);
+    }
+
+    active = 201;
+    while (active > 0) {
+        aio_poll(ctx, true);
+    }
+    g_assert_cmpint(finished, ==, 200);
+    for (i = 0; i < 201; i++) {
+        g_assert_cmpint(data[i].ret, ==, 0);
+    }
+}
+
+/* THREAD_POOL_MAX_THREADS in util/thread-pool.c */
+#define MAX_THREADS 64
+
+static int waiting_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+
+    /* Wait for the matching release_cb.  */
+    while (!atomic_read(&data->n)) {
+        g_usleep(1000);
+    }
+    return 0;
+}
+
+static int release_cb(void *opaque)
+{
+    WorkerTestData *data = opaque;
+
+    atomic_set(&data->n, 1);
+    return 0;
+}
+
+static void test_submit_behind_busy(void)
+{
+    WorkerTestData waiting[MAX_THREADS - 1];
+    WorkerTestData release[MAX_THREADS - 1];
+    int round, i;
+
+    /* Keep all workers but one busy with requests that wait for a later
+     * request, then submit those later requests one at a time.  With
+     * every worker slot taken, they are queued behind busy workers,
+     * sometimes right while the free worker goes idle.  Only that worker
+     * can run them, so it must not go to sleep without seeing them.
+     */
+    for (round = 0; round < 10; round++) {
+        for (i = 0; i < MAX_THREADS - 1; i++) {
+            waiting[i].n = 0;
+            waiting[i].ret = -EINPROGRESS;
+            thread_pool_submit_aio(pool, waiting_cb, &waiting[i],
+                                   done_cb, &waiting[i]);
+        }
+
+        active = 2 * (MAX_THREADS - 1);
+        for (i = 0; i < MAX_THREADS - 1; i++) {
+            /* Let the bottom half start more threads.  */
+            aio_poll(ctx, false);
+            g_usleep(g_test_rand_int_range(0, 100));
+
+            release[i].n = 0;
+            release[i].ret = -EINPROGRESS;
+            thread_pool_submit_aio(pool, release_cb, &waiting[i],
+                                   done_cb, &release[i]);
+        }
+
+        while (active > 0) {
+            aio_poll(ctx, true);
+        }
+        for (i = 0; i < MAX_THREADS - 1; i++) {
+            g_assert_cmpint(waiting[i].n, ==, 1);
+            g_assert_cmpint(waiting[i].ret, ==, 0);
+            g_assert_cmpint(release[i].ret, ==, 0);
+        }
+    }
+}
+
 static void do_test_cancel(bool sync)
 {
     WorkerTestData data[100];
@@ -235,6 +343,8 @@ int main(int argc, char **argv)
     g_test_add_func("/thread-pool/submit-aio", test_submit_aio);
     g_test_add_func("/thread-pool/submit-co", test_submit_co);
     g_test_add_func("/thread-pool/submit-many", test_submit_many);
+    g_test_add_func("/thread-pool/submit-blocked", test_submit_blocked);
+    g_test_add_func("/thread-pool/submit-behind-busy", test_submit_behind_busy);
     g_test_add_func("/thread-pool/cancel", test_cancel);
     g_test_add_func("/thread-pool/cancel-async", test_cancel_async);
 
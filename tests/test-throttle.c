@@ -20,6 +20,8 @@
 #include "qemu/error-report.h"
 #include "block/throttle-groups.h"
 #include "sysemu/block-backend.h"
+#include "sysemu/qtest.h"
+#include "qom/object_interfaces.h"
 
 static AioContext     *ctx;
 static LeakyBucket    bkt;
@@ -28,6 +30,14 @@ static ThrottleGroupMember tgm;
 static ThrottleState  ts;
 static ThrottleTimers *tt;
 
+/* This is the clock for QEMU_CLOCK_VIRTUAL */
+static int64_t virtual_clock_value;
+
+int64_t cpu_get_clock(void)
+{
+    return virtual_clock_value;
+}
+
 /* useful function */
 static bool double_cmp(double x, double y)
 {
@@ -734,6 +744,280 @@ static void test_groups(void)
     g_assert(tgm3->throttle_state == NULL);
 }
 
+static void test_groups_nested(void)
+{
+    Object *tenant, *vm1, *vm2, *vm3;
+    BlockBackend *blk1, *blk2;
+    ThrottleGroupMember *tgm1, *tgm2;
+    Error *err = NULL;
+    char *parent;
+
+    tenant = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                   object_get_objects_root(), "tenant",
+                                   &error_abort,
+                                   "x-iops-total", "1000",
+                                   NULL);
+    vm1 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm1",
+                                &error_abort,
+                                "parent", "tenant",
+                                "weight", "300",
+                                "borrow", "on",
+                                "x-iops-total", "100",
+                                NULL);
+    vm2 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm2",
+                                &error_abort,
+                                "parent", "tenant",
+                                NULL);
+
+    parent = object_property_get_str(vm1, "parent", &error_abort);
+    g_assert_cmpstr(parent, ==, "tenant");
+    g_free(parent);
+    parent = object_property_get_str(tenant, "parent", &error_abort);
+    g_assert_cmpstr(parent, ==, "");
+    g_free(parent);
+
+    g_assert_cmpuint(object_property_get_uint(vm1, "weight", &error_abort),
+                     ==, 300);
+    g_assert_cmpuint(object_property_get_uint(vm2, "weight", &error_abort),
+                     ==, 100);
+    g_assert(object_property_get_bool(vm1, "borrow", &error_abort));
+    g_assert(!object_property_get_bool(vm2, "borrow", &error_abort));
+
+    /* The weight can change at run time, but not the tree */
+    object_property_set_uint(vm2, 50, "weight", &error_abort);
+    g_assert_cmpuint(object_property_get_uint(vm2, "weight", &error_abort),
+                     ==, 50);
+    object_property_set_uint(vm2, 0, "weight", &err);
+    error_free_or_abort(&err);
+    object_property_set_str(vm2, "vm1", "parent", &err);
+    error_free_or_abort(&err);
+
+    /* The parent must exist */
+    vm3 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm3",
+                                &err,
+                                "parent", "nonexistent",
+                                NULL);
+    g_assert(vm3 == NULL);
+    error_free_or_abort(&err);
+
+    /* A group cannot be deleted while it has children */
+    g_assert(!user_creatable_can_be_deleted(USER_CREATABLE(tenant)));
+
+    /* No actual I/O is performed on these devices */
+    blk1 = blk_new(0, BLK_PERM_ALL);
+    blk2 = blk_new(0, BLK_PERM_ALL);
+    tgm1 = &blk_get_public(blk1)->throttle_group_member;
+    tgm2 = &blk_get_public(blk2)->throttle_group_member;
+
+    throttle_group_register_tgm(tgm1, "vm1", blk_get_aio_context(blk1));
+    throttle_group_register_tgm(tgm2, "vm2", blk_get_aio_context(blk2));
+    g_assert_cmpstr(throttle_group_get_name(tgm1), ==, "vm1");
+    g_assert_cmpstr(throttle_group_get_name(tgm2), ==, "vm2");
+    g_assert(tgm1->throttle_state != tgm2->throttle_state);
+
+    throttle_group_unregister_tgm(tgm1);
+    throttle_group_unregister_tgm(tgm2);
+    blk_unref(blk1);
+    blk_unref(blk2);
+
+    object_unparent(vm1);
+    object_unparent(vm2);
+    g_assert(user_creatable_can_be_deleted(USER_CREATABLE(tenant)));
+    object_unparent(tenant);
+}
+
+/* A member of a throttle group that keeps several requests queued */
+typedef struct TestLoad {
+    BlockBackend *blk;
+    ThrottleGroupMember *tgm;
+    unsigned done;      /* requests let through so far */
+    int running;        /* coroutines still issuing requests */
+} TestLoad;
+
+#define TEST_LOAD_QUEUE_DEPTH 4
+
+static bool test_load_stop;
+
+static void coroutine_fn test_load_entry(void *opaque)
+{
+    TestLoad *load = opaque;
+
+    while (!test_load_stop) {
+        throttle_group_co_io_limits_intercept(load->tgm, 512, false);
+        load->done++;
+    }
+    load->running--;
+}
+
+static void test_load_start(TestLoad *load, const char *group)
+{
+    int i;
+
+    /* No actual I/O is performed on this device */
+    load->blk = blk_new(0, BLK_PERM_ALL);
+    load->tgm = &blk_get_public(load->blk)->throttle_group_member;
+    load->done = 0;
+    throttle_group_register_tgm(load->tgm, group,
+                                blk_get_aio_context(load->blk));
+
+    for (i = 0; i < TEST_LOAD_QUEUE_DEPTH; i++) {
+        Coroutine *co = qemu_coroutine_create(test_load_entry, load);
+        load->running++;
+        qemu_coroutine_enter(co);
+    }
+}
+
+/* The groups use QEMU_CLOCK_VIRTUAL under qtest, so that the tests can
+ * move time forward themselves: run whatever is ready, and otherwise
+ * step the clock to the next throttle timer.
+ */
+static void test_load_step(void)
+{
+    int64_t deadline;
+
+    if (aio_poll(ctx, false)) {
+        return;
+    }
+    deadline = qemu_clock_deadline_ns_all(QEMU_CLOCK_VIRTUAL);
+    g_assert_cmpint(deadline, >, 0);
+    virtual_clock_value += deadline;
+}
+
+/* Run the main loop until @n more requests of @a and @b together have gone
+ * through */
+static void test_load_run(TestLoad *a, TestLoad *b, unsigned n)
+{
+    unsigned target = a->done + (b ? b->done : 0) + n;
+
+    while (a->done + (b ? b->done : 0) < target) {
+        test_load_step();
+    }
+}
+
+static void test_load_stop_all(TestLoad *a, TestLoad *b)
+{
+    test_load_stop = true;
+    while (a->running || b->running) {
+        test_load_step();
+    }
+    test_load_stop = false;
+
+    throttle_group_unregister_tgm(a->tgm);
+    throttle_group_unregister_tgm(b->tgm);
+    blk_unref(a->blk);
+    blk_unref(b->blk);
+}
+
+static void test_groups_weights(void)
+{
+    Object *tenant, *vm1, *vm2;
+    TestLoad load1 = { 0 }, load2 = { 0 };
+    unsigned done1, done2;
+    double share;
+
+    qtest_allowed = true;
+    tenant = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                   object_get_objects_root(), "tenant",
+                                   &error_abort,
+                                   "x-iops-total", "2000",
+                                   NULL);
+    vm1 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm1",
+                                &error_abort,
+                                "parent", "tenant",
+                                "weight", "300",
+                                NULL);
+    vm2 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm2",
+                                &error_abort,
+                                "parent", "tenant",
+                                "weight", "100",
+                                NULL);
+
+    test_load_start(&load1, "vm1");
+    test_load_start(&load2, "vm2");
+
+    /* Use up the burst, after which both members are always queued */
+    test_load_run(&load1, &load2, 400);
+
+    done1 = load1.done;
+    done2 = load2.done;
+    test_load_run(&load1, &load2, 800);
+    done1 = load1.done - done1;
+    done2 = load2.done - done2;
+
+    /* The tenant's limit is shared 3:1 */
+    share = (double) done1 / (done1 + done2);
+    g_assert_cmpfloat(share, >, 0.65);
+    g_assert_cmpfloat(share, <, 0.85);
+
+    test_load_stop_all(&load1, &load2);
+    object_unparent(vm1);
+    object_unparent(vm2);
+    object_unparent(tenant);
+    qtest_allowed = false;
+}
+
+static void test_groups_borrow(void)
+{
+    Object *tenant, *vm1, *vm2;
+    TestLoad load1 = { 0 }, load2 = { 0 };
+    unsigned done1, done2;
+    int64_t start, elapsed;
+
+    qtest_allowed = true;
+    tenant = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                   object_get_objects_root(), "tenant",
+                                   &error_abort,
+                                   "x-iops-total", "2000",
+                                   NULL);
+    vm1 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm1",
+                                &error_abort,
+                                "parent", "tenant",
+                                "borrow", "on",
+                                "x-iops-total", "100",
+                                NULL);
+    vm2 = object_new_with_props(TYPE_THROTTLE_GROUP,
+                                object_get_objects_root(), "vm2",
+                                &error_abort,
+                                "parent", "tenant",
+                                NULL);
+
+    /* While vm2 is idle, vm1 can use the tenant's whole limit */
+    test_load_start(&load1, "vm1");
+    test_load_run(&load1, NULL, 400);
+
+    start = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    test_load_run(&load1, NULL, 400);
+    elapsed = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) - start;
+
+    /* That takes a fifth of a second at the tenant's limit, but would
+     * take four seconds at vm1's own limit */
+    g_assert_cmpint(elapsed, <, NANOSECONDS_PER_SECOND / 2);
+
+    /* vm1 is far over its own limit now, so it gives way to vm2 */
+    test_load_start(&load2, "vm2");
+    test_load_run(&load1, &load2, 400);
+
+    done1 = load1.done;
+    done2 = load2.done;
+    test_load_run(&load1, &load2, 800);
+    done1 = load1.done - done1;
+    done2 = load2.done - done2;
+
+    g_assert_cmpuint(done2, >, 9 * done1);
+
+    test_load_stop_all(&load1, &load2);
+    object_unparent(vm1);
+    object_unparent(vm2);
+    object_unparent(tenant);
+    qtest_allowed = false;
+}
+
 int main(int argc, char **argv)
 {
     qemu_init_main_loop(&error_fatal);
@@ -761,6 +1045,9 @@ int main(int argc, char **argv)
     g_test_add_func("/throttle/config_functions",   test_config_functions);
     g_test_add_func("/throttle/accounting",         test_accounting);
     g_test_add_func("/throttle/groups",             test_groups);
+    g_test_add_func("/throttle/groups/nested",      test_groups_nested);
+    g_test_add_func("/throttle/groups/weights",     test_groups_weights);
+    g_test_add_func("/throttle/groups/borrow",      test_groups_borrow);
     return g_test_run();
 }
 
@@ -54,6 +54,9 @@ QemuOptsList qemu_trace_opts = {
         },{
             .name = "file",
             .type = QEMU_OPT_STRING,
+        },{
+            .name = "shm",
+            .type = QEMU_OPT_STRING,
         },
         { /* end of list */ }
     },
@@ -320,6 +323,15 @@ char *trace_opt_parse(const char *optarg)
         trace_enable_events(qemu_opt_get(opts, "enable"));
     }
     trace_init_events(qemu_opt_get(opts, "events"));
+    if (qemu_opt_get(opts, "shm")) {
+#ifdef CONFIG_TRACE_SIMPLE
+        st_set_trace_shm(qemu_opt_get(opts, "shm"), &error_fatal);
+#else
+        error_report("-trace shm=...: "
+                     "option not supported by the selected tracing backends");
+        exit(1);
+#endif
+    }
     trace_file = g_strdup(qemu_opt_get(opts, "file"));
     qemu_opts_del(opts);
 
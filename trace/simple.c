@@ -13,8 +13,11 @@
 #include <pthread.h>
 #endif
 #include "qemu/timer.h"
+#include "qemu/atomic.h"
+#include "qemu/queue.h"
 #include "trace/control.h"
 #include "trace/simple.h"
+#include "qapi/error.h"
 #include "qemu/error-report.h"
 
 /** Trace file header event ID, picked to avoid conflict with real event IDs */
@@ -24,17 +27,24 @@
 #define HEADER_MAGIC 0xf2b177cb0aa429b4ULL
 
 /** Trace file version number, bump if format changes */
-#define HEADER_VERSION 4
+#define HEADER_VERSION 5
 
 /** Records were dropped event ID */
 #define DROPPED_EVENT_ID (~(uint64_t)0 - 1)
 
-/** Trace record is valid */
-#define TRACE_RECORD_VALID ((uint64_t)1 << 63)
+/** Shared memory trace ring magic number */
+#define SHM_MAGIC 0x676e697274756d71ULL
 
 /*
+ * Every thread that emits trace events owns a ring buffer.  The owning thread
+ * is the only producer and the writeout thread is the only consumer, so no
+ * atomic read-modify-write operations are needed on the fast path: a record is
+ * copied into the ring and published by a store-release of the head index.
+ *
  * Trace records are written out by a dedicated thread.  The thread waits for
- * records to become available, writes them out, and then waits again.
+ * records to become available or for the writeout interval to expire, merges
+ * the records from all rings in timestamp order, writes them out, and then
+ * waits again.
  */
 static CompatGMutex trace_lock;
 static CompatGCond trace_available_cond;
@@ -46,16 +56,52 @@ static bool trace_writeout_enabled;
 enum {
     TRACE_BUF_LEN = 4096 * 64,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
+    TRACE_SHM_LEN = 16 * 1024 * 1024,
+    TRACE_WRITEOUT_INTERVAL_US = 100 * 1000,
+};
+
+struct TraceThreadBuf {
+    unsigned int head;      /* published by the owning thread */
+    unsigned int tail;      /* released by the writeout thread */
+    unsigned int dropped;   /* records dropped since the last writeout */
+    bool in_record;         /* owning thread is between start and finish */
+    bool exited;            /* owning thread is gone, free once drained */
+    uint64_t tid;
+    Notifier exit_notifier;
+    QSLIST_ENTRY(TraceThreadBuf) node;
+    uint8_t data[TRACE_BUF_LEN];
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/* Rings registered since the last writeout, taken over by writeout_thread */
+static QSLIST_HEAD(TraceThreadBufList, TraceThreadBuf) trace_new_bufs;
+static __thread TraceThreadBuf *trace_thread_buf;
+
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
 
+/*
+ * Shared memory ring for a local collector.  QEMU is the only producer and
+ * publishes @head after each complete record; the collector is the only
+ * consumer and publishes @tail once it has copied data out.  Both indices
+ * run freely modulo 2^32.  The stream in @data has the same format as the
+ * trace file, starting with the file header and event mapping records, so
+ * nothing is lost when the collector attaches late.  Records that do not fit
+ * are dropped and later accounted for with a dropped event record.
+ */
+typedef struct {
+    uint64_t magic;         /* SHM_MAGIC */
+    uint64_t version;       /* HEADER_VERSION */
+    uint32_t size;          /* size of data[] in bytes, a power of two */
+    uint32_t head;          /* written by QEMU */
+    uint32_t tail;          /* written by the collector */
+    uint32_t reserved;
+    uint8_t data[];
+} TraceShmRing;
+
+static TraceShmRing *trace_shm;
+static uint32_t trace_shm_dropped;
+
 #define TRACE_RECORD_TYPE_MAPPING 0
 #define TRACE_RECORD_TYPE_EVENT   1
 
@@ -65,6 +111,7 @@ typedef struct {
     uint64_t timestamp_ns;
     uint32_t length;   /*    in bytes */
     uint32_t pid;
+    uint64_t tid;
     uint64_t arguments[];
 } TraceRecord;
 
@@ -74,55 +121,17 @@ typedef struct {
     uint64_t header_version;  /* HEADER_VERSION  */
 } TraceLogHeader;
 
+static const TraceLogHeader trace_log_header = {
+    .header_event_id = HEADER_EVENT_ID,
+    .header_magic = HEADER_MAGIC,
+    /* Older log readers will check for version at next location */
+    .header_version = HEADER_VERSION,
+};
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
-
-static void clear_buffer_range(unsigned int idx, size_t len)
-{
-    uint32_t num = 0;
-    while (num < len) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = 0;
-        num++;
-    }
-}
-/**
- * Read a trace record from the trace buffer
- *
- * @idx         Trace buffer index
- * @record      Trace record to fill
- *
- * Returns false if the record is not valid.
- */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
-{
-    uint64_t event_flag = 0;
-    TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
-
-    if (!(record.event & TRACE_RECORD_VALID)) {
-        return false;
-    }
-
-    smp_rmb(); /* read memory barrier before accessing record */
-    /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
-    *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
-    /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
-    smp_rmb(); /* memory barrier before clearing valid flag */
-    (*recordptr)->event &= ~TRACE_RECORD_VALID;
-    /* clear the trace buffer range for consumed record otherwise any byte
-     * with its MSB set may be considered as a valid event id when the writer
-     * thread crosses this range of buffer again.
-     */
-    clear_buffer_range(idx, record.length);
-    return true;
-}
+static void read_from_buffer(TraceThreadBuf *tb, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceThreadBuf *tb, unsigned int idx,
+                                    const void *dataptr, size_t size);
 
 /**
  * Kick writeout thread
@@ -142,139 +151,356 @@ static void flush_trace_file(bool wait)
     g_mutex_unlock(&trace_lock);
 }
 
-static void wait_for_trace_records_available(void)
+/**
+ * Wait until there is something to write out
+ *
+ * @fp          Trace file to write to, or NULL
+ * @shm         Shared memory ring to write to, or NULL
+ *
+ * Records are written out when a thread kicks the writeout thread, or
+ * periodically so that records from mostly idle threads do not linger.
+ */
+static void wait_for_trace_records_available(FILE **fp, TraceShmRing **shm)
 {
+    gint64 end_time = g_get_monotonic_time() + TRACE_WRITEOUT_INTERVAL_US;
+
     g_mutex_lock(&trace_lock);
-    while (!(trace_available && trace_writeout_enabled)) {
+    while (!(trace_available && (trace_writeout_enabled || trace_shm))) {
         g_cond_signal(&trace_empty_cond);
-        g_cond_wait(&trace_available_cond, &trace_lock);
+        if (!trace_writeout_enabled && !trace_shm) {
+            g_cond_wait(&trace_available_cond, &trace_lock);
+        } else if (!g_cond_wait_until(&trace_available_cond, &trace_lock,
+                                      end_time)) {
+            break;
+        }
     }
     trace_available = false;
+    *fp = trace_writeout_enabled ? trace_fp : NULL;
+    *shm = trace_shm;
     g_mutex_unlock(&trace_lock);
 }
 
-static gpointer writeout_thread(gpointer opaque)
+static void shm_write(TraceShmRing *shm, uint32_t idx,
+                      const void *dataptr, size_t size)
 {
-    TraceRecord *recordptr;
+    uint32_t off = idx & (shm->size - 1);
+    size_t n = MIN(size, shm->size - off);
+
+    memcpy(&shm->data[off], dataptr, n);
+    memcpy(shm->data, (const uint8_t *)dataptr + n, size - n);
+}
+
+static bool shm_has_room(TraceShmRing *shm, size_t size)
+{
+    return shm->size - (shm->head - atomic_load_acquire(&shm->tail)) >= size;
+}
+
+/*
+ * A trace file or shared memory ring entry is built from up to three pieces:
+ * the record type, the record header, and the payload (which may wrap around
+ * the end of a thread's ring).  Entries are written to the shared memory ring
+ * as a whole or not at all.
+ */
+typedef struct {
+    const void *ptr;
+    size_t len;
+} TraceChunk;
+
+static void writeout_chunks(FILE *fp, TraceShmRing *shm,
+                            const TraceChunk *chunks, int n)
+{
+    size_t unused __attribute__ ((unused));
+    size_t total = 0;
+    uint32_t idx;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (fp && chunks[i].len) {
+            unused = fwrite(chunks[i].ptr, chunks[i].len, 1, fp);
+        }
+        total += chunks[i].len;
+    }
+
+    if (!shm) {
+        return;
+    }
+
+    if (trace_shm_dropped) {
+        uint64_t type = TRACE_RECORD_TYPE_EVENT;
+        union {
+            TraceRecord rec;
+            uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
+        } dropped;
+
+        if (!shm_has_room(shm, sizeof(type) + sizeof(dropped))) {
+            trace_shm_dropped++;
+            return;
+        }
+        dropped.rec.event = DROPPED_EVENT_ID;
+        dropped.rec.timestamp_ns = get_clock();
+        dropped.rec.length = sizeof(dropped);
+        dropped.rec.pid = trace_pid;
+        dropped.rec.tid = 0;
+        dropped.rec.arguments[0] = trace_shm_dropped;
+        shm_write(shm, shm->head, &type, sizeof(type));
+        shm_write(shm, shm->head + sizeof(type), &dropped, sizeof(dropped));
+        atomic_store_release(&shm->head,
+                             shm->head + sizeof(type) + sizeof(dropped));
+        trace_shm_dropped = 0;
+    }
+
+    if (!shm_has_room(shm, total)) {
+        trace_shm_dropped++;
+        return;
+    }
+    idx = shm->head;
+    for (i = 0; i < n; i++) {
+        shm_write(shm, idx, chunks[i].ptr, chunks[i].len);
+        idx += chunks[i].len;
+    }
+    atomic_store_release(&shm->head, idx);
+}
+
+static void writeout_dropped(FILE *fp, TraceShmRing *shm,
+                             TraceThreadBuf *tb, unsigned int count)
+{
+    uint64_t type = TRACE_RECORD_TYPE_EVENT;
     union {
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
-    int dropped_count;
-    size_t unused __attribute__ ((unused));
+    TraceChunk chunks[] = {
+        { &type, sizeof(type) },
+        { &dropped, sizeof(dropped) },
+    };
+
+    dropped.rec.event = DROPPED_EVENT_ID;
+    dropped.rec.timestamp_ns = get_clock();
+    dropped.rec.length = sizeof(dropped);
+    dropped.rec.pid = trace_pid;
+    dropped.rec.tid = tb->tid;
+    dropped.rec.arguments[0] = count;
+    writeout_chunks(fp, shm, chunks, ARRAY_SIZE(chunks));
+}
+
+/* Write out the record at the tail of @tb and consume it */
+static void writeout_record(FILE *fp, TraceShmRing *shm, TraceThreadBuf *tb,
+                            uint32_t length)
+{
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
+    unsigned int off = tb->tail & (TRACE_BUF_LEN - 1);
+    size_t n = MIN(length, TRACE_BUF_LEN - off);
+    TraceChunk chunks[] = {
+        { &type, sizeof(type) },
+        { &tb->data[off], n },
+        { tb->data, length - n },
+    };
+
+    writeout_chunks(fp, shm, chunks, ARRAY_SIZE(chunks));
+    atomic_store_release(&tb->tail, tb->tail + length);
+}
+
+static gpointer writeout_thread(gpointer opaque)
+{
+    struct TraceThreadBufList bufs = QSLIST_HEAD_INITIALIZER(bufs);
+    struct TraceThreadBufList fresh;
+    TraceThreadBuf *tb, *prev, *next;
+    GPtrArray *active = g_ptr_array_new();
+    GArray *heads = g_array_new(FALSE, FALSE, sizeof(unsigned int));
+    FILE *fp;
+    TraceShmRing *shm;
+    unsigned int count;
+    int i;
 
     for (;;) {
-        wait_for_trace_records_available();
-
-        if (g_atomic_int_get(&dropped_events)) {
-            dropped.rec.event = DROPPED_EVENT_ID,
-            dropped.rec.timestamp_ns = get_clock();
-            dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t),
-            dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
-            dropped.rec.arguments[0] = dropped_count;
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
+        wait_for_trace_records_available(&fp, &shm);
+
+        /* Take over rings registered since the last round */
+        QSLIST_MOVE_ATOMIC(&fresh, &trace_new_bufs);
+        while (!QSLIST_EMPTY(&fresh)) {
+            tb = QSLIST_FIRST(&fresh);
+            QSLIST_REMOVE_HEAD(&fresh, node);
+            QSLIST_INSERT_HEAD(&bufs, tb, node);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
-            unused = fwrite(&type, sizeof(type), 1, trace_fp);
-            unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
-            free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
+        /*
+         * Snapshot each ring's head; records published after this point are
+         * left for the next round so that the merge below terminates.
+         */
+        g_ptr_array_set_size(active, 0);
+        g_array_set_size(heads, 0);
+        QSLIST_FOREACH(tb, &bufs, node) {
+            unsigned int head = atomic_load_acquire(&tb->head);
+
+            count = atomic_xchg(&tb->dropped, 0);
+            if (count) {
+                writeout_dropped(fp, shm, tb, count);
+            }
+            if (head != tb->tail) {
+                g_ptr_array_add(active, tb);
+                g_array_append_val(heads, head);
+            }
         }
 
-        fflush(trace_fp);
+        /* Merge the records from all rings in timestamp order */
+        while (active->len) {
+            TraceRecord record;
+            uint64_t oldest_ns = 0;
+            uint32_t oldest_len = 0;
+            int oldest_idx = -1;
+
+            for (i = 0; i < active->len; i++) {
+                tb = g_ptr_array_index(active, i);
+                read_from_buffer(tb, tb->tail, &record, sizeof(record));
+                if (oldest_idx < 0 || record.timestamp_ns < oldest_ns) {
+                    oldest_ns = record.timestamp_ns;
+                    oldest_len = record.length;
+                    oldest_idx = i;
+                }
+            }
+
+            tb = g_ptr_array_index(active, oldest_idx);
+            writeout_record(fp, shm, tb, oldest_len);
+            if (tb->tail == g_array_index(heads, unsigned int, oldest_idx)) {
+                g_ptr_array_remove_index_fast(active, oldest_idx);
+                g_array_remove_index_fast(heads, oldest_idx);
+            }
+        }
+
+        /* Free the rings of threads that have exited once they are drained */
+        prev = NULL;
+        QSLIST_FOREACH_SAFE(tb, &bufs, node, next) {
+            if (atomic_load_acquire(&tb->exited) &&
+                atomic_load_acquire(&tb->head) == tb->tail &&
+                !atomic_read(&tb->dropped)) {
+                if (prev) {
+                    QSLIST_REMOVE_AFTER(prev, node);
+                } else {
+                    QSLIST_REMOVE_HEAD(&bufs, node);
+                }
+                free(tb); /* don't use g_free, can deadlock when traced */
+            } else {
+                prev = tb;
+            }
+        }
+
+        if (fp) {
+            fflush(fp);
+        }
     }
     return NULL;
 }
 
+static void trace_thread_buf_exit(Notifier *n, void *unused)
+{
+    TraceThreadBuf *tb = container_of(n, TraceThreadBuf, exit_notifier);
+
+    trace_thread_buf = NULL;
+    atomic_store_release(&tb->exited, true);
+}
+
+/* Return the calling thread's ring, allocating it on first use */
+static TraceThreadBuf *trace_thread_buf_get(void)
+{
+    TraceThreadBuf *tb = trace_thread_buf;
+
+    if (likely(tb)) {
+        return tb;
+    }
+
+    /* don't use g_malloc, can deadlock when traced */
+    tb = calloc(1, sizeof(*tb));
+    if (!tb) {
+        return NULL;
+    }
+    tb->tid = qemu_get_thread_id();
+    tb->exit_notifier.notify = trace_thread_buf_exit;
+    qemu_thread_atexit_add(&tb->exit_notifier);
+    trace_thread_buf = tb;
+    QSLIST_INSERT_HEAD_ATOMIC(&trace_new_bufs, tb, node);
+    return tb;
+}
+
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off,
+                                   &val, sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off,
+                                   &slen, sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->buf, rec->rec_off, s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
 {
-    unsigned int idx, rec_off, old_idx, new_idx;
+    TraceThreadBuf *tb = trace_thread_buf_get();
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
-    uint64_t event_u64 = event;
-    uint64_t timestamp_ns = get_clock();
-
-    do {
-        old_idx = g_atomic_int_get(&trace_idx);
-        smp_rmb();
-        new_idx = old_idx + rec_len;
-
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
-            /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
-            return -ENOSPC;
-        }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    TraceRecord record;
 
-    idx = old_idx % TRACE_BUF_LEN;
+    if (!tb) {
+        return -ENOMEM;
+    }
 
-    rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    /*
+     * An event fired from a signal handler that interrupted another event in
+     * the same thread cannot be recorded without corrupting the ring.
+     */
+    if (tb->in_record ||
+        tb->head + rec_len - atomic_read(&tb->tail) > TRACE_BUF_LEN) {
+        /* Trace Buffer Full, Event dropped ! */
+        atomic_inc(&tb->dropped);
+        return -ENOSPC;
+    }
+    tb->in_record = true;
 
-    rec->tbuf_idx = idx;
-    rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
+    record.event = event;
+    record.timestamp_ns = get_clock();
+    record.length = rec_len;
+    record.pid = trace_pid;
+    record.tid = tb->tid;
+
+    rec->buf = tb;
+    rec->tbuf_idx = tb->head;
+    rec->rec_off = write_to_buffer(tb, tb->head, &record, sizeof(record));
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceThreadBuf *tb, unsigned int idx,
+                             void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        data_ptr[x++] = trace_buf[idx++];
-    }
+    unsigned int off = idx & (TRACE_BUF_LEN - 1);
+    size_t n = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(dataptr, &tb->data[off], n);
+    memcpy((uint8_t *)dataptr + n, tb->data, size - n);
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceThreadBuf *tb, unsigned int idx,
+                                    const void *dataptr, size_t size)
 {
-    uint8_t *data_ptr = dataptr;
-    uint32_t x = 0;
-    while (x < size) {
-        if (idx >= TRACE_BUF_LEN) {
-            idx = idx % TRACE_BUF_LEN;
-        }
-        trace_buf[idx++] = data_ptr[x++];
-    }
-    return idx; /* most callers wants to know where to write next */
+    unsigned int off = idx & (TRACE_BUF_LEN - 1);
+    size_t n = MIN(size, TRACE_BUF_LEN - off);
+
+    memcpy(&tb->data[off], dataptr, n);
+    memcpy(tb->data, (const uint8_t *)dataptr + n, size - n);
+    return idx + size; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
-    TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
-    smp_wmb(); /* write barrier before marking as valid */
-    record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    TraceThreadBuf *tb = rec->buf;
+
+    /* Publish the record to the writeout thread */
+    atomic_store_release(&tb->head, rec->rec_off);
+    tb->in_record = false;
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
-        > TRACE_BUF_FLUSH_THRESHOLD) {
+    if (rec->rec_off - atomic_read(&tb->tail) > TRACE_BUF_FLUSH_THRESHOLD &&
+        !atomic_read(&trace_available)) {
         flush_trace_file(false);
     }
 }
@@ -301,6 +527,36 @@ static int st_write_event_mapping(void)
     return 0;
 }
 
+#ifndef _WIN32
+static bool st_write_shm_header(TraceShmRing *shm)
+{
+    uint64_t type = TRACE_RECORD_TYPE_MAPPING;
+    TraceChunk header = { &trace_log_header, sizeof(trace_log_header) };
+    TraceEventIter iter;
+    TraceEvent *ev;
+
+    writeout_chunks(NULL, shm, &header, 1);
+
+    trace_event_iter_init(&iter, NULL);
+    while ((ev = trace_event_iter_next(&iter)) != NULL) {
+        uint64_t id = trace_event_get_id(ev);
+        const char *name = trace_event_get_name(ev);
+        uint32_t len = strlen(name);
+        TraceChunk chunks[] = {
+            { &type, sizeof(type) },
+            { &id, sizeof(id) },
+            { &len, sizeof(len) },
+            { name, len },
+        };
+
+        writeout_chunks(NULL, shm, chunks, ARRAY_SIZE(chunks));
+    }
+
+    /* The collector cannot parse the stream without the complete mapping */
+    return trace_shm_dropped == 0;
+}
+#endif
+
 void st_set_trace_file_enabled(bool enable)
 {
     if (enable == !!trace_fp) {
@@ -313,19 +569,13 @@ void st_set_trace_file_enabled(bool enable)
     flush_trace_file(true);
 
     if (enable) {
-        static const TraceLogHeader header = {
-            .header_event_id = HEADER_EVENT_ID,
-            .header_magic = HEADER_MAGIC,
-            /* Older log readers will check for version at next location */
-            .header_version = HEADER_VERSION,
-        };
-
         trace_fp = fopen(trace_file_name, "wb");
         if (!trace_fp) {
             return;
         }
 
-        if (fwrite(&header, sizeof header, 1, trace_fp) != 1 ||
+        if (fwrite(&trace_log_header, sizeof trace_log_header, 1,
+                   trace_fp) != 1 ||
             st_write_event_mapping() < 0) {
             fclose(trace_fp);
             trace_fp = NULL;
@@ -363,10 +613,79 @@ void st_set_trace_file(const char *file)
     st_set_trace_file_enabled(true);
 }
 
+/**
+ * Export trace records through a shared memory ring
+ *
+ * @name        POSIX shared memory object name
+ * @errp        Error object
+ *
+ * The ring stays in place until QEMU exits, records are written to it in
+ * addition to the trace file.
+ */
+void st_set_trace_shm(const char *name, Error **errp)
+{
+#ifdef _WIN32
+    error_setg(errp, "shared memory trace ring not supported on this host");
+#else
+    char *path;
+    TraceShmRing *shm;
+    size_t size = sizeof(*shm) + TRACE_SHM_LEN;
+    int fd;
+
+    if (trace_shm) {
+        error_setg(errp, "shared memory trace ring already set up");
+        return;
+    }
+
+    path = g_strdup_printf("%s%s", name[0] == '/' ? "" : "/", name);
+    fd = shm_open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "cannot create shared memory '%s'",
+                         path);
+        g_free(path);
+        return;
+    }
+    if (ftruncate(fd, size) < 0) {
+        error_setg_errno(errp, errno, "cannot resize shared memory '%s'",
+                         path);
+        goto out;
+    }
+    shm = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (shm == MAP_FAILED) {
+        error_setg_errno(errp, errno, "cannot map shared memory '%s'", path);
+        goto out;
+    }
+
+    shm->size = TRACE_SHM_LEN;
+    if (!st_write_shm_header(shm)) {
+        error_setg(errp, "trace event mapping does not fit in '%s'", path);
+        munmap(shm, size);
+        goto out;
+    }
+    smp_wmb(); /* the collector checks the magic last */
+    shm->version = HEADER_VERSION;
+    atomic_set(&shm->magic, SHM_MAGIC);
+
+    g_mutex_lock(&trace_lock);
+    trace_shm = shm;
+    g_mutex_unlock(&trace_lock);
+
+out:
+    close(fd);
+    g_free(path);
+#endif
+}
+
 void st_print_trace_file_status(FILE *stream, int (*stream_printf)(FILE *stream, const char *fmt, ...))
 {
     stream_printf(stream, "Trace file \"%s\" %s.\n",
                   trace_file_name, trace_fp ? "on" : "off");
+    if (trace_shm) {
+        stream_printf(stream, "Trace shared memory ring %u/%u bytes used.\n",
+                      atomic_read(&trace_shm->head) -
+                      atomic_read(&trace_shm->tail),
+                      trace_shm->size);
+    }
 }
 
 void st_flush_trace_buffer(void)
@@ -14,10 +14,14 @@
 void st_print_trace_file_status(FILE *stream, fprintf_function stream_printf);
 void st_set_trace_file_enabled(bool enable);
 void st_set_trace_file(const char *file);
+void st_set_trace_shm(const char *name, Error **errp);
 bool st_init(void);
 void st_flush_trace_buffer(void);
 
+typedef struct TraceThreadBuf TraceThreadBuf;
+
 typedef struct {
+    TraceThreadBuf *buf;
     unsigned int tbuf_idx;
     unsigned int rec_off;
 } TraceBufferRecord;
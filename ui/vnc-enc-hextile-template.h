@@ -13,8 +13,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
                                              void *last_fg_,
                                              int *has_bg, int *has_fg)
 {
-    VncDisplay *vd = vs->vd;
-    uint8_t *row = vnc_server_fb_ptr(vd, x, y);
+    uint8_t *row = vnc_server_fb_ptr(vs, x, y);
     pixel_t *irow = (pixel_t *)row;
     int j, i;
     pixel_t *last_bg = (pixel_t *)last_bg_;
@@ -58,7 +57,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
 	}
 	if (n_colors > 2)
 	    break;
-	irow += vnc_server_fb_stride(vd) / sizeof(pixel_t);
+	irow += vnc_server_fb_stride(vs) / sizeof(pixel_t);
     }
 
     if (n_colors > 1 && fg_count > bg_count) {
@@ -106,7 +105,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
 		n_data += 2;
 		n_subtiles++;
 	    }
-	    irow += vnc_server_fb_stride(vd) / sizeof(pixel_t);
+	    irow += vnc_server_fb_stride(vs) / sizeof(pixel_t);
 	}
 	break;
     case 3:
@@ -162,7 +161,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
 		n_data += 2;
 		n_subtiles++;
 	    }
-	    irow += vnc_server_fb_stride(vd) / sizeof(pixel_t);
+	    irow += vnc_server_fb_stride(vs) / sizeof(pixel_t);
 	}
 
 	/* A SubrectsColoured subtile invalidates the foreground color */
@@ -200,7 +199,7 @@ static void CONCAT(send_hextile_tile_, NAME)(VncState *vs,
     } else {
 	for (j = 0; j < h; j++) {
 	    vs->write_pixels(vs, row, w * 4);
-	    row += vnc_server_fb_stride(vd);
+	    row += vnc_server_fb_stride(vs);
 	}
     }
 }
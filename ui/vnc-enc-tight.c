@@ -48,6 +48,10 @@
 #include "vnc-enc-tight.h"
 #include "vnc-palette.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* Compression level stuff. The following array contains various
    encoder parameters for each of 10 compression levels (0..9).
    Last three parameters correspond to JPEG quality levels (0..9). */
@@ -339,6 +343,53 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
     return (errors < tight_conf[compression].gradient_threshold);
 }
 
+/*
+ * Return the number of pixels at the start of data that are equal to c.
+ * Long runs of a single color are the common case for desktop content,
+ * so compare a whole vector of pixels at a time where possible.
+ */
+#ifdef __SSE2__
+#define DEFINE_RUN_LENGTH_FUNCTION(bpp)                                 \
+                                                                        \
+    static size_t                                                       \
+    tight_run_length##bpp(const uint##bpp##_t *data, size_t count,      \
+                          uint##bpp##_t c) {                            \
+        const size_t n = sizeof(__m128i) / sizeof(c);                   \
+        __m128i vc = _mm_set1_epi##bpp(c);                              \
+        size_t i = 0;                                                   \
+        int mask;                                                       \
+                                                                        \
+        for (; i + n <= count; i += n) {                                \
+            __m128i v = _mm_loadu_si128((const __m128i *)(data + i));   \
+            mask = _mm_movemask_epi8(_mm_cmpeq_epi##bpp(v, vc));        \
+            if (mask != 0xffff) {                                       \
+                return i + ctz32(~mask) / sizeof(c);                    \
+            }                                                           \
+        }                                                               \
+        while (i < count && data[i] == c) {                             \
+            i++;                                                        \
+        }                                                               \
+        return i;                                                       \
+    }
+#else
+#define DEFINE_RUN_LENGTH_FUNCTION(bpp)                                 \
+                                                                        \
+    static size_t                                                       \
+    tight_run_length##bpp(const uint##bpp##_t *data, size_t count,      \
+                          uint##bpp##_t c) {                            \
+        size_t i = 0;                                                   \
+                                                                        \
+        while (i < count && data[i] == c) {                             \
+            i++;                                                        \
+        }                                                               \
+        return i;                                                       \
+    }
+#endif
+
+DEFINE_RUN_LENGTH_FUNCTION(8)
+DEFINE_RUN_LENGTH_FUNCTION(16)
+DEFINE_RUN_LENGTH_FUNCTION(32)
+
 /*
  * Code to determine how many different colors used in rectangle.
  */
@@ -356,9 +407,7 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
         data = (uint##bpp##_t *)vs->tight.tight.buffer;                 \
                                                                         \
         c0 = data[0];                                                   \
-        i = 1;                                                          \
-        while (i < count && data[i] == c0)                              \
-            i++;                                                        \
+        i = 1 + tight_run_length##bpp(data + 1, count - 1, c0);         \
         if (i >= count) {                                               \
             *bg = *fg = c0;                                             \
             return 1;                                                   \
@@ -401,13 +450,13 @@ tight_detect_smooth_image(VncState *vs, int w, int h)
         palette_put(palette, ci);                                       \
                                                                         \
         for (i++; i < count; i++) {                                     \
-            if (data[i] == ci) {                                        \
-                continue;                                               \
-            } else {                                                    \
-                ci = data[i];                                           \
-                if (!palette_put(palette, (uint32_t)ci)) {              \
-                    return 0;                                           \
-                }                                                       \
+            i += tight_run_length##bpp(data + i, count - i, ci);        \
+            if (i >= count) {                                           \
+                break;                                                  \
+            }                                                           \
+            ci = data[i];                                               \
+            if (!palette_put(palette, (uint32_t)ci)) {                  \
+                return 0;                                               \
             }                                                           \
         }                                                               \
                                                                         \
@@ -547,6 +596,65 @@ DEFINE_MONO_ENCODE_FUNCTION(32)
  * Color components assumed to be byte-aligned.
  */
 
+#ifdef __SSE2__
+/*
+ * SSE2 version of the 24-bit gradient filter, for byte aligned color
+ * components.  Four pixels are handled at a time: the prediction is
+ * computed on 16-bit lanes and clamped to 0..255 by the saturating pack.
+ * Rows are copied to the gradient buffer first, because the filtered
+ * output overwrites buf in place; slot 0 of each row is the zero pixel
+ * on the left of the rectangle.
+ */
+static void
+tight_filter_gradient24_sse2(VncState *vs, uint8_t *buf, int w, int h,
+                             const int *shift)
+{
+    const __m128i zero = _mm_setzero_si128();
+    int stride = QEMU_ALIGN_UP(w, 4) + 4;
+    uint32_t *buf32 = (uint32_t *)buf;
+    uint32_t *upper_row, *here_row, *tmp;
+    uint32_t diff[4];
+    int x, y, c, i, n;
+
+    upper_row = (uint32_t *)vs->tight.gradient.buffer;
+    here_row = upper_row + stride;
+    memset(upper_row, 0, 2 * stride * sizeof(uint32_t));
+
+    for (y = 0; y < h; y++) {
+        memcpy(here_row + 1, buf32, w * sizeof(uint32_t));
+        buf32 += w;
+
+        for (x = 0; x < w; x += 4) {
+            __m128i here = _mm_loadu_si128((__m128i *)(here_row + x + 1));
+            __m128i left = _mm_loadu_si128((__m128i *)(here_row + x));
+            __m128i upper = _mm_loadu_si128((__m128i *)(upper_row + x + 1));
+            __m128i upperleft = _mm_loadu_si128((__m128i *)(upper_row + x));
+            __m128i lo, hi;
+
+            lo = _mm_add_epi16(_mm_unpacklo_epi8(left, zero),
+                               _mm_unpacklo_epi8(upper, zero));
+            lo = _mm_sub_epi16(lo, _mm_unpacklo_epi8(upperleft, zero));
+            hi = _mm_add_epi16(_mm_unpackhi_epi8(left, zero),
+                               _mm_unpackhi_epi8(upper, zero));
+            hi = _mm_sub_epi16(hi, _mm_unpackhi_epi8(upperleft, zero));
+            _mm_storeu_si128((__m128i *)diff,
+                             _mm_sub_epi8(here, _mm_packus_epi16(lo, hi)));
+
+            n = MIN(4, w - x);
+            for (i = 0; i < n; i++) {
+                for (c = 0; c < 3; c++) {
+                    *buf++ = diff[i] >> shift[c];
+                }
+            }
+        }
+
+        tmp = upper_row;
+        upper_row = here_row;
+        here_row = tmp;
+    }
+}
+#endif
+
 static void
 tight_filter_gradient24(VncState *vs, uint8_t *buf, int w, int h)
 {
@@ -558,9 +666,6 @@ tight_filter_gradient24(VncState *vs, uint8_t *buf, int w, int h)
     int prediction;
     int x, y, c;
 
-    buf32 = (uint32_t *)buf;
-    memset(vs->tight.gradient.buffer, 0, w * 3 * sizeof(int));
-
     if (1 /* FIXME */) {
         shift[0] = vs->client_pf.rshift;
         shift[1] = vs->client_pf.gshift;
@@ -571,6 +676,16 @@ tight_filter_gradient24(VncState *vs, uint8_t *buf, int w, int h)
         shift[2] = 24 - vs->client_pf.bshift;
     }
 
+#ifdef __SSE2__
+    if (!(shift[0] % 8) && !(shift[1] % 8) && !(shift[2] % 8)) {
+        tight_filter_gradient24_sse2(vs, buf, w, h, shift);
+        return;
+    }
+#endif
+
+    buf32 = (uint32_t *)buf;
+    memset(vs->tight.gradient.buffer, 0, w * 3 * sizeof(int));
+
     for (y = 0; y < h; y++) {
         for (c = 0; c < 3; c++) {
             upper[c] = 0;
@@ -677,12 +792,11 @@ static bool
 check_solid_tile32(VncState *vs, int x, int y, int w, int h,
                    uint32_t *color, bool samecolor)
 {
-    VncDisplay *vd = vs->vd;
     uint32_t *fbptr;
     uint32_t c;
     int dx, dy;
 
-    fbptr = vnc_server_fb_ptr(vd, x, y);
+    fbptr = vnc_server_fb_ptr(vs, x, y);
 
     c = *fbptr;
     if (samecolor && (uint32_t)c != *color) {
@@ -696,7 +810,7 @@ check_solid_tile32(VncState *vs, int x, int y, int w, int h,
             }
         }
         fbptr = (uint32_t *)
-            ((uint8_t *)fbptr + vnc_server_fb_stride(vd));
+            ((uint8_t *)fbptr + vnc_server_fb_stride(vs));
     }
 
     *color = (uint32_t)c;
@@ -1050,7 +1164,8 @@ static bool send_gradient_rect(VncState *vs, int x, int y, int w, int h)
     vnc_write_u8(vs, (stream | VNC_TIGHT_EXPLICIT_FILTER) << 4);
     vnc_write_u8(vs, VNC_TIGHT_FILTER_GRADIENT);
 
-    buffer_reserve(&vs->tight.gradient, w * 3 * sizeof (int));
+    /* leave room for the row padding of tight_filter_gradient24_sse2 */
+    buffer_reserve(&vs->tight.gradient, (w + 8) * 3 * sizeof (int));
 
     if (vs->tight.pixel24) {
         tight_filter_gradient24(vs, vs->tight.tight.buffer, w, h);
@@ -1212,7 +1327,8 @@ static int send_jpeg_rect(VncState *vs, int x, int y, int w, int h, int quality)
     buf = (uint8_t *)pixman_image_get_data(linebuf);
     row[0] = buf;
     for (dy = 0; dy < h; dy++) {
-        qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
+        qemu_pixman_linebuf_fill(linebuf, vs->fb, w,
+                                 x - vs->fb_x, y + dy - vs->fb_y);
         jpeg_write_scanlines(&cinfo, row, 1);
     }
     qemu_pixman_image_unref(linebuf);
@@ -1356,7 +1472,8 @@ static int send_png_rect(VncState *vs, int x, int y, int w, int h,
         if (color_type == PNG_COLOR_TYPE_PALETTE) {
             memcpy(buf, vs->tight.tight.buffer + (dy * w), w);
         } else {
-            qemu_pixman_linebuf_fill(linebuf, vs->vd->server, w, x, y + dy);
+            qemu_pixman_linebuf_fill(linebuf, vs->fb, w,
+                                     x - vs->fb_x, y + dy - vs->fb_y);
         }
         png_write_row(png_ptr, buf);
     }
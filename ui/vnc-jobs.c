@@ -44,30 +44,45 @@
  * - VncState::output lock: used to make sure the output buffer is not corrupted
  *                          if two threads try to write on it at the same time
  *
- * While the VNC worker thread is working, the VncDisplay global lock is held
- * to avoid screen corruption (this does not block vnc_refresh() because it
- * uses trylock()) but the output lock is not held because the thread works on
+ * Before encoding, a VNC worker thread takes the VncDisplay global lock just
+ * long enough to copy the regions of the server surface that the job covers
+ * (this does not block vnc_refresh() for long, and vnc_refresh() uses
+ * trylock() anyway).  The encoding itself works on that copy without the
+ * display lock, so several clients of the same display are encoded in
+ * parallel.  The output lock is not held either because the thread works on
  * its own output buffer.
  * When the encoding job is done, the worker thread will hold the output lock
  * and copy its output buffer in vs->output.
+ *
+ * Jobs are encoded by a pool of worker threads shared by all clients.  The
+ * encoders keep per-client state (zlib streams, lossy rectangles...) and the
+ * updates must reach the client in order, so a job is only handed to a worker
+ * when it is the oldest queued job of its client; jobs of different clients
+ * are encoded in parallel.
  */
 
+/* upper limit for the number of encoding threads */
+#define VNC_WORKER_THREADS_MAX 16
+
 struct VncJobQueue {
     QemuCond cond;
     QemuMutex mutex;
-    QemuThread thread;
     bool exit;
+    int max_threads;    /* size limit of the worker pool */
+    int cur_threads;    /* number of worker threads */
+    int idle_threads;   /* number of workers waiting for a job */
     QTAILQ_HEAD(, VncJob) jobs;
 };
 
 typedef struct VncJobQueue VncJobQueue;
 
 /*
- * We use a single global queue, but most of the functions are
- * already reentrant, so we can easily add more than one encoding thread
+ * We use a single global queue, served by all the encoding threads
  */
 static VncJobQueue *queue;
 
+static void vnc_spawn_worker_thread(VncJobQueue *queue);
+
 static void vnc_lock_queue(VncJobQueue *queue)
 {
     qemu_mutex_lock(&queue->mutex);
@@ -111,6 +126,9 @@ void vnc_job_push(VncJob *job)
         g_free(job);
     } else {
         QTAILQ_INSERT_TAIL(&queue->jobs, job, next);
+        if (!queue->idle_threads && queue->cur_threads < queue->max_threads) {
+            vnc_spawn_worker_thread(queue);
+        }
         qemu_cond_broadcast(&queue->cond);
     }
     vnc_unlock_queue(queue);
@@ -183,6 +201,69 @@ static void vnc_async_encoding_start(VncState *orig, VncState *local)
     local->zrle = orig->zrle;
 }
 
+/*
+ * Copy the bounding box of the job's rectangles out of the server surface,
+ * so that they can be encoded without holding the display lock.  *fb
+ * belongs to the worker thread; it is reused across jobs and only grows.
+ */
+static void vnc_async_copy_fb(VncJob *job, VncState *local,
+                              pixman_image_t **fb)
+{
+    VncDisplay *vd = job->vs->vd;
+    VncRectEntry *entry;
+    int x1 = INT_MAX, y1 = INT_MAX, x2 = 0, y2 = 0;
+    int width, height;
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        x1 = MIN(x1, entry->rect.x);
+        y1 = MIN(y1, entry->rect.y);
+        x2 = MAX(x2, entry->rect.x + entry->rect.w);
+        y2 = MAX(y2, entry->rect.y + entry->rect.h);
+    }
+
+    width = x2 - x1;
+    height = y2 - y1;
+
+    vnc_lock_display(vd);
+
+    /*
+     * Keep the copy from earlier jobs if the rectangles fit, but never let
+     * it be larger than the current surface, so that it shrinks after the
+     * display was resized to a smaller mode.
+     */
+    if (*fb) {
+        int surface_width = pixman_image_get_width(vd->server);
+        int surface_height = pixman_image_get_height(vd->server);
+        int fb_width = pixman_image_get_width(*fb);
+        int fb_height = pixman_image_get_height(*fb);
+
+        if (fb_width < width || fb_height < height ||
+            fb_width > surface_width || fb_height > surface_height) {
+            /* Grow, but only as far as the surface is large */
+            width = MAX(width, MIN(fb_width, surface_width));
+            height = MAX(height, MIN(fb_height, surface_height));
+            qemu_pixman_image_unref(*fb);
+            *fb = NULL;
+        }
+    }
+    if (!*fb) {
+        *fb = pixman_image_create_bits(VNC_SERVER_FB_FORMAT, width, height,
+                                       NULL, 0);
+    }
+
+    QLIST_FOREACH(entry, &job->rectangles, next) {
+        pixman_image_composite(PIXMAN_OP_SRC, vd->server, NULL, *fb,
+                               entry->rect.x, entry->rect.y, 0, 0,
+                               entry->rect.x - x1, entry->rect.y - y1,
+                               entry->rect.w, entry->rect.h);
+    }
+    vnc_unlock_display(vd);
+
+    local->fb = *fb;
+    local->fb_x = x1;
+    local->fb_y = y1;
+}
+
 static void vnc_async_encoding_end(VncState *orig, VncState *local)
 {
     orig->tight = local->tight;
@@ -192,7 +273,33 @@ static void vnc_async_encoding_end(VncState *orig, VncState *local)
     orig->lossy_rect = local->lossy_rect;
 }
 
-static int vnc_worker_thread_loop(VncJobQueue *queue)
+/*
+ * Return the oldest job that can be encoded now, i.e. that is not being
+ * encoded already and that has no older job of the same client in front
+ * of it.
+ */
+static VncJob *vnc_queue_next_job_locked(VncJobQueue *queue)
+{
+    VncJob *job, *prev;
+
+    QTAILQ_FOREACH(job, &queue->jobs, next) {
+        if (job->running) {
+            continue;
+        }
+        for (prev = QTAILQ_FIRST(&queue->jobs); prev != job;
+             prev = QTAILQ_NEXT(prev, next)) {
+            if (prev->vs == job->vs) {
+                break;
+            }
+        }
+        if (prev == job) {
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static int vnc_worker_thread_loop(VncJobQueue *queue, pixman_image_t **fb)
 {
     VncJob *job;
     VncRectEntry *entry, *tmp;
@@ -201,16 +308,18 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     int saved_offset;
 
     vnc_lock_queue(queue);
-    while (QTAILQ_EMPTY(&queue->jobs) && !queue->exit) {
+    queue->idle_threads++;
+    while (!(job = vnc_queue_next_job_locked(queue)) && !queue->exit) {
         qemu_cond_wait(&queue->cond, &queue->mutex);
     }
+    queue->idle_threads--;
     /* Here job can only be NULL if queue->exit is true */
-    job = QTAILQ_FIRST(&queue->jobs);
-    vnc_unlock_queue(queue);
-
     if (queue->exit) {
+        vnc_unlock_queue(queue);
         return -1;
     }
+    job->running = true;
+    vnc_unlock_queue(queue);
 
     vnc_lock_output(job->vs);
     if (job->vs->ioc == NULL || job->vs->abort == true) {
@@ -229,6 +338,7 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
 
     /* Make a local copy of vs and switch output buffers */
     vnc_async_encoding_start(job->vs, &vs);
+    vnc_async_copy_fb(job, &vs, fb);
 
     /* Start sending rectangles */
     n_rectangles = 0;
@@ -237,12 +347,10 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
     saved_offset = vs.output.offset;
     vnc_write_u16(&vs, 0);
 
-    vnc_lock_display(job->vs->vd);
     QLIST_FOREACH_SAFE(entry, &job->rectangles, next, tmp) {
         int n;
 
         if (job->vs->ioc == NULL) {
-            vnc_unlock_display(job->vs->vd);
             /* Copy persistent encoding data */
             vnc_async_encoding_end(job->vs, &vs);
             goto disconnected;
@@ -256,7 +364,6 @@ static int vnc_worker_thread_loop(VncJobQueue *queue)
         }
         g_free(entry);
     }
-    vnc_unlock_display(job->vs->vd);
 
     /* Put n_rectangles at the beginning of the message */
     vs.output.buffer[saved_offset] = (n_rectangles >> 8) & 0xFF;
@@ -288,10 +395,12 @@ disconnected:
 static VncJobQueue *vnc_queue_init(void)
 {
     VncJobQueue *queue = g_new0(VncJobQueue, 1);
+    long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
 
     qemu_cond_init(&queue->cond);
     qemu_mutex_init(&queue->mutex);
     QTAILQ_INIT(&queue->jobs);
+    queue->max_threads = MAX(1, MIN(host_procs, VNC_WORKER_THREADS_MAX));
     return queue;
 }
 
@@ -306,14 +415,32 @@ static void vnc_queue_clear(VncJobQueue *q)
 static void *vnc_worker_thread(void *arg)
 {
     VncJobQueue *queue = arg;
+    pixman_image_t *fb = NULL;
+    bool last;
 
-    qemu_thread_get_self(&queue->thread);
+    while (!vnc_worker_thread_loop(queue, &fb)) ;
 
-    while (!vnc_worker_thread_loop(queue)) ;
-    vnc_queue_clear(queue);
+    qemu_pixman_image_unref(fb);
+
+    vnc_lock_queue(queue);
+    last = --queue->cur_threads == 0;
+    vnc_unlock_queue(queue);
+    if (last) {
+        vnc_queue_clear(queue);
+    }
     return NULL;
 }
 
+/* Called with the queue lock held */
+static void vnc_spawn_worker_thread(VncJobQueue *queue)
+{
+    QemuThread thread;
+
+    queue->cur_threads++;
+    qemu_thread_create(&thread, "vnc_worker", vnc_worker_thread, queue,
+                       QEMU_THREAD_DETACHED);
+}
+
 static bool vnc_worker_thread_running(void)
 {
     return queue; /* Check global queue */
@@ -327,7 +454,8 @@ void vnc_start_worker_thread(void)
         return ;
 
     q = vnc_queue_init();
-    qemu_thread_create(&q->thread, "vnc_worker", vnc_worker_thread, q,
-                       QEMU_THREAD_DETACHED);
+    vnc_lock_queue(q);
+    vnc_spawn_worker_thread(q);
+    vnc_unlock_queue(q);
     queue = q; /* Set global queue */
 }
@@ -55,6 +55,10 @@ static const struct timeval VNC_REFRESH_LOSSY = { 2, 0 };
 #include "vnc_keysym.h"
 #include "crypto/cipher.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static QTAILQ_HEAD(, VncDisplay) vnc_displays =
     QTAILQ_HEAD_INITIALIZER(vnc_displays);
 
@@ -702,18 +706,18 @@ static void vnc_abort_display_jobs(VncDisplay *vd)
     }
 }
 
-int vnc_server_fb_stride(VncDisplay *vd)
+int vnc_server_fb_stride(VncState *vs)
 {
-    return pixman_image_get_stride(vd->server);
+    return pixman_image_get_stride(vs->fb);
 }
 
-void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y)
+void *vnc_server_fb_ptr(VncState *vs, int x, int y)
 {
     uint8_t *ptr;
 
-    ptr  = (uint8_t *)pixman_image_get_data(vd->server);
-    ptr += y * vnc_server_fb_stride(vd);
-    ptr += x * VNC_SERVER_FB_BYTES;
+    ptr  = (uint8_t *)pixman_image_get_data(vs->fb);
+    ptr += (y - vs->fb_y) * vnc_server_fb_stride(vs);
+    ptr += (x - vs->fb_x) * VNC_SERVER_FB_BYTES;
     return ptr;
 }
 
@@ -821,6 +825,54 @@ void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v)
     }
 }
 
+/*
+ * Convert n server pixels to a 32 bits per pixel client format.  Same as
+ * vnc_convert_pixel, but the SSE2 version does four pixels at a time.
+ */
+static void vnc_convert_pixels32(VncState *vs, uint32_t *dst,
+                                 const uint32_t *src, int n)
+{
+    int i = 0;
+
+#if VNC_SERVER_FB_FORMAT != PIXMAN_FORMAT(32, PIXMAN_TYPE_ARGB, 0, 8, 8, 8)
+# error need some bits here if you change VNC_SERVER_FB_FORMAT
+#endif
+#ifdef __SSE2__
+    if (vs->client_pf.rbits <= 8 && vs->client_pf.gbits <= 8 &&
+        vs->client_pf.bbits <= 8) {
+        const __m128i mask = _mm_set1_epi32(0xff);
+        const __m128i rbits = _mm_cvtsi32_si128(8 - vs->client_pf.rbits);
+        const __m128i gbits = _mm_cvtsi32_si128(8 - vs->client_pf.gbits);
+        const __m128i bbits = _mm_cvtsi32_si128(8 - vs->client_pf.bbits);
+        const __m128i rshift = _mm_cvtsi32_si128(vs->client_pf.rshift);
+        const __m128i gshift = _mm_cvtsi32_si128(vs->client_pf.gshift);
+        const __m128i bshift = _mm_cvtsi32_si128(vs->client_pf.bshift);
+
+        for (; i + 4 <= n; i += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(src + i));
+            __m128i r, g, b, v;
+
+            r = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+            g = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+            b = _mm_and_si128(p, mask);
+            r = _mm_sll_epi32(_mm_srl_epi32(r, rbits), rshift);
+            g = _mm_sll_epi32(_mm_srl_epi32(g, gbits), gshift);
+            b = _mm_sll_epi32(_mm_srl_epi32(b, bbits), bshift);
+            v = _mm_or_si128(_mm_or_si128(r, g), b);
+            if (vs->client_be) {
+                /* swap the bytes of each 16-bit word, then the words */
+                v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+                v = _mm_shufflelo_epi16(_mm_shufflehi_epi16(v, 0xb1), 0xb1);
+            }
+            _mm_storeu_si128((__m128i *)(dst + i), v);
+        }
+    }
+#endif
+    for (; i < n; i++) {
+        vnc_convert_pixel(vs, (uint8_t *)(dst + i), src[i]);
+    }
+}
+
 static void vnc_write_pixels_generic(VncState *vs,
                                      void *pixels1, int size)
 {
@@ -830,6 +882,18 @@ static void vnc_write_pixels_generic(VncState *vs,
         uint32_t *pixels = pixels1;
         int n, i;
         n = size >> 2;
+        if (vs->client_pf.bytes_per_pixel == 4) {
+            /* convert in chunks, instead of one vnc_write per pixel */
+            uint32_t converted[256];
+            int chunk;
+
+            for (i = 0; i < n; i += chunk) {
+                chunk = MIN(n - i, ARRAY_SIZE(converted));
+                vnc_convert_pixels32(vs, converted, pixels + i, chunk);
+                vnc_write(vs, converted, chunk * 4);
+            }
+            return;
+        }
         for (i = 0; i < n; i++) {
             vnc_convert_pixel(vs, buf, pixels[i]);
             vnc_write(vs, buf, vs->client_pf.bytes_per_pixel);
@@ -841,12 +905,11 @@ int vnc_raw_send_framebuffer_update(VncState *vs, int x, int y, int w, int h)
 {
     int i;
     uint8_t *row;
-    VncDisplay *vd = vs->vd;
 
-    row = vnc_server_fb_ptr(vd, x, y);
+    row = vnc_server_fb_ptr(vs, x, y);
     for (i = 0; i < h; i++) {
         vs->write_pixels(vs, row, w * VNC_SERVER_FB_BYTES);
-        row += vnc_server_fb_stride(vd);
+        row += vnc_server_fb_stride(vs);
     }
     return 1;
 }
@@ -2720,12 +2783,15 @@ double vnc_update_freq(VncState *vs, int x, int y, int w, int h)
     x =  QEMU_ALIGN_DOWN(x, VNC_STAT_RECT);
     y =  QEMU_ALIGN_DOWN(y, VNC_STAT_RECT);
 
+    /* Called by the encoding threads, the stats are updated by vnc_refresh */
+    vnc_lock_display(vs->vd);
     for (j = y; j <= y + h; j += VNC_STAT_RECT) {
         for (i = x; i <= x + w; i += VNC_STAT_RECT) {
             total += vnc_stat_rect(vs->vd, i, j)->freq;
             num++;
         }
     }
+    vnc_unlock_display(vs->vd);
 
     if (num) {
         return total / num;
@@ -2821,10 +2887,9 @@ static int vnc_refresh_server_surface(VncDisplay *vd)
                 _cmp_bytes = line_bytes - x * cmp_bytes;
             }
             assert(_cmp_bytes >= 0);
-            if (memcmp(server_ptr, guest_ptr, _cmp_bytes) == 0) {
+            if (!buffer_cmpcpy(server_ptr, guest_ptr, _cmp_bytes)) {
                 continue;
             }
-            memcpy(server_ptr, guest_ptr, _cmp_bytes);
             if (!vd->non_adaptive) {
                 vnc_rect_updated(vd, x * VNC_DIRTY_PIXELS_PER_BIT,
                                  y, &tv);
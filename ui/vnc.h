@@ -247,6 +247,7 @@ struct VncRectEntry
 struct VncJob
 {
     VncState *vs;
+    bool running;   /* picked up by an encoding thread */
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
@@ -314,6 +315,13 @@ struct VncState
     QEMUBH *bh;
     Buffer jobs_buffer;
 
+    /* Worker copy of the server surface regions being encoded; its
+     * top-left corner is at (fb_x, fb_y) in the server surface.
+     */
+    pixman_image_t *fb;
+    int fb_x;
+    int fb_y;
+
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
      */
@@ -547,8 +555,8 @@ void vnc_framebuffer_update(VncState *vs, int x, int y, int w, int h,
 #define VNC_SERVER_FB_BITS   (PIXMAN_FORMAT_BPP(VNC_SERVER_FB_FORMAT))
 #define VNC_SERVER_FB_BYTES  ((VNC_SERVER_FB_BITS+7)/8)
 
-void *vnc_server_fb_ptr(VncDisplay *vd, int x, int y);
-int vnc_server_fb_stride(VncDisplay *vd);
+void *vnc_server_fb_ptr(VncState *vs, int x, int y);
+int vnc_server_fb_stride(VncState *vs);
 
 void vnc_convert_pixel(VncState *vs, uint8_t *buf, uint32_t v);
 double vnc_update_freq(VncState *vs, int x, int y, int w, int h);
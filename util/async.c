@@ -279,6 +279,7 @@ aio_ctx_finalize(GSource     *source)
 
     assert(QSLIST_EMPTY(&ctx->scheduled_coroutines));
     qemu_bh_delete(ctx->co_schedule_bh);
+    qemu_coroutine_pool_unref(ctx->co_pool);
 
     qemu_lockcnt_lock(&ctx->list_lock);
     assert(!qemu_lockcnt_count(&ctx->list_lock));
@@ -295,6 +296,7 @@ aio_ctx_finalize(GSource     *source)
 
     aio_set_event_notifier(ctx, &ctx->notifier, false, NULL, NULL);
     event_notifier_cleanup(&ctx->notifier);
+    aio_context_destroy(ctx);
     qemu_rec_mutex_destroy(&ctx->lock);
     qemu_lockcnt_destroy(&ctx->list_lock);
     timerlistgroup_deinit(&ctx->tlg);
@@ -321,6 +323,12 @@ ThreadPool *aio_get_thread_pool(AioContext *ctx)
     return ctx->thread_pool;
 }
 
+void aio_context_set_coroutine_stack_size(AioContext *ctx, size_t stack_size,
+                                          Error **errp)
+{
+    qemu_coroutine_pool_set_stack_size(ctx->co_pool, stack_size, errp);
+}
+
 #ifdef CONFIG_LINUX_AIO
 LinuxAioState *aio_get_linux_aio(AioContext *ctx)
 {
@@ -414,6 +422,7 @@ AioContext *aio_context_new(Error **errp)
 
     ctx->co_schedule_bh = aio_bh_new(ctx, co_schedule_bh_cb, ctx);
     QSLIST_INIT(&ctx->scheduled_coroutines);
+    ctx->co_pool = qemu_coroutine_pool_new();
 
     aio_set_event_notifier(ctx, &ctx->notifier,
                            false,
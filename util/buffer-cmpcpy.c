@@ -0,0 +1,207 @@
+/*
+ * Compare-and-copy of memory buffers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "qemu/cutils.h"
+#include "qemu/bswap.h"
+#include "qemu/cpuinfo.h"
+
+/*
+ * All the implementations look for the first block that differs, and copy
+ * from there to the end of the buffer.  The common case for framebuffers
+ * is that nothing changed, so the compare loop is what matters.
+ */
+
+static bool
+buffer_cmpcpy_int(void *dst, const void *src, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        if (ldq_he_p(dst + i) != ldq_he_p(src + i)) {
+            goto differ;
+        }
+    }
+    for (; i < len; i++) {
+        if (((uint8_t *)dst)[i] != ((const uint8_t *)src)[i]) {
+            goto differ;
+        }
+    }
+    return false;
+
+differ:
+    memcpy(dst + i, src + i, len - i);
+    return true;
+}
+
+#if defined(CONFIG_AVX2_OPT) || defined(__SSE2__)
+/* Do not use push_options pragmas unnecessarily, because clang
+ * does not support them.
+ */
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#endif
+#include <emmintrin.h>
+
+static bool
+buffer_cmpcpy_sse2(void *dst, const void *src, size_t len)
+{
+    size_t i;
+
+    /* Loop over unaligned blocks of 64.  */
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m128i t0 = _mm_cmpeq_epi8(_mm_loadu_si128(dst + i),
+                                    _mm_loadu_si128(src + i));
+        __m128i t1 = _mm_cmpeq_epi8(_mm_loadu_si128(dst + i + 16),
+                                    _mm_loadu_si128(src + i + 16));
+        __m128i t2 = _mm_cmpeq_epi8(_mm_loadu_si128(dst + i + 32),
+                                    _mm_loadu_si128(src + i + 32));
+        __m128i t3 = _mm_cmpeq_epi8(_mm_loadu_si128(dst + i + 48),
+                                    _mm_loadu_si128(src + i + 48));
+
+        __builtin_prefetch(src + i + 64);
+        t0 = _mm_and_si128(_mm_and_si128(t0, t1), _mm_and_si128(t2, t3));
+        if (unlikely(_mm_movemask_epi8(t0) != 0xFFFF)) {
+            memcpy(dst + i, src + i, len - i);
+            return true;
+        }
+    }
+
+    /* Finish the tail, at most 63 bytes.  */
+    return buffer_cmpcpy_int(dst + i, src + i, len - i);
+}
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC pop_options
+#endif
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+static bool
+buffer_cmpcpy_avx2(void *dst, const void *src, size_t len)
+{
+    size_t i;
+
+    /* Loop over unaligned blocks of 64.  */
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m256i t0 = _mm256_cmpeq_epi8(_mm256_loadu_si256(dst + i),
+                                       _mm256_loadu_si256(src + i));
+        __m256i t1 = _mm256_cmpeq_epi8(_mm256_loadu_si256(dst + i + 32),
+                                       _mm256_loadu_si256(src + i + 32));
+
+        __builtin_prefetch(src + i + 64);
+        t0 = _mm256_and_si256(t0, t1);
+        if (unlikely(_mm256_movemask_epi8(t0) != -1)) {
+            memcpy(dst + i, src + i, len - i);
+            return true;
+        }
+    }
+
+    /* Finish the tail, at most 63 bytes.  */
+    return buffer_cmpcpy_int(dst + i, src + i, len - i);
+}
+#pragma GCC pop_options
+#endif /* CONFIG_AVX2_OPT */
+
+/* Note that for test_buffer_cmpcpy_next_accel, the most preferred
+ * ISA must have the least significant bit.
+ */
+#define CACHE_AVX2    1
+#define CACHE_SSE2    2
+
+/* Make sure that these variables are appropriately initialized when
+ * SSE2 is enabled on the compiler command-line, but the compiler is
+ * too old to support CONFIG_AVX2_OPT.
+ */
+#ifdef CONFIG_AVX2_OPT
+# define INIT_CACHE 0
+# define INIT_ACCEL buffer_cmpcpy_int
+#else
+# ifndef __SSE2__
+#  error "ISA selection confusion"
+# endif
+# define INIT_CACHE CACHE_SSE2
+# define INIT_ACCEL buffer_cmpcpy_sse2
+#endif
+
+static unsigned cpuid_cache = INIT_CACHE;
+static bool (*buffer_accel)(void *, const void *, size_t) = INIT_ACCEL;
+
+static void init_accel(unsigned cache)
+{
+    bool (*fn)(void *, const void *, size_t) = buffer_cmpcpy_int;
+    if (cache & CACHE_SSE2) {
+        fn = buffer_cmpcpy_sse2;
+    }
+#ifdef CONFIG_AVX2_OPT
+    if (cache & CACHE_AVX2) {
+        fn = buffer_cmpcpy_avx2;
+    }
+#endif
+    buffer_accel = fn;
+}
+
+#ifdef CONFIG_AVX2_OPT
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    unsigned info = cpuinfo_init();
+    unsigned cache = 0;
+
+    if (info & CPUINFO_SSE2) {
+        cache |= CACHE_SSE2;
+    }
+    if (info & CPUINFO_AVX2) {
+        cache |= CACHE_AVX2;
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+#endif /* CONFIG_AVX2_OPT */
+
+bool test_buffer_cmpcpy_next_accel(void)
+{
+    /* If no bits set, we just tested buffer_cmpcpy_int, and there
+       are no more acceleration options to test.  */
+    if (!cpuinfo_next_accel(&cpuid_cache)) {
+        return false;
+    }
+    /* Select the next accelerator.  */
+    init_accel(cpuid_cache);
+    return true;
+}
+
+static bool select_accel_fn(void *dst, const void *src, size_t len)
+{
+    if (likely(len >= 64)) {
+        return buffer_accel(dst, src, len);
+    }
+    return buffer_cmpcpy_int(dst, src, len);
+}
+
+#else
+#define select_accel_fn  buffer_cmpcpy_int
+bool test_buffer_cmpcpy_next_accel(void)
+{
+    return false;
+}
+#endif
+
+/*
+ * Copy len bytes from src to dst if the two buffers differ.  Returns
+ * true if they differed, in which case dst has been updated.
+ */
+bool buffer_cmpcpy(void *dst, const void *src, size_t len)
+{
+    if (unlikely(len == 0)) {
+        return false;
+    }
+
+    return select_accel_fn(dst, src, len);
+}
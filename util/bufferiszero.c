@@ -25,6 +25,7 @@
 #include "qemu-common.h"
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
+#include "qemu/cpuinfo.h"
 
 static bool
 buffer_zero_int(const void *buf, size_t len)
@@ -231,32 +232,19 @@ static void init_accel(unsigned cache)
 }
 
 #ifdef CONFIG_AVX2_OPT
-#include "qemu/cpuid.h"
-
 static void __attribute__((constructor)) init_cpuid_cache(void)
 {
-    int max = __get_cpuid_max(0, NULL);
-    int a, b, c, d;
+    unsigned info = cpuinfo_init();
     unsigned cache = 0;
 
-    if (max >= 1) {
-        __cpuid(1, a, b, c, d);
-        if (d & bit_SSE2) {
-            cache |= CACHE_SSE2;
-        }
-        if (c & bit_SSE4_1) {
-            cache |= CACHE_SSE4;
-        }
-
-        /* We must check that AVX is not just available, but usable.  */
-        if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
-            int bv;
-            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
-            __cpuid_count(7, 0, a, b, c, d);
-            if ((bv & 6) == 6 && (b & bit_AVX2)) {
-                cache |= CACHE_AVX2;
-            }
-        }
+    if (info & CPUINFO_SSE2) {
+        cache |= CACHE_SSE2;
+    }
+    if (info & CPUINFO_SSE4) {
+        cache |= CACHE_SSE4;
+    }
+    if (info & CPUINFO_AVX2) {
+        cache |= CACHE_AVX2;
     }
     cpuid_cache = cache;
     init_accel(cache);
@@ -267,11 +255,10 @@ bool test_buffer_is_zero_next_accel(void)
 {
     /* If no bits set, we just tested buffer_zero_int, and there
        are no more acceleration options to test.  */
-    if (cpuid_cache == 0) {
+    if (!cpuinfo_next_accel(&cpuid_cache)) {
         return false;
     }
-    /* Disable the accelerator we used before and select a new one.  */
-    cpuid_cache &= cpuid_cache - 1;
+    /* Select the next accelerator.  */
     init_accel(cpuid_cache);
     return true;
 }
@@ -69,9 +69,8 @@ static void CALLBACK coroutine_trampoline(void *co_)
     }
 }
 
-Coroutine *qemu_coroutine_new(void)
+Coroutine *qemu_coroutine_new(size_t stack_size)
 {
-    const size_t stack_size = COROUTINE_STACK_SIZE;
     CoroutineWin32 *co;
 
     co = g_malloc0(sizeof(*co));
@@ -79,6 +78,12 @@ Coroutine *qemu_coroutine_new(void)
     return &co->base;
 }
 
+size_t qemu_coroutine_check_stack(Coroutine *co_)
+{
+    /* Fiber stacks always have a guard page */
+    return 0;
+}
+
 void qemu_coroutine_delete(Coroutine *co_)
 {
     CoroutineWin32 *co = DO_UPCAST(CoroutineWin32, base, co_);
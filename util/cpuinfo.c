@@ -0,0 +1,60 @@
+/*
+ * cpuinfo.c - probe the host CPU features once for all users
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cpuinfo.h"
+#ifdef CONFIG_CPUID_H
+#include "qemu/cpuid.h"
+#endif
+
+unsigned cpuinfo;
+
+unsigned cpuinfo_init(void)
+{
+    unsigned info = cpuinfo;
+
+    if (info) {
+        return info;
+    }
+
+    info = CPUINFO_ALWAYS;
+#ifdef CONFIG_CPUID_H
+    {
+        int max = __get_cpuid_max(0, NULL);
+        int a, b, c, d;
+
+        if (max >= 1) {
+            __cpuid(1, a, b, c, d);
+            if (d & bit_SSE2) {
+                info |= CPUINFO_SSE2;
+            }
+            if (c & bit_SSE4_1) {
+                info |= CPUINFO_SSE4;
+            }
+            if (c & bit_AES) {
+                info |= CPUINFO_AES;
+            }
+
+            /* We must check that AVX is not just available, but usable.  */
+            if ((c & bit_OSXSAVE) && (c & bit_AVX) && max >= 7) {
+                int bv;
+                __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+                __cpuid_count(7, 0, a, b, c, d);
+                if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                    info |= CPUINFO_AVX2;
+                    if ((info & CPUINFO_AES) && (c & bit_VAES)) {
+                        info |= CPUINFO_VAES;
+                    }
+                }
+            }
+        }
+    }
+#endif
+
+    cpuinfo = info;
+    return info;
+}
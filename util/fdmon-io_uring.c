@@ -0,0 +1,568 @@
+/*
+ * Linux io_uring file descriptor monitoring
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * The Linux io_uring API supports file descriptor monitoring with a few
+ * advantages over existing APIs like poll(2) and epoll(7):
+ *
+ * 1. Userspace polling of events is possible because the completion queue (cq
+ *    ring) is shared between the kernel and userspace.  This allows
+ *    applications that rely on userspace polling to also monitor file
+ *    descriptors in the same userspace polling loop.
+ *
+ * 2. Submission and completion is batched and done together in a single system
+ *    call.  This minimizes the number of system calls.
+ *
+ * 3. File descriptor monitoring is O(1) like epoll(7) so it scales better than
+ *    poll(2).
+ *
+ * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
+ *    epoll(7).
+ *
+ * This code only monitors file descriptors and does not do asynchronous disk
+ * I/O.  Implementing disk I/O efficiently has other requirements and should
+ * use a separate io_uring so it does not make sense to unify the code.
+ *
+ * File descriptor monitoring is implemented using the following operations:
+ *
+ * 1. IORING_OP_POLL_ADD - adds a file descriptor to be monitored.
+ * 2. IORING_OP_POLL_REMOVE - removes a file descriptor being monitored.  When
+ *    the poll mask changes for a file descriptor it is first removed and then
+ *    re-added with the new poll mask, so this operation is also used as part
+ *    of modifying an existing monitored file descriptor.
+ *
+ * The timeout is passed to io_uring_enter(2) itself (IORING_ENTER_EXT_ARG),
+ * so no timeout requests are needed.  Kernels without IORING_FEAT_EXT_ARG
+ * (Linux 5.11) are not used; epoll(7) is used instead.
+ *
+ * aio_set_fd_handler() can be called from any thread, but the rings are
+ * only touched by the thread running the event loop.  Changes are queued
+ * on a lock-free list and turned into sqes the next time ->wait() or
+ * ->poll() runs, so that they reach the kernel together with the next
+ * io_uring_enter(2) call.
+ */
+
+#include "qemu/osdep.h"
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <linux/io_uring.h>
+#include "qemu/rcu_queue.h"
+#include "qemu/timer.h"
+#include "aio-posix.h"
+
+enum {
+    FDMON_IO_URING_ENTRIES  = 128, /* sq ring size */
+
+    /*
+     * Every monitored fd can have a cqe pending, so make room for many
+     * more cqes than sqes.
+     */
+    FDMON_IO_URING_CQ_ENTRIES = 1024,
+
+    /* AioHandler::flags */
+    FDMON_IO_URING_PENDING  = (1 << 0),
+    FDMON_IO_URING_ADD      = (1 << 1),
+    FDMON_IO_URING_REMOVE   = (1 << 2),
+};
+
+typedef QSLIST_HEAD(, AioHandler) AioHandlerSList;
+
+typedef struct FDMonIoUring {
+    int fd;
+
+    /* Submission queue */
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_flags;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail;          /* sqes filled in but not yet published */
+
+    /* Completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring;
+    size_t ring_size;
+    size_t sqes_size;
+
+    /* AioHandlers with changes that were not turned into sqes yet */
+    AioHandlerSList submit_list;
+} FDMonIoUring;
+
+static inline int poll_events_from_pfd(int pfd_events)
+{
+    return (pfd_events & G_IO_IN ? POLLIN : 0) |
+           (pfd_events & G_IO_OUT ? POLLOUT : 0) |
+           (pfd_events & G_IO_HUP ? POLLHUP : 0) |
+           (pfd_events & G_IO_ERR ? POLLERR : 0);
+}
+
+static inline int pfd_events_from_poll(int poll_events)
+{
+    return (poll_events & POLLIN ? G_IO_IN : 0) |
+           (poll_events & POLLOUT ? G_IO_OUT : 0) |
+           (poll_events & POLLHUP ? G_IO_HUP : 0) |
+           (poll_events & POLLERR ? G_IO_ERR : 0);
+}
+
+static int io_uring_enter(FDMonIoUring *ring, unsigned to_submit,
+                          unsigned min_complete, int64_t timeout)
+{
+    struct __kernel_timespec ts = {
+        .tv_sec = timeout / NANOSECONDS_PER_SECOND,
+        .tv_nsec = timeout % NANOSECONDS_PER_SECOND,
+    };
+    struct io_uring_getevents_arg arg = {
+        .ts = timeout > 0 ? (uintptr_t)&ts : 0,
+    };
+    unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    int ret;
+
+    ret = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+                  flags, &arg, sizeof(arg));
+    return ret < 0 ? -errno : ret;
+}
+
+/* Make the sqes filled in so far visible to the kernel */
+static unsigned publish_sqes(FDMonIoUring *ring)
+{
+    unsigned tail = *ring->sq_tail;
+    unsigned n = ring->sqe_tail - tail;
+
+    if (n) {
+        /* Write the sqes before the tail */
+        atomic_store_release(ring->sq_tail, ring->sqe_tail);
+    }
+    return n;
+}
+
+/* Number of published sqes that the kernel has not consumed yet */
+static unsigned sq_pending(FDMonIoUring *ring)
+{
+    return *ring->sq_tail - atomic_load_acquire(ring->sq_head);
+}
+
+static bool cq_ready(FDMonIoUring *ring)
+{
+    return atomic_load_acquire(ring->cq_tail) != *ring->cq_head;
+}
+
+static int submit(FDMonIoUring *ring, unsigned min_complete, int64_t timeout)
+{
+    int ret;
+
+    publish_sqes(ring);
+    do {
+        ret = io_uring_enter(ring, sq_pending(ring), min_complete, timeout);
+    } while (ret == -EINTR);
+
+    /* -ETIME is how the kernel reports an expired timeout */
+    assert(ret >= 0 || ret == -ETIME || ret == -EBUSY);
+    return ret;
+}
+
+/*
+ * Returns NULL if the sq ring is full and the kernel does not take sqes
+ * until the cq ring has been drained; the caller queues its change again
+ * on ring->submit_list.
+ */
+static struct io_uring_sqe *get_sqe(FDMonIoUring *ring)
+{
+    struct io_uring_sqe *sqe;
+
+    /* No free sqes left, submit pending sqes first */
+    while (ring->sqe_tail - atomic_load_acquire(ring->sq_head) >=
+           ring->sq_entries) {
+        if (submit(ring, 0, 0) == -EBUSY) {
+            return NULL;
+        }
+    }
+
+    sqe = &ring->sqes[ring->sqe_tail & ring->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[ring->sqe_tail & ring->sq_mask] =
+        ring->sqe_tail & ring->sq_mask;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/* Atomically enqueue an AioHandler for sq ring submission */
+static void enqueue(AioHandlerSList *head, AioHandler *node, unsigned flags)
+{
+    unsigned old_flags;
+
+    old_flags = atomic_fetch_or(&node->flags, FDMON_IO_URING_PENDING | flags);
+    if (!(old_flags & FDMON_IO_URING_PENDING)) {
+        QSLIST_INSERT_HEAD_ATOMIC(head, node, node_submitted);
+    }
+}
+
+/* Dequeue an AioHandler for sq ring submission.  Called by fill_sq_ring(). */
+static AioHandler *dequeue(AioHandlerSList *head, unsigned *flags)
+{
+    AioHandler *node = QSLIST_FIRST(head);
+
+    if (!node) {
+        return NULL;
+    }
+
+    /* Doesn't need to be atomic since fill_sq_ring() moves the list */
+    QSLIST_REMOVE_HEAD(head, node_submitted);
+
+    /*
+     * Don't clear FDMON_IO_URING_REMOVE.  It's sticky so that
+     * process_cqe() knows to delete the AioHandler when its
+     * IORING_OP_POLL_ADD completes.
+     */
+    *flags = atomic_fetch_and(&node->flags, ~(FDMON_IO_URING_PENDING |
+                                              FDMON_IO_URING_ADD));
+    return node;
+}
+
+static void fdmon_io_uring_update(AioContext *ctx,
+                                  AioHandler *old_node,
+                                  AioHandler *new_node)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+
+    if (new_node) {
+        enqueue(&ring->submit_list, new_node, FDMON_IO_URING_ADD);
+    }
+
+    if (old_node) {
+        /*
+         * Deletion is tricky because IORING_OP_POLL_ADD and
+         * IORING_OP_POLL_REMOVE are async.  The kernel may still complete
+         * the original IORING_OP_POLL_ADD, so the handler can only be freed
+         * once that cqe has been seen.  Mark it deleted now; fill_sq_ring()
+         * or process_cqe() puts it on ctx->deleted_aio_handlers later.
+         */
+        old_node->deleted = 1;
+        old_node->pfd.revents = 0;
+        enqueue(&ring->submit_list, old_node, FDMON_IO_URING_REMOVE);
+    }
+}
+
+static void add_poll_add_sqe(FDMonIoUring *ring, AioHandler *node)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    uint32_t events = poll_events_from_pfd(node->pfd.events);
+
+    if (!sqe) {
+        enqueue(&ring->submit_list, node, FDMON_IO_URING_ADD);
+        return;
+    }
+
+#ifdef HOST_WORDS_BIGENDIAN
+    /* The kernel expects the two 16-bit halves swapped */
+    events = (events << 16) | (events >> 16);
+#endif
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = node->pfd.fd;
+    sqe->poll32_events = events;
+    sqe->user_data = (uintptr_t)node;
+    node->armed = true;
+}
+
+static void add_poll_remove_sqe(FDMonIoUring *ring, AioHandler *node)
+{
+    struct io_uring_sqe *sqe = get_sqe(ring);
+
+    if (!sqe) {
+        enqueue(&ring->submit_list, node, FDMON_IO_URING_REMOVE);
+        return;
+    }
+
+    /* The cqe of the removal itself has a zero user_data field */
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = (uintptr_t)node;
+}
+
+/* Add sqes for the changes queued by fdmon_io_uring_update() */
+static void fill_sq_ring(AioContext *ctx)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+    AioHandlerSList submit_list;
+    AioHandler *node;
+    unsigned flags;
+
+    QSLIST_MOVE_ATOMIC(&submit_list, &ring->submit_list);
+
+    while ((node = dequeue(&submit_list, &flags))) {
+        if (flags & FDMON_IO_URING_REMOVE) {
+            if (node->armed) {
+                /* process_cqe() deletes it once the poll is cancelled */
+                add_poll_remove_sqe(ring, node);
+            } else {
+                /* Never submitted or already completed, free it now */
+                QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                      node_deleted);
+            }
+        } else if ((flags & FDMON_IO_URING_ADD) && node->pfd.events) {
+            add_poll_add_sqe(ring, node);
+        }
+    }
+}
+
+/* Returns true if a handler became ready */
+static bool process_cqe(AioContext *ctx,
+                        AioHandlerList *ready_list,
+                        struct io_uring_cqe *cqe)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+    AioHandler *node = (AioHandler *)(uintptr_t)cqe->user_data;
+    unsigned flags;
+
+    /* POLL_REMOVE cqes have a zero user_data field */
+    if (!node) {
+        return false;
+    }
+
+    node->armed = false;
+
+    /*
+     * If the handler was deleted, it is either still on the submit list,
+     * and fill_sq_ring() will free it, or POLL_REMOVE has been submitted
+     * and this is the cqe we were waiting for.
+     */
+    flags = atomic_read(&node->flags);
+    if (flags & FDMON_IO_URING_REMOVE) {
+        if (!(flags & FDMON_IO_URING_PENDING)) {
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+        }
+        return false;
+    }
+
+    /* Not re-armed, otherwise e.g. a closed fd would fail over and over */
+    if (cqe->res < 0) {
+        return false;
+    }
+
+    /* IORING_OP_POLL_ADD is one-shot so we must re-arm it */
+    add_poll_add_sqe(ring, node);
+
+    aio_add_ready_handler(ready_list, node, pfd_events_from_poll(cqe->res));
+    return true;
+}
+
+static int process_cq_ring(AioContext *ctx, AioHandlerList *ready_list)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_acquire(ring->cq_tail);
+    unsigned num_ready = 0;
+
+    while (head != tail) {
+        struct io_uring_cqe cqe = ring->cqes[head & ring->cq_mask];
+
+        /*
+         * Read the cqe, then hand its slot back to the kernel before
+         * process_cqe() re-arms the handler.  get_sqe() may have to submit,
+         * and the kernel refuses new sqes with -EBUSY while it has cqes
+         * that do not fit in the cq ring.
+         */
+        atomic_store_release(ring->cq_head, ++head);
+
+        if (process_cqe(ctx, ready_list, &cqe)) {
+            num_ready++;
+        }
+    }
+
+    return num_ready;
+}
+
+static int fdmon_io_uring_wait(AioContext *ctx, AioHandlerList *ready_list,
+                               int64_t timeout)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+
+    /* Fall back while external clients are disabled */
+    if (atomic_read(&ctx->external_disable_cnt)) {
+        return fdmon_poll_ops.wait(ctx, ready_list, timeout);
+    }
+
+    fill_sq_ring(ctx);
+
+    /*
+     * Wait only if nothing is ready yet, the cqes of an earlier ->poll()
+     * are already in the cq ring.
+     */
+    submit(ring, timeout != 0 && !cq_ready(ring), timeout);
+
+    return process_cq_ring(ctx, ready_list);
+}
+
+static bool fdmon_io_uring_need_wait(AioContext *ctx)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+
+    /* Have io_uring events completed? */
+    if (cq_ready(ring)) {
+        return true;
+    }
+
+    /* Are there pending sqes to submit? */
+    if (ring->sqe_tail != *ring->sq_tail || sq_pending(ring)) {
+        return true;
+    }
+
+    /* Do we need to process AioHandlers for io_uring changes? */
+    if (!QSLIST_EMPTY(&ring->submit_list)) {
+        return true;
+    }
+
+    /* Did the kernel have to buffer cqes that did not fit in the ring? */
+    if (atomic_read(ring->sq_flags) & IORING_SQ_CQ_OVERFLOW) {
+        return true;
+    }
+
+    /* Are we falling back to fdmon-poll? */
+    return atomic_read(&ctx->external_disable_cnt);
+}
+
+static bool fdmon_io_uring_poll(AioContext *ctx)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+
+    if (atomic_read(&ctx->external_disable_cnt)) {
+        return false;
+    }
+
+    /* Arm new and re-armed polls so the cq ring can be polled below */
+    if (!QSLIST_EMPTY(&ring->submit_list)) {
+        fill_sq_ring(ctx);
+    }
+    if (ring->sqe_tail != *ring->sq_tail) {
+        submit(ring, 0, 0);
+    }
+
+    return cq_ready(ring);
+}
+
+static const FDMonOps fdmon_io_uring_ops = {
+    .update = fdmon_io_uring_update,
+    .wait = fdmon_io_uring_wait,
+    .need_wait = fdmon_io_uring_need_wait,
+    .poll = fdmon_io_uring_poll,
+};
+
+bool fdmon_io_uring_setup(AioContext *ctx)
+{
+    struct io_uring_params p = {
+        .flags = IORING_SETUP_CQSIZE,
+        .cq_entries = FDMON_IO_URING_CQ_ENTRIES,
+    };
+    FDMonIoUring *ring;
+    size_t sq_size, cq_size;
+    int fd;
+
+    fd = syscall(__NR_io_uring_setup, FDMON_IO_URING_ENTRIES, &p);
+    if (fd < 0) {
+        return false;
+    }
+
+    /* Timeouts are passed to io_uring_enter(2), which requires EXT_ARG */
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return false;
+    }
+
+    ring = g_new0(FDMonIoUring, 1);
+    ring->fd = fd;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ring_size = MAX(sq_size, cq_size);
+    ring->ring = mmap(NULL, ring->ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->ring == MAP_FAILED) {
+        goto fail_ring;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        goto fail_sqes;
+    }
+
+    ring->sq_head = ring->ring + p.sq_off.head;
+    ring->sq_tail = ring->ring + p.sq_off.tail;
+    ring->sq_flags = ring->ring + p.sq_off.flags;
+    ring->sq_array = ring->ring + p.sq_off.array;
+    ring->sq_mask = *(unsigned *)(ring->ring + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sqe_tail = *ring->sq_tail;
+
+    ring->cq_head = ring->ring + p.cq_off.head;
+    ring->cq_tail = ring->ring + p.cq_off.tail;
+    ring->cq_mask = *(unsigned *)(ring->ring + p.cq_off.ring_mask);
+    ring->cqes = ring->ring + p.cq_off.cqes;
+
+    QSLIST_INIT(&ring->submit_list);
+    ctx->fdmon_io_uring = ring;
+    ctx->fdmon_ops = &fdmon_io_uring_ops;
+    return true;
+
+fail_sqes:
+    munmap(ring->ring, ring->ring_size);
+fail_ring:
+    g_free(ring);
+    close(fd);
+    return false;
+}
+
+void fdmon_io_uring_destroy(AioContext *ctx)
+{
+    FDMonIoUring *ring = ctx->fdmon_io_uring;
+    AioHandler *node;
+
+    if (!ring) {
+        return;
+    }
+
+    /* Closing the ring cancels all polls, nothing references the handlers */
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->ring, ring->ring_size);
+    close(ring->fd);
+
+    /* Move handlers due to be removed onto the deleted list */
+    while ((node = QSLIST_FIRST(&ring->submit_list))) {
+        unsigned flags = atomic_fetch_and(&node->flags,
+                ~(FDMON_IO_URING_PENDING |
+                  FDMON_IO_URING_ADD |
+                  FDMON_IO_URING_REMOVE));
+
+        QSLIST_REMOVE_HEAD(&ring->submit_list, node_submitted);
+        if (flags & FDMON_IO_URING_REMOVE) {
+            node->armed = false;
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+        }
+    }
+
+    /* Deleted handlers whose POLL_REMOVE was in flight */
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (node->deleted && node->armed) {
+            node->armed = false;
+            QLIST_INSERT_HEAD_RCU(&ctx->deleted_aio_handlers, node,
+                                  node_deleted);
+        }
+    }
+
+    g_free(ring);
+    ctx->fdmon_io_uring = NULL;
+    ctx->fdmon_ops = &fdmon_poll_ops;
+}
@@ -96,6 +96,230 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Kernels for bulk operations on arrays of words.  With 64 KiB granularity
+ * the last level of a multi-TiB bitmap has millions of words, and these
+ * loops run with the dirty bitmap lock held.
+ *
+ * hb_or_words: OR @n words of @src into @dst, return the number of bits
+ * that were newly set in @dst.
+ * hb_count_words: return the number of bits set in @n words of @w.
+ * hb_find_word: return the index of the first of @n words of @w that is
+ * different from @skip (0 or ~0UL), or @n if there is none.
+ */
+
+static uint64_t hb_or_words_int(unsigned long *dst, const unsigned long *src,
+                                size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        unsigned long old = dst[i];
+
+        dst[i] = old | src[i];
+        count += ctpopl(src[i] & ~old);
+    }
+    return count;
+}
+
+static uint64_t hb_count_words_int(const unsigned long *w, size_t n)
+{
+    uint64_t count = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        count += ctpopl(w[i]);
+    }
+    return count;
+}
+
+static size_t hb_find_word_int(const unsigned long *w, size_t n,
+                               unsigned long skip)
+{
+    size_t i;
+
+    for (i = 0; i < n && w[i] == skip; i++) {
+        /* nothing */
+    }
+    return i;
+}
+
+#ifdef CONFIG_AVX2_OPT
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#include <immintrin.h>
+
+#define WORDS_PER_YMM (sizeof(__m256i) / sizeof(unsigned long))
+
+/* Population count of each byte, using a nibble lookup table.  */
+static inline __m256i hb_popcnt_epi8_avx2(__m256i v)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3,
+                                         1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low);
+
+    return _mm256_add_epi8(_mm256_shuffle_epi8(lut, lo),
+                           _mm256_shuffle_epi8(lut, hi));
+}
+
+/* Add the byte counts of @v to the four 64-bit counters in @acc.  */
+static inline __m256i hb_popcnt_acc_avx2(__m256i acc, __m256i v)
+{
+    return _mm256_add_epi64(acc, _mm256_sad_epu8(hb_popcnt_epi8_avx2(v),
+                                                 _mm256_setzero_si256()));
+}
+
+static inline uint64_t hb_popcnt_sum_avx2(__m256i acc)
+{
+    uint64_t lanes[4];
+
+    _mm256_storeu_si256((__m256i *)lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+static uint64_t hb_or_words_avx2(unsigned long *dst, const unsigned long *src,
+                                 size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + WORDS_PER_YMM <= n; i += WORDS_PER_YMM) {
+        __m256i old = _mm256_loadu_si256((__m256i *)(dst + i));
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(old, v));
+        acc = hb_popcnt_acc_avx2(acc, _mm256_andnot_si256(old, v));
+    }
+    return hb_popcnt_sum_avx2(acc) + hb_or_words_int(dst + i, src + i, n - i);
+}
+
+static uint64_t hb_count_words_avx2(const unsigned long *w, size_t n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    size_t i;
+
+    for (i = 0; i + WORDS_PER_YMM <= n; i += WORDS_PER_YMM) {
+        acc = hb_popcnt_acc_avx2(acc,
+                                 _mm256_loadu_si256((const __m256i *)(w + i)));
+    }
+    return hb_popcnt_sum_avx2(acc) + hb_count_words_int(w + i, n - i);
+}
+
+static size_t hb_find_word_avx2(const unsigned long *w, size_t n,
+                                unsigned long skip)
+{
+    /* skip is all zeroes or all ones, so comparing bytes is enough */
+    const __m256i pattern = _mm256_set1_epi8((char)skip);
+    size_t i;
+
+    for (i = 0; i + 2 * WORDS_PER_YMM <= n; i += 2 * WORDS_PER_YMM) {
+        __m256i t0 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(w + i)), pattern);
+        __m256i t1 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(w + i + WORDS_PER_YMM)),
+            pattern);
+
+        if (_mm256_movemask_epi8(_mm256_and_si256(t0, t1)) != -1) {
+            break;
+        }
+    }
+    return i + hb_find_word_int(w + i, n - i, skip);
+}
+#pragma GCC pop_options
+
+typedef struct HBitmapAccel {
+    uint64_t (*or_words)(unsigned long *dst, const unsigned long *src,
+                         size_t n);
+    uint64_t (*count_words)(const unsigned long *w, size_t n);
+    size_t (*find_word)(const unsigned long *w, size_t n, unsigned long skip);
+} HBitmapAccel;
+
+static const HBitmapAccel hb_accel_int = {
+    .or_words = hb_or_words_int,
+    .count_words = hb_count_words_int,
+    .find_word = hb_find_word_int,
+};
+
+static const HBitmapAccel hb_accel_avx2 = {
+    .or_words = hb_or_words_avx2,
+    .count_words = hb_count_words_avx2,
+    .find_word = hb_find_word_avx2,
+};
+
+#define CACHE_AVX2    1
+
+static unsigned cpuid_cache;
+static const HBitmapAccel *hb_accel = &hb_accel_int;
+
+static void init_accel(unsigned cache)
+{
+    hb_accel = cache & CACHE_AVX2 ? &hb_accel_avx2 : &hb_accel_int;
+}
+
+#include "qemu/cpuid.h"
+
+static void __attribute__((constructor)) init_cpuid_cache(void)
+{
+    int max = __get_cpuid_max(0, NULL);
+    int a, b, c, d;
+    unsigned cache = 0;
+
+    if (max >= 7) {
+        __cpuid(1, a, b, c, d);
+
+        /* We must check that AVX is not just available, but usable.  */
+        if ((c & bit_OSXSAVE) && (c & bit_AVX)) {
+            int bv;
+            __asm("xgetbv" : "=a"(bv), "=d"(d) : "c"(0));
+            __cpuid_count(7, 0, a, b, c, d);
+            if ((bv & 6) == 6 && (b & bit_AVX2)) {
+                cache |= CACHE_AVX2;
+            }
+        }
+    }
+    cpuid_cache = cache;
+    init_accel(cache);
+}
+
+bool test_hbitmap_next_accel(void)
+{
+    /* If no bits set, we just tested the integer kernels, and there
+       are no more acceleration options to test.  */
+    if (cpuid_cache == 0) {
+        return false;
+    }
+    /* Disable the accelerator we used before and select a new one.  */
+    cpuid_cache &= cpuid_cache - 1;
+    init_accel(cpuid_cache);
+    return true;
+}
+
+#define hb_or_words(dst, src, n)        hb_accel->or_words(dst, src, n)
+#define hb_count_words(w, n)            hb_accel->count_words(w, n)
+#define hb_find_word_n(w, n, skip)      hb_accel->find_word(w, n, skip)
+#else
+#define hb_or_words                     hb_or_words_int
+#define hb_count_words                  hb_count_words_int
+#define hb_find_word_n                  hb_find_word_int
+
+bool test_hbitmap_next_accel(void)
+{
+    return false;
+}
+#endif /* CONFIG_AVX2_OPT */
+
+/* Return the index of the first word of @w in [@start, @n) that is not
+ * @skip, or @n.  */
+static inline size_t hb_find_word(const unsigned long *w, size_t start,
+                                  size_t n, unsigned long skip)
+{
+    return start + hb_find_word_n(w + start, n - start, skip);
+}
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -202,10 +426,7 @@ int64_t hbitmap_next_zero(const HBitmap *hb, uint64_t start)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        pos = hb_find_word(last_lev, pos + 1, sz, (unsigned long)-1);
         if (pos >= sz) {
             return -1;
         }
@@ -272,6 +493,22 @@ static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
     return count;
 }
 
+/* Count the number of set bits in the whole bottom level.  Bits past the
+ * end can be set by hbitmap_deserialize_ones(), so they are masked out.
+ */
+static uint64_t hb_count_all(const HBitmap *hb)
+{
+    const unsigned long *last_lev = hb->levels[HBITMAP_LEVELS - 1];
+    uint64_t words = hb->size >> BITS_PER_LEVEL;
+    unsigned tail = hb->size & (BITS_PER_LONG - 1);
+    uint64_t count = hb_count_words(last_lev, words);
+
+    if (tail) {
+        count += ctpopl(last_lev[words] & ((1UL << tail) - 1));
+    }
+    return count;
+}
+
 /* Setting starts at the last layer and propagates up if an element
  * changes.
  */
@@ -621,15 +858,16 @@ void hbitmap_deserialize_finish(HBitmap *bitmap)
         size = MAX((size + BITS_PER_LONG - 1) >> BITS_PER_LEVEL, 1);
         memset(bitmap->levels[lev], 0, size * sizeof(unsigned long));
 
-        for (i = 0; i < prev_size; ++i) {
-            if (bitmap->levels[lev + 1][i]) {
-                bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
-                    1UL << (i & (BITS_PER_LONG - 1));
-            }
+        for (i = hb_find_word(bitmap->levels[lev + 1], 0, prev_size, 0);
+             i < prev_size;
+             i = hb_find_word(bitmap->levels[lev + 1], i + 1, prev_size, 0)) {
+            bitmap->levels[lev][i >> BITS_PER_LEVEL] |=
+                1UL << (i & (BITS_PER_LONG - 1));
         }
     }
 
     bitmap->levels[0][0] |= 1UL << (BITS_PER_LONG - 1);
+    bitmap->count = hb_count_all(bitmap);
 }
 
 void hbitmap_free(HBitmap *hb)
@@ -719,6 +957,47 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
 }
 
 
+/* OR word @pos of level @level of B into A, and recursively the words of
+ * the next level that it marks as nonzero.  Subtrees that are empty in B
+ * are never looked at, and runs of nonzero words in the bottom level are
+ * merged in bulk.  Returns the number of bits newly set in A's bottom
+ * level.
+ */
+static uint64_t hb_merge_level(HBitmap *a, const HBitmap *b, int level,
+                               uint64_t pos)
+{
+    unsigned long cur = b->levels[level][pos];
+    uint64_t base = pos << BITS_PER_LEVEL;
+    uint64_t count = 0;
+
+    if (level == 0) {
+        /* Drop the sentinel, A has its own.  */
+        cur &= ~(1UL << (BITS_PER_LONG - 1));
+    }
+    a->levels[level][pos] |= cur;
+
+    if (level < HBITMAP_LEVELS - 2) {
+        while (cur) {
+            count += hb_merge_level(a, b, level + 1, base + ctzl(cur));
+            cur &= cur - 1;
+        }
+        return count;
+    }
+
+    while (cur) {
+        unsigned start = ctzl(cur);
+        unsigned len = ctol(cur >> start);
+
+        count += hb_or_words(&a->levels[level + 1][base + start],
+                             &b->levels[level + 1][base + start], len);
+        if (start + len == BITS_PER_LONG) {
+            break;
+        }
+        cur &= ~((1UL << (start + len)) - 1);
+    }
+    return count;
+}
+
 /**
  * Given HBitmaps A and B, let A := A (BITOR) B.
  * Bitmap B will not be modified.
@@ -728,9 +1007,6 @@ void hbitmap_truncate(HBitmap *hb, uint64_t size)
  */
 bool hbitmap_merge(HBitmap *a, const HBitmap *b)
 {
-    int i;
-    uint64_t j;
-
     if ((a->size != b->size) || (a->granularity != b->granularity)) {
         return false;
     }
@@ -739,15 +1015,7 @@ bool hbitmap_merge(HBitmap *a, const HBitmap *b)
         return true;
     }
 
-    /* This merge is O(size), as BITS_PER_LONG and HBITMAP_LEVELS are constant.
-     * It may be possible to improve running times for sparsely populated maps
-     * by using hbitmap_iter_next, but this is suboptimal for dense maps.
-     */
-    for (i = HBITMAP_LEVELS - 1; i >= 0; i--) {
-        for (j = 0; j < a->sizes[i]; j++) {
-            a->levels[i][j] |= b->levels[i][j];
-        }
-    }
+    a->count += hb_merge_level(a, b, 0, 0);
 
     return true;
 }
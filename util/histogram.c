@@ -0,0 +1,283 @@
+/*
+ * Lock-free latency histograms
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/histogram.h"
+#include "qemu/bitops.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qmp-commands.h"
+
+/*
+ * Every thread that records values gets a slot, and every histogram has one
+ * shard of counters per slot that is only ever written by the slot's owner.
+ * Slots are recycled when threads exit.  Threads that do not get a slot
+ * because too many are running share one shard under a spinlock.
+ *
+ * Counters are 64 bits wide even on 32-bit hosts, where a concurrent query
+ * may see a torn value; that only affects one sample of a statistic.
+ */
+#define HISTOGRAM_MAX_SLOTS 256
+#define HISTOGRAM_NO_SLOT   HISTOGRAM_MAX_SLOTS
+
+typedef struct HistogramShard {
+    uint64_t sum;
+    uint64_t max;
+    unsigned epoch;     /* @max is only valid if this matches histogram_epoch */
+    uint64_t buckets[QEMU_HISTOGRAM_BUCKETS];
+} HistogramShard;
+
+struct QHistogram {
+    char *name;
+    HistogramShard *shards[HISTOGRAM_MAX_SLOTS];
+
+    QemuSpin shared_lock;
+    HistogramShard shared;
+
+    /* Totals at the last reset, protected by histograms_lock */
+    uint64_t base_sum;
+    uint64_t base_buckets[QEMU_HISTOGRAM_BUCKETS];
+
+    QTAILQ_ENTRY(QHistogram) next;
+};
+
+bool qemu_histograms_enabled;
+
+static QemuMutex histograms_lock;
+static QTAILQ_HEAD(, QHistogram) histograms =
+    QTAILQ_HEAD_INITIALIZER(histograms);
+
+/* Bumped on reset so that shards restart tracking their maximum */
+static unsigned histogram_epoch;
+
+static unsigned long histogram_slots[BITS_TO_LONGS(HISTOGRAM_MAX_SLOTS)];
+static __thread int histogram_slot = -1;
+static __thread Notifier histogram_slot_notifier;
+
+static void histogram_slot_release(Notifier *n, void *unused)
+{
+    qemu_mutex_lock(&histograms_lock);
+    clear_bit(histogram_slot, histogram_slots);
+    qemu_mutex_unlock(&histograms_lock);
+    histogram_slot = -1;
+}
+
+static int histogram_slot_get(void)
+{
+    int slot = histogram_slot;
+
+    if (likely(slot >= 0)) {
+        return slot;
+    }
+
+    qemu_mutex_lock(&histograms_lock);
+    slot = find_first_zero_bit(histogram_slots, HISTOGRAM_MAX_SLOTS);
+    if (slot < HISTOGRAM_MAX_SLOTS) {
+        set_bit(slot, histogram_slots);
+    }
+    qemu_mutex_unlock(&histograms_lock);
+
+    if (slot < HISTOGRAM_MAX_SLOTS) {
+        histogram_slot_notifier.notify = histogram_slot_release;
+        qemu_thread_atexit_add(&histogram_slot_notifier);
+    }
+    histogram_slot = slot;
+    return slot;
+}
+
+static void histogram_shard_add(HistogramShard *s, uint64_t value)
+{
+    unsigned b = qemu_histogram_bucket(value);
+    unsigned epoch = atomic_read(&histogram_epoch);
+
+    atomic_set__nocheck(&s->buckets[b], s->buckets[b] + 1);
+    atomic_set__nocheck(&s->sum, s->sum + value);
+    if (s->epoch != epoch) {
+        atomic_set__nocheck(&s->max, value);
+        atomic_set(&s->epoch, epoch);
+    } else if (value > s->max) {
+        atomic_set__nocheck(&s->max, value);
+    }
+}
+
+void qemu_histogram_add(QHistogram *h, uint64_t value)
+{
+    int slot = histogram_slot_get();
+    HistogramShard *s;
+
+    if (unlikely(slot == HISTOGRAM_NO_SLOT)) {
+        qemu_spin_lock(&h->shared_lock);
+        histogram_shard_add(&h->shared, value);
+        qemu_spin_unlock(&h->shared_lock);
+        return;
+    }
+
+    s = h->shards[slot];
+    if (unlikely(!s)) {
+        s = g_new0(HistogramShard, 1);
+        s->epoch = atomic_read(&histogram_epoch);
+        atomic_rcu_set(&h->shards[slot], s);
+    }
+    histogram_shard_add(s, value);
+}
+
+QHistogram *qemu_histogram_get(const char *name)
+{
+    QHistogram *h;
+
+    qemu_mutex_lock(&histograms_lock);
+    QTAILQ_FOREACH(h, &histograms, next) {
+        if (!strcmp(h->name, name)) {
+            goto out;
+        }
+    }
+
+    h = g_new0(QHistogram, 1);
+    h->name = g_strdup(name);
+    qemu_spin_init(&h->shared_lock);
+    h->shared.epoch = histogram_epoch;
+    QTAILQ_INSERT_TAIL(&histograms, h, next);
+
+out:
+    qemu_mutex_unlock(&histograms_lock);
+    return h;
+}
+
+QHistogram *qemu_histogram_get_cached(QHistogram **cache, const char *fmt, ...)
+{
+    QHistogram *h = atomic_rcu_read(cache);
+    va_list ap;
+    char *name;
+
+    if (likely(h)) {
+        return h;
+    }
+
+    va_start(ap, fmt);
+    name = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+
+    h = qemu_histogram_get(name);
+    g_free(name);
+
+    atomic_rcu_set(cache, h);
+    return h;
+}
+
+/* Sum up all shards of @h.  Called with histograms_lock held. */
+static void histogram_read(QHistogram *h, uint64_t *buckets,
+                           uint64_t *sum, uint64_t *max)
+{
+    unsigned epoch = histogram_epoch;
+    int slot, i;
+
+    memset(buckets, 0, sizeof(h->base_buckets));
+    *sum = *max = 0;
+
+    for (slot = 0; slot <= HISTOGRAM_MAX_SLOTS; slot++) {
+        HistogramShard *s;
+
+        if (slot == HISTOGRAM_NO_SLOT) {
+            s = &h->shared;
+        } else {
+            s = atomic_rcu_read(&h->shards[slot]);
+            if (!s) {
+                continue;
+            }
+        }
+
+        for (i = 0; i < QEMU_HISTOGRAM_BUCKETS; i++) {
+            buckets[i] += atomic_read__nocheck(&s->buckets[i]);
+        }
+        *sum += atomic_read__nocheck(&s->sum);
+        if (atomic_read(&s->epoch) == epoch) {
+            *max = MAX(*max, atomic_read__nocheck(&s->max));
+        }
+    }
+}
+
+void qemu_histograms_set_enabled(bool enable, bool reset)
+{
+    QHistogram *h;
+
+    qemu_mutex_lock(&histograms_lock);
+    if (reset) {
+        uint64_t max;
+
+        atomic_inc(&histogram_epoch);
+        QTAILQ_FOREACH(h, &histograms, next) {
+            histogram_read(h, h->base_buckets, &h->base_sum, &max);
+        }
+    }
+    atomic_set(&qemu_histograms_enabled, enable);
+    qemu_mutex_unlock(&histograms_lock);
+}
+
+static HistogramInfo *histogram_get_info(QHistogram *h)
+{
+    HistogramInfo *info = g_new0(HistogramInfo, 1);
+    HistogramBucketList **tail = &info->buckets;
+    uint64_t buckets[QEMU_HISTOGRAM_BUCKETS];
+    int i;
+
+    histogram_read(h, buckets, &info->sum, &info->max);
+    info->name = g_strdup(h->name);
+    info->sum -= h->base_sum;
+
+    for (i = 0; i < QEMU_HISTOGRAM_BUCKETS; i++) {
+        uint64_t count = buckets[i] - h->base_buckets[i];
+        HistogramBucketList *entry;
+
+        if (!count) {
+            continue;
+        }
+        info->count += count;
+
+        entry = g_new0(HistogramBucketList, 1);
+        entry->value = g_new0(HistogramBucket, 1);
+        entry->value->lower = qemu_histogram_bucket_lower(i);
+        entry->value->count = count;
+        *tail = entry;
+        tail = &entry->next;
+    }
+    return info;
+}
+
+HistogramInfoList *qmp_query_histograms(bool has_name, const char *name,
+                                       Error **errp)
+{
+    HistogramInfoList *head = NULL, **tail = &head;
+    QHistogram *h;
+
+    qemu_mutex_lock(&histograms_lock);
+    QTAILQ_FOREACH(h, &histograms, next) {
+        HistogramInfoList *entry;
+
+        if (has_name && !g_pattern_match_simple(name, h->name)) {
+            continue;
+        }
+
+        entry = g_new0(HistogramInfoList, 1);
+        entry->value = histogram_get_info(h);
+        *tail = entry;
+        tail = &entry->next;
+    }
+    qemu_mutex_unlock(&histograms_lock);
+
+    return head;
+}
+
+void qmp_histogram_set_state(bool enable, bool has_reset, bool reset,
+                             Error **errp)
+{
+    qemu_histograms_set_enabled(enable, has_reset && reset);
+}
+
+static void __attribute__((constructor)) histogram_init(void)
+{
+    qemu_mutex_init(&histograms_lock);
+}
@@ -520,9 +520,34 @@ pid_t qemu_fork(Error **errp)
     return pid;
 }
 
+#define STACK_CANARY 0x5741434b43414e41ULL
+#define STACK_PAINT 0xdeadbeaf
+
+static bool stack_has_guard_page(size_t sz)
+{
+    /* Stacks with guard page are at least one page larger, see below */
+    return sz >= QEMU_STACK_GUARD_MIN_SIZE;
+}
+
+/* The first word to be overwritten by an overflow of a stack without guard */
+static uint64_t *stack_canary(void *stack, size_t sz)
+{
+#if defined(HOST_IA64)
+    /* separate register stack */
+    return stack + ROUND_UP(sz / 2, sizeof(uint64_t));
+#elif defined(HOST_HPPA)
+    /* stack grows up */
+    return stack + sz - sizeof(uint64_t);
+#else
+    /* stack grows down */
+    return stack;
+#endif
+}
+
 void *qemu_alloc_stack(size_t *sz)
 {
     void *ptr, *guardpage;
+    bool guard;
 #ifdef CONFIG_DEBUG_STACK_USAGE
     void *ptr2;
 #endif
@@ -535,7 +560,10 @@ void *qemu_alloc_stack(size_t *sz)
     /* adjust stack size to a multiple of the page size */
     *sz = ROUND_UP(*sz, pagesz);
     /* allocate one extra page for the guard page */
-    *sz += pagesz;
+    guard = stack_has_guard_page(*sz);
+    if (guard) {
+        *sz += pagesz;
+    }
 
     ptr = mmap(NULL, *sz, PROT_READ | PROT_WRITE,
                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
@@ -544,30 +572,61 @@ void *qemu_alloc_stack(size_t *sz)
         abort();
     }
 
+    if (guard) {
 #if defined(HOST_IA64)
-    /* separate register stack */
-    guardpage = ptr + (((*sz - pagesz) / 2) & ~pagesz);
+        /* separate register stack */
+        guardpage = ptr + (((*sz - pagesz) / 2) & ~pagesz);
 #elif defined(HOST_HPPA)
-    /* stack grows up */
-    guardpage = ptr + *sz - pagesz;
+        /* stack grows up */
+        guardpage = ptr + *sz - pagesz;
 #else
-    /* stack grows down */
-    guardpage = ptr;
+        /* stack grows down */
+        guardpage = ptr;
 #endif
-    if (mprotect(guardpage, pagesz, PROT_NONE) != 0) {
-        perror("failed to set up stack guard page");
-        abort();
+        if (mprotect(guardpage, pagesz, PROT_NONE) != 0) {
+            perror("failed to set up stack guard page");
+            abort();
+        }
+    } else {
+        *stack_canary(ptr, *sz) = STACK_CANARY;
     }
 
 #ifdef CONFIG_DEBUG_STACK_USAGE
-    for (ptr2 = ptr + pagesz; ptr2 < ptr + *sz; ptr2 += sizeof(uint32_t)) {
-        *(uint32_t *)ptr2 = 0xdeadbeaf;
+    for (ptr2 = ptr + (guard ? pagesz : sizeof(uint64_t)); ptr2 < ptr + *sz;
+         ptr2 += sizeof(uint32_t)) {
+        *(uint32_t *)ptr2 = STACK_PAINT;
     }
 #endif
 
     return ptr;
 }
 
+size_t qemu_check_stack(void *stack, size_t sz)
+{
+    bool guard = stack_has_guard_page(sz);
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    void *ptr;
+#endif
+
+    if (!guard && *stack_canary(stack, sz) != STACK_CANARY) {
+        error_report("stack overflow detected on %zu byte stack %p",
+                     sz, stack);
+        abort();
+    }
+
+#ifdef CONFIG_DEBUG_STACK_USAGE
+    for (ptr = stack + (guard ? getpagesize() : sizeof(uint64_t));
+         ptr < stack + sz; ptr += sizeof(uint32_t)) {
+        if (*(uint32_t *)ptr != STACK_PAINT) {
+            break;
+        }
+    }
+    return sz - (uintptr_t) (ptr - stack);
+#else
+    return 0;
+#endif
+}
+
 #ifdef CONFIG_DEBUG_STACK_USAGE
 static __thread unsigned int max_stack_usage;
 #endif
@@ -575,21 +634,15 @@ static __thread unsigned int max_stack_usage;
 void qemu_free_stack(void *stack, size_t sz)
 {
 #ifdef CONFIG_DEBUG_STACK_USAGE
-    unsigned int usage;
-    void *ptr;
+    unsigned int usage = qemu_check_stack(stack, sz);
 
-    for (ptr = stack + getpagesize(); ptr < stack + sz;
-         ptr += sizeof(uint32_t)) {
-        if (*(uint32_t *)ptr != 0xdeadbeaf) {
-            break;
-        }
-    }
-    usage = sz - (uintptr_t) (ptr - stack);
     if (usage > max_stack_usage) {
         error_report("thread %d max stack usage increased from %u to %u",
                      qemu_get_thread_id(), max_stack_usage, usage);
         max_stack_usage = usage;
     }
+#else
+    qemu_check_stack(stack, sz);
 #endif
 
     munmap(stack, sz);
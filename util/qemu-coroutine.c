@@ -20,16 +20,49 @@
 #include "qemu/coroutine.h"
 #include "qemu/coroutine_int.h"
 #include "block/aio.h"
+#include "qapi/error.h"
 
 enum {
     POOL_BATCH_SIZE = 64,
+
+    /* How often the in-flight peak of a pool decays, in creations */
+    POOL_DECAY_PERIOD = 16384,
+};
+
+struct CoroutinePool {
+    /* Free list to speed up creation, filled by any thread */
+    QSLIST_HEAD(, Coroutine) release_pool;
+    unsigned int release_pool_size;
+
+    /* One for the owner plus one for each coroutine created from this pool
+     * that has not terminated yet.
+     */
+    unsigned int refcnt;
+
+    /* Recent maximum of coroutines in flight, the release pool is sized
+     * after it.
+     */
+    unsigned int in_flight_peak;
+    unsigned int creations;
+
+    size_t stack_size;
+    size_t max_stack_usage;
+};
+
+/* For coroutines created outside any AioContext */
+static CoroutinePool default_pool = {
+    .release_pool = QSLIST_HEAD_INITIALIZER(default_pool.release_pool),
+    .stack_size = COROUTINE_STACK_SIZE,
+    .refcnt = 1,
 };
 
-/** Free list to speed up creation */
-static QSLIST_HEAD(, Coroutine) release_pool = QSLIST_HEAD_INITIALIZER(pool);
-static unsigned int release_pool_size;
+/* Per-thread batch taken from a release pool, all with alloc_pool_stack_size
+ * bytes of stack.  Coroutines of the same stack size are interchangeable, so
+ * these can serve any pool.
+ */
 static __thread QSLIST_HEAD(, Coroutine) alloc_pool = QSLIST_HEAD_INITIALIZER(pool);
 static __thread unsigned int alloc_pool_size;
+static __thread size_t alloc_pool_stack_size;
 static __thread Notifier coroutine_pool_cleanup_notifier;
 
 static void coroutine_pool_cleanup(Notifier *n, void *value)
@@ -41,65 +74,186 @@ static void coroutine_pool_cleanup(Notifier *n, void *value)
         QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
         qemu_coroutine_delete(co);
     }
+    alloc_pool_size = 0;
 }
 
-Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+CoroutinePool *qemu_coroutine_pool_new(void)
 {
-    Coroutine *co = NULL;
+    CoroutinePool *pool = g_new0(CoroutinePool, 1);
 
-    if (CONFIG_COROUTINE_POOL) {
-        co = QSLIST_FIRST(&alloc_pool);
-        if (!co) {
-            if (release_pool_size > POOL_BATCH_SIZE) {
-                /* Slow path; a good place to register the destructor, too.  */
-                if (!coroutine_pool_cleanup_notifier.notify) {
-                    coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
-                    qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
-                }
-
-                /* This is not exact; there could be a little skew between
-                 * release_pool_size and the actual size of release_pool.  But
-                 * it is just a heuristic, it does not need to be perfect.
-                 */
-                alloc_pool_size = atomic_xchg(&release_pool_size, 0);
-                QSLIST_MOVE_ATOMIC(&alloc_pool, &release_pool);
-                co = QSLIST_FIRST(&alloc_pool);
+    QSLIST_INIT(&pool->release_pool);
+    pool->stack_size = COROUTINE_STACK_SIZE;
+    pool->refcnt = 1;
+    return pool;
+}
+
+void qemu_coroutine_pool_unref(CoroutinePool *pool)
+{
+    Coroutine *co;
+
+    if (!atomic_dec_fetch(&pool->refcnt)) {
+        assert(pool != &default_pool);
+        while ((co = QSLIST_FIRST(&pool->release_pool))) {
+            QSLIST_REMOVE_HEAD(&pool->release_pool, pool_next);
+            qemu_coroutine_delete(co);
+        }
+        g_free(pool);
+    }
+}
+
+void qemu_coroutine_pool_set_stack_size(CoroutinePool *pool,
+                                        size_t stack_size, Error **errp)
+{
+    if (stack_size < COROUTINE_STACK_SIZE_MIN ||
+        stack_size > COROUTINE_STACK_SIZE_MAX) {
+        error_setg(errp, "coroutine stack size must be between %d and %d",
+                   COROUTINE_STACK_SIZE_MIN, COROUTINE_STACK_SIZE_MAX);
+        return;
+    }
+
+    /* Pooled coroutines of the old size are freed as they are found */
+    atomic_set(&pool->stack_size, stack_size);
+}
+
+size_t qemu_coroutine_pool_get_stack_size(CoroutinePool *pool)
+{
+    return atomic_read(&pool->stack_size);
+}
+
+static unsigned int coroutine_pool_max_size(CoroutinePool *pool)
+{
+    return MAX(POOL_BATCH_SIZE * 2, atomic_read(&pool->in_flight_peak));
+}
+
+/* Take a reference to @pool for a new coroutine */
+static void coroutine_pool_ref(CoroutinePool *pool)
+{
+    /* The owner's reference is the one too many */
+    unsigned int in_flight = atomic_fetch_inc(&pool->refcnt);
+    unsigned int peak = atomic_read(&pool->in_flight_peak);
+    unsigned int creations = atomic_read(&pool->creations);
+
+    /* Let the pool shrink again after a burst.  This is just a heuristic,
+     * lost updates from concurrent threads do not matter.
+     */
+    atomic_set(&pool->creations, creations + 1);
+    if (creations % POOL_DECAY_PERIOD == 0) {
+        peak /= 2;
+        atomic_set(&pool->in_flight_peak, peak);
+    }
+    if (in_flight > peak) {
+        atomic_set(&pool->in_flight_peak, in_flight);
+    }
+}
+
+static Coroutine *coroutine_pool_get(CoroutinePool *pool, size_t stack_size)
+{
+    Coroutine *co;
+
+    if (alloc_pool_stack_size != stack_size) {
+        /* The thread moved to a pool with another stack size */
+        coroutine_pool_cleanup(NULL, NULL);
+        alloc_pool_stack_size = stack_size;
+    }
+
+    co = QSLIST_FIRST(&alloc_pool);
+    if (!co) {
+        if (atomic_read(&pool->release_pool_size) > POOL_BATCH_SIZE) {
+            /* Slow path; a good place to register the destructor, too.  */
+            if (!coroutine_pool_cleanup_notifier.notify) {
+                coroutine_pool_cleanup_notifier.notify = coroutine_pool_cleanup;
+                qemu_thread_atexit_add(&coroutine_pool_cleanup_notifier);
             }
+
+            /* This is not exact; there could be a little skew between
+             * release_pool_size and the actual size of release_pool.  But
+             * it is just a heuristic, it does not need to be perfect.
+             */
+            alloc_pool_size = atomic_xchg(&pool->release_pool_size, 0);
+            QSLIST_MOVE_ATOMIC(&alloc_pool, &pool->release_pool);
         }
-        if (co) {
-            QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
-            alloc_pool_size--;
+    }
+
+    while ((co = QSLIST_FIRST(&alloc_pool))) {
+        QSLIST_REMOVE_HEAD(&alloc_pool, pool_next);
+        alloc_pool_size--;
+        if (co->stack_size == stack_size) {
+            return co;
         }
+        /* Left over from before a stack size change */
+        qemu_coroutine_delete(co);
+    }
+    return NULL;
+}
+
+Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+    CoroutinePool *pool = ctx ? ctx->co_pool : &default_pool;
+    size_t stack_size = atomic_read(&pool->stack_size);
+    Coroutine *co = NULL;
+
+    if (CONFIG_COROUTINE_POOL) {
+        co = coroutine_pool_get(pool, stack_size);
     }
 
     if (!co) {
-        co = qemu_coroutine_new();
+        co = qemu_coroutine_new(stack_size);
+        co->stack_size = stack_size;
     }
 
+    coroutine_pool_ref(pool);
+    co->pool = pool;
+
     co->entry = entry;
     co->entry_arg = opaque;
     QSIMPLEQ_INIT(&co->co_queue_wakeup);
     return co;
 }
 
+static void coroutine_check_stack(CoroutinePool *pool, Coroutine *co)
+{
+    size_t usage = qemu_coroutine_check_stack(co);
+    size_t max = atomic_read(&pool->max_stack_usage);
+
+    while (usage > max) {
+        size_t old = atomic_cmpxchg(&pool->max_stack_usage, max, usage);
+        if (old == max) {
+            trace_qemu_coroutine_stack_usage(pool, usage, co->stack_size);
+            break;
+        }
+        max = old;
+    }
+}
+
 static void coroutine_delete(Coroutine *co)
 {
+    CoroutinePool *pool = co->pool;
+
     co->caller = NULL;
+    co->pool = NULL;
 
-    if (CONFIG_COROUTINE_POOL) {
-        if (release_pool_size < POOL_BATCH_SIZE * 2) {
-            QSLIST_INSERT_HEAD_ATOMIC(&release_pool, co, pool_next);
-            atomic_inc(&release_pool_size);
-            return;
+    coroutine_check_stack(pool, co);
+
+    if (CONFIG_COROUTINE_POOL &&
+        co->stack_size == atomic_read(&pool->stack_size)) {
+        if (atomic_read(&pool->release_pool_size) <
+            coroutine_pool_max_size(pool)) {
+            QSLIST_INSERT_HEAD_ATOMIC(&pool->release_pool, co, pool_next);
+            atomic_inc(&pool->release_pool_size);
+            goto out;
         }
-        if (alloc_pool_size < POOL_BATCH_SIZE) {
+        if (alloc_pool_size < POOL_BATCH_SIZE &&
+            alloc_pool_stack_size == co->stack_size) {
             QSLIST_INSERT_HEAD(&alloc_pool, co, pool_next);
             alloc_pool_size++;
-            return;
+            goto out;
         }
     }
 
     qemu_coroutine_delete(co);
+out:
+    qemu_coroutine_pool_unref(pool);
 }
 
 void qemu_aio_coroutine_enter(AioContext *ctx, Coroutine *co)
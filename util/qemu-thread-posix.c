@@ -14,6 +14,7 @@
 #include "qemu/thread.h"
 #include "qemu/atomic.h"
 #include "qemu/notify.h"
+#include "qemu/bitops.h"
 #include "trace.h"
 
 static bool name_threads;
@@ -539,6 +540,31 @@ void qemu_thread_exit(void *retval)
     pthread_exit(retval);
 }
 
+int qemu_thread_set_affinity(QemuThread *thread, const unsigned long *host_cpus,
+                             unsigned long nbits)
+{
+#ifdef CONFIG_PTHREAD_AFFINITY_NP
+    size_t setsize = CPU_ALLOC_SIZE(nbits);
+    cpu_set_t *cpuset;
+    unsigned long cpu;
+    int err;
+
+    cpuset = CPU_ALLOC(nbits);
+    g_assert(cpuset);
+    CPU_ZERO_S(setsize, cpuset);
+    for (cpu = find_first_bit(host_cpus, nbits); cpu < nbits;
+         cpu = find_next_bit(host_cpus, nbits, cpu + 1)) {
+        CPU_SET_S(cpu, setsize, cpuset);
+    }
+
+    err = pthread_setaffinity_np(thread->thread, setsize, cpuset);
+    CPU_FREE(cpuset);
+    return -err;
+#else
+    return -ENOSYS;
+#endif
+}
+
 void *qemu_thread_join(QemuThread *thread)
 {
     int err;
@@ -19,13 +19,42 @@
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/bitmap.h"
+#include "qemu/processor.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
+/* Each worker has its own request queue.  The submitting AioContext
+ * hands a request to an idle worker if there is one, otherwise to a
+ * new worker or in round-robin order to a busy one.  Workers that run
+ * out of work steal requests from the queues of the others, and poll
+ * for THREAD_POOL_SPIN_NS before going to sleep on their semaphore.
+ * A worker marks itself idle before it looks at the queues one last
+ * time, and a submitter that queued behind a busy worker wakes up an
+ * idle one afterwards, so one of the two always sees the other.
+ * At most half as many workers as there are host CPUs poll at any
+ * time, because a polling worker only helps if it does not take the
+ * CPU away from the threads that produce or run requests.
+ * Completed requests are pushed on a lock-free list; only the push
+ * that finds the list empty schedules the completion bottom half,
+ * which then delivers the whole batch.
+ */
+
+#define THREAD_POOL_MAX_THREADS 64
+
+/* How long a worker polls for new requests before it goes to sleep */
+#define THREAD_POOL_SPIN_NS     50000
+
+/* How long a sleeping worker waits before it exits */
+#define THREAD_POOL_IDLE_MS     10000
+
 static void do_spawn_thread(ThreadPool *pool);
 
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolWorker ThreadPoolWorker;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -39,100 +68,334 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* The worker whose queue the request was submitted to.  Moving
+     * state out of THREAD_QUEUED is protected by worker->lock.  After
+     * that, only the thread that dequeued the request can write to it.
+     * ret is published by the atomic push on pool->completed.
      */
+    ThreadPoolWorker *worker;
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Links the request into worker->request_list while it is queued,
+     * and into pool->done_list once the completion BH has collected it.
+     */
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
+    /* Pushed atomically by the thread that completes the request.  */
+    QSLIST_ENTRY(ThreadPoolElement) next_done;
+
     /* Access to this list is protected by the global mutex.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+enum WorkerState {
+    WORKER_FREE,        /* slot unused */
+    WORKER_NEW,         /* accepts requests, thread not created yet */
+    WORKER_RUNNING,
+};
+
+struct ThreadPoolWorker {
+    ThreadPool *pool;
+    QemuSemaphore sem;
+
+    /* Set by the worker when it runs out of requests, cleared with
+     * atomic_xchg by whoever claims the worker.  pool->idle_threads
+     * counts the workers that have it set.
+     */
+    bool idle;
+
+    QemuMutex lock;
+
+    /* Written with both pool->lock and lock taken.  */
+    enum WorkerState state;
+
+    /* The following variables are protected by lock.  queued mirrors
+     * the length of request_list and is also read without the lock,
+     * to find a queue worth stealing from.
+     */
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    int queued;
+    bool sleeping;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
     QemuMutex lock;
     QemuCond worker_stopped;
-    QemuSemaphore sem;
     int max_threads;
     QEMUBH *new_thread_bh;
 
+    ThreadPoolWorker workers[THREAD_POOL_MAX_THREADS];
+    int idle_threads;
+    int spinning_threads;
+    int max_spinning_threads;
+
+    /* Requests completed by the workers, most recent first.  */
+    QSLIST_HEAD(, ThreadPoolElement) completed;
+
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    QTAILQ_HEAD(, ThreadPoolElement) done_list;
+    int next_worker;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    /* The following variables are protected by lock.  cur_threads and
+     * stopping are also read without it.
+     */
     int cur_threads;
-    int idle_threads;
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     bool stopping;
+    unsigned long *host_cpus;
+    unsigned long host_cpus_nbits;
 };
 
-static void *worker_thread(void *opaque)
+static void thread_pool_set_idle(ThreadPoolWorker *w)
 {
-    ThreadPool *pool = opaque;
+    if (!atomic_xchg(&w->idle, true)) {
+        atomic_inc(&w->pool->idle_threads);
+    }
+}
 
-    qemu_mutex_lock(&pool->lock);
-    pool->pending_threads--;
-    do_spawn_thread(pool);
+/* Returns true if the caller was the one to move @w out of idle.  */
+static bool thread_pool_clear_idle(ThreadPoolWorker *w)
+{
+    if (atomic_read(&w->idle) && atomic_xchg(&w->idle, false)) {
+        atomic_dec(&w->pool->idle_threads);
+        return true;
+    }
+    return false;
+}
 
-    while (!pool->stopping) {
-        ThreadPoolElement *req;
-        int ret;
+/* Take the oldest request queued on @w.  */
+static ThreadPoolElement *thread_pool_pop(ThreadPoolWorker *w)
+{
+    ThreadPoolElement *req;
 
-        do {
-            pool->idle_threads++;
-            qemu_mutex_unlock(&pool->lock);
-            ret = qemu_sem_timedwait(&pool->sem, 10000);
-            qemu_mutex_lock(&pool->lock);
-            pool->idle_threads--;
-        } while (ret == -1 && !QTAILQ_EMPTY(&pool->request_list));
-        if (ret == -1 || pool->stopping) {
-            break;
-        }
+    if (!atomic_read(&w->queued)) {
+        return NULL;
+    }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
+    qemu_mutex_lock(&w->lock);
+    req = QTAILQ_FIRST(&w->request_list);
+    if (req) {
+        QTAILQ_REMOVE(&w->request_list, req, reqs);
+        atomic_set(&w->queued, w->queued - 1);
         req->state = THREAD_ACTIVE;
+    }
+    qemu_mutex_unlock(&w->lock);
+    return req;
+}
+
+static ThreadPoolElement *thread_pool_get_request(ThreadPoolWorker *w)
+{
+    ThreadPool *pool = w->pool;
+    ThreadPoolElement *req;
+    int self = w - pool->workers;
+    int i;
+
+    req = thread_pool_pop(w);
+    if (req) {
+        return req;
+    }
+
+    for (i = 1; i < pool->max_threads; i++) {
+        int victim = (self + i) % pool->max_threads;
+
+        req = thread_pool_pop(&pool->workers[victim]);
+        if (req) {
+            trace_thread_pool_steal(pool, req, self, victim);
+            return req;
+        }
+    }
+    return NULL;
+}
+
+static ThreadPoolElement *thread_pool_spin(ThreadPoolWorker *w)
+{
+    ThreadPool *pool = w->pool;
+    ThreadPoolElement *req = NULL;
+    int64_t deadline;
+
+    if (atomic_fetch_inc(&pool->spinning_threads) >=
+        pool->max_spinning_threads) {
+        atomic_dec(&pool->spinning_threads);
+        return NULL;
+    }
+
+    deadline = get_clock() + THREAD_POOL_SPIN_NS;
+    do {
+        cpu_relax();
+        req = thread_pool_get_request(w);
+    } while (!req && !atomic_read(&pool->stopping) && get_clock() < deadline);
+
+    atomic_dec(&pool->spinning_threads);
+    return req;
+}
+
+/* Sleep until a request is queued on @w, or until a submitter claims
+ * @w to steal a request from a busy worker.  Returns false on timeout.
+ */
+static bool thread_pool_wait(ThreadPoolWorker *w)
+{
+    qemu_mutex_lock(&w->lock);
+    if (!QTAILQ_EMPTY(&w->request_list) || !atomic_read(&w->idle)) {
+        qemu_mutex_unlock(&w->lock);
+        return true;
+    }
+    w->sleeping = true;
+    qemu_mutex_unlock(&w->lock);
+
+    return qemu_sem_timedwait(&w->sem, THREAD_POOL_IDLE_MS) == 0;
+}
+
+/* Release the slot of @w unless requests were queued on it, or it was
+ * woken up to steal one, after the wait timed out.
+ */
+static bool thread_pool_exit(ThreadPoolWorker *w)
+{
+    ThreadPool *pool = w->pool;
+    bool woken;
+
+    qemu_mutex_lock(&pool->lock);
+    qemu_mutex_lock(&w->lock);
+    woken = !atomic_read(&pool->stopping) && !w->sleeping;
+    w->sleeping = false;
+    if (woken || !QTAILQ_EMPTY(&w->request_list)) {
+        qemu_mutex_unlock(&w->lock);
         qemu_mutex_unlock(&pool->lock);
+        return false;
+    }
 
-        ret = req->func(req->arg);
+    /* A submitter that claimed us in the meantime will see WORKER_FREE
+     * and pick another worker.
+     */
+    thread_pool_clear_idle(w);
+    w->state = WORKER_FREE;
+    qemu_mutex_unlock(&w->lock);
 
-        req->ret = ret;
-        /* Write ret before state.  */
-        smp_wmb();
-        req->state = THREAD_DONE;
+    atomic_set(&pool->cur_threads, pool->cur_threads - 1);
+    qemu_cond_signal(&pool->worker_stopped);
+    qemu_mutex_unlock(&pool->lock);
+    return true;
+}
 
-        qemu_mutex_lock(&pool->lock);
+static void thread_pool_complete(ThreadPool *pool, ThreadPoolElement *req)
+{
+    ThreadPoolElement *old_head;
 
+    /* Open-coded QSLIST_INSERT_HEAD_ATOMIC.  Once the cmpxchg succeeds the
+     * BH may collect and free @req, so only look at the head it replaced.
+     */
+    do {
+        old_head = atomic_read(&pool->completed.slh_first);
+        req->next_done.sle_next = old_head;
+    } while (atomic_cmpxchg(&pool->completed.slh_first, old_head, req) !=
+             old_head);
+
+    /* Whoever finds the list empty kicks the BH, which then collects
+     * everything that was pushed until it runs.
+     */
+    if (!old_head) {
         qemu_bh_schedule(pool->completion_bh);
     }
+}
 
-    pool->cur_threads--;
-    qemu_cond_signal(&pool->worker_stopped);
+static void thread_pool_set_worker_affinity(ThreadPool *pool)
+{
+    QemuThread self;
+    int ret;
+
+    qemu_mutex_lock(&pool->lock);
+    if (pool->host_cpus) {
+        qemu_thread_get_self(&self);
+        ret = qemu_thread_set_affinity(&self, pool->host_cpus,
+                                       pool->host_cpus_nbits);
+        if (ret < 0) {
+            trace_thread_pool_set_affinity_failed(pool, ret);
+        }
+    }
     qemu_mutex_unlock(&pool->lock);
+}
+
+static void *worker_thread(void *opaque)
+{
+    ThreadPoolWorker *w = opaque;
+    ThreadPool *pool = w->pool;
+
+    qemu_mutex_lock(&pool->lock);
+    pool->pending_threads--;
+    do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
+
+    thread_pool_set_worker_affinity(pool);
+
+    for (;;) {
+        ThreadPoolElement *req = NULL;
+
+        if (!atomic_read(&pool->stopping)) {
+            req = thread_pool_get_request(w);
+            if (!req) {
+                /* A submitter that did not see us idle may have queued
+                 * a request behind a busy worker after the scan above,
+                 * so scan once more before spinning or sleeping.
+                 */
+                thread_pool_set_idle(w);
+                req = thread_pool_get_request(w);
+            }
+            if (!req) {
+                req = thread_pool_spin(w);
+            }
+            if (!req && thread_pool_wait(w)) {
+                continue;
+            }
+        }
+
+        if (!req) {
+            if (thread_pool_exit(w)) {
+                break;
+            }
+            continue;
+        }
+
+        thread_pool_clear_idle(w);
+
+        req->ret = req->func(req->arg);
+        req->state = THREAD_DONE;
+        thread_pool_complete(pool, req);
+    }
+
     return NULL;
 }
 
 static void do_spawn_thread(ThreadPool *pool)
 {
+    ThreadPoolWorker *w = NULL;
     QemuThread t;
+    int i;
 
     /* Runs with lock taken.  */
     if (!pool->new_threads) {
         return;
     }
 
+    for (i = 0; i < pool->max_threads; i++) {
+        if (pool->workers[i].state == WORKER_NEW) {
+            w = &pool->workers[i];
+            break;
+        }
+    }
+    assert(w);
+
     pool->new_threads--;
     pool->pending_threads++;
 
-    qemu_thread_create(&t, "worker", worker_thread, pool, QEMU_THREAD_DETACHED);
+    qemu_mutex_lock(&w->lock);
+    w->state = WORKER_RUNNING;
+    qemu_mutex_unlock(&w->lock);
+
+    qemu_thread_create(&t, "worker", worker_thread, w, QEMU_THREAD_DETACHED);
 }
 
 static void spawn_thread_bh_fn(void *opaque)
@@ -144,9 +407,30 @@ static void spawn_thread_bh_fn(void *opaque)
     qemu_mutex_unlock(&pool->lock);
 }
 
-static void spawn_thread(ThreadPool *pool)
+/* Reserve a worker slot, which accepts requests right away.  */
+static ThreadPoolWorker *spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    ThreadPoolWorker *w = NULL;
+    int i;
+
+    /* Runs with lock taken.  */
+    if (pool->cur_threads >= pool->max_threads) {
+        return NULL;
+    }
+
+    for (i = 0; i < pool->max_threads; i++) {
+        if (pool->workers[i].state == WORKER_FREE) {
+            w = &pool->workers[i];
+            break;
+        }
+    }
+    assert(w);
+
+    qemu_mutex_lock(&w->lock);
+    w->state = WORKER_NEW;
+    qemu_mutex_unlock(&w->lock);
+
+    atomic_set(&pool->cur_threads, pool->cur_threads + 1);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -158,28 +442,141 @@ static void spawn_thread(ThreadPool *pool)
     if (!pool->pending_threads) {
         qemu_bh_schedule(pool->new_thread_bh);
     }
+    return w;
+}
+
+/* Choose the worker that will run a new request and return it locked.
+ * *busy tells whether the worker already had work to do.
+ */
+static ThreadPoolWorker *thread_pool_pick_worker(ThreadPool *pool, bool *busy)
+{
+    ThreadPoolWorker *w;
+    int i, n;
+
+    for (;;) {
+        /* Prefer a worker that is waiting for requests...  */
+        for (i = 0; i < pool->max_threads; i++) {
+            if (!atomic_read(&pool->idle_threads)) {
+                break;
+            }
+            n = (pool->next_worker + i) % pool->max_threads;
+            w = &pool->workers[n];
+            if (thread_pool_clear_idle(w)) {
+                qemu_mutex_lock(&w->lock);
+                if (w->state != WORKER_FREE) {
+                    pool->next_worker = n + 1;
+                    *busy = false;
+                    return w;
+                }
+                qemu_mutex_unlock(&w->lock);
+            }
+        }
+
+        /* ... then start a new one...  */
+        if (atomic_read(&pool->cur_threads) < pool->max_threads) {
+            qemu_mutex_lock(&pool->lock);
+            w = spawn_thread(pool);
+            if (w) {
+                qemu_mutex_lock(&w->lock);
+            }
+            qemu_mutex_unlock(&pool->lock);
+            if (w) {
+                *busy = false;
+                return w;
+            }
+        }
+
+        /* ... and otherwise queue behind a busy one.  The request runs
+         * when that worker gets to it, unless another worker steals it
+         * first; thread_pool_kick_idle() makes sure that a worker going
+         * idle right now does not sleep through it.
+         */
+        for (i = 0; i < pool->max_threads; i++) {
+            n = (pool->next_worker + i) % pool->max_threads;
+            w = &pool->workers[n];
+            if (atomic_read(&w->state) == WORKER_FREE) {
+                continue;
+            }
+            qemu_mutex_lock(&w->lock);
+            if (w->state != WORKER_FREE) {
+                pool->next_worker = n + 1;
+                *busy = true;
+                return w;
+            }
+            qemu_mutex_unlock(&w->lock);
+        }
+    }
+}
+
+/* Called after queuing a request behind a busy worker.  A worker that
+ * became idle after thread_pool_pick_worker() looked for one may have
+ * scanned the queues before the request was added; claim it and wake
+ * it up, so that it scans them again.
+ */
+static void thread_pool_kick_idle(ThreadPool *pool)
+{
+    ThreadPoolWorker *w;
+    bool wake;
+    int i;
+
+    /* Pairs with the barrier in thread_pool_set_idle(): either we see the
+     * worker's idle flag, or the worker sees our request in its rescan.
+     */
+    smp_mb();
+
+    for (i = 0; i < pool->max_threads; i++) {
+        if (!atomic_read(&pool->idle_threads)) {
+            return;
+        }
+        w = &pool->workers[i];
+        if (thread_pool_clear_idle(w)) {
+            qemu_mutex_lock(&w->lock);
+            wake = w->sleeping;
+            w->sleeping = false;
+            qemu_mutex_unlock(&w->lock);
+
+            if (wake) {
+                qemu_sem_post(&w->sem);
+            }
+            return;
+        }
+    }
+}
+
+/* Move the requests pushed by the workers to done_list, oldest first.  */
+static void thread_pool_collect(ThreadPool *pool)
+{
+    QSLIST_HEAD(, ThreadPoolElement) batch, reversed;
+    ThreadPoolElement *elem;
+
+    QSLIST_MOVE_ATOMIC(&batch, &pool->completed);
+    QSLIST_INIT(&reversed);
+    while ((elem = QSLIST_FIRST(&batch))) {
+        QSLIST_REMOVE_HEAD(&batch, next_done);
+        QSLIST_INSERT_HEAD(&reversed, elem, next_done);
+    }
+    while ((elem = QSLIST_FIRST(&reversed))) {
+        QSLIST_REMOVE_HEAD(&reversed, next_done);
+        QTAILQ_INSERT_TAIL(&pool->done_list, elem, reqs);
+    }
 }
 
 static void thread_pool_completion_bh(void *opaque)
 {
     ThreadPool *pool = opaque;
-    ThreadPoolElement *elem, *next;
+    ThreadPoolElement *elem;
 
     aio_context_acquire(pool->ctx);
 restart:
-    QLIST_FOREACH_SAFE(elem, &pool->head, all, next) {
-        if (elem->state != THREAD_DONE) {
-            continue;
-        }
+    thread_pool_collect(pool);
+    while ((elem = QTAILQ_FIRST(&pool->done_list))) {
+        QTAILQ_REMOVE(&pool->done_list, elem, reqs);
 
         trace_thread_pool_complete(pool, elem, elem->common.opaque,
                                    elem->ret);
         QLIST_REMOVE(elem, all);
 
         if (elem->common.cb) {
-            /* Read state before ret.  */
-            smp_rmb();
-
             /* Schedule ourselves in case elem->common.cb() calls aio_poll() to
              * wait for another request that completed at the same time.
              */
@@ -207,26 +604,27 @@ restart:
 static void thread_pool_cancel(BlockAIOCB *acb)
 {
     ThreadPoolElement *elem = (ThreadPoolElement *)acb;
-    ThreadPool *pool = elem->pool;
+    ThreadPoolWorker *w = elem->worker;
+    bool canceled = false;
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    qemu_mutex_lock(&pool->lock);
-    if (elem->state == THREAD_QUEUED &&
-        /* No thread has yet started working on elem. we can try to "steal"
-         * the item from the worker if we can get a signal from the
-         * semaphore.  Because this is non-blocking, we can do it with
-         * the lock taken and ensure that elem will remain THREAD_QUEUED.
+    qemu_mutex_lock(&w->lock);
+    if (elem->state == THREAD_QUEUED) {
+        /* No thread has yet started working on elem, and none can take
+         * it from the queue while we hold the lock.
          */
-        qemu_sem_timedwait(&pool->sem, 0) == 0) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
-        qemu_bh_schedule(pool->completion_bh);
-
+        QTAILQ_REMOVE(&w->request_list, elem, reqs);
+        atomic_set(&w->queued, w->queued - 1);
         elem->state = THREAD_DONE;
         elem->ret = -ECANCELED;
+        canceled = true;
     }
+    qemu_mutex_unlock(&w->lock);
 
-    qemu_mutex_unlock(&pool->lock);
+    if (canceled) {
+        thread_pool_complete(elem->pool, elem);
+    }
 }
 
 static AioContext *thread_pool_get_aio_context(BlockAIOCB *acb)
@@ -247,6 +645,8 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
         BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolWorker *w;
+    bool busy, wake;
 
     req = qemu_aio_get(&thread_pool_aiocb_info, NULL, cb, opaque);
     req->func = func;
@@ -258,13 +658,20 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPool *pool,
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    w = thread_pool_pick_worker(pool, &busy);
+    req->worker = w;
+    QTAILQ_INSERT_TAIL(&w->request_list, req, reqs);
+    atomic_set(&w->queued, w->queued + 1);
+    wake = w->sleeping;
+    w->sleeping = false;
+    qemu_mutex_unlock(&w->lock);
+
+    if (wake) {
+        qemu_sem_post(&w->sem);
+    }
+    if (busy) {
+        thread_pool_kick_idle(pool);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_sem_post(&pool->sem);
     return &req->common;
 }
 
@@ -296,8 +703,34 @@ void thread_pool_submit(ThreadPool *pool, ThreadPoolFunc *func, void *arg)
     thread_pool_submit_aio(pool, func, arg, NULL, NULL);
 }
 
+void thread_pool_set_affinity(ThreadPool *pool, const unsigned long *host_cpus,
+                              unsigned long nbits, Error **errp)
+{
+#ifdef CONFIG_PTHREAD_AFFINITY_NP
+    if (host_cpus && find_first_bit(host_cpus, nbits) == nbits) {
+        error_setg(errp, "CPU affinity mask for the thread pool is empty");
+        return;
+    }
+
+    qemu_mutex_lock(&pool->lock);
+    g_free(pool->host_cpus);
+    pool->host_cpus = NULL;
+    pool->host_cpus_nbits = 0;
+    if (host_cpus) {
+        pool->host_cpus = bitmap_new(nbits);
+        bitmap_copy(pool->host_cpus, host_cpus, nbits);
+        pool->host_cpus_nbits = nbits;
+    }
+    qemu_mutex_unlock(&pool->lock);
+#else
+    error_setg(errp, "Thread CPU affinity is not supported on this host");
+#endif
+}
+
 static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
 {
+    int i;
+
     if (!ctx) {
         ctx = qemu_get_aio_context();
     }
@@ -307,12 +740,24 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->completion_bh = aio_bh_new(ctx, thread_pool_completion_bh, pool);
     qemu_mutex_init(&pool->lock);
     qemu_cond_init(&pool->worker_stopped);
-    qemu_sem_init(&pool->sem, 0);
-    pool->max_threads = 64;
+    pool->max_threads = THREAD_POOL_MAX_THREADS;
+    pool->max_spinning_threads = MIN(sysconf(_SC_NPROCESSORS_ONLN) / 2,
+                                     pool->max_threads);
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
+    for (i = 0; i < pool->max_threads; i++) {
+        ThreadPoolWorker *w = &pool->workers[i];
+
+        w->pool = pool;
+        w->state = WORKER_FREE;
+        qemu_sem_init(&w->sem, 0);
+        qemu_mutex_init(&w->lock);
+        QTAILQ_INIT(&w->request_list);
+    }
+
+    QSLIST_INIT(&pool->completed);
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    QTAILQ_INIT(&pool->done_list);
 }
 
 ThreadPool *thread_pool_new(AioContext *ctx)
@@ -324,6 +769,8 @@ ThreadPool *thread_pool_new(AioContext *ctx)
 
 void thread_pool_free(ThreadPool *pool)
 {
+    int i;
+
     if (!pool) {
         return;
     }
@@ -334,21 +781,38 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
+    for (i = 0; i < pool->max_threads; i++) {
+        ThreadPoolWorker *w = &pool->workers[i];
+
+        if (w->state == WORKER_NEW) {
+            qemu_mutex_lock(&w->lock);
+            w->state = WORKER_FREE;
+            qemu_mutex_unlock(&w->lock);
+        }
+    }
     pool->cur_threads -= pool->new_threads;
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->stopping = true;
+    atomic_set(&pool->stopping, true);
     while (pool->cur_threads > 0) {
-        qemu_sem_post(&pool->sem);
+        for (i = 0; i < pool->max_threads; i++) {
+            if (pool->workers[i].state == WORKER_RUNNING) {
+                qemu_sem_post(&pool->workers[i].sem);
+            }
+        }
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
     }
 
     qemu_mutex_unlock(&pool->lock);
 
+    for (i = 0; i < pool->max_threads; i++) {
+        qemu_sem_destroy(&pool->workers[i].sem);
+        qemu_mutex_destroy(&pool->workers[i].lock);
+    }
     qemu_bh_delete(pool->completion_bh);
-    qemu_sem_destroy(&pool->sem);
     qemu_cond_destroy(&pool->worker_stopped);
     qemu_mutex_destroy(&pool->lock);
+    g_free(pool->host_cpus);
     g_free(pool);
 }
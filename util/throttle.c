@@ -164,6 +164,22 @@ static int64_t throttle_compute_wait_for(ThrottleState *ts,
     return max_wait;
 }
 
+/* leak the buckets up to now and compute the time to wait for this type
+ * of operation
+ *
+ * @is_write:   the type of operation
+ * @now:        the current clock timestamp
+ * @ret:        time to wait in ns, or 0 if the operation can go through
+ */
+int64_t throttle_compute_wait_at(ThrottleState *ts, bool is_write,
+                                 int64_t now)
+{
+    /* leak proportionally to the time elapsed */
+    throttle_do_leak(ts, now);
+
+    return throttle_compute_wait_for(ts, is_write);
+}
+
 /* compute the timer for this type of operation
  *
  * @is_write:   the type of operation
@@ -178,11 +194,8 @@ static bool throttle_compute_timer(ThrottleState *ts,
 {
     int64_t wait;
 
-    /* leak proportionally to the time elapsed */
-    throttle_do_leak(ts, now);
-
     /* compute the wait time if any */
-    wait = throttle_compute_wait_for(ts, is_write);
+    wait = throttle_compute_wait_at(ts, is_write, now);
 
     /* if the code must wait compute when the next timer should fire */
     if (wait) {